@@ -0,0 +1,58 @@
+#include "CameraPath.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/constants.hpp>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+CameraPath CameraPath::fromFile(const std::string& file)
+{
+	std::ifstream in(file);
+	if (!in) throw std::runtime_error("failed to open camera path: " + file);
+	CameraPath path;
+	std::string line;
+	while (std::getline(in, line)) {
+		if (line.empty() || line[0] == '#') continue;
+		std::istringstream values(line);
+		Key key;
+		values >> key.frame >> key.position.x >> key.position.y >> key.position.z
+			>> key.target.x >> key.target.y >> key.target.z;
+		if (!values) throw std::runtime_error("bad camera path line: " + line);
+		path.keys.push_back(key);
+	}
+	if (path.keys.empty()) throw std::runtime_error("empty camera path: " + file);
+	std::sort(path.keys.begin(), path.keys.end(), [](const Key& a, const Key& b) { return a.frame < b.frame; });
+	return path;
+}
+
+CameraPath CameraPath::orbit(vkengine::ViewSetup start, unsigned frames)
+{
+	CameraPath path;
+	path.start = start;
+	path.frames = std::max(frames, 1u);
+	return path;
+}
+
+void CameraPath::apply(unsigned frame, vkengine::ViewSetup& view) const
+{
+	if (keys.empty()) {
+		float angle = glm::two_pi<float>() * (frame % frames) / frames;
+		glm::vec3 offset = glm::vec3(glm::rotate(glm::mat4(1.f), angle, start.upVector) * glm::vec4(start.position - start.target, 0.f));
+		view.position = start.target + offset;
+		view.target = start.target;
+		return;
+	}
+	// the first key after the frame, the camera stays on the last one
+	auto next = std::upper_bound(keys.begin(), keys.end(), frame, [](unsigned f, const Key& key) { return f < key.frame; });
+	if (next == keys.begin() || next == keys.end()) {
+		const Key& key = next == keys.end() ? keys.back() : keys.front();
+		view.position = key.position;
+		view.target = key.target;
+		return;
+	}
+	const Key& prev = *(next - 1);
+	float t = float(frame - prev.frame) / float(next->frame - prev.frame);
+	view.position = glm::mix(prev.position, next->position, t);
+	view.target = glm::mix(prev.target, next->target, t);
+}
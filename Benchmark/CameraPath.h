@@ -0,0 +1,28 @@
+#pragma once
+#include "..\\VkEngine\VkEngine.h"
+#include <string>
+#include <vector>
+
+/*
+* Where the camera is at every frame of a run. Either keyframes read from a text file, one per line:
+*     frame  position.x position.y position.z  target.x target.y target.z
+* (lines starting with # are skipped) linearly interpolated between them, or an orbit around the target
+* of the camera, a full turn over the frames of the run.
+*/
+class CameraPath
+{
+public:
+	static CameraPath fromFile(const std::string& file);
+	static CameraPath orbit(vkengine::ViewSetup start, unsigned frames);
+	void apply(unsigned frame, vkengine::ViewSetup& view) const;
+private:
+	struct Key {
+		unsigned frame;
+		glm::vec3 position;
+		glm::vec3 target;
+	};
+	std::vector<Key> keys;
+	// orbit
+	vkengine::ViewSetup start = {};
+	unsigned frames = 0;
+};
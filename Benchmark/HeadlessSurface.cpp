@@ -0,0 +1,35 @@
+#include "HeadlessSurface.h"
+#include <iostream>
+
+HeadlessSurface::HeadlessSurface(int width, int height) : width(width), height(height)
+{
+}
+
+vkengine::VulkanInstanceInitInfo HeadlessSurface::getInstanceExtInfo()
+{
+	vkengine::VulkanInstanceInitInfo info = {};
+	info.instanceExtensions = nullptr;
+	info.instance_extension_count = 0;
+	return info;
+}
+
+void* HeadlessSurface::getSurface(void* vulkan_instance)
+{
+	return nullptr;
+}
+
+void HeadlessSurface::getFrameBufferSize(int* width, int* height)
+{
+	*width = this->width;
+	*height = this->height;
+}
+
+void HeadlessSurface::printDebug(std::string msg)
+{
+	std::cout << msg << std::endl;
+}
+
+void HeadlessSurface::waitEvents()
+{
+	// never minimized
+}
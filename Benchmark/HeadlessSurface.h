@@ -0,0 +1,19 @@
+#pragma once
+#include "..\\VkEngine\VkEngine.h"
+
+/*
+* SurfaceOwner without a window: no surface and no instance extensions, so the engine runs headless
+* and renders frames of the requested size that are never presented.
+*/
+class HeadlessSurface : public vkengine::SurfaceOwner
+{
+public:
+	HeadlessSurface(int width, int height);
+	vkengine::VulkanInstanceInitInfo getInstanceExtInfo() override;
+	void* getSurface(void* vulkan_instance) override;
+	void getFrameBufferSize(int* width, int* height) override;
+	void printDebug(std::string msg) override;
+	void waitEvents() override;
+private:
+	int width, height;
+};
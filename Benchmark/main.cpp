@@ -0,0 +1,198 @@
+#include "..\\VkEngine\VkEngine.h"
+#include "..\\Editor\Project.h"
+#include "HeadlessSurface.h"
+#include "CameraPath.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <limits>
+
+/*
+* Renders a project headless along a scripted camera and writes what every frame cost:
+* CPU time of renderFrame and GPU time of each pass. Runs without a display, on software drivers too.
+*/
+
+struct Options {
+	std::string project = "Data/default_project/";
+	unsigned frames = 600;
+	unsigned warmup = 60; // rendered but not measured: caches, streaming and BLAS builds settle
+	int width = 1280, height = 720;
+	std::string path_file; // orbit around the camera target without one
+	std::string csv_file = "benchmark.csv";
+	unsigned dump_every = 0; // frames between PPM dumps, 0 for none
+	std::string dump_dir = "benchmark_frames";
+	std::string trace_file; // Chrome trace of the CPU scopes, if compiled in
+};
+
+struct FrameRecord {
+	float cpu_ms = -1.f;
+	float gpu_ms[vkengine::GPU_PASS_COUNT];
+	bool has_gpu = false;
+};
+
+static void printUsage()
+{
+	std::cout << "Benchmark [project_dir] [--frames N] [--warmup N] [--width W] [--height H] [--path file]\n"
+		"          [--csv file] [--dump-every N] [--dump-dir dir] [--trace file]\n"
+		"A dump waits for the GPU, so the frame after it is not representative." << std::endl;
+}
+
+static bool parseOptions(int argc, char** argv, Options& opt)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--help" || arg == "-h") return false;
+		else if (arg == "--frames" && has_value) opt.frames = std::stoul(argv[++i]);
+		else if (arg == "--warmup" && has_value) opt.warmup = std::stoul(argv[++i]);
+		else if (arg == "--width" && has_value) opt.width = std::stoi(argv[++i]);
+		else if (arg == "--height" && has_value) opt.height = std::stoi(argv[++i]);
+		else if (arg == "--path" && has_value) opt.path_file = argv[++i];
+		else if (arg == "--csv" && has_value) opt.csv_file = argv[++i];
+		else if (arg == "--dump-every" && has_value) opt.dump_every = std::stoul(argv[++i]);
+		else if (arg == "--dump-dir" && has_value) opt.dump_dir = argv[++i];
+		else if (arg == "--trace" && has_value) opt.trace_file = argv[++i];
+		else if (arg.rfind("--", 0) != 0) opt.project = arg;
+		else return false;
+	}
+	if (opt.project.back() != '/' && opt.project.back() != '\\') opt.project += "/";
+	return opt.frames > 0 && opt.width > 0 && opt.height > 0;
+}
+
+static float percentile(std::vector<float> values, float p)
+{
+	if (values.empty()) return 0.f;
+	std::sort(values.begin(), values.end());
+	return values[std::min(values.size() - 1, (size_t)(p * (values.size() - 1) + 0.5f))];
+}
+
+static void writeCsv(const std::string& file, const std::map<uint64_t, FrameRecord>& records)
+{
+	std::ofstream out(file, std::ios::trunc);
+	if (!out) throw std::runtime_error("failed to write " + file);
+	out << "frame,cpu_ms";
+	for (int pass = 0; pass < vkengine::GPU_PASS_COUNT; pass++) out << "," << vkengine::gpuPassName((vkengine::GpuPass)pass) << "_ms";
+	out << "\n";
+	// the passes that didn't run are left empty, like the editor export
+	for (auto& r : records) {
+		out << r.first << ",";
+		if (r.second.cpu_ms >= 0.f) out << r.second.cpu_ms;
+		for (int pass = 0; pass < vkengine::GPU_PASS_COUNT; pass++) {
+			out << ",";
+			if (r.second.has_gpu && r.second.gpu_ms[pass] >= 0.f) out << r.second.gpu_ms[pass];
+		}
+		out << "\n";
+	}
+}
+
+static void printSummary(const std::map<uint64_t, FrameRecord>& records)
+{
+	std::vector<float> cpu;
+	std::vector<float> gpu[vkengine::GPU_PASS_COUNT];
+	for (auto& r : records) {
+		if (r.second.cpu_ms >= 0.f) cpu.push_back(r.second.cpu_ms);
+		for (int pass = 0; pass < vkengine::GPU_PASS_COUNT && r.second.has_gpu; pass++) {
+			if (r.second.gpu_ms[pass] >= 0.f) gpu[pass].push_back(r.second.gpu_ms[pass]);
+		}
+	}
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << records.size() << " frames measured" << std::endl;
+	std::cout << "cpu      p50 " << percentile(cpu, 0.5f) << " ms, p95 " << percentile(cpu, 0.95f)
+		<< " ms, p99 " << percentile(cpu, 0.99f) << " ms" << std::endl;
+	for (int pass = 0; pass < vkengine::GPU_PASS_COUNT; pass++) {
+		if (gpu[pass].empty()) continue;
+		std::cout << std::left << std::setw(9) << vkengine::gpuPassName((vkengine::GpuPass)pass) << std::right
+			<< "p50 " << percentile(gpu[pass], 0.5f) << " ms, p95 " << percentile(gpu[pass], 0.95f)
+			<< " ms, p99 " << percentile(gpu[pass], 0.99f) << " ms" << std::endl;
+	}
+}
+
+// the timings of the frames measured so far, they are read back a few frames late
+static void gatherGpuTimings(uint64_t first_measured, std::map<uint64_t, FrameRecord>& records, uint64_t& last_gathered)
+{
+	for (auto& timings : vkengine::getGpuTimings()) {
+		if (timings.frame <= last_gathered) continue;
+		last_gathered = timings.frame;
+		if (timings.frame < first_measured) continue;
+		FrameRecord& record = records[timings.frame];
+		std::copy(std::begin(timings.pass_ms), std::end(timings.pass_ms), record.gpu_ms);
+		record.has_gpu = true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options opt;
+	if (!parseOptions(argc, argv, opt)) {
+		printUsage();
+		return 1;
+	}
+	HeadlessSurface surface(opt.width, opt.height);
+	try {
+		vkengine::setSurfaceOwner(&surface);
+		vkengine::init();
+		// nothing of the UI is drawn, but its pipeline wants a font atlas
+		unsigned char white[4] = { 255, 255, 255, 255 };
+		int atlas_width = 1, atlas_height = 1;
+		vkengine::loadFontAtlas(white, &atlas_width, &atlas_height);
+		Project project(opt.project.c_str());
+		project.load();
+	}
+	catch (std::exception& err) {
+		std::cout << "Engine Initialization FAILED: " << err.what() << std::endl;
+		return 1;
+	}
+
+	vkengine::Scene3D* scene = vkengine::getActiveScene();
+	vkengine::ViewSetup& view = scene->getCamera(scene->current_camera)->getViewSetup();
+	CameraPath path = opt.path_file.empty() ? CameraPath::orbit(view, opt.frames) : CameraPath::fromFile(opt.path_file);
+	if (opt.dump_every > 0) std::filesystem::create_directories(opt.dump_dir);
+
+	std::map<uint64_t, FrameRecord> records;
+	uint64_t last_gathered = 0;
+	uint64_t first_measured = std::numeric_limits<uint64_t>::max(); // set once the warmup is over
+	// a fixed step: the same run renders the same frames
+	vkengine::unified_delta_time = 1.0 / 60.0;
+	for (unsigned i = 0; i < opt.warmup + opt.frames; i++) {
+		bool measured = i >= opt.warmup;
+		if (i == opt.warmup) {
+			first_measured = vkengine::getFrameCount() + 1;
+			if (!opt.trace_file.empty()) vkengine::setCpuProfiling(true);
+		}
+		path.apply(measured ? i - opt.warmup : 0, view);
+
+		uint64_t before = vkengine::getFrameCount();
+		auto start = std::chrono::high_resolution_clock::now();
+		vkengine::renderFrame();
+		float cpu_ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		// a frame that only recreated the swapchain submitted nothing
+		if (measured && vkengine::getFrameCount() > before) {
+			records[vkengine::getFrameCount()].cpu_ms = cpu_ms;
+		}
+		gatherGpuTimings(first_measured, records, last_gathered);
+
+		if (measured && opt.dump_every > 0 && (i - opt.warmup) % opt.dump_every == 0) {
+			std::ostringstream name;
+			name << opt.dump_dir << "/frame_" << std::setw(5) << std::setfill('0') << (i - opt.warmup) << ".ppm";
+			if (!vkengine::saveRenderedFrame(name.str())) std::cout << "failed to write " << name.str() << std::endl;
+		}
+	}
+	vkengine::waitForFrames();
+	gatherGpuTimings(first_measured, records, last_gathered);
+
+	if (!vkengine::hasGpuProfiler()) std::cout << "No GPU timestamps on this device, only CPU times are written" << std::endl;
+	writeCsv(opt.csv_file, records);
+	std::cout << "Per frame timings written to " << opt.csv_file << std::endl;
+	printSummary(records);
+	if (!opt.trace_file.empty()) {
+		if (!vkengine::hasCpuProfiler()) std::cout << "CPU scopes are compiled out, no trace written" << std::endl;
+		else if (vkengine::exportCpuTrace(opt.trace_file)) std::cout << "CPU trace written to " << opt.trace_file << std::endl;
+	}
+	vkengine::shutdown();
+	return 0;
+}
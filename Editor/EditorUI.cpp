@@ -6,7 +6,9 @@
 #include "View3D.h"
 #include "Outliner.h"
 #include "ToolsPanel.h"
+#include "ProfilerPanel.h"
 #include "../ImGui/imgui.h"
+#include "..\\VkEngine\CpuProfiler.h"
 #include <string>
 #include <iostream>
 #include <sstream> 
@@ -40,6 +42,7 @@ EditorUI::EditorUI(Editor* editor)
 	this->editorComponents.push_back(new View3D(this));
 	this->editorComponents.push_back(new Outliner(this));
 	this->editorComponents.push_back(new ToolsPanel(this));
+	this->editorComponents.push_back(new ProfilerPanel(this));
 	this->editorComponents.push_back(new MainMenuBar(this));
 	// Setup Dear ImGui context
 	IMGUI_CHECKVERSION();
@@ -57,6 +60,7 @@ EditorUI::EditorUI(Editor* editor)
 
 vkengine::UiDrawData EditorUI::drawUI()
 {
+	PROFILE_FUNCTION();
 	this->pollInputs();
 	ImGui::NewFrame();
 	this->setCaptureFlags();
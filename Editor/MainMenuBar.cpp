@@ -22,8 +22,100 @@ void MainMenuBar::draw(int w_width, int w_height)
 	ImGui::BeginMainMenuBar();
 	if (vkengine::hasRayTracing()) {
 		ImGui::Checkbox("Ray Tracing: ", vkengine::rayTracing());
+		if (*vkengine::rayTracing()) {
+			auto stats = vkengine::getRayTracingStats();
+			ImGui::Text("TLAS: %u changed, %u descriptions, %llu B, %u build %u refit", stats.instances_changed,
+				stats.descriptions_changed, (unsigned long long)stats.bytes_uploaded, stats.tlas_builds, stats.tlas_refits);
+			if (stats.blas_pending > 0) ImGui::Text("BLAS: %u pending", stats.blas_pending);
+			ImGui::Text("%u opaque", stats.opaque_instances);
+			ImGui::Checkbox("Accumulate", vkengine::rtAccumulation());
+			if (*vkengine::rtAccumulation()) {
+				ImGui::Text("%u/%u spp", vkengine::rtAccumulatedSamples(), *vkengine::rtAccumulationMaxSamples());
+			}
+			auto budget_settings = vkengine::rtBudgetSettings();
+			ImGui::Checkbox("Adaptive", &budget_settings->enabled);
+			if (budget_settings->enabled) {
+				ImGui::SetNextItemWidth(80);
+				ImGui::SliderFloat("target ms", &budget_settings->target_ms, 1.f, 33.f, "%.1f");
+				auto budget = vkengine::getRayBudget();
+				ImGui::Text("%.2f ms: depth %u, scale %.2f, roulette %.2f", stats.trace_ms, budget.max_depth,
+					budget.resolution_scale, budget.roulette);
+			}
+			// each resolution with the GPU time it was last traced in
+			const vkengine::ReflectionResolution resolutions[] = { vkengine::REFLECTIONS_FULL, vkengine::REFLECTIONS_HALF,
+				vkengine::REFLECTIONS_QUARTER };
+			const char* resolution_names[] = { "full", "half", "quarter" };
+			auto reflections = vkengine::rtReflectionResolution();
+			int selected = 0;
+			while (resolutions[selected] != *reflections) selected++;
+			ImGui::SetNextItemWidth(160);
+			if (ImGui::BeginCombo("Reflections", resolution_names[selected])) {
+				for (int i = 0; i < 3; i++) {
+					if (ImGui::Selectable(resolution_names[i], i == selected)) *reflections = resolutions[i];
+					float ms = vkengine::getReflectionTraceTime(resolutions[i]);
+					if (ms >= 0.f) {
+						ImGui::SameLine();
+						ImGui::Text("%.2f ms", ms);
+					}
+				}
+				ImGui::EndCombo();
+			}
+			ImGui::Checkbox("Compact BLAS", vkengine::compactBlas());
+			auto blas_memory = vkengine::listBlasMemory();
+			uint64_t original_size = 0, current_size = 0;
+			for (auto& blas : blas_memory) { original_size += blas.original_size; current_size += blas.current_size; }
+			ImGui::Text("BLAS: %.1f/%.1f MB", current_size / 1048576.f, original_size / 1048576.f);
+			if (ImGui::IsItemHovered()) {
+				ImGui::BeginTooltip();
+				for (auto& blas : blas_memory) {
+					ImGui::Text("%s: %llu -> %llu B %s", blas.mesh.c_str(), (unsigned long long)blas.original_size,
+						(unsigned long long)blas.current_size, blas.compacted ? "" : "(not compacted)");
+				}
+				ImGui::EndTooltip();
+			}
+		}
+		else if (vkengine::hasHybridRendering()) {
+			ImGui::Checkbox("Hybrid (ray queried shadows and reflections)", vkengine::hybridRendering());
+		}
 	}
 	else { ImGui::Text("Ray Tracing: device not capable :P"); }
+	ImGui::Checkbox("Occlusion Culling", vkengine::occlusionCulling());
+	if (!vkengine::hasRayTracing() || !*vkengine::rayTracing()) {
+		auto resolution = vkengine::dynamicResolution();
+		ImGui::Checkbox("Dynamic Resolution", &resolution->enabled);
+		if (resolution->enabled) {
+			ImGui::SetNextItemWidth(80);
+			ImGui::SliderFloat("GPU ms", &resolution->target_ms, 1.f, 33.f, "%.1f");
+			ImGui::SetNextItemWidth(80);
+			ImGui::SliderFloat("min scale", &resolution->min_scale, 0.25f, 1.f, "%.2f");
+			ImGui::Text("scale %.2f", vkengine::getRenderScale());
+		}
+		static const char* filters[] = { "Linear", "Nearest" };
+		int filter = resolution->filter;
+		ImGui::SetNextItemWidth(90);
+		if (ImGui::Combo("Upscale", &filter, filters, 2)) resolution->filter = (vkengine::UpscaleFilter)filter;
+	}
+	int frames_in_flight = vkengine::getFramesInFlight();
+	ImGui::SetNextItemWidth(80);
+	if (ImGui::SliderInt("Frames in flight", &frames_in_flight, 1, 3)) vkengine::setFramesInFlight(frames_in_flight);
+	static const char* present_modes[] = { "FIFO", "Mailbox", "Immediate" };
+	int present_mode = vkengine::getPresentMode();
+	ImGui::SetNextItemWidth(100);
+	if (ImGui::Combo("Present", &present_mode, present_modes, 3)) vkengine::setPresentMode((vkengine::PresentMode)present_mode);
+	vkengine::FrameLatency latency = vkengine::getFrameLatency();
+	if (latency.cpu_to_display_ms >= 0.f) ImGui::Text("Latency: %.1f ms to present, %.1f ms to display", latency.cpu_to_present_ms, latency.cpu_to_display_ms);
+	else ImGui::Text("Latency: %.1f ms to present", latency.cpu_to_present_ms);
+	vkengine::SubmitStats submits = vkengine::getSubmitStats();
+	ImGui::Text("%u submits, %.3f ms", submits.submits, submits.submit_ms);
+	bool streaming = vkengine::getWorldPartition(vkengine::getActiveScene()) != nullptr;
+	if (ImGui::Checkbox("World Streaming", &streaming)) {
+		if (streaming) vkengine::enableWorldPartition(vkengine::getActiveScene(), {});
+		else vkengine::disableWorldPartition(vkengine::getActiveScene());
+	}
+	if (auto partition = vkengine::getWorldPartition(vkengine::getActiveScene())) {
+		ImGui::Text("%u objects (%.1f MB) in %u cells, %u loading", partition->countResidentObjects(),
+			partition->countResidentBytes() / 1048576.0, partition->countResidentCells(), partition->countLoadingCells());
+	}
 	ImGui::SameLine(ImGui::GetWindowWidth() - 400);
 	ImGui::SetNextItemWidth(120);
 	std::vector<const char*> scene_ids = vkengine::list_scenes(); scene_ids.push_back("+ ADD NEW");
@@ -85,6 +177,10 @@ void MainMenuBar::draw(int w_width, int w_height)
 	}
 
 	if (ImGui::Button("SAVE")) this->UI->getEditor()->loadedProject.get()->save();
+	if (ImGui::Button("BENCH LOAD")) this->UI->getEditor()->loadedProject.get()->benchmarkSceneLoading();
+	static float cpu_mrays = 0.f;
+	if (ImGui::Button("CPU REF")) cpu_mrays = vkengine::renderCpuReference("cpu_reference.ppm", 640, 360).mrays_per_second;
+	if (cpu_mrays > 0.f) ImGui::Text("%.2f Mrays/s", cpu_mrays);
 	ImGui::Checkbox("Demo Window", &show_demo_window);      // Edit bools storing our window open/close state
 	if (show_demo_window) {
 		ImGui::ShowDemoWindow(&show_demo_window);
@@ -69,8 +69,7 @@ void Outliner::draw(int w_width, int w_height)
 				if (selected_element == o && ImGui::IsKeyDown(KeyType::KEY_DELETE) && ImGui::IsWindowFocused()) 
 				{
 					selected_element = -1;
-					scene->removeObject(o);
-					vkengine::reloadScene();
+					vkengine::removeObject(scene, o);
 				}
 
 				context_menu_id = o;
@@ -83,17 +82,16 @@ void Outliner::draw(int w_width, int w_height)
 						vkengine::ObjectInitInfo info = {};
 						info.name = obj->name + "_cpy";
 						info.reflective = obj->reflective;
+						info.occluder = obj->occluder;
 						info.mesh_name = obj->getMeshName();
 						info.texture_name = obj->getTextureName();
 						info.transformation = obj->getObjTransform();
-						scene->addObject(info);
-						vkengine::reloadScene();
+						vkengine::addObject(scene, info);
 						ImGui::CloseCurrentPopup();
 					}
 					if (ImGui::Button("Delete")) {
 						if (selected_element == context_menu_id) selected_element = -1;
-						scene->removeObject(context_menu_id);
-						vkengine::reloadScene();
+						vkengine::removeObject(scene, context_menu_id);
 					}
 					ImGui::EndPopup();
 				}
@@ -235,6 +233,7 @@ void showOjectProperties(vkengine::Scene3D* scene, unsigned obj_id)
 
 	//showVectorControls("Scale",  &obj->getObjTransform().scale_vector);
 	ImGui::Checkbox("Reflective", &obj->reflective);
+	ImGui::Checkbox("Occluder", &obj->occluder);
 }
 
 void showLightProperties(vkengine::Scene3D* scene, unsigned light_id)
@@ -0,0 +1,96 @@
+#include "ProfilerPanel.h"
+#include "ToolsPanel.h"
+#include "EditorUI.h"
+#include <algorithm>
+#include <cstdio>
+#include <float.h>
+
+ProfilerPanel::ProfilerPanel(EditorUI * UI) : EditorComponent(UI)
+{
+	this->name = "GPU Profiler";
+	this->visible = true;
+}
+
+void ProfilerPanel::draw(int w_width, int w_height)
+{
+	if (!visible) { return; }
+
+	static bool paused = false;
+	static std::vector<vkengine::GpuFrameTimings> timings;
+	static char csv_file[64] = "gpu_timings.csv";
+	static const char* export_result = "";
+	static char trace_file[64] = "cpu_trace.json";
+	static const char* trace_result = "";
+
+	// Drawing
+	// next to the tools, over the 3D view until it is moved
+	ImGui::SetNextWindowPos(ImVec2(tools_panel_width, main_menu_shift), ImGuiCond_FirstUseEver);
+	ImGui::SetNextWindowSize(ImVec2(360, 300), ImGuiCond_FirstUseEver);
+	ImGui::Begin(this->name);
+	// scope markers of the CPU, compiled in debug builds or with VKENGINE_PROFILING
+	if (vkengine::hasCpuProfiler()) {
+		bool recording = vkengine::isCpuProfiling();
+		if (ImGui::Checkbox("Record CPU", &recording)) vkengine::setCpuProfiling(recording);
+		ImGui::SameLine();
+		ImGui::SetNextItemWidth(120);
+		ImGui::InputText("##trace", trace_file, sizeof(trace_file));
+		ImGui::SameLine();
+		if (ImGui::Button("Export trace")) {
+			trace_result = vkengine::exportCpuTrace(trace_file) ? "saved" : "can't write the file";
+		}
+		ImGui::SameLine();
+		ImGui::Text("%s", trace_result);
+		ImGui::Separator();
+	}
+	if (!vkengine::hasGpuProfiler()) {
+		ImGui::Text("No timestamps on the graphics queue of this device");
+		ImGui::End();
+		return;
+	}
+	ImGui::Checkbox("Pause", &paused);
+	if (!paused) timings = vkengine::getGpuTimings();
+	ImGui::SameLine();
+	ImGui::Text("%u frames", (unsigned)timings.size());
+
+	// a pass that didn't run in a frame is plotted as 0
+	std::vector<float> values(timings.size()), totals(timings.size(), 0.f);
+	for (int pass = 0; pass < vkengine::GPU_PASS_COUNT; pass++) {
+		float sum = 0.f, max = 0.f;
+		unsigned measured = 0;
+		for (size_t i = 0; i < timings.size(); i++) {
+			float ms = timings[i].pass_ms[pass];
+			values[i] = std::max(ms, 0.f);
+			if (ms < 0.f) continue;
+			sum += ms;
+			max = std::max(max, ms);
+			totals[i] += ms;
+			measured++;
+		}
+		const char* pass_name = vkengine::gpuPassName((vkengine::GpuPass)pass);
+		if (measured == 0) {
+			ImGui::Text("%s: not running", pass_name);
+			continue;
+		}
+		char overlay[48];
+		snprintf(overlay, sizeof(overlay), "avg %.3f ms, max %.3f ms", sum / measured, max);
+		ImGui::PlotLines(pass_name, values.data(), (int)values.size(), 0, overlay, 0.f, FLT_MAX, ImVec2(0, 36));
+	}
+	if (!totals.empty()) {
+		char overlay[32];
+		snprintf(overlay, sizeof(overlay), "last %.3f ms", totals.back());
+		ImGui::PlotLines("total", totals.data(), (int)totals.size(), 0, overlay, 0.f, FLT_MAX, ImVec2(0, 36));
+	}
+
+	ImGui::Separator();
+	ImGui::SetNextItemWidth(160);
+	ImGui::InputText("##csv", csv_file, sizeof(csv_file));
+	ImGui::SameLine();
+	if (ImGui::Button("Export CSV")) {
+		export_result = vkengine::exportGpuTimings(csv_file) ? "saved" : "can't write the file";
+	}
+	ImGui::SameLine();
+	ImGui::Text("%s", export_result);
+	ImGui::End();
+}
+
+ProfilerPanel::~ProfilerPanel() = default;
@@ -0,0 +1,11 @@
+#pragma once
+#include "EditorComponent.h"
+
+// GPU time of each pass over the last frames, from the engine's GPU profiler
+class ProfilerPanel : public EditorComponent
+{
+public:
+	ProfilerPanel(EditorUI* UI);
+	virtual void draw(int w_width, int w_height) override;
+	~ProfilerPanel();
+};
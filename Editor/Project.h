@@ -8,6 +8,8 @@ public:
 	Project(const char* project_dir);
 	void load();
 	void save();
+	// Prints JSON vs binary snapshot parsing times of every scene
+	void benchmarkSceneLoading();
 	~Project();
 private:
 	struct _data;
@@ -0,0 +1,285 @@
+#include "SceneSnapshot.h"
+#include "..\\VkEngine\VkEngine.h"
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+
+// nlohmann/json.hpp
+#include "json.hpp"
+// for convenience
+using json = nlohmann::json;
+
+SceneData SceneSnapshot::readJson(const std::string& file)
+{
+	json scene;
+	std::ifstream str(file.c_str());
+	str >> scene;
+
+	SceneData data;
+	data.header.id = data.addString(scene["id"].get<std::string>());
+	data.header.title = data.addString(scene["title"].get<std::string>());
+	data.header.def_camera = scene.value("def-camera", 0u);
+
+	auto global = scene["global_light"];
+	for (int c = 0; c < 3; c++) {
+		data.header.global_position[c] = global["position"][c];
+		data.header.global_color[c] = global["color"][c];
+	}
+	data.header.global_power = global["power"];
+
+	for (const auto& light : scene["lights"]) {
+		LightRecord record = {};
+		record.name = data.addString(light["name"].get<std::string>());
+		for (int c = 0; c < 3; c++) {
+			record.position[c] = light["position"][c];
+			record.color[c] = light["color"][c];
+		}
+		record.power = light["power"];
+		data.lights.push_back(record);
+	}
+	for (const auto& camera : scene["cameras"]) {
+		CameraRecord record = {};
+		record.name = data.addString(camera["name"].get<std::string>());
+		for (int c = 0; c < 3; c++) {
+			record.position[c] = camera["position"][c];
+			record.target[c] = camera["target"][c];
+			record.up_vector[c] = camera["up-vector"][c];
+		}
+		record.fovY = camera["fovY"];
+		record.aspect = camera.value("aspect", 16.f / 9.f);
+		record.near = camera["near"];
+		record.far = camera["far"];
+		data.cameras.push_back(record);
+	}
+
+	SnapshotObjectWriter writer(data);
+	data.objects.reserve(scene["objects"].size());
+	for (const auto& obj : scene["objects"]) {
+		const json& trans = obj["transformation"];
+		vkengine::ObjTransformation transform = {};
+		for (int c = 0; c < 3; c++) {
+			transform.position[c] = trans["pos"][c];
+			transform.eulerAngles[c] = trans["EulerAngles"][c];
+		}
+		transform.scale_factor = trans["scale"];
+		writer.add(obj["name"].get<std::string>(), obj["mesh"].get<std::string>(), obj["texture"].get<std::string>(),
+			obj["reflective"].get<bool>(), obj.value("occluder", false), transform);
+	}
+	return data;
+}
+
+void SceneSnapshot::writeJson(const std::string& file, const SceneData& data)
+{
+	auto vec3 = [](const float* v) { return std::vector<float>(v, v + 3); };
+	json s_save;
+	s_save["id"] = data.getString(data.header.id);
+	s_save["title"] = data.getString(data.header.title);
+	s_save["def-camera"] = data.header.def_camera;
+	// Dumping cameras
+	std::vector<json> cams;
+	for (auto& cam : data.cameras) {
+		json j;
+		j["name"] = data.getString(cam.name);
+		j["position"] = vec3(cam.position);
+		j["target"] = vec3(cam.target);
+		j["up-vector"] = vec3(cam.up_vector);
+		j["aspect"] = cam.aspect;
+		j["fovY"] = cam.fovY;
+		j["near"] = cam.near;
+		j["far"] = cam.far;
+		cams.push_back(j);
+	}
+	s_save["cameras"] = cams;
+
+	// Dumping lights
+	json g;
+	g["name"] = "global";
+	g["position"] = vec3(data.header.global_position);
+	g["color"] = vec3(data.header.global_color);
+	g["power"] = data.header.global_power;
+	s_save["global_light"] = g;
+	std::vector<json> lights;
+	for (auto& light : data.lights) {
+		json j;
+		j["name"] = data.getString(light.name);
+		j["position"] = vec3(light.position);
+		j["color"] = vec3(light.color);
+		j["power"] = light.power;
+		lights.push_back(j);
+	}
+	s_save["lights"] = lights;
+
+	// Dumping Objects
+	std::vector<json> objects;
+	objects.reserve(data.objects.size());
+	for (auto& obj : data.objects) {
+		json j, trans;
+		j["name"] = data.getString(obj.name);
+		j["mesh"] = data.getString(data.meshes[obj.mesh]);
+		j["reflective"] = (obj.flags & OBJECT_REFLECTIVE) != 0;
+		j["occluder"] = (obj.flags & OBJECT_OCCLUDER) != 0;
+		j["texture"] = data.getString(data.textures[obj.texture]);
+		trans["pos"] = vec3(obj.position);
+		trans["scale"] = obj.scale;
+		trans["EulerAngles"] = vec3(obj.euler_angles);
+		j["transformation"] = trans;
+		objects.push_back(j);
+	}
+	s_save["objects"] = objects;
+
+	// Write on file
+	std::ofstream save_file(file.c_str());
+	save_file << std::setw(4) << s_save << std::endl;
+}
+
+SceneData SceneSnapshot::capture(vkengine::Scene3D* scene)
+{
+	SceneData data;
+	data.header.id = data.addString(scene->getId());
+	data.header.title = data.addString(scene->name);
+	data.header.def_camera = scene->current_camera;
+	for (int c = 0; c < 3; c++) {
+		data.header.global_position[c] = scene->globalLight.position[c];
+		data.header.global_color[c] = scene->globalLight.color[c];
+	}
+	data.header.global_power = scene->globalLight.power.w;
+
+	for (auto& id : scene->listCameras()) {
+		auto cam = scene->getCamera(id);
+		auto& view = cam->getViewSetup();
+		auto& perspective = cam->getPerspectiveSetup();
+		CameraRecord record = {};
+		record.name = data.addString(cam->name);
+		for (int c = 0; c < 3; c++) {
+			record.position[c] = view.position[c];
+			record.target[c] = view.target[c];
+			record.up_vector[c] = view.upVector[c];
+		}
+		record.fovY = perspective.fovY;
+		record.aspect = perspective.aspect;
+		record.near = perspective.near;
+		record.far = perspective.far;
+		data.cameras.push_back(record);
+	}
+	for (auto& id : scene->listLights()) {
+		auto light = scene->getLight(id);
+		LightRecord record = {};
+		record.name = data.addString(light->name);
+		for (int c = 0; c < 3; c++) {
+			record.position[c] = light->getData().position[c];
+			record.color[c] = light->getData().color[c];
+		}
+		record.power = light->getData().power.w;
+		data.lights.push_back(record);
+	}
+
+	SnapshotObjectWriter writer(data);
+	auto objs_ids = scene->listObjects();
+	data.objects.reserve(objs_ids.size());
+	for (auto& id : objs_ids) {
+		auto obj = scene->getObject(id);
+		writer.add(obj->name, obj->getMeshName(), obj->getTextureName(), obj->reflective, obj->occluder, obj->getObjTransform());
+	}
+	// objects streamed out by the world partition belong to the scene as well
+	if (auto partition = vkengine::getWorldPartition(scene)) {
+		for (auto& info : partition->listStreamedObjects()) {
+			writer.add(info);
+		}
+	}
+	return data;
+}
+
+void SceneSnapshot::instantiate(const SceneData& data)
+{
+	const SnapshotHeader& h = data.header;
+	vkengine::createScene(data.getString(h.id), data.getString(h.title));
+	instantiate(data, vkengine::getScene(data.getString(h.id)));
+}
+
+void SceneSnapshot::instantiate(const SceneData& data, vkengine::Scene3D* s)
+{
+	const SnapshotHeader& h = data.header;
+	s->globalLight = {
+		{ h.global_position[0], h.global_position[1], h.global_position[2], 1.0f },
+		{ h.global_color[0], h.global_color[1], h.global_color[2], 1.0f },
+		{ h.global_power, h.global_power, h.global_power, h.global_power }
+	};
+
+	for (auto& light : data.lights) {
+		vkengine::PointLightInfo i = { data.getString(light.name),
+			{ light.position[0], light.position[1], light.position[2] },
+			{ light.color[0], light.color[1], light.color[2] },
+			light.power };
+		s->addLight(i);
+	}
+	for (auto& cam : data.cameras) {
+		s->addCamera(data.getString(cam.name),
+			{
+			  glm::vec3(cam.position[0], cam.position[1], cam.position[2]),
+			  glm::vec3(cam.target[0], cam.target[1], cam.target[2]),
+			  glm::vec3(cam.up_vector[0], cam.up_vector[1], cam.up_vector[2])
+			},
+			{ cam.fovY,
+			  16.f / 9.f, // fixed value for now..
+			  cam.near,
+			  cam.far });
+	}
+
+	s->addObjects(toObjectBatch(data));
+}
+
+void SceneSnapshot::jsonToSnapshot(const std::string& json_file, const std::string& snapshot_file)
+{
+	writeSnapshot(snapshot_file, readJson(json_file));
+}
+
+void SceneSnapshot::snapshotToJson(const std::string& snapshot_file, const std::string& json_file)
+{
+	SceneData data;
+	if (!readSnapshot(snapshot_file, data)) {
+		throw std::runtime_error("invalid scene snapshot " + snapshot_file);
+	}
+	writeJson(json_file, data);
+}
+
+void SceneSnapshot::benchmark(const std::string& json_file, const std::string& snapshot_file, int runs)
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto ms = [](clock::time_point from, clock::time_point to) { return std::chrono::duration<double, std::milli>(to - from).count(); };
+	size_t objects = 0;
+	double json_parse_ms = 0.0, json_total_ms = 0.0, snapshot_parse_ms = 0.0, snapshot_total_ms = 0.0;
+	for (int r = 0; r < runs; r++) {
+		// the objects are created as at startup, in a scene that is destroyed outside of the timing
+		auto start = clock::now();
+		SceneData data = readJson(json_file);
+		auto parsed = clock::now();
+		vkengine::Scene3D scene(data.getString(data.header.id), data.getString(data.header.title));
+		instantiate(data, &scene);
+		auto done = clock::now();
+		json_parse_ms += ms(start, parsed);
+		json_total_ms += ms(start, done);
+		objects = scene.get_object_num();
+	}
+	for (int r = 0; r < runs; r++) {
+		auto start = clock::now();
+		SceneData data;
+		if (!readSnapshot(snapshot_file, data)) {
+			std::cout << "Scene benchmark: " << snapshot_file << " is not a valid snapshot" << std::endl;
+			return;
+		}
+		auto parsed = clock::now();
+		vkengine::Scene3D scene(data.getString(data.header.id), data.getString(data.header.title));
+		instantiate(data, &scene);
+		auto done = clock::now();
+		snapshot_parse_ms += ms(start, parsed);
+		snapshot_total_ms += ms(start, done);
+	}
+
+	std::cout << std::fixed << std::setprecision(3) << "Scene benchmark (" << objects << " objects, " << runs << " runs): "
+		<< "JSON " << json_total_ms / runs << " ms (parse " << json_parse_ms / runs << "), "
+		<< "snapshot " << snapshot_total_ms / runs << " ms (parse " << snapshot_parse_ms / runs << "), "
+		<< json_total_ms / std::max(snapshot_total_ms, 1e-6) << "x faster" << std::endl;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "..\\VkEngine\SnapshotFormat.h"
+#include <string>
+
+/*
+* Editor side of the scene snapshots (see SnapshotFormat.h):
+* the JSON files stay the authoring and diff format, the snapshot is what the editor loads at startup.
+*/
+class SceneSnapshot
+{
+public:
+	static SceneData readJson(const std::string& file);
+	static void writeJson(const std::string& file, const SceneData& data);
+	static SceneData capture(vkengine::Scene3D* scene);
+	// creates the scene in the engine, meshes and textures have to be loaded already
+	static void instantiate(const SceneData& data);
+	// fills a scene that may not be registered in the engine
+	static void instantiate(const SceneData& data, vkengine::Scene3D* scene);
+
+	// converters between the authoring format and the snapshot
+	static void jsonToSnapshot(const std::string& json_file, const std::string& snapshot_file);
+	static void snapshotToJson(const std::string& snapshot_file, const std::string& json_file);
+
+	// CPU only: loads both formats of the same scene into a scene the engine does not render and prints the average times
+	static void benchmark(const std::string& json_file, const std::string& snapshot_file, int runs = 10);
+};
@@ -86,8 +86,7 @@ void ToolsPanel::draw(int w_width, int w_height)
 			obj_info.mesh_name = selected_mesh;
 			obj_info.transformation = transform;
 
-			scene->addObject(obj_info);
-			vkengine::reloadScene();
+			vkengine::addObject(scene, obj_info);
 
 			ImGui::CloseCurrentPopup();
 		}
@@ -3,6 +3,7 @@
 #include "ToolsPanel.h"
 #include "Editor.h"
 #include "Project.h"
+#include <algorithm>
 
 
 View3D::View3D(EditorUI* UI) : EditorComponent(UI)
@@ -29,15 +30,18 @@ void View3D::draw(int w_width, int w_height)
 	//ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
 	ImVec2 oldDrawingPos = ImGui::GetCursorPos();
 	ImVec2 frame_size = ImGui::GetWindowSize();
-	frame_size.x -= oldDrawingPos.x;
+	frame_size.x -= oldDrawingPos.x * 2;
 	frame_size.y -= oldDrawingPos.y;
-	ImVec2 width_padding = frame_size;
-	frame_size.x = frame_size.y * ((float)w_width / (float)w_height);
-	width_padding.x = (ImGui::GetWindowSize().x - frame_size.x) / 2;
-	ImVec2 newDrawingPos = { width_padding.x, oldDrawingPos.y - oldDrawingPos.x };
+	ImVec2 newDrawingPos = { oldDrawingPos.x, oldDrawingPos.y - oldDrawingPos.x };
 	ImGui::SetCursorPos(newDrawingPos);
+	// the scene is rendered at the size of the panel, in framebuffer pixels
+	ImVec2 pixel_scale = ImGui::GetIO().DisplayFramebufferScale;
+	vkengine::setViewportSize((uint32_t)std::max(frame_size.x * pixel_scale.x, 1.f),
+		(uint32_t)std::max(frame_size.y * pixel_scale.y, 1.f));
+	// at a lower render scale only the top left part of the offscreen image is drawn
+	float render_scale = vkengine::getRenderScale();
 	ImGui::Image((ImTextureID)OFFSCREEN_FRAMEBUFFER_TEXTURE_ID, frame_size,
-		ImVec2(0, 0), ImVec2(1, 1),
+		ImVec2(0, 0), ImVec2(render_scale, render_scale),
 		ImVec4(1.0f, 1.0f, 1.0f, 1.0f), ImVec4(1.0f, 1.0f, 1.0f, 1.0f));
 
 	if (ImGui::IsWindowHovered() &&
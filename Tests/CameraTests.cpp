@@ -0,0 +1,92 @@
+#include "TestFramework.h"
+#include "..\\VkEngine\Mesh.h"
+#include "..\\VkEngine\Object3D.h"
+#include "..\\VkEngine\Camera.h"
+#include <random>
+
+using namespace vkengine;
+
+/*
+* Frustum culling must never hide a visible object: every object with a vertex strictly inside
+* the clip volume has to pass the sphere test, the box test and the combined one.
+* Meshes, transformations and cameras are random, the per vertex projection is the reference.
+*/
+
+static bool vertexInsideClipVolume(const glm::mat4& model_view_projection, glm::vec3 pos)
+{
+	glm::vec4 clip = model_view_projection * glm::vec4(pos, 1.f);
+	float margin = 1e-4f * clip.w; // strictly inside, away from the rounding of the planes
+	return clip.w > 0.f &&
+		clip.x > -clip.w + margin && clip.x < clip.w - margin &&
+		clip.y > -clip.w + margin && clip.y < clip.w - margin &&
+		clip.z > margin && clip.z < clip.w - margin;
+}
+
+TEST(Camera, FrustumHasNoFalseNegatives)
+{
+	std::mt19937 rng(26);
+	std::uniform_real_distribution<float> unit(-1.f, 1.f);
+	auto range = [&rng](float low, float high) { return std::uniform_real_distribution<float>(low, high)(rng); };
+
+	unsigned visible = 0, culled = 0;
+	for (int iteration = 0; iteration < 4000; iteration++) {
+		// elongated random point clouds, not centered on the origin
+		std::vector<Vertex3D> vertices(4 + rng() % 60);
+		glm::vec3 offset(range(-3.f, 3.f), range(-3.f, 3.f), range(-3.f, 3.f));
+		glm::vec3 extent(range(0.05f, 4.f), range(0.05f, 4.f), range(0.05f, 4.f));
+		for (auto& v : vertices) {
+			v = {};
+			v.pos = offset + extent * glm::vec3(unit(rng), unit(rng), unit(rng));
+		}
+		AABB box;
+		BoundingSphere sphere;
+		Mesh3D::computeBounds(vertices, box, sphere);
+		for (auto& v : vertices) {
+			CHECK(glm::all(glm::greaterThanEqual(v.pos, box.min)) && glm::all(glm::lessThanEqual(v.pos, box.max)));
+			CHECK(glm::distance(v.pos, sphere.center) <= sphere.radius * 1.0001f + 1e-5f);
+		}
+
+		glm::vec3 eye(range(-50.f, 50.f), range(-10.f, 10.f), range(-50.f, 50.f));
+		glm::vec3 direction = glm::normalize(glm::vec3(unit(rng), unit(rng) * 0.8f, unit(rng)) + glm::vec3(0.f, 0.f, 1e-3f));
+		Camera camera(0, "camera", { eye, eye + direction, glm::vec3(0.f, 1.f, 0.f) },
+			{ range(30.f, 100.f), range(0.5f, 2.5f), range(0.05f, 1.f), range(20.f, 200.f) });
+		camera.setCamera();
+
+		// around the camera, so that both outcomes are frequent
+		ObjTransformation transform = {};
+		transform.position = eye + glm::vec3(unit(rng), unit(rng), unit(rng)) * 40.f;
+		transform.eulerAngles = glm::vec3(range(0.f, 360.f), range(0.f, 360.f), range(0.f, 360.f));
+		transform.scale_factor = range(0.1f, 5.f);
+		Object3D object(0, "object", "mesh", "texture", transform);
+		object.setLocalBounds(box, sphere);
+
+		glm::mat4 model_view_projection = camera.getViewProjection() * object.getMatrix();
+		bool any_vertex_inside = false;
+		for (auto& v : vertices) {
+			any_vertex_inside = any_vertex_inside || vertexInsideClipVolume(model_view_projection, v.pos);
+		}
+		const BoundingSphere& world_sphere = object.getWorldSphere();
+		bool sphere_visible = camera.checkFrustum(world_sphere.center, world_sphere.radius);
+		bool box_visible = camera.checkFrustum(object.getWorldAABB());
+		bool combined_visible = camera.checkFrustum(world_sphere, object.getWorldAABB());
+		if (any_vertex_inside) {
+			CHECK(sphere_visible);
+			CHECK(box_visible);
+			CHECK(combined_visible);
+			visible++;
+		}
+		if (!combined_visible) culled++;
+	}
+	// the test means something only if both cases happened often
+	CHECK(visible > 400);
+	CHECK(culled > 400);
+}
+
+TEST(Camera, EmptyMeshHasPointBounds)
+{
+	AABB box;
+	BoundingSphere sphere;
+	Mesh3D::computeBounds({}, box, sphere);
+	CHECK(box.min == glm::vec3(0.f) && box.max == glm::vec3(0.f));
+	CHECK(sphere.radius == 0.f);
+}
@@ -0,0 +1,129 @@
+#include "TestFramework.h"
+#include "..\\VkEngine\commons.h"
+#include "..\\VkEngine\CpuRayTracer.h"
+#include <iostream>
+
+using namespace vkengine;
+
+/*
+* The golden scene is built in code, no asset is read: a checkered ground, an opaque cube and a reflective
+* one, the sun and a point light. Its image is compared with Data/golden.ppm, rewritten by --update-golden
+* after an intended change of the shading. The bound leaves room for the float differences between
+* compilers and instruction sets, not for a broken shader port.
+*/
+
+constexpr const float GOLDEN_MAX_RMSE = 2.f;
+constexpr const uint32_t GOLDEN_DEPTH = 3;
+
+static CpuImage checkerTexture(int size, int squares)
+{
+	CpuImage image;
+	image.width = image.height = size;
+	image.rgba.resize(size * size * 4);
+	for (int y = 0; y < size; y++) {
+		for (int x = 0; x < size; x++) {
+			bool light = ((x * squares / size) + (y * squares / size)) % 2 == 0;
+			unsigned char* p = &image.rgba[(y * size + x) * 4];
+			p[0] = light ? 230 : 40;
+			p[1] = light ? 220 : 60;
+			p[2] = light ? 200 : 90;
+			p[3] = 255;
+		}
+	}
+	return image;
+}
+
+static CpuImage plainTexture(unsigned char r, unsigned char g, unsigned char b)
+{
+	CpuImage image;
+	image.width = image.height = 1;
+	image.rgba = { r, g, b, 255 };
+	return image;
+}
+
+// unit cube centered on the origin, 4 vertices per face for the normals
+static void cubeMesh(std::vector<Vertex3D>& vertices, std::vector<uint32_t>& indices)
+{
+	const glm::vec3 normals[6] = { {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1} };
+	for (const glm::vec3& n : normals) {
+		glm::vec3 u = std::abs(n.y) > 0.5f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+		glm::vec3 v = glm::cross(n, u);
+		uint32_t first = (uint32_t)vertices.size();
+		const glm::vec2 corners[4] = { {-1, -1}, {1, -1}, {1, 1}, {-1, 1} };
+		for (const glm::vec2& c : corners) {
+			vertices.push_back({ 0.5f * (n + c.x * u + c.y * v), n, glm::vec3(1.f), 0.5f * (c + 1.f) });
+		}
+		for (uint32_t i : { 0u, 1u, 2u, 0u, 2u, 3u }) indices.push_back(first + i);
+	}
+}
+
+static CpuScene goldenScene(int width, int height)
+{
+	CpuScene scene;
+	std::vector<Vertex3D> ground = {
+		{ {-1, 0, -1}, {0, 1, 0}, glm::vec3(1.f), {0, 0} },
+		{ { 1, 0, -1}, {0, 1, 0}, glm::vec3(1.f), {4, 0} },
+		{ { 1, 0,  1}, {0, 1, 0}, glm::vec3(1.f), {4, 4} },
+		{ {-1, 0,  1}, {0, 1, 0}, glm::vec3(1.f), {0, 4} },
+	};
+	uint32_t ground_mesh = scene.addMesh(ground, { 0, 2, 1, 0, 3, 2 });
+	std::vector<Vertex3D> cube_vertices;
+	std::vector<uint32_t> cube_indices;
+	cubeMesh(cube_vertices, cube_indices);
+	uint32_t cube_mesh = scene.addMesh(cube_vertices, cube_indices);
+
+	uint32_t checker = scene.addTexture(checkerTexture(64, 8));
+	uint32_t red = scene.addTexture(plainTexture(200, 40, 30));
+	uint32_t grey = scene.addTexture(plainTexture(180, 180, 190));
+
+	scene.addInstance(ground_mesh, checker, glm::scale(glm::mat4(1.f), glm::vec3(10.f)), false);
+	glm::mat4 cube = glm::translate(glm::mat4(1.f), glm::vec3(-1.5f, 1.f, 0.f));
+	cube = glm::rotate(cube, glm::radians(30.f), glm::vec3(0, 1, 0));
+	scene.addInstance(cube_mesh, red, glm::scale(cube, glm::vec3(2.f)), false);
+	glm::mat4 mirror = glm::translate(glm::mat4(1.f), glm::vec3(1.8f, 1.5f, -1.f));
+	mirror = glm::rotate(mirror, glm::radians(-20.f), glm::vec3(0, 1, 0));
+	scene.addInstance(cube_mesh, grey, glm::scale(mirror, glm::vec3(2.f, 3.f, 0.5f)), true);
+	scene.commit();
+
+	scene.global_light = { glm::vec4(-0.5f, 1.f, 0.7f, 0.f), glm::vec4(1.f, 0.95f, 0.9f, 1.f), glm::vec4(1.f) };
+	scene.lights.push_back({ glm::vec4(0.f, 3.f, 3.f, 1.f), glm::vec4(0.4f, 0.6f, 1.f, 1.f), glm::vec4(5.f) });
+	scene.setCamera(glm::lookAt(glm::vec3(0.f, 4.f, 9.f), glm::vec3(0.f, 0.5f, 0.f), glm::vec3(0.f, 1.f, 0.f)),
+		glm::perspective(glm::radians(45.f), (float)width / height, 0.1f, 100.f));
+	return scene;
+}
+
+TEST(CpuRayTracer, GoldenImage)
+{
+	const int width = 160, height = 120;
+	CpuScene scene = goldenScene(width, height);
+	CpuImage image;
+	image.width = width;
+	image.height = height;
+	CpuRayTracingStats stats = CpuRayTracer::render(scene, image, GOLDEN_DEPTH, 0);
+	CHECK(stats.rays >= (uint64_t)width * height);
+
+	std::string golden_file = tests::dataDir() + "golden.ppm";
+	if (tests::updateGolden()) {
+		image.writePPM(golden_file);
+		std::cout << "  golden image written to " << golden_file << std::endl;
+		return;
+	}
+	float rmse = CpuImage::compare(image, CpuImage::readPPM(golden_file));
+	CHECK(rmse >= 0.f);
+	CHECK_NEAR(rmse, 0.f, GOLDEN_MAX_RMSE);
+}
+
+// Mrays/s of the golden scene at a bigger size on every thread, the number to compare the GPU with
+TEST(CpuRayTracer, Baseline)
+{
+	const int width = 640, height = 480;
+	CpuScene scene = goldenScene(width, height);
+	CpuImage image;
+	image.width = width;
+	image.height = height;
+	CpuRayTracingStats stats = CpuRayTracer::render(scene, image, GOLDEN_DEPTH, 0);
+	CHECK(stats.rays >= (uint64_t)width * height);
+	CHECK(stats.mrays_per_second > 0.f);
+	std::cout << "  " << width << "x" << height << ": " << stats.rays << " rays in " << stats.trace_ms
+		<< " ms (" << stats.mrays_per_second << " Mrays/s)" << std::endl;
+}
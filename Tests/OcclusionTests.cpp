@@ -0,0 +1,315 @@
+#include "TestFramework.h"
+#include "..\\VkEngine\OcclusionCulling.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <random>
+#include <set>
+#include <array>
+#include <limits>
+
+using namespace vkengine;
+
+/*
+* The SIMD rasterizer and the tile shortcut of the culling are checked against a plain
+* per-pixel reference in double precision. A pixel is written if the square of the pixel is inside
+* the triangle, or only its centre for the edges shared with the triangle on the other side.
+* Pixels on the limit can go either way, everything else has to match.
+*/
+
+struct ReferenceBuffer {
+	int width, height;
+	std::vector<double> depth;
+	std::vector<bool> on_edge; // within EDGE_TOLERANCE pixels of the limit of a covering triangle
+	static constexpr double EDGE_TOLERANCE = 1e-3;
+
+	ReferenceBuffer(int width, int height) : width(width), height(height),
+		depth(width * height, 1.0), on_edge(width * height, false) {}
+
+	struct Triangle {
+		double sx[3], sy[3], sz[3];
+	};
+
+	void rasterize(const std::vector<glm::vec4>& clip_vertices, const std::vector<uint32_t>& indices)
+	{
+		std::vector<Triangle> triangles;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+			Triangle t;
+			bool clipped = false;
+			for (int v = 0; v < 3; v++) {
+				const glm::vec4& c = clip_vertices[indices[i + v]];
+				if (c.w <= 1e-4f || c.z < 0.f) { clipped = true; break; }
+				t.sx[v] = (c.x / c.w * 0.5f + 0.5f) * width;
+				t.sy[v] = (c.y / c.w * 0.5f + 0.5f) * height;
+				t.sz[v] = c.z / c.w;
+			}
+			if (clipped) continue;
+			double area = (t.sx[1] - t.sx[0]) * (t.sy[2] - t.sy[0]) - (t.sy[1] - t.sy[0]) * (t.sx[2] - t.sx[0]);
+			if (std::abs(area) < 1e-6) continue;
+			if (area < 0.0) {
+				std::swap(t.sx[1], t.sx[2]); std::swap(t.sy[1], t.sy[2]); std::swap(t.sz[1], t.sz[2]);
+			}
+			triangles.push_back(t);
+		}
+		// directed edges, an edge also found reversed has a triangle on both sides
+		std::set<std::array<double, 4>> edges;
+		for (auto& t : triangles)
+			for (int e = 0; e < 3; e++)
+				edges.insert({ t.sx[(e + 1) % 3], t.sy[(e + 1) % 3], t.sx[(e + 2) % 3], t.sy[(e + 2) % 3] });
+		for (auto& t : triangles) {
+			const double* sx = t.sx;
+			const double* sy = t.sy;
+			const double* sz = t.sz;
+			double area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sy[1] - sy[0]) * (sx[2] - sx[0]);
+			// distance from an outer edge at which the pixel square touches it
+			double margin[3];
+			for (int e = 0; e < 3; e++) {
+				int a = (e + 1) % 3, b = (e + 2) % 3;
+				double ex = sx[b] - sx[a], ey = sy[b] - sy[a];
+				bool inner = edges.count({ sx[b], sy[b], sx[a], sy[a] }) > 0;
+				margin[e] = inner ? 0.0 : 0.5 * (std::abs(ex) + std::abs(ey)) / std::hypot(ex, ey);
+			}
+			for (int y = 0; y < height; y++) {
+				for (int x = 0; x < width; x++) {
+					double px = x + 0.5, py = y + 0.5;
+					double w[3], distance[3];
+					bool inside = true, near_edge = false;
+					for (int e = 0; e < 3; e++) {
+						int a = (e + 1) % 3, b = (e + 2) % 3;
+						w[e] = ((sx[b] - sx[a]) * (py - sy[a]) - (sy[b] - sy[a]) * (px - sx[a])) / area;
+						distance[e] = w[e] * area / std::hypot(sx[b] - sx[a], sy[b] - sy[a]) - margin[e];
+						inside = inside && distance[e] >= 0.0;
+					}
+					for (int e = 0; e < 3; e++) {
+						near_edge = near_edge || (std::abs(distance[e]) < EDGE_TOLERANCE &&
+							distance[(e + 1) % 3] > -EDGE_TOLERANCE && distance[(e + 2) % 3] > -EDGE_TOLERANCE);
+					}
+					if (near_edge) on_edge[y * width + x] = true;
+					if (inside) {
+						double z = w[0] * sz[0] + w[1] * sz[1] + w[2] * sz[2];
+						depth[y * width + x] = std::min(depth[y * width + x], z);
+					}
+				}
+			}
+		}
+	}
+
+	// occluded only if every pixel the box projects on is nearer than the box
+	bool isOccluded(const AABB& box, const glm::mat4& view_projection) const
+	{
+		double min_x = std::numeric_limits<double>::max(), max_x = -min_x, min_y = min_x, max_y = -min_x, nearest_z = min_x;
+		for (int i = 0; i < 8; i++) {
+			glm::vec4 c = view_projection * glm::vec4(
+				i & 1 ? box.max.x : box.min.x, i & 2 ? box.max.y : box.min.y, i & 4 ? box.max.z : box.min.z, 1.f);
+			if (c.w <= 1e-4f) return false;
+			double x = (c.x / c.w * 0.5f + 0.5f) * width, y = (c.y / c.w * 0.5f + 0.5f) * height;
+			min_x = std::min(min_x, x); max_x = std::max(max_x, x);
+			min_y = std::min(min_y, y); max_y = std::max(max_y, y);
+			nearest_z = std::min(nearest_z, (double)(c.z / c.w));
+		}
+		if (nearest_z < 0.0) return false;
+		int x0 = std::max(0, (int)std::floor(min_x)), x1 = std::min(width - 1, (int)std::floor(max_x));
+		int y0 = std::max(0, (int)std::floor(min_y)), y1 = std::min(height - 1, (int)std::floor(max_y));
+		if (x0 > x1 || y0 > y1) return false;
+		for (int y = y0; y <= y1; y++)
+			for (int x = x0; x <= x1; x++)
+				if (depth[y * width + x] >= nearest_z) return false;
+		return true;
+	}
+};
+
+static void addTriangle(std::vector<glm::vec4>& vertices, std::vector<uint32_t>& indices, glm::vec4 a, glm::vec4 b, glm::vec4 c)
+{
+	uint32_t first = static_cast<uint32_t>(vertices.size());
+	vertices.insert(vertices.end(), { a, b, c });
+	indices.insert(indices.end(), { first, first + 1, first + 2 });
+}
+
+// screen aligned quad at clip depth z, corners in pixels
+static void addQuad(std::vector<glm::vec4>& vertices, std::vector<uint32_t>& indices, const OcclusionBuffer& buffer,
+	glm::vec2 min_px, glm::vec2 max_px, float z)
+{
+	auto clip = [&buffer, z](float x, float y) {
+		return glm::vec4(x / buffer.getWidth() * 2.f - 1.f, y / buffer.getHeight() * 2.f - 1.f, z, 1.f);
+	};
+	addTriangle(vertices, indices, clip(min_px.x, min_px.y), clip(max_px.x, min_px.y), clip(max_px.x, max_px.y));
+	addTriangle(vertices, indices, clip(min_px.x, min_px.y), clip(max_px.x, max_px.y), clip(min_px.x, max_px.y));
+}
+
+static void randomTriangles(std::mt19937& rng, unsigned count, std::vector<glm::vec4>& vertices, std::vector<uint32_t>& indices)
+{
+	std::uniform_real_distribution<float> ndc(-1.3f, 1.3f), depth(0.05f, 0.95f), w(0.5f, 4.f);
+	for (unsigned i = 0; i < count; i++) {
+		glm::vec4 corners[3];
+		for (auto& c : corners) {
+			float cw = w(rng);
+			c = glm::vec4(ndc(rng) * cw, ndc(rng) * cw, depth(rng) * cw, cw);
+		}
+		addTriangle(vertices, indices, corners[0], corners[1], corners[2]);
+	}
+}
+
+TEST(Occlusion, RasterizerMatchesScalarReference)
+{
+	std::mt19937 rng(27);
+	// odd sizes: the width is padded to 4 pixels and the last tiles are partial
+	const int sizes[][2] = { { 256, 144 }, { 250, 70 }, { 37, 19 } };
+	for (auto& size : sizes) {
+		OcclusionBuffer buffer(size[0], size[1]);
+		CHECK(buffer.getWidth() % 4 == 0 && buffer.getWidth() >= size[0]);
+		std::vector<glm::vec4> vertices;
+		std::vector<uint32_t> indices;
+		randomTriangles(rng, 60, vertices, indices);
+		buffer.rasterize(vertices, indices, 0, buffer.getHeight());
+
+		ReferenceBuffer reference(buffer.getWidth(), buffer.getHeight());
+		reference.rasterize(vertices, indices);
+		unsigned mismatches = 0, covered = 0;
+		for (int y = 0; y < buffer.getHeight(); y++) {
+			for (int x = 0; x < buffer.getWidth(); x++) {
+				double expected = reference.depth[y * buffer.getWidth() + x];
+				if (expected < 1.0) covered++;
+				if (std::abs(buffer.getDepth(x, y) - expected) > 1e-3 && !reference.on_edge[y * buffer.getWidth() + x]) {
+					if (mismatches++ < 5) CHECK_NEAR(buffer.getDepth(x, y), expected, 1e-3);
+				}
+			}
+		}
+		CHECK(mismatches == 0);
+		CHECK(covered > 0);
+	}
+}
+
+TEST(Occlusion, SkipsTrianglesCrossingTheNearPlane)
+{
+	OcclusionBuffer buffer(64, 32);
+	std::vector<glm::vec4> vertices;
+	std::vector<uint32_t> indices;
+	addTriangle(vertices, indices, { -1.f, -1.f, 0.5f, 1.f }, { 1.f, -1.f, -0.1f, 1.f }, { 0.f, 1.f, 0.5f, 1.f });
+	addTriangle(vertices, indices, { -1.f, -1.f, 0.5f, 1.f }, { 1.f, -1.f, 0.5f, 0.f }, { 0.f, 1.f, 0.5f, 1.f });
+	buffer.rasterize(vertices, indices, 0, buffer.getHeight());
+	for (int y = 0; y < buffer.getHeight(); y++)
+		for (int x = 0; x < buffer.getWidth(); x++)
+			CHECK(buffer.getDepth(x, y) == 1.f);
+}
+
+TEST(Occlusion, BandsMatchWholeBuffer)
+{
+	std::mt19937 rng(270);
+	std::vector<glm::vec4> vertices;
+	std::vector<uint32_t> indices;
+	randomTriangles(rng, 80, vertices, indices);
+	OcclusionBuffer whole(250, 70), banded(250, 70);
+	whole.rasterize(vertices, indices, 0, whole.getHeight());
+	// tile aligned bands like the workers use, then bands cutting tiles and rows past the end
+	const int bands[] = { 0, 8, 24, 40, 41, 53, 69, 200 };
+	for (size_t i = 0; i + 1 < sizeof(bands) / sizeof(bands[0]); i++)
+		banded.rasterize(vertices, indices, bands[i], bands[i + 1]);
+	bool identical = true;
+	for (int y = 0; y < whole.getHeight(); y++)
+		for (int x = 0; x < whole.getWidth(); x++)
+			identical = identical && whole.getDepth(x, y) == banded.getDepth(x, y);
+	CHECK(identical);
+}
+
+TEST(Occlusion, CullDecisionsMatchScalarReference)
+{
+	std::mt19937 rng(2700);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	const glm::mat4 projections[] = {
+		glm::mat4(1.f), // clip space = world space
+		glm::perspective(glm::radians(60.f), 16.f / 9.f, 0.1f, 100.f) *
+			glm::lookAt(glm::vec3(0.f, 0.f, 5.f), glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f)) };
+	unsigned occluded = 0, visible = 0;
+	for (int p = 0; p < 2; p++) {
+		const glm::mat4& view_projection = projections[p];
+		OcclusionBuffer buffer(250, 70);
+		std::vector<glm::vec4> vertices;
+		std::vector<uint32_t> indices;
+		// occluders with edges on, just before and just after the tile borders
+		addQuad(vertices, indices, buffer, { 0.f, 0.f }, { 250.f, 70.f }, 0.9f);
+		addQuad(vertices, indices, buffer, { 32.f, 8.f }, { 96.f, 40.f }, 0.3f);
+		addQuad(vertices, indices, buffer, { 95.5f, 7.5f }, { 160.5f, 48.5f }, 0.4f);
+		addQuad(vertices, indices, buffer, { 161.f, 15.f }, { 224.f, 57.f }, 0.5f);
+		randomTriangles(rng, 20, vertices, indices);
+		// bands as the workers fill them, tiles refreshed per band
+		for (int row = 0; row < buffer.getHeight(); row += 2 * OcclusionBuffer::TILE_HEIGHT) {
+			buffer.rasterize(vertices, indices, row, row + 2 * OcclusionBuffer::TILE_HEIGHT);
+			buffer.updateTiles(row, row + 2 * OcclusionBuffer::TILE_HEIGHT);
+		}
+		ReferenceBuffer reference(buffer.getWidth(), buffer.getHeight());
+		for (int y = 0; y < buffer.getHeight(); y++)
+			for (int x = 0; x < buffer.getWidth(); x++)
+				reference.depth[y * buffer.getWidth() + x] = buffer.getDepth(x, y);
+
+		bool perspective = p == 1;
+		for (int i = 0; i < 4000; i++) {
+			glm::vec3 center, half_extent;
+			if (perspective) { // the occluders are less than 1 unit from the camera
+				center = glm::vec3(unit(rng) * 6.f - 3.f, unit(rng) * 4.f - 2.f, unit(rng) * 7.5f - 3.5f);
+				half_extent = glm::vec3(unit(rng), unit(rng), unit(rng)) * 0.8f;
+			}
+			else {
+				center = glm::vec3(unit(rng) * 2.4f - 1.2f, unit(rng) * 2.4f - 1.2f, unit(rng));
+				half_extent = glm::vec3(unit(rng) * 0.3f, unit(rng) * 0.3f, unit(rng) * 0.05f);
+			}
+			AABB world_box = { center - half_extent, center + half_extent };
+			bool culled = buffer.isOccluded(world_box, view_projection);
+			CHECK(culled == reference.isOccluded(world_box, view_projection));
+			if (culled) occluded++;
+			else visible++;
+		}
+	}
+	CHECK(occluded > 100);
+	CHECK(visible > 100);
+}
+
+TEST(Occlusion, BoxesAroundAnOccluder)
+{
+	OcclusionBuffer buffer(256, 144);
+	std::vector<glm::vec4> vertices;
+	std::vector<uint32_t> indices;
+	addQuad(vertices, indices, buffer, { 64.f, 32.f }, { 192.f, 112.f }, 0.5f);
+	buffer.rasterize(vertices, indices, 0, buffer.getHeight());
+	buffer.updateTiles(0, buffer.getHeight());
+	const glm::mat4 identity(1.f);
+	auto box = [&buffer](glm::vec2 min_px, glm::vec2 max_px, float near_z, float far_z) {
+		return AABB{
+			{ min_px.x / buffer.getWidth() * 2.f - 1.f, min_px.y / buffer.getHeight() * 2.f - 1.f, near_z },
+			{ max_px.x / buffer.getWidth() * 2.f - 1.f, max_px.y / buffer.getHeight() * 2.f - 1.f, far_z } };
+	};
+	// behind
+	CHECK(buffer.isOccluded(box({ 70.f, 40.f }, { 180.f, 100.f }, 0.6f, 0.8f), identity));
+	// across tile borders, still inside the occluder
+	CHECK(buffer.isOccluded(box({ 64.5f, 32.5f }, { 191.5f, 111.5f }, 0.6f, 0.8f), identity));
+	// in front, or straddling its depth
+	CHECK(!buffer.isOccluded(box({ 70.f, 40.f }, { 180.f, 100.f }, 0.2f, 0.4f), identity));
+	CHECK(!buffer.isOccluded(box({ 70.f, 40.f }, { 180.f, 100.f }, 0.4f, 0.6f), identity));
+	// one pixel past the border, on the same tile or on the next one
+	CHECK(!buffer.isOccluded(box({ 70.f, 40.f }, { 193.5f, 100.f }, 0.6f, 0.8f), identity));
+	CHECK(!buffer.isOccluded(box({ 62.5f, 40.f }, { 180.f, 100.f }, 0.6f, 0.8f), identity));
+	CHECK(!buffer.isOccluded(box({ 70.f, 40.f }, { 180.f, 113.5f }, 0.6f, 0.8f), identity));
+	// crossing the near plane or off screen: left to the other tests
+	CHECK(!buffer.isOccluded(box({ 70.f, 40.f }, { 180.f, 100.f }, -0.1f, 0.8f), identity));
+	CHECK(!buffer.isOccluded(box({ 300.f, 40.f }, { 320.f, 100.f }, 0.6f, 0.8f), identity));
+	// nothing rasterized after a clear
+	buffer.clear();
+	CHECK(!buffer.isOccluded(box({ 70.f, 40.f }, { 180.f, 100.f }, 0.6f, 0.8f), identity));
+}
+
+// the occluder covers the center of the pixel 192 but not the whole pixel, a box sticking out there is visible
+TEST(Occlusion, SubPixelProtrusionStaysVisible)
+{
+	OcclusionBuffer buffer(256, 144);
+	std::vector<glm::vec4> vertices;
+	std::vector<uint32_t> indices;
+	addQuad(vertices, indices, buffer, { 64.f, 32.f }, { 192.6f, 112.6f }, 0.5f);
+	buffer.rasterize(vertices, indices, 0, buffer.getHeight());
+	buffer.updateTiles(0, buffer.getHeight());
+	const glm::mat4 identity(1.f);
+	auto box = [&buffer](glm::vec2 min_px, glm::vec2 max_px) {
+		return AABB{
+			{ min_px.x / buffer.getWidth() * 2.f - 1.f, min_px.y / buffer.getHeight() * 2.f - 1.f, 0.6f },
+			{ max_px.x / buffer.getWidth() * 2.f - 1.f, max_px.y / buffer.getHeight() * 2.f - 1.f, 0.8f } };
+	};
+	CHECK(buffer.isOccluded(box({ 70.f, 40.f }, { 191.9f, 100.f }), identity));
+	CHECK(!buffer.isOccluded(box({ 70.f, 40.f }, { 192.9f, 100.f }), identity));
+	CHECK(!buffer.isOccluded(box({ 70.f, 40.f }, { 180.f, 112.9f }), identity));
+}
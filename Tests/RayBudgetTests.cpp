@@ -0,0 +1,134 @@
+#include "TestFramework.h"
+#include "..\\VkEngine\RayBudget.h"
+#include <algorithm>
+
+using namespace vkengine;
+
+/*
+* The controller is fed by a cost model of the dispatch instead of a GPU: every bounce after the first
+* costs a share of the first one unless the roulette ends the path, and the cost scales with the pixels.
+* A small deterministic noise stands for the frame to frame variance of the timings.
+*/
+
+static float dispatchCost(const RayBudget& budget, float scene_ms, int frame, float noise_ms)
+{
+	float bounces = 1.f + (budget.max_depth - 1) * (1.f - budget.roulette) * 0.8f;
+	float noise = ((frame * 7919) % 13 - 6) / 6.f * noise_ms;
+	return scene_ms * bounces * budget.resolution_scale * budget.resolution_scale + 0.3f + noise;
+}
+
+struct BudgetChange {
+	int frame;
+	size_t from, to;
+};
+
+// runs the controller for frame_count frames, returns the level changes
+static std::vector<BudgetChange> simulate(RayBudgetController& controller, std::vector<RayBudget>& ladder,
+	float scene_ms, int first_frame, int frame_count, float noise_ms)
+{
+	std::vector<BudgetChange> changes;
+	auto levelOf = [&ladder](const RayBudget& budget) {
+		return (size_t)(std::find(ladder.begin(), ladder.end(), budget) - ladder.begin());
+	};
+	RayBudget budget = controller.current();
+	for (int frame = first_frame; frame < first_frame + frame_count; frame++) {
+		RayBudget next = controller.update(dispatchCost(budget, scene_ms, frame, noise_ms));
+		if (next != budget) changes.push_back({ frame, levelOf(budget), levelOf(next) });
+		budget = next;
+	}
+	return changes;
+}
+
+static std::vector<RayBudget> listLevels(const RayBudgetSettings& settings, uint32_t max_depth)
+{
+	// the ladder is only visible one step at a time: walk it down with a time far over the target
+	RayBudgetController walker;
+	walker.configure(settings, max_depth);
+	std::vector<RayBudget> ladder = { walker.current() };
+	for (size_t i = 0; i < walker.countLevels() * (settings.settle_frames + 2); i++) {
+		RayBudget budget = walker.update(settings.target_ms * 100.f);
+		if (budget != ladder.back()) ladder.push_back(budget);
+	}
+	return ladder;
+}
+
+TEST(RayBudget, ConvergesWithoutChangesOnceSettled)
+{
+	RayBudgetSettings settings;
+	settings.enabled = true;
+	settings.target_ms = 8.f;
+	std::vector<RayBudget> ladder = listLevels(settings, 5);
+
+	RayBudgetController controller;
+	controller.configure(settings, 5);
+	CHECK(ladder.size() == controller.countLevels());
+	// full quality costs ~9.5 ms, one step of roulette brings it inside the tolerance
+	float scene_ms = 2.2f;
+	simulate(controller, ladder, scene_ms, 0, 2000, 0.3f);
+	std::vector<BudgetChange> late = simulate(controller, ladder, scene_ms, 2000, 20000, 0.3f);
+	CHECK(late.empty());
+	CHECK(controller.smoothedTime() <= settings.target_ms * (1.f + settings.tolerance));
+	CHECK(controller.smoothedTime() >= settings.target_ms * (1.f - settings.tolerance));
+	CHECK(controller.current() == ladder[1]);
+}
+
+TEST(RayBudget, ReachesTheCheapestLevelAndComesBack)
+{
+	RayBudgetSettings settings;
+	settings.enabled = true;
+	settings.target_ms = 8.f;
+	std::vector<RayBudget> ladder = listLevels(settings, 5);
+
+	RayBudgetController controller;
+	controller.configure(settings, 5);
+	// a scene no budget can fit: it ends at the bottom of the ladder and stays there
+	simulate(controller, ladder, 40.f, 0, 3000, 0.3f);
+	CHECK(controller.current() == ladder.back());
+	CHECK(simulate(controller, ladder, 40.f, 3000, 3000, 0.3f).empty());
+	// a cheap scene: back to full quality, one step at a time
+	std::vector<BudgetChange> changes = simulate(controller, ladder, 0.5f, 6000, 20000, 0.1f);
+	CHECK(controller.current() == ladder.front());
+	for (auto& change : changes) {
+		CHECK(change.to + 1 == change.from);
+	}
+}
+
+TEST(RayBudget, FailedUpgradesBackOff)
+{
+	RayBudgetSettings settings;
+	settings.enabled = true;
+	settings.target_ms = 8.f;
+	// no level inside the tolerance: full quality is over it (~8.9 ms), the next level under it (~7.3 ms)
+	settings.tolerance = 0.05f;
+	std::vector<RayBudget> ladder = listLevels(settings, 5);
+
+	RayBudgetController controller;
+	controller.configure(settings, 5);
+	const uint32_t first_wait = controller.upgradeWait();
+	CHECK(first_wait == 2 * settings.settle_frames);
+	std::vector<BudgetChange> changes = simulate(controller, ladder, 2.05f, 0, 30000, 0.05f);
+
+	// it only ever moves between the two levels around the target
+	std::vector<int> upgrades;
+	for (auto& change : changes) {
+		CHECK(std::max(change.from, change.to) == 1 && std::min(change.from, change.to) == 0);
+		if (change.to < change.from) upgrades.push_back(change.frame);
+	}
+	CHECK(upgrades.size() >= 4);
+	// every failed attempt doubles the wait before the next one, up to the cap
+	for (size_t i = 2; i < upgrades.size(); i++) {
+		int previous_gap = upgrades[i - 1] - upgrades[i - 2];
+		int gap = upgrades[i] - upgrades[i - 1];
+		CHECK(gap >= previous_gap);
+	}
+	CHECK(controller.upgradeWait() > first_wait);
+	CHECK(controller.upgradeWait() <= 512);
+	// once the cap is reached the attempts are rare: a few per minute at 60 fps
+	int late_upgrades = (int)std::count_if(upgrades.begin(), upgrades.end(), [](int frame) { return frame >= 20000; });
+	CHECK(late_upgrades <= 10000 / 512 + 1);
+
+	// a step up that holds resets the wait
+	simulate(controller, ladder, 1.5f, 30000, 2000, 0.05f);
+	CHECK(controller.current() == ladder.front());
+	CHECK(controller.upgradeWait() == first_wait);
+}
@@ -0,0 +1,337 @@
+#include "TestFramework.h"
+#include "..\\VkEngine\RenderGraph.h"
+
+/*
+* Only declare and compile() are exercised: they call no Vulkan function, so the culling, the barriers
+* and the memory slots of the transients are checked on graphs shaped like the frames of the renderer.
+*/
+
+static const GraphImageDesc COLOR_DESC = { VK_FORMAT_R8G8B8A8_UNORM, { 64, 64 } };
+static const GraphImageDesc DEPTH_DESC = { VK_FORMAT_D32_SFLOAT, { 64, 64 }, VK_IMAGE_ASPECT_DEPTH_BIT };
+
+static void noRecord(VkCommandBuffer, uint32_t) {}
+
+static const CompiledPass* findCompiled(const RenderGraph& graph, uint32_t pass)
+{
+	for (auto& compiled : graph.getCompiledPasses()) {
+		if (compiled.pass == pass) return &compiled;
+	}
+	return nullptr;
+}
+
+static const GraphBarrier* findBarrier(const std::vector<GraphBarrier>& barriers, uint32_t resource)
+{
+	for (auto& barrier : barriers) {
+		if (barrier.resource == resource) return &barrier;
+	}
+	return nullptr;
+}
+
+static const TransientImage* findTransient(const RenderGraph& graph, uint32_t resource)
+{
+	for (auto& transient : graph.getTransients()) {
+		if (transient.resource == resource) return &transient;
+	}
+	return nullptr;
+}
+
+// out is exported, left for a copy
+static uint32_t importOutput(RenderGraph& graph)
+{
+	GraphImportInfo info;
+	info.final_layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	return graph.importImage("out", COLOR_DESC, info);
+}
+
+TEST(RenderGraph, CullsPassesNobodyReads)
+{
+	RenderGraph graph;
+	uint32_t out = importOutput(graph);
+	uint32_t a = graph.createImage("a", COLOR_DESC);
+	uint32_t unused = graph.createImage("unused", COLOR_DESC);
+	uint32_t p0 = graph.addPass("p0", noRecord);
+	graph.write(p0, a, RG_COLOR_ATTACHMENT);
+	uint32_t dead = graph.addPass("dead", noRecord);
+	graph.read(dead, a, RG_SAMPLED_FRAGMENT);
+	graph.write(dead, unused, RG_COLOR_ATTACHMENT);
+	uint32_t side = graph.addPass("side effects", noRecord, true);
+	graph.read(side, a, RG_SAMPLED_FRAGMENT);
+	uint32_t p1 = graph.addPass("p1", noRecord);
+	graph.read(p1, a, RG_SAMPLED_FRAGMENT);
+	graph.write(p1, out, RG_STORAGE_RAY_TRACING);
+	graph.compile();
+
+	CHECK(!graph.isCulled(p0));
+	CHECK(graph.isCulled(dead));
+	CHECK(!graph.isCulled(side));
+	CHECK(!graph.isCulled(p1));
+	CHECK(graph.getCompiledPasses().size() == 3);
+	CHECK(findCompiled(graph, dead) == nullptr);
+	// the image only the culled pass wrote is not allocated
+	CHECK(findTransient(graph, unused) == nullptr);
+	CHECK(graph.getFirstUseStages(unused) == 0);
+}
+
+TEST(RenderGraph, CullsOverwrittenAndUnexportedWrites)
+{
+	RenderGraph graph;
+	uint32_t out = importOutput(graph);
+	GraphImportInfo hidden_info;
+	hidden_info.exported = false;
+	uint32_t hidden = graph.importImage("hidden", COLOR_DESC, hidden_info);
+	uint32_t first = graph.addPass("first", noRecord);
+	graph.write(first, out, RG_COLOR_ATTACHMENT);
+	uint32_t second = graph.addPass("second", noRecord);
+	graph.write(second, out, RG_COLOR_ATTACHMENT);
+	uint32_t unexported = graph.addPass("unexported", noRecord);
+	graph.write(unexported, hidden, RG_COLOR_ATTACHMENT);
+	graph.compile();
+
+	CHECK(graph.isCulled(first));
+	CHECK(!graph.isCulled(second));
+	CHECK(graph.isCulled(unexported));
+}
+
+TEST(RenderGraph, ReadAfterWriteBarrier)
+{
+	RenderGraph graph;
+	uint32_t out = importOutput(graph);
+	uint32_t a = graph.createImage("a", COLOR_DESC);
+	uint32_t p0 = graph.addPass("p0", noRecord);
+	graph.write(p0, a, RG_COLOR_ATTACHMENT);
+	uint32_t p1 = graph.addPass("p1", noRecord);
+	graph.read(p1, a, RG_SAMPLED_FRAGMENT);
+	graph.write(p1, out, RG_COLOR_ATTACHMENT);
+	graph.compile();
+
+	const CompiledPass* compiled = findCompiled(graph, p1);
+	CHECK(compiled != nullptr);
+	if (!compiled) return;
+	const GraphBarrier* barrier = findBarrier(compiled->barriers, a);
+	CHECK(barrier != nullptr);
+	if (!barrier) return;
+	CHECK(barrier->old_layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	CHECK(barrier->new_layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	CHECK(barrier->src_stage == VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+	CHECK(barrier->src_access == VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+	CHECK(barrier->dst_stage == VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	CHECK(barrier->dst_access == VK_ACCESS_SHADER_READ_BIT);
+}
+
+TEST(RenderGraph, WriteAfterReadBarrier)
+{
+	// storage image: the same layout for every use, only the execution order has to be kept
+	RenderGraph graph;
+	uint32_t out = importOutput(graph);
+	uint32_t a = graph.createImage("a", COLOR_DESC);
+	uint32_t writer = graph.addPass("writer", noRecord);
+	graph.write(writer, a, RG_STORAGE_RAY_TRACING);
+	uint32_t reader = graph.addPass("reader", noRecord, true);
+	graph.read(reader, a, RG_STORAGE_RAY_TRACING);
+	uint32_t second_reader = graph.addPass("second reader", noRecord, true);
+	graph.read(second_reader, a, RG_STORAGE_RAY_TRACING);
+	uint32_t rewriter = graph.addPass("rewriter", noRecord);
+	graph.write(rewriter, a, RG_STORAGE_RAY_TRACING);
+	graph.write(rewriter, out, RG_STORAGE_RAY_TRACING);
+	graph.compile();
+
+	// read after write, no transition
+	const GraphBarrier* raw = findBarrier(findCompiled(graph, reader)->barriers, a);
+	CHECK(raw != nullptr);
+	if (raw) {
+		CHECK(raw->old_layout == VK_IMAGE_LAYOUT_GENERAL && raw->new_layout == VK_IMAGE_LAYOUT_GENERAL);
+		CHECK(raw->src_access == VK_ACCESS_SHADER_WRITE_BIT);
+	}
+	// the write is already visible to these stages
+	CHECK(findBarrier(findCompiled(graph, second_reader)->barriers, a) == nullptr);
+	// write after read: waits for the reads before overwriting
+	const GraphBarrier* war = findBarrier(findCompiled(graph, rewriter)->barriers, a);
+	CHECK(war != nullptr);
+	if (war) {
+		CHECK(war->src_stage == VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR);
+		CHECK(war->dst_stage == VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR);
+		CHECK(war->old_layout == VK_IMAGE_LAYOUT_GENERAL && war->new_layout == VK_IMAGE_LAYOUT_GENERAL);
+	}
+}
+
+TEST(RenderGraph, ImportedLayouts)
+{
+	RenderGraph graph;
+	GraphImportInfo scene_info;
+	scene_info.initial_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	scene_info.final_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	uint32_t scene = graph.importImage("scene", COLOR_DESC, scene_info);
+	GraphImportInfo swapchain_info;
+	swapchain_info.initial_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	swapchain_info.final_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	swapchain_info.acquired = true;
+	uint32_t swapchain = graph.importImage("swapchain", COLOR_DESC, swapchain_info);
+	uint32_t trace = graph.addPass("trace", noRecord);
+	graph.write(trace, scene, RG_STORAGE_RAY_TRACING);
+	uint32_t ui = graph.addPass("ui", noRecord);
+	graph.read(ui, scene, RG_SAMPLED_FRAGMENT);
+	graph.write(ui, swapchain, RG_COLOR_ATTACHMENT);
+	graph.compile();
+
+	const CompiledPass* compiled_trace = findCompiled(graph, trace);
+	const CompiledPass* compiled_ui = findCompiled(graph, ui);
+	CHECK(compiled_trace != nullptr && compiled_ui != nullptr);
+	if (!compiled_trace || !compiled_ui) return;
+	// the passes after the first use of the acquired image wait for it
+	CHECK(compiled_trace->batch == 0);
+	CHECK(compiled_ui->batch == 1);
+
+	const GraphBarrier* to_storage = findBarrier(compiled_trace->barriers, scene);
+	CHECK(to_storage != nullptr);
+	if (to_storage) {
+		CHECK(to_storage->old_layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		CHECK(to_storage->new_layout == VK_IMAGE_LAYOUT_GENERAL);
+	}
+	// UNDEFINED to attachment, after the wait of the acquire semaphore
+	const GraphBarrier* acquire = findBarrier(compiled_ui->barriers, swapchain);
+	CHECK(acquire != nullptr);
+	if (acquire) {
+		CHECK(acquire->old_layout == VK_IMAGE_LAYOUT_UNDEFINED);
+		CHECK(acquire->new_layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+		CHECK(acquire->src_stage == VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+	}
+	CHECK(graph.getFirstUseStages(swapchain) == VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+
+	// the swapchain image is presented, the scene image is already in its final layout
+	const GraphBarrier* present = findBarrier(compiled_ui->final_barriers, swapchain);
+	CHECK(present != nullptr);
+	if (present) {
+		CHECK(present->old_layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+		CHECK(present->new_layout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+		CHECK(present->src_access == VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+		CHECK(present->dst_stage == VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+	}
+	CHECK(findBarrier(compiled_ui->final_barriers, scene) == nullptr);
+	CHECK(compiled_trace->final_barriers.empty());
+}
+
+TEST(RenderGraph, TwoLayoutsInOnePassThrow)
+{
+	RenderGraph graph;
+	uint32_t out = importOutput(graph);
+	uint32_t pass = graph.addPass("feedback", noRecord);
+	graph.read(pass, out, RG_SAMPLED_FRAGMENT);
+	graph.write(pass, out, RG_COLOR_ATTACHMENT);
+	bool thrown = false;
+	try {
+		graph.compile();
+	}
+	catch (const std::runtime_error&) {
+		thrown = true;
+	}
+	CHECK(thrown);
+}
+
+// p0 writes a, p1 a -> b, p2 b -> c, p3 c -> out: a and c don't overlap
+static void chainGraph(RenderGraph& graph, uint32_t& a, uint32_t& b, uint32_t& c, GraphImageDesc c_desc)
+{
+	uint32_t out = importOutput(graph);
+	a = graph.createImage("a", COLOR_DESC);
+	b = graph.createImage("b", COLOR_DESC);
+	c = graph.createImage("c", c_desc);
+	RenderGraphAccess c_access = c_desc.aspect == VK_IMAGE_ASPECT_DEPTH_BIT ? RG_DEPTH_ATTACHMENT : RG_COLOR_ATTACHMENT;
+	uint32_t p0 = graph.addPass("p0", noRecord);
+	graph.write(p0, a, RG_COLOR_ATTACHMENT);
+	uint32_t p1 = graph.addPass("p1", noRecord);
+	graph.read(p1, a, RG_SAMPLED_FRAGMENT);
+	graph.write(p1, b, RG_COLOR_ATTACHMENT);
+	uint32_t p2 = graph.addPass("p2", noRecord);
+	graph.read(p2, b, RG_SAMPLED_FRAGMENT);
+	graph.write(p2, c, c_access);
+	uint32_t p3 = graph.addPass("p3", noRecord);
+	graph.read(p3, c, RG_SAMPLED_FRAGMENT);
+	graph.write(p3, out, RG_STORAGE_RAY_TRACING);
+}
+
+TEST(RenderGraph, DisjointTransientsShareASlot)
+{
+	RenderGraph graph;
+	uint32_t a, b, c;
+	chainGraph(graph, a, b, c, COLOR_DESC);
+	graph.compile();
+
+	CHECK(graph.getTransients().size() == 3);
+	CHECK(graph.countSlots() == 2);
+	const TransientImage* ta = findTransient(graph, a);
+	const TransientImage* tb = findTransient(graph, b);
+	const TransientImage* tc = findTransient(graph, c);
+	CHECK(ta && tb && tc);
+	if (!ta || !tb || !tc) return;
+	CHECK(ta->first_use == 0 && ta->last_use == 1);
+	CHECK(tc->first_use == 2 && tc->last_use == 3);
+	CHECK(ta->slot == tc->slot);
+	CHECK(ta->slot != tb->slot);
+	CHECK(!ta->lazy && !tb->lazy && !tc->lazy);
+	CHECK(ta->usage == (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT));
+
+	// c takes over the memory once the reads of a are done
+	const GraphBarrier* alias = findBarrier(findCompiled(graph, 2)->barriers, c);
+	CHECK(alias != nullptr);
+	if (alias) {
+		CHECK(alias->old_layout == VK_IMAGE_LAYOUT_UNDEFINED);
+		CHECK(alias->src_stage == (VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT));
+		CHECK(alias->src_access == VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+	}
+	// a is the first of the slot: it waits for c, the last one of the previous frame
+	const GraphBarrier* first = findBarrier(findCompiled(graph, 0)->barriers, a);
+	CHECK(first != nullptr);
+	if (first) CHECK(first->src_stage == (VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT));
+}
+
+TEST(RenderGraph, DifferentAspectsDontShareASlot)
+{
+	RenderGraph graph;
+	uint32_t a, b, c;
+	chainGraph(graph, a, b, c, DEPTH_DESC);
+	graph.compile();
+
+	CHECK(graph.countSlots() == 3);
+	const TransientImage* ta = findTransient(graph, a);
+	const TransientImage* tc = findTransient(graph, c);
+	CHECK(ta && tc);
+	if (ta && tc) CHECK(ta->slot != tc->slot);
+}
+
+TEST(RenderGraph, LazyAttachmentsGetTheirOwnSlot)
+{
+	RenderGraph graph;
+	uint32_t out = importOutput(graph);
+	uint32_t depth0 = graph.createImage("depth0", DEPTH_DESC);
+	uint32_t depth1 = graph.createImage("depth1", DEPTH_DESC);
+	uint32_t color = graph.createImage("color", COLOR_DESC);
+	uint32_t p0 = graph.addPass("p0", noRecord);
+	graph.write(p0, color, RG_COLOR_ATTACHMENT);
+	graph.write(p0, depth0, RG_DEPTH_ATTACHMENT);
+	uint32_t p1 = graph.addPass("p1", noRecord);
+	graph.read(p1, color, RG_SAMPLED_FRAGMENT);
+	graph.write(p1, out, RG_COLOR_ATTACHMENT);
+	graph.write(p1, depth1, RG_DEPTH_ATTACHMENT);
+	graph.compile(true);
+
+	const TransientImage* t0 = findTransient(graph, depth0);
+	const TransientImage* t1 = findTransient(graph, depth1);
+	const TransientImage* tc = findTransient(graph, color);
+	CHECK(t0 && t1 && tc);
+	if (!t0 || !t1 || !tc) return;
+	// never stored: lazily allocated, even with disjoint lifetimes no memory to share
+	CHECK(t0->lazy && t1->lazy);
+	CHECK(t0->slot != t1->slot);
+	CHECK((t0->usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) != 0);
+	// sampled after it is written: real memory
+	CHECK(!tc->lazy);
+	CHECK((tc->usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) == 0);
+	CHECK(graph.countSlots() == 3);
+
+	// without lazy memory the two depth buffers alias
+	graph.compile(false);
+	t0 = findTransient(graph, depth0);
+	t1 = findTransient(graph, depth1);
+	CHECK(t0 && t1);
+	if (t0 && t1) CHECK(!t0->lazy && t0->slot == t1->slot);
+	CHECK(graph.countSlots() == 2);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cmath>
+
+/*
+* Minimal test registry for the device-free parts of the engine.
+* TEST(suite, name) registers a test, CHECK and CHECK_NEAR record a failure and let the test go on,
+* so a run reports every broken assertion instead of the first one.
+*/
+namespace tests
+{
+	typedef void(*TestFunction)();
+
+	struct TestCase {
+		std::string suite;
+		std::string name;
+		TestFunction run;
+	};
+
+	std::vector<TestCase>& registry();
+	void fail(const char* file, int line, const std::string& what);
+	// folder with the reference data, --data on the command line
+	const std::string& dataDir();
+	// --update-golden: tests comparing with a reference rewrite it instead
+	bool updateGolden();
+
+	struct Registrar {
+		Registrar(const char* suite, const char* name, TestFunction run) { registry().push_back({ suite, name, run }); }
+	};
+}
+
+#define TEST(suite, name) \
+	static void suite##_##name(); \
+	static tests::Registrar suite##_##name##_registrar(#suite, #name, suite##_##name); \
+	static void suite##_##name()
+
+#define CHECK(condition) \
+	do { if (!(condition)) tests::fail(__FILE__, __LINE__, #condition); } while (0)
+
+#define CHECK_NEAR(value, expected, tolerance) \
+	do { \
+		double check_value = (value), check_expected = (expected); \
+		if (!(std::abs(check_value - check_expected) <= (tolerance))) { \
+			std::ostringstream check_message; \
+			check_message << #value << " = " << check_value << ", expected " << check_expected << " +- " << (tolerance); \
+			tests::fail(__FILE__, __LINE__, check_message.str()); \
+		} \
+	} while (0)
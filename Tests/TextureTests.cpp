@@ -0,0 +1,71 @@
+#include "TestFramework.h"
+#include "..\\VkEngine\commons.h"
+#include "..\\VkEngine\Texture.h"
+
+/*
+* hasOnlyOpaqueTexels decides if a texture can skip the any-hit shader: a single texel
+* with alpha below 255 has to be found wherever it is, and nothing past the last texel may be read.
+*/
+
+static std::vector<unsigned char> opaquePixels(size_t pixel_count)
+{
+	std::vector<unsigned char> pixels(pixel_count * 4);
+	for (size_t i = 0; i < pixel_count; i++) {
+		pixels[4 * i + 0] = (unsigned char)(i * 7);
+		pixels[4 * i + 1] = (unsigned char)(i * 13);
+		pixels[4 * i + 2] = (unsigned char)(i * 29);
+		pixels[4 * i + 3] = 255;
+	}
+	return pixels;
+}
+
+TEST(Texture, AllOpaqueTexels)
+{
+	for (size_t pixel_count : { 1, 64, 4096 }) {
+		std::vector<unsigned char> pixels = opaquePixels(pixel_count);
+		CHECK(BaseTexture::hasOnlyOpaqueTexels(pixels.data(), pixel_count));
+	}
+}
+
+TEST(Texture, OneTranslucentTexel)
+{
+	const size_t pixel_count = 256;
+	// first, last and a few in between
+	for (size_t translucent : { (size_t)0, (size_t)1, (size_t)100, pixel_count - 1 }) {
+		std::vector<unsigned char> pixels = opaquePixels(pixel_count);
+		pixels[4 * translucent + 3] = 254;
+		CHECK(!BaseTexture::hasOnlyOpaqueTexels(pixels.data(), pixel_count));
+	}
+}
+
+TEST(Texture, ColorChannelsAreIgnored)
+{
+	std::vector<unsigned char> pixels = opaquePixels(16);
+	for (size_t i = 0; i < 16; i++) {
+		pixels[4 * i + 0] = pixels[4 * i + 1] = pixels[4 * i + 2] = 0;
+	}
+	CHECK(BaseTexture::hasOnlyOpaqueTexels(pixels.data(), 16));
+}
+
+TEST(Texture, EmptyImageIsOpaque)
+{
+	CHECK(BaseTexture::hasOnlyOpaqueTexels(nullptr, 0));
+	std::vector<unsigned char> pixels = opaquePixels(1);
+	pixels[3] = 0;
+	CHECK(BaseTexture::hasOnlyOpaqueTexels(pixels.data(), 0));
+}
+
+TEST(Texture, OddSizes)
+{
+	// sizes that are not a multiple of any vector width, the texel after the image is translucent
+	for (int width : { 1, 3, 7, 17, 33 }) {
+		for (int height : { 1, 5, 9 }) {
+			size_t pixel_count = (size_t)width * height;
+			std::vector<unsigned char> pixels = opaquePixels(pixel_count + 1);
+			pixels[4 * pixel_count + 3] = 0;
+			CHECK(BaseTexture::hasOnlyOpaqueTexels(pixels.data(), pixel_count));
+			pixels[4 * (pixel_count - 1) + 3] = 254;
+			CHECK(!BaseTexture::hasOnlyOpaqueTexels(pixels.data(), pixel_count));
+		}
+	}
+}
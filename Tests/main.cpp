@@ -0,0 +1,73 @@
+#include "TestFramework.h"
+#include <iostream>
+#include <chrono>
+
+/*
+* Runs the tests whose "suite.name" contains the filter, every test without one.
+* The exit code is the number of failed tests.
+*/
+
+static unsigned current_failures = 0;
+static std::string data_dir = "Tests/Data/";
+static bool update_golden = false;
+
+std::vector<tests::TestCase>& tests::registry()
+{
+	static std::vector<TestCase> cases;
+	return cases;
+}
+
+void tests::fail(const char* file, int line, const std::string& what)
+{
+	current_failures++;
+	std::cout << "  " << file << "(" << line << "): " << what << std::endl;
+}
+
+const std::string& tests::dataDir()
+{
+	return data_dir;
+}
+
+bool tests::updateGolden()
+{
+	return update_golden;
+}
+
+int main(int argc, char** argv)
+{
+	std::string filter;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--data" && i + 1 < argc) {
+			data_dir = argv[++i];
+			if (!data_dir.empty() && data_dir.back() != '/' && data_dir.back() != '\\') data_dir += '/';
+		}
+		else if (arg == "--update-golden") update_golden = true;
+		else if (arg == "--help" || arg == "-h") {
+			std::cout << "Tests [filter] [--data dir] [--update-golden]" << std::endl;
+			return 0;
+		}
+		else filter = arg;
+	}
+
+	int failed = 0, run = 0;
+	for (auto& test : tests::registry()) {
+		std::string full_name = test.suite + "." + test.name;
+		if (!filter.empty() && full_name.find(filter) == std::string::npos) continue;
+		std::cout << "[ RUN  ] " << full_name << std::endl;
+		current_failures = 0;
+		auto start = std::chrono::high_resolution_clock::now();
+		try {
+			test.run();
+		}
+		catch (const std::exception& e) {
+			tests::fail(__FILE__, __LINE__, std::string("exception: ") + e.what());
+		}
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << (current_failures ? "[ FAIL ] " : "[  OK  ] ") << full_name << " (" << ms << " ms)" << std::endl;
+		if (current_failures) failed++;
+		run++;
+	}
+	std::cout << run - failed << "/" << run << " tests passed" << std::endl;
+	return failed;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <cmath>
+
+namespace vkengine
+{
+	struct AABB {
+		glm::vec3 min;
+		glm::vec3 max;
+
+		inline glm::vec3 center() const { return (min + max) * 0.5f; }
+		inline glm::vec3 halfExtent() const { return (max - min) * 0.5f; }
+		/*
+		* Box containing this box after the transformation M (Arvo's method):
+		* the new half extent is |M| * old half extent.
+		*/
+		inline AABB transformed(const glm::mat4& M) const
+		{
+			glm::vec3 c = glm::vec3(M * glm::vec4(center(), 1.f));
+			glm::mat3 abs_M = glm::mat3(M);
+			for (int col = 0; col < 3; col++)
+				abs_M[col] = glm::abs(abs_M[col]);
+			glm::vec3 e = abs_M * halfExtent();
+			return { c - e, c + e };
+		}
+	};
+
+	struct BoundingSphere {
+		glm::vec3 center;
+		float radius;
+
+		// Only valid for matrices with uniform scale (the only kind Object3D produces)
+		inline BoundingSphere transformed(const glm::mat4& M, float uniform_scale) const
+		{
+			return { glm::vec3(M * glm::vec4(center, 1.f)), radius * std::abs(uniform_scale) };
+		}
+	};
+}
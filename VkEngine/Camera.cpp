@@ -66,7 +66,8 @@ mat4 Camera::setCamera()
 {
 	this->manageMotion(vkengine::unified_delta_time);
 	glm::mat4 V = lookAt(view.position,view.target,view.upVector);
-	this->frustum.update(this->getProjection() * V );
+	this->view_projection = this->getProjection() * V;
+	this->frustum.update(this->view_projection);
 	return V;
 }
 
@@ -80,6 +81,25 @@ bool vkengine::Camera::checkFrustum(glm::vec3 pos, float radius)
 	return this->frustum.checkSphere(pos, radius);
 }
 
+bool vkengine::Camera::checkFrustum(const AABB& box)
+{
+	glm::vec3 c = box.center();
+	glm::vec3 e = box.halfExtent();
+	for (auto& plane : this->frustum.planes)
+	{	// projected radius of the box on the plane normal
+		float r = e.x * std::abs(plane.x) + e.y * std::abs(plane.y) + e.z * std::abs(plane.z);
+		if (plane.x * c.x + plane.y * c.y + plane.z * c.z + plane.w <= -r) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool vkengine::Camera::checkFrustum(const BoundingSphere& sphere, const AABB& box)
+{
+	return this->frustum.checkSphere(sphere.center, sphere.radius) && checkFrustum(box);
+}
+
 void Camera::updateAspectRatio(float width, float height)
 {
 	this->projection.aspect = width / height;
@@ -1,5 +1,6 @@
 #pragma once
 #include "SceneElement.h"
+#include "BoundingVolumes.h"
 #include "Libraries/frustum.hpp"
 
 namespace vkengine
@@ -36,7 +37,12 @@ namespace vkengine
 		void rotate_FPS_style(glm::vec2 delta);
 		glm::mat4 setCamera();
 		glm::mat4 getProjection();
+		// projection * view of the last setCamera() call
+		inline glm::mat4 getViewProjection() { return view_projection; };
 		bool checkFrustum(glm::vec3 pos, float radius);
+		bool checkFrustum(const AABB& box);
+		// sphere test first (cheap), the box refines it for elongated meshes
+		bool checkFrustum(const BoundingSphere& sphere, const AABB& box);
 		void updateAspectRatio(float width, float height);
 		void moveCameraForeward();
 		void moveCameraLeft();
@@ -58,6 +64,7 @@ namespace vkengine
 		PerspectiveSetup projection;
 		ViewSetup view;
 		vks::Frustum frustum;
+		glm::mat4 view_projection = glm::mat4(1.f);
 		bool foreward = false, back = false, left = false, right = false;
 		bool wasd_movement_mutex = false;
 		float camera_speed;
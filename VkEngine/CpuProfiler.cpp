@@ -0,0 +1,120 @@
+#include "CpuProfiler.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> CpuProfiler::recording = false;
+
+namespace {
+	struct CpuProfileEvent {
+		const char* name;
+		uint64_t begin_ns;
+		uint64_t end_ns;
+	};
+
+	// written only by its thread, the exporter reads up to the published head
+	struct ThreadEvents {
+		uint32_t id;
+		const char* name = nullptr;
+		std::atomic<uint64_t> head = 0;
+		std::vector<CpuProfileEvent> ring = std::vector<CpuProfileEvent>(CpuProfiler::RING_SIZE);
+	};
+
+	std::mutex threads_mutex;
+	// never freed: a worker that exits leaves its events for the export
+	std::vector<std::unique_ptr<ThreadEvents>> threads;
+	thread_local ThreadEvents* this_thread_events = nullptr;
+
+	ThreadEvents* threadEvents()
+	{
+		if (this_thread_events == nullptr) {
+			std::lock_guard<std::mutex> lock(threads_mutex);
+			threads.push_back(std::make_unique<ThreadEvents>());
+			threads.back()->id = (uint32_t)threads.size();
+			this_thread_events = threads.back().get();
+		}
+		return this_thread_events;
+	}
+
+	void writeJsonString(std::ofstream& out, const char* text)
+	{
+		out << '"';
+		for (const char* c = text; *c; c++) {
+			if (*c == '"' || *c == '\\') out << '\\';
+			if ((unsigned char)*c >= 0x20) out << *c;
+		}
+		out << '"';
+	}
+}
+
+void CpuProfiler::setRecording(bool flag)
+{
+	recording.store(flag);
+}
+
+void CpuProfiler::setThreadName(const char* name)
+{
+	threadEvents()->name = name;
+}
+
+void CpuProfiler::record(const char* name, uint64_t begin_ns, uint64_t end_ns)
+{
+	ThreadEvents* events = threadEvents();
+	uint64_t head = events->head.load(std::memory_order_relaxed);
+	events->ring[head % RING_SIZE] = { name, begin_ns, end_ns };
+	events->head.store(head + 1, std::memory_order_release);
+}
+
+bool CpuProfiler::exportChromeTrace(const std::string& file)
+{
+	std::ofstream out(file, std::ios::trunc);
+	if (!out) return false;
+	std::lock_guard<std::mutex> lock(threads_mutex);
+	// the window of each ring up to the head loaded once, both passes work on these copies
+	std::vector<std::vector<CpuProfileEvent>> copies(threads.size());
+	for (size_t t = 0; t < threads.size(); t++) {
+		ThreadEvents& thread = *threads[t];
+		uint64_t head = thread.head.load(std::memory_order_acquire);
+		uint64_t first = head > RING_SIZE ? head - RING_SIZE : 0;
+		for (uint64_t i = first; i < head; i++) {
+			copies[t].push_back(thread.ring[i % RING_SIZE]);
+		}
+		// the thread kept recording: the slots it reached meanwhile (and the one it may be writing) are torn
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t new_head = thread.head.load(std::memory_order_relaxed);
+		if (new_head + 1 > first + RING_SIZE) {
+			size_t torn = (size_t)std::min<uint64_t>(new_head + 1 - RING_SIZE - first, copies[t].size());
+			copies[t].erase(copies[t].begin(), copies[t].begin() + torn);
+		}
+	}
+	// timestamps in microseconds from the first event
+	uint64_t origin = UINT64_MAX;
+	for (auto& events : copies) {
+		for (auto& event : events) {
+			origin = std::min(origin, event.begin_ns);
+		}
+	}
+	// nanosecond digits even hours into the run
+	out << std::fixed << std::setprecision(3);
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	for (size_t t = 0; t < threads.size(); t++) {
+		ThreadEvents* thread = threads[t].get();
+		out << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->id << ",\"args\":{\"name\":";
+		writeJsonString(out, thread->name ? thread->name : ("thread " + std::to_string(thread->id)).c_str());
+		out << "}}";
+		first = false;
+		for (const CpuProfileEvent& event : copies[t]) {
+			out << ",\n{\"name\":";
+			writeJsonString(out, event.name);
+			out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->id
+				<< ",\"ts\":" << (int64_t)(event.begin_ns - origin) / 1000.0
+				<< ",\"dur\":" << (event.end_ns - event.begin_ns) / 1000.0 << "}";
+		}
+	}
+	out << "\n]}\n";
+	return (bool)out;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/*
+* Scoped CPU profiler: PROFILE_SCOPE("name") records the time spent until the end of the enclosing scope.
+* Every thread writes to its own ring buffer, nothing is shared while recording: the buffer is created
+* (under a lock) the first time the thread records, after that a scope costs two clock reads and a store.
+* The oldest events are overwritten once a buffer is full.
+* The markers compile to nothing unless DEBUG or VKENGINE_PROFILING is defined.
+* Names are kept by pointer: literals, or strings that live as long as the program.
+*/
+#if defined(DEBUG) || defined(VKENGINE_PROFILING)
+#define VKENGINE_CPU_PROFILER
+#endif
+
+class CpuProfiler
+{
+public:
+	static constexpr size_t RING_SIZE = 1 << 16; // events kept per thread
+	static inline bool isRecording() { return recording.load(std::memory_order_relaxed); };
+	static void setRecording(bool flag);
+	// shown in the trace instead of the thread number, name has to outlive the program like the scope names
+	static void setThreadName(const char* name);
+	static inline uint64_t now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	};
+	static void record(const char* name, uint64_t begin_ns, uint64_t end_ns);
+	/*
+	* Chrome trace event JSON (chrome://tracing, Perfetto) with the events of every thread.
+	* Recording can go on: each ring is copied once, the events overwritten during the copy are dropped.
+	*/
+	static bool exportChromeTrace(const std::string& file);
+private:
+	static std::atomic<bool> recording;
+};
+
+class CpuProfileScope
+{
+public:
+	inline CpuProfileScope(const char* name) : name(name), begin(CpuProfiler::isRecording() ? CpuProfiler::now() : 0) {};
+	inline ~CpuProfileScope() { if (begin != 0) CpuProfiler::record(name, begin, CpuProfiler::now()); };
+private:
+	const char* name;
+	uint64_t begin;
+};
+
+#ifdef VKENGINE_CPU_PROFILER
+#define PROFILE_SCOPE_JOIN(a, b) a##b
+#define PROFILE_SCOPE_NAME(line) PROFILE_SCOPE_JOIN(profile_scope_, line)
+#define PROFILE_SCOPE(name) CpuProfileScope PROFILE_SCOPE_NAME(__LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_SCOPE(__FUNCTION__)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_FUNCTION()
+#endif
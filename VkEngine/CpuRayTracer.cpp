@@ -0,0 +1,729 @@
+#include "CpuRayTracer.h"
+#include "commons.h"
+#include "Libraries/stb_image.h"
+#include <atomic>
+#include <cfloat>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CPU_RT_SSE2
+#endif
+
+using namespace vkengine;
+
+// same constants as the shaders
+constexpr const float T_MIN = 0.001f;
+constexpr const float T_MAX = 10000.f;
+constexpr const float SUN_DISTANCE = 1000000.f;
+constexpr const float Kc = 1.f, Kl = 0.35f, Kq = 0.44f;
+static const glm::vec3 CLEAR_COLOR = { 0.f, 0.1f, 0.3f };
+// semi-transparent layers crossed by one ray at most (the GPU has no limit)
+constexpr const int MAX_CONTINUATIONS = 64;
+constexpr const int BVH_STACK_SIZE = 256;
+
+static inline AABB emptyBox()
+{
+	return { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+}
+
+static inline void grow(AABB& box, const AABB& other)
+{
+	box.min = glm::min(box.min, other.min);
+	box.max = glm::max(box.max, other.max);
+}
+
+static inline float surfaceArea(const AABB& box)
+{
+	glm::vec3 d = box.max - box.min;
+	if (d.x < 0.f || d.y < 0.f || d.z < 0.f) return 0.f;
+	return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static inline bool intersectBox(const AABB& box, glm::vec3 origin, glm::vec3 inv_direction, float t_min, float t_max)
+{
+	glm::vec3 t0 = (box.min - origin) * inv_direction;
+	glm::vec3 t1 = (box.max - origin) * inv_direction;
+	glm::vec3 t_lo = glm::min(t0, t1), t_hi = glm::max(t0, t1);
+	float t_near = std::max(std::max(t_lo.x, t_lo.y), std::max(t_lo.z, t_min));
+	float t_far = std::min(std::min(t_hi.x, t_hi.y), std::min(t_hi.z, t_max));
+	return t_near <= t_far;
+}
+
+/////// IMAGES
+
+glm::vec4 CpuImage::sample(glm::vec2 uv) const
+{
+	if (width == 0 || height == 0) return glm::vec4(1.f);
+	// texel centers at half integers, like VK_FILTER_LINEAR
+	float x = uv.x * width - 0.5f, y = uv.y * height - 0.5f;
+	float fx = std::floor(x), fy = std::floor(y);
+	int x0 = (int)fx, y0 = (int)fy;
+	auto texel = [this](int tx, int ty) {
+		tx = ((tx % width) + width) % width;
+		ty = ((ty % height) + height) % height;
+		const unsigned char* p = &rgba[(ty * width + tx) * 4];
+		return glm::vec4(p[0], p[1], p[2], p[3]) / 255.f;
+	};
+	return glm::mix(
+		glm::mix(texel(x0, y0), texel(x0 + 1, y0), x - fx),
+		glm::mix(texel(x0, y0 + 1), texel(x0 + 1, y0 + 1), x - fx), y - fy);
+}
+
+void CpuImage::writePPM(const std::string& file) const
+{
+	std::ofstream out(file, std::ios::binary);
+	if (!out) throw std::runtime_error("failed to write image: " + file);
+	out << "P6\n" << width << " " << height << "\n255\n";
+	std::vector<unsigned char> rgb(width * height * 3);
+	for (int i = 0; i < width * height; i++) {
+		memcpy(&rgb[i * 3], &rgba[i * 4], 3);
+	}
+	out.write((const char*)rgb.data(), rgb.size());
+}
+
+CpuImage CpuImage::readPPM(const std::string& file)
+{
+	std::ifstream in(file, std::ios::binary);
+	std::string magic;
+	int max_value;
+	CpuImage image;
+	in >> magic >> image.width >> image.height >> max_value;
+	if (!in || magic != "P6" || max_value != 255) throw std::runtime_error("not a binary 8 bit PPM: " + file);
+	in.get(); // the single whitespace before the data
+	std::vector<unsigned char> rgb(image.width * image.height * 3);
+	in.read((char*)rgb.data(), rgb.size());
+	image.rgba.resize(image.width * image.height * 4);
+	for (int i = 0; i < image.width * image.height; i++) {
+		memcpy(&image.rgba[i * 4], &rgb[i * 3], 3);
+		image.rgba[i * 4 + 3] = 255;
+	}
+	return image;
+}
+
+CpuImage CpuImage::load(const std::string& file)
+{
+	CpuImage image;
+	int channels;
+	unsigned char* pixels = stbi_load(file.c_str(), &image.width, &image.height, &channels, STBI_rgb_alpha);
+	if (!pixels) {
+		throw std::runtime_error("failed to load texture image: " + file);
+	}
+	image.rgba.assign(pixels, pixels + image.width * image.height * 4);
+	stbi_image_free(pixels);
+	return image;
+}
+
+float CpuImage::compare(const CpuImage& a, const CpuImage& b)
+{
+	if (a.width != b.width || a.height != b.height) return -1.f;
+	double sum = 0.0;
+	// alpha is not compared: PPM files don't have it
+	for (size_t i = 0; i < a.rgba.size(); i++) {
+		if (i % 4 == 3) continue;
+		double d = (double)a.rgba[i] - (double)b.rgba[i];
+		sum += d * d;
+	}
+	return (float)std::sqrt(sum / std::max<size_t>(1, a.rgba.size() / 4 * 3));
+}
+
+/////// MESH BVH
+
+MeshBVH::MeshBVH(const std::vector<Vertex3D>& vertices, const std::vector<uint32_t>& indices)
+	: vertices(vertices), indices(indices)
+{
+	uint32_t count = (uint32_t)(indices.size() / 3);
+	order.resize(count);
+	tri_bounds.resize(count);
+	centroids.resize(count);
+	bounds = emptyBox();
+	for (uint32_t i = 0; i < count; i++) {
+		glm::vec3 a = vertices[indices[3 * i + 0]].pos;
+		glm::vec3 b = vertices[indices[3 * i + 1]].pos;
+		glm::vec3 c = vertices[indices[3 * i + 2]].pos;
+		tri_bounds[i] = { glm::min(a, glm::min(b, c)), glm::max(a, glm::max(b, c)) };
+		centroids[i] = tri_bounds[i].center();
+		order[i] = i;
+		grow(bounds, tri_bounds[i]);
+	}
+	if (count == 0) {
+		bounds = { glm::vec3(0.f), glm::vec3(0.f) };
+		return;
+	}
+	buildNode({ 0, count, bounds });
+	// triangles in leaf order, so a leaf is a contiguous range
+	triangles.reserve(count);
+	for (auto primitive : order) {
+		glm::vec3 a = vertices[indices[3 * primitive + 0]].pos;
+		glm::vec3 b = vertices[indices[3 * primitive + 1]].pos;
+		glm::vec3 c = vertices[indices[3 * primitive + 2]].pos;
+		triangles.push_back({ a, b - a, c - a, primitive });
+	}
+	std::vector<uint32_t>().swap(order);
+	std::vector<AABB>().swap(tri_bounds);
+	std::vector<glm::vec3>().swap(centroids);
+}
+
+/*
+* Binned SAH on the axis where the centroids spread the most.
+* Returns false if the range has to stay a leaf.
+*/
+bool MeshBVH::split(const BuildRange& range, BuildRange& left, BuildRange& right)
+{
+	if (range.count <= MAX_LEAF_TRIANGLES) return false;
+	AABB centroid_box = emptyBox();
+	for (uint32_t k = range.first; k < range.first + range.count; k++) {
+		grow(centroid_box, { centroids[order[k]], centroids[order[k]] });
+	}
+	glm::vec3 extent = centroid_box.max - centroid_box.min;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	auto first = order.begin() + range.first, last = first + range.count;
+	decltype(first) middle;
+	if (extent[axis] <= 0.f) {
+		// all the centroids in one point: no plane separates them, halves keep the leaves small
+		middle = first + range.count / 2;
+	}
+	else {
+		struct Bin { AABB box; uint32_t count; };
+		Bin bins[SAH_BINS];
+		for (auto& bin : bins) bin = { emptyBox(), 0 };
+		float scale = SAH_BINS / extent[axis];
+		auto binOf = [&](uint32_t primitive) {
+			return std::min(SAH_BINS - 1, (int)((centroids[primitive][axis] - centroid_box.min[axis]) * scale));
+		};
+		for (auto it = first; it != last; it++) {
+			Bin& bin = bins[binOf(*it)];
+			bin.count++;
+			grow(bin.box, tri_bounds[*it]);
+		}
+		// cost of the plane after bin i: area * count of both sides
+		float left_area[SAH_BINS - 1];
+		uint32_t left_count[SAH_BINS - 1];
+		AABB acc = emptyBox();
+		uint32_t n = 0;
+		for (int i = 0; i < SAH_BINS - 1; i++) {
+			grow(acc, bins[i].box);
+			n += bins[i].count;
+			left_area[i] = surfaceArea(acc);
+			left_count[i] = n;
+		}
+		acc = emptyBox();
+		n = 0;
+		float best_cost = FLT_MAX;
+		int best_plane = -1;
+		for (int i = SAH_BINS - 1; i > 0; i--) {
+			grow(acc, bins[i].box);
+			n += bins[i].count;
+			float cost = left_area[i - 1] * left_count[i - 1] + surfaceArea(acc) * n;
+			if (left_count[i - 1] > 0 && n > 0 && cost < best_cost) {
+				best_cost = cost;
+				best_plane = i - 1;
+			}
+		}
+		if (best_plane < 0) middle = first + range.count / 2;
+		else middle = std::partition(first, last, [&](uint32_t primitive) { return binOf(primitive) <= best_plane; });
+	}
+	left = { range.first, (uint32_t)(middle - first), emptyBox() };
+	right = { left.first + left.count, range.count - left.count, emptyBox() };
+	for (auto it = first; it != middle; it++) grow(left.bounds, tri_bounds[*it]);
+	for (auto it = middle; it != last; it++) grow(right.bounds, tri_bounds[*it]);
+	return true;
+}
+
+int32_t MeshBVH::buildNode(const BuildRange& range)
+{
+	// up to 4 children: the biggest range that can still be split is split again
+	BuildRange children[4] = { range };
+	bool leaf[4] = {};
+	int n = 1;
+	while (n < 4) {
+		int pick = -1;
+		float pick_area = -1.f;
+		for (int i = 0; i < n; i++) {
+			if (!leaf[i] && children[i].count > MAX_LEAF_TRIANGLES && surfaceArea(children[i].bounds) > pick_area) {
+				pick = i;
+				pick_area = surfaceArea(children[i].bounds);
+			}
+		}
+		if (pick < 0) break;
+		BuildRange left, right;
+		if (!split(children[pick], left, right)) {
+			leaf[pick] = true;
+			continue;
+		}
+		children[pick] = left;
+		children[n++] = right;
+	}
+
+	Node4 node;
+	for (int i = 0; i < 4; i++) {
+		// empty slots never pass the box test
+		node.min_x[i] = node.min_y[i] = node.min_z[i] = FLT_MAX;
+		node.max_x[i] = node.max_y[i] = node.max_z[i] = -FLT_MAX;
+		node.child[i] = -1;
+		node.count[i] = 0;
+	}
+	int32_t index = (int32_t)nodes.size();
+	nodes.push_back(node);
+	for (int i = 0; i < n; i++) {
+		const AABB& box = children[i].bounds;
+		node.min_x[i] = box.min.x; node.min_y[i] = box.min.y; node.min_z[i] = box.min.z;
+		node.max_x[i] = box.max.x; node.max_y[i] = box.max.y; node.max_z[i] = box.max.z;
+		if (leaf[i] || children[i].count <= MAX_LEAF_TRIANGLES) {
+			node.child[i] = (int32_t)children[i].first;
+			node.count[i] = children[i].count;
+		}
+		else {
+			node.child[i] = buildNode(children[i]);
+		}
+	}
+	// the recursion could have moved the vector
+	nodes[index] = node;
+	return index;
+}
+
+template<typename Filter>
+bool MeshBVH::intersect(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max, Hit& hit, Filter filter) const
+{
+	if (nodes.empty()) return false;
+	glm::vec3 inv_direction = 1.f / direction;
+	bool found = false;
+	int32_t stack[BVH_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+#ifdef CPU_RT_SSE2
+	const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+	const __m128 ix = _mm_set1_ps(inv_direction.x), iy = _mm_set1_ps(inv_direction.y), iz = _mm_set1_ps(inv_direction.z);
+#endif
+	while (stack_size > 0) {
+		const Node4& node = nodes[stack[--stack_size]];
+		float t_near[4];
+		int hit_mask = 0;
+#ifdef CPU_RT_SSE2
+		// slab test of the 4 children at once
+		__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.min_x), ox), ix);
+		__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.max_x), ox), ix);
+		__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.min_y), oy), iy);
+		__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.max_y), oy), iy);
+		__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.min_z), oz), iz);
+		__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.max_z), oz), iz);
+		__m128 near_t = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)),
+			_mm_max_ps(_mm_min_ps(t0z, t1z), _mm_set1_ps(t_min)));
+		__m128 far_t = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)),
+			_mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(t_max)));
+		hit_mask = _mm_movemask_ps(_mm_cmple_ps(near_t, far_t));
+		_mm_storeu_ps(t_near, near_t);
+#else
+		for (int i = 0; i < 4; i++) {
+			AABB box = { { node.min_x[i], node.min_y[i], node.min_z[i] }, { node.max_x[i], node.max_y[i], node.max_z[i] } };
+			glm::vec3 t0 = (box.min - origin) * inv_direction;
+			glm::vec3 t1 = (box.max - origin) * inv_direction;
+			glm::vec3 t_lo = glm::min(t0, t1), t_hi = glm::max(t0, t1);
+			t_near[i] = std::max(std::max(t_lo.x, t_lo.y), std::max(t_lo.z, t_min));
+			float t_far = std::min(std::min(t_hi.x, t_hi.y), std::min(t_hi.z, t_max));
+			if (t_near[i] <= t_far) hit_mask |= 1 << i;
+		}
+#endif
+		// nearest children first: leaves are tested right away, inner nodes are pushed farthest first
+		int sorted[4], hits = 0;
+		for (int i = 0; i < 4; i++) {
+			if (!(hit_mask & (1 << i)) || (node.child[i] < 0 && node.count[i] == 0)) continue;
+			int k = hits++;
+			while (k > 0 && t_near[sorted[k - 1]] > t_near[i]) { sorted[k] = sorted[k - 1]; k--; }
+			sorted[k] = i;
+		}
+		int inner[4], inner_count = 0;
+		for (int s = 0; s < hits; s++) {
+			int i = sorted[s];
+			if (node.count[i] == 0) {
+				inner[inner_count++] = node.child[i];
+				continue;
+			}
+			if (t_near[i] > t_max) continue;
+			// Moller-Trumbore, both faces (the instances disable culling)
+			for (uint32_t k = node.child[i]; k < node.child[i] + node.count[i]; k++) {
+				const Triangle& tri = triangles[k];
+				glm::vec3 p = glm::cross(direction, tri.e2);
+				float det = glm::dot(tri.e1, p);
+				if (std::abs(det) < 1e-12f) continue;
+				float inv_det = 1.f / det;
+				glm::vec3 s_vec = origin - tri.v0;
+				float u = glm::dot(s_vec, p) * inv_det;
+				if (u < 0.f || u > 1.f) continue;
+				glm::vec3 q = glm::cross(s_vec, tri.e1);
+				float v = glm::dot(direction, q) * inv_det;
+				if (v < 0.f || u + v > 1.f) continue;
+				float t = glm::dot(tri.e2, q) * inv_det;
+				if (t < t_min || t > t_max) continue;
+				Hit candidate = { t, tri.primitive, u, v };
+				if (!filter(candidate)) continue;
+				hit = candidate;
+				t_max = t;
+				found = true;
+			}
+		}
+		for (int s = inner_count - 1; s >= 0; s--) {
+			stack[stack_size++] = inner[s];
+		}
+	}
+	return found;
+}
+
+/////// SCENE
+
+uint32_t CpuScene::addMesh(const std::vector<Vertex3D>& vertices, const std::vector<uint32_t>& indices)
+{
+	meshes.emplace_back(vertices, indices);
+	return (uint32_t)meshes.size() - 1;
+}
+
+uint32_t CpuScene::addTexture(const CpuImage& texture)
+{
+	textures.push_back(texture);
+	return (uint32_t)textures.size() - 1;
+}
+
+void CpuScene::addInstance(uint32_t mesh, uint32_t texture, const glm::mat4& transform, bool reflective)
+{
+	instances.push_back({ mesh, texture, transform, glm::inverse(transform), reflective,
+		meshes[mesh].getBounds().transformed(transform) });
+}
+
+void CpuScene::setCamera(const glm::mat4& view, const glm::mat4& projection)
+{
+	glm::mat4 P = projection;
+	P[1][1] *= -1; // invert openGL Y sign, like Renderer::updateUniforms
+	V_inverted = glm::inverse(view);
+	P_inverted = glm::inverse(P);
+}
+
+void CpuScene::commit()
+{
+	instance_nodes.clear();
+	instance_order.resize(instances.size());
+	std::iota(instance_order.begin(), instance_order.end(), 0);
+	if (!instances.empty()) buildInstanceNode(0, (uint32_t)instances.size());
+}
+
+// Median split: instances are few compared to triangles and the depth stays log2(n)
+uint32_t CpuScene::buildInstanceNode(uint32_t first, uint32_t count)
+{
+	uint32_t index = (uint32_t)instance_nodes.size();
+	instance_nodes.push_back({});
+	AABB box = emptyBox(), centers = emptyBox();
+	for (uint32_t k = first; k < first + count; k++) {
+		grow(box, instances[instance_order[k]].world_box);
+		glm::vec3 c = instances[instance_order[k]].world_box.center();
+		grow(centers, { c, c });
+	}
+	if (count <= 2) {
+		instance_nodes[index] = { box, first, count, 0 };
+		return index;
+	}
+	glm::vec3 extent = centers.max - centers.min;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	auto begin = instance_order.begin() + first;
+	std::nth_element(begin, begin + count / 2, begin + count, [&](uint32_t a, uint32_t b) {
+		return instances[a].world_box.center()[axis] < instances[b].world_box.center()[axis];
+	});
+	buildInstanceNode(first, count / 2);
+	uint32_t right = buildInstanceNode(first + count / 2, count - count / 2);
+	instance_nodes[index] = { box, 0, 0, right };
+	return index;
+}
+
+/////// TRACING
+
+struct SceneHit {
+	uint32_t instance;
+	MeshBVH::Hit hit;
+};
+
+// hitPayload of raycommon.glsl
+struct HitPayload {
+	uint32_t stop;
+	uint32_t depth;
+	glm::vec3 attenuation;
+	glm::vec3 rayOrigin;
+	glm::vec3 rayDir;
+	glm::vec4 hitValue;
+};
+
+static glm::vec4 albedoAt(const CpuScene& scene, const CpuInstance& object, const MeshBVH::Hit& hit, glm::vec3* barycentrics = nullptr)
+{
+	const MeshBVH& mesh = scene.meshes[object.mesh];
+	const auto& indices = mesh.getIndices();
+	const auto& vertices = mesh.getVertices();
+	glm::vec3 b = { 1.f - hit.u - hit.v, hit.u, hit.v };
+	if (barycentrics) *barycentrics = b;
+	glm::vec2 UV = vertices[indices[3 * hit.primitive + 0]].texCoord * b.x +
+		vertices[indices[3 * hit.primitive + 1]].texCoord * b.y +
+		vertices[indices[3 * hit.primitive + 2]].texCoord * b.z;
+	if (object.texture >= scene.textures.size()) return glm::vec4(1.f);
+	return scene.textures[object.texture].sample(UV);
+}
+
+/*
+* Instance BVH, then the mesh BVH in object space: the direction is not normalized
+* there, so t is the same in both spaces.
+*/
+template<typename Filter>
+static bool traceScene(const CpuScene& scene, glm::vec3 origin, glm::vec3 direction, float t_min, float t_max,
+	SceneHit& result, Filter filter)
+{
+	if (scene.instance_nodes.empty()) return false;
+	glm::vec3 inv_direction = 1.f / direction;
+	bool found = false;
+	uint32_t stack[BVH_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+	while (stack_size > 0) {
+		uint32_t index = stack[--stack_size];
+		const CpuScene::InstanceNode& node = scene.instance_nodes[index];
+		if (!intersectBox(node.box, origin, inv_direction, t_min, t_max)) continue;
+		if (node.count == 0) {
+			stack[stack_size++] = node.right;
+			stack[stack_size++] = index + 1;
+			continue;
+		}
+		for (uint32_t k = node.first; k < node.first + node.count; k++) {
+			uint32_t instance = scene.instance_order[k];
+			const CpuInstance& object = scene.instances[instance];
+			glm::vec3 object_origin = glm::vec3(object.inverse * glm::vec4(origin, 1.f));
+			glm::vec3 object_direction = glm::mat3(object.inverse) * direction;
+			MeshBVH::Hit hit;
+			if (scene.meshes[object.mesh].intersect(object_origin, object_direction, t_min, t_max, hit,
+				[&](const MeshBVH::Hit& candidate) { return filter(object, candidate); })) {
+				t_max = hit.t;
+				result = { instance, hit };
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+static glm::vec3 computeDiffuse(glm::vec3 matColor, const LightData& light, glm::vec3 lightDir, glm::vec3 normal)
+{
+	// Lambertian
+	float dotNL = std::max(glm::dot(normal, lightDir), 0.f);
+	return matColor * glm::vec3(light.color) * dotNL * light.power.w;
+}
+
+static glm::vec3 computeSpecular(const LightData& light, glm::vec3 viewDir, glm::vec3 lightDir, glm::vec3 normal)
+{
+	glm::vec3 V = glm::normalize(-viewDir);
+	glm::vec3 R = glm::reflect(-lightDir, normal);
+	float specular = std::pow(std::max(glm::dot(V, R), 0.f), 100.f);
+	return glm::vec3(light.color) * specular * light.power.w;
+}
+
+class PixelTracer
+{
+public:
+	PixelTracer(const CpuScene& scene) : scene(scene) {};
+	uint64_t rays = 0;
+
+	// raytrace.rgen
+	glm::vec4 tracePixel(glm::vec2 inUV, uint32_t max_reflections_depth)
+	{
+		glm::vec2 d = inUV * 2.f - 1.f;
+		glm::vec4 origin = scene.V_inverted * glm::vec4(0, 0, 0, 1);
+		glm::vec4 target = scene.P_inverted * glm::vec4(d.x, d.y, 1, 1);
+		glm::vec4 direction = scene.V_inverted * glm::vec4(glm::normalize(glm::vec3(target)), 0);
+
+		prd.hitValue = glm::vec4(0);
+		prd.depth = 0;
+		prd.stop = 1;
+		prd.rayOrigin = glm::vec3(origin);
+		prd.rayDir = glm::vec3(direction);
+		prd.attenuation = glm::vec3(1.f);
+		glm::vec4 finalHitValue = glm::vec4(0);
+		for (;;)
+		{
+			traceRay(glm::vec3(origin), glm::vec3(direction));
+			//Iterating through semi-trasparent objects
+			for (int i = 0; prd.hitValue.a < 1.f && prd.stop == 1 && i < MAX_CONTINUATIONS; i++) {
+				origin = glm::vec4(prd.rayOrigin, 1);
+				direction = glm::vec4(prd.rayDir, 0);
+				traceRay(glm::vec3(origin), glm::vec3(direction));
+			}
+			glm::vec3 blended = (glm::vec3(prd.hitValue) * prd.attenuation) * (1.f - finalHitValue.a)
+				+ glm::vec3(finalHitValue) * finalHitValue.a;
+			finalHitValue = glm::vec4(blended, finalHitValue.a + prd.hitValue.a);
+			prd.hitValue = glm::vec4(0);
+			prd.depth++;
+			if (prd.stop == 1 || prd.depth >= max_reflections_depth)
+				break;
+			origin = glm::vec4(prd.rayOrigin, 1);
+			direction = glm::vec4(prd.rayDir, 0);
+			prd.stop = 1; // Will stop if a reflective material isn't hit
+		}
+		return finalHitValue;
+	}
+private:
+	const CpuScene& scene;
+	HitPayload prd;
+
+	void traceRay(glm::vec3 origin, glm::vec3 direction)
+	{
+		rays++;
+		SceneHit hit;
+		// any hit of payload 0: fully transparent texels are ignored
+		bool found = traceScene(scene, origin, direction, T_MIN, T_MAX, hit,
+			[this](const CpuInstance& object, const MeshBVH::Hit& candidate) {
+				return albedoAt(scene, object, candidate).a > 0.f;
+			});
+		if (found) closestHit(origin, direction, hit);
+		else miss(direction);
+	}
+
+	// raytrace.rmiss
+	void miss(glm::vec3 direction)
+	{
+		glm::vec3 sky = CLEAR_COLOR;
+		if (scene.sky_faces.size() == 6) sky = glm::vec3(sampleSky(direction));
+		glm::vec3 blended = sky * (1.f - prd.hitValue.a) + glm::vec3(prd.hitValue) * prd.hitValue.a;
+		prd.hitValue = glm::vec4(blended, 1.f);
+	}
+
+	// face selection of the cube map lookup
+	glm::vec4 sampleSky(glm::vec3 r)
+	{
+		glm::vec3 a = glm::abs(r);
+		int face;
+		float sc, tc, ma;
+		if (a.x >= a.y && a.x >= a.z) { face = r.x > 0 ? 0 : 1; ma = a.x; sc = r.x > 0 ? -r.z : r.z; tc = -r.y; }
+		else if (a.y >= a.z) { face = r.y > 0 ? 2 : 3; ma = a.y; sc = r.x; tc = r.y > 0 ? r.z : -r.z; }
+		else { face = r.z > 0 ? 4 : 5; ma = a.z; sc = r.z > 0 ? r.x : -r.x; tc = -r.y; }
+		if (ma <= 0.f) return glm::vec4(CLEAR_COLOR, 1.f);
+		return scene.sky_faces[face].sample({ 0.5f * (sc / ma + 1.f), 0.5f * (tc / ma + 1.f) });
+	}
+
+	/*
+	* Shadow ray with the any hit of payload 1: every intersection adds its alpha.
+	* Opaque instances skip it on the GPU and count as fully occluding, the clamped sum is the same.
+	*/
+	float castShadowRay(glm::vec3 origin, glm::vec3 rayDir, float lightDistance)
+	{
+		rays++;
+		float shadow_alpha = 0.f;
+		SceneHit hit;
+		traceScene(scene, origin, rayDir, T_MIN, lightDistance, hit,
+			[&](const CpuInstance& object, const MeshBVH::Hit& candidate) {
+				shadow_alpha += albedoAt(scene, object, candidate).a;
+				return false;
+			});
+		return shadow_alpha;
+	}
+
+	// raytrace.rchit
+	void closestHit(glm::vec3 rayOrigin, glm::vec3 rayDirection, const SceneHit& hit)
+	{
+		const CpuInstance& object = scene.instances[hit.instance];
+		const MeshBVH& mesh = scene.meshes[object.mesh];
+		const auto& indices = mesh.getIndices();
+		const auto& vertices = mesh.getVertices();
+		const Vertex3D& v0 = vertices[indices[3 * hit.hit.primitive + 0]];
+		const Vertex3D& v1 = vertices[indices[3 * hit.hit.primitive + 1]];
+		const Vertex3D& v2 = vertices[indices[3 * hit.hit.primitive + 2]];
+		glm::vec3 barycentrics;
+		glm::vec4 albedo = albedoAt(scene, object, hit.hit, &barycentrics);
+
+		// Computing the normal at hit position
+		glm::vec3 normal = v0.normal * barycentrics.x + v1.normal * barycentrics.y + v2.normal * barycentrics.z;
+		normal = glm::normalize(glm::vec3(object.transform * glm::vec4(normal, 0.f)));
+		// Computing the coordinates of the hit position
+		glm::vec3 worldPos = v0.pos * barycentrics.x + v1.pos * barycentrics.y + v2.pos * barycentrics.z;
+		worldPos = glm::vec3(object.transform * glm::vec4(worldPos, 1.f));
+		glm::vec3 shadowOrigin = rayOrigin + rayDirection * hit.hit.t;
+
+		glm::vec3 ambient = glm::vec3(albedo) * 0.01f;
+		glm::vec3 color = glm::vec3(0);
+		//Global direcitonal light
+		glm::vec3 L = glm::normalize(glm::vec3(scene.global_light.position));
+		if (!object.reflective) {
+			color = computeDiffuse(glm::vec3(albedo), scene.global_light, L, normal);
+			if (glm::dot(normal, L) > 0) {
+				float shadow_alpha = castShadowRay(shadowOrigin, L, SUN_DISTANCE);
+				if (shadow_alpha > 0)
+					color *= 1 - glm::clamp(shadow_alpha, 0.f, 1.f);
+				else
+					color += computeSpecular(scene.global_light, rayDirection, L, normal);
+			}
+		}
+		// Point lights
+		for (const auto& light : scene.lights)
+		{
+			glm::vec3 lightVector = glm::vec3(light.position) - worldPos;
+			glm::vec3 lDir = glm::normalize(lightVector);
+			float lightDistance = glm::length(lightVector);
+			glm::vec3 c = glm::vec3(0);
+			if (!object.reflective) {
+				c = computeDiffuse(glm::vec3(albedo), light, lDir, normal);
+				if (glm::dot(normal, lDir) > 0) {
+					float shadow_alpha = castShadowRay(shadowOrigin, lDir, lightDistance);
+					if (shadow_alpha > 0)
+						c *= 1 - glm::clamp(shadow_alpha, 0.f, 1.f);
+					else
+						c += computeSpecular(light, rayDirection, lDir, normal);
+				}
+			}
+			c *= 1.f / (Kc + Kl * lightDistance + Kq * lightDistance * lightDistance);
+			color += c;
+		}
+
+		// BLENDING
+		glm::vec3 blended = (ambient + color / (float)(scene.lights.size() + 1)) * (1.f - prd.hitValue.a)
+			+ glm::vec3(prd.hitValue) * prd.hitValue.a;
+		prd.hitValue = glm::vec4(blended, prd.hitValue.a);
+
+		// Reflection
+		if (object.reflective) {
+			prd.stop = 0;
+			prd.rayOrigin = worldPos;
+			prd.rayDir = glm::reflect(rayDirection, normal);
+		}
+		else {
+			prd.hitValue.a += albedo.a;
+			prd.rayOrigin = worldPos;
+			prd.rayDir = rayDirection;
+		}
+	}
+};
+
+CpuRayTracingStats CpuRayTracer::render(const CpuScene& scene, CpuImage& image, uint32_t max_reflections_depth,
+	unsigned thread_count)
+{
+	if (thread_count == 0) thread_count = std::max(1u, std::thread::hardware_concurrency());
+	image.rgba.assign(image.width * image.height * 4, 0);
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// workers take bands of rows until the image is done
+	std::atomic<int> next_row = { 0 };
+	std::atomic<uint64_t> rays = { 0 };
+	auto worker = [&]() {
+		PixelTracer tracer(scene);
+		for (int first = next_row.fetch_add(TILE_ROWS); first < image.height; first = next_row.fetch_add(TILE_ROWS)) {
+			for (int y = first; y < std::min(first + TILE_ROWS, image.height); y++) {
+				for (int x = 0; x < image.width; x++) {
+					glm::vec2 inUV = (glm::vec2(x, y) + glm::vec2(0.5f)) / glm::vec2(image.width, image.height);
+					glm::vec4 color = glm::clamp(tracer.tracePixel(inUV, max_reflections_depth), 0.f, 1.f);
+					// rgba8 storage image
+					unsigned char* p = &image.rgba[(y * image.width + x) * 4];
+					for (int c = 0; c < 4; c++) p[c] = (unsigned char)(color[c] * 255.f + 0.5f);
+				}
+			}
+		}
+		rays += tracer.rays;
+	};
+	std::vector<std::thread> workers;
+	for (unsigned t = 1; t < thread_count; t++) workers.emplace_back(worker);
+	worker();
+	for (auto& t : workers) t.join();
+
+	CpuRayTracingStats stats = {};
+	stats.rays = rays;
+	stats.trace_ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	stats.mrays_per_second = stats.trace_ms > 0.f ? stats.rays / (stats.trace_ms * 1000.f) : 0.f;
+	return stats;
+}
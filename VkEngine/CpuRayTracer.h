@@ -0,0 +1,134 @@
+#pragma once
+#include "Mesh.h"
+#include "LightSource.h"
+#include "BoundingVolumes.h"
+#include <vector>
+#include <string>
+
+/*
+* CPU reference of the ray tracing pipeline: raytrace.rgen, raytrace.rchit, the two any hit shaders and
+* the miss shaders, ported on the same scene description, lights and max_reflections_depth.
+* Meshes get a 4-wide BVH (binned SAH, 4 boxes tested at a time with SSE2 when available), instances a
+* binary BVH on top, like BLASs and the TLAS. Nothing in here needs a device: scenes can be built from
+* files on machines without a GPU, e.g. for golden images and as a performance baseline.
+*/
+
+// RGBA8 image, textures and output
+struct CpuImage {
+	int width = 0, height = 0;
+	std::vector<unsigned char> rgba;
+
+	// bilinear with repeat, like the texture samplers
+	glm::vec4 sample(glm::vec2 uv) const;
+	// binary PPM (P6), alpha is dropped
+	void writePPM(const std::string& file) const;
+	static CpuImage readPPM(const std::string& file);
+	// any format stb_image reads
+	static CpuImage load(const std::string& file);
+	// root mean square error per channel (0-255), negative if the sizes differ
+	static float compare(const CpuImage& a, const CpuImage& b);
+};
+
+// Ray vs 4 boxes at a time
+class MeshBVH
+{
+public:
+	static constexpr uint32_t MAX_LEAF_TRIANGLES = 4;
+	static constexpr int SAH_BINS = 12;
+
+	struct Hit {
+		float t;
+		uint32_t primitive; // gl_PrimitiveID
+		float u, v; // hit attributes: weights of the second and third vertex
+	};
+	// filter(hit) returns false to ignore the intersection (ignoreIntersectionEXT)
+	template<typename Filter>
+	bool intersect(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max, Hit& hit, Filter filter) const;
+
+	MeshBVH(const std::vector<Vertex3D>& vertices, const std::vector<uint32_t>& indices);
+	inline const vkengine::AABB& getBounds() const { return bounds; };
+	inline const std::vector<Vertex3D>& getVertices() const { return vertices; };
+	inline const std::vector<uint32_t>& getIndices() const { return indices; };
+	inline size_t countNodes() const { return nodes.size(); };
+private:
+	// SoA bounds of the 4 children. count > 0: leaf of count triangles from first,
+	// count == 0 and child >= 0: inner node, child < 0: empty slot
+	struct Node4 {
+		float min_x[4], min_y[4], min_z[4];
+		float max_x[4], max_y[4], max_z[4];
+		int32_t child[4];
+		uint32_t count[4];
+	};
+	// edges precomputed for Moller-Trumbore, in leaf order
+	struct Triangle {
+		glm::vec3 v0, e1, e2;
+		uint32_t primitive;
+	};
+	struct BuildRange {
+		uint32_t first, count;
+		vkengine::AABB bounds;
+	};
+	bool split(const BuildRange& range, BuildRange& left, BuildRange& right);
+	int32_t buildNode(const BuildRange& range);
+	std::vector<Vertex3D> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<Node4> nodes;
+	std::vector<Triangle> triangles;
+	// build only
+	std::vector<uint32_t> order;
+	std::vector<vkengine::AABB> tri_bounds;
+	std::vector<glm::vec3> centroids;
+	vkengine::AABB bounds;
+};
+
+struct CpuInstance {
+	uint32_t mesh;
+	uint32_t texture;
+	glm::mat4 transform;
+	glm::mat4 inverse;
+	bool reflective;
+	vkengine::AABB world_box;
+};
+
+// What the descriptor sets and the uniform block give to the GPU ray tracer
+class CpuScene
+{
+public:
+	uint32_t addMesh(const std::vector<Vertex3D>& vertices, const std::vector<uint32_t>& indices);
+	uint32_t addTexture(const CpuImage& texture);
+	void addInstance(uint32_t mesh, uint32_t texture, const glm::mat4& transform, bool reflective);
+	// px, nx, py, ny, pz, nz like the cube map, without faces the clear color is used
+	std::vector<CpuImage> sky_faces;
+	vkengine::LightData global_light = {};
+	std::vector<vkengine::LightData> lights;
+	// camera, as in the uniform block (projection with the Y flipped)
+	glm::mat4 V_inverted = glm::mat4(1.f);
+	glm::mat4 P_inverted = glm::mat4(1.f);
+	void setCamera(const glm::mat4& view, const glm::mat4& projection);
+	// builds the instance BVH, has to be called after the last addInstance
+	void commit();
+
+	std::vector<MeshBVH> meshes;
+	std::vector<CpuImage> textures;
+	std::vector<CpuInstance> instances;
+	// binary BVH over the instance boxes: count > 0 is a leaf of instance_order[first, first + count)
+	struct InstanceNode {
+		vkengine::AABB box;
+		uint32_t first, count;
+		uint32_t right; // left child is the next node
+	};
+	std::vector<InstanceNode> instance_nodes;
+	std::vector<uint32_t> instance_order;
+private:
+	uint32_t buildInstanceNode(uint32_t first, uint32_t count);
+};
+
+class CpuRayTracer
+{
+public:
+	// thread_count 0 uses every hardware thread
+	static vkengine::CpuRayTracingStats render(const CpuScene& scene, CpuImage& image, uint32_t max_reflections_depth,
+		unsigned thread_count = 0);
+	// rows traced by a worker at a time
+	static constexpr int TILE_ROWS = 8;
+};
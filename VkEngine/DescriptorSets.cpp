@@ -26,29 +26,29 @@ VkDescriptorSetLayout createDStLayout(std::vector<VkDescriptorSetLayoutBinding>
 void DescriptorSetsFactory::initLayouts() {
 	DescriptorSetsFactory::layouts.resize(DescSetsLayouts::DescSetsLayouts_END);
 
-	// RT STATIC DESC_SET : 1 binding of 1 ACs in raytracing shaders
+	// RT STATIC DESC_SET : 1 binding of 1 ACs in raytracing shaders, also read by the ray queries of the hybrid fragment shader
 	{
 
 		VkDescriptorSetLayoutBinding vertexStorageBinding = {};
 		vertexStorageBinding.binding = 0;
 		vertexStorageBinding.descriptorCount = SUPPORTED_MESH_COUNT; // TODO make dynamic
 		vertexStorageBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		vertexStorageBinding.stageFlags = VK_SHADER_STAGE_ANY_HIT_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
+		vertexStorageBinding.stageFlags = VK_SHADER_STAGE_ANY_HIT_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_FRAGMENT_BIT;
 		VkDescriptorSetLayoutBinding indexStorageBinding = {};
 		indexStorageBinding.binding = 1;
 		indexStorageBinding.descriptorCount = SUPPORTED_MESH_COUNT; // TODO  make dynamic
 		indexStorageBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		indexStorageBinding.stageFlags = VK_SHADER_STAGE_ANY_HIT_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
+		indexStorageBinding.stageFlags = VK_SHADER_STAGE_ANY_HIT_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_FRAGMENT_BIT;
 		VkDescriptorSetLayoutBinding samplerArrayBinding = {};
 		samplerArrayBinding.binding = 2;
 		samplerArrayBinding.descriptorCount = SUPPORTED_TEXTURE_COUNT; // TODO  make dynamic
 		samplerArrayBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		samplerArrayBinding.stageFlags = VK_SHADER_STAGE_ANY_HIT_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;	
+		samplerArrayBinding.stageFlags = VK_SHADER_STAGE_ANY_HIT_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_FRAGMENT_BIT;
 		VkDescriptorSetLayoutBinding cubeMapBinding = {};
 		cubeMapBinding.binding = 3;
 		cubeMapBinding.descriptorCount = 1; // TODO  make dynamic
 		cubeMapBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		cubeMapBinding.stageFlags = VK_SHADER_STAGE_MISS_BIT_KHR;
+		cubeMapBinding.stageFlags = VK_SHADER_STAGE_MISS_BIT_KHR | VK_SHADER_STAGE_FRAGMENT_BIT;
 		layouts[DSL_RAY_TRACING_SCENE].bindings = { vertexStorageBinding, indexStorageBinding, samplerArrayBinding, cubeMapBinding };
 		layouts[DSL_RAY_TRACING_SCENE].layout = createDStLayout(layouts[DSL_RAY_TRACING_SCENE].bindings);
 	}
@@ -62,13 +62,14 @@ void DescriptorSetsFactory::initLayouts() {
 		layouts[DSL_TEXTURE_ARRAY].bindings = { samplerLayoutBinding };
 		layouts[DSL_TEXTURE_ARRAY].layout = createDStLayout(layouts[DSL_TEXTURE_ARRAY].bindings);
 	}
-	// STORAGE_IMAGE for RAYTRACING : 1 binding of 1 storage image and 1 sceneObj buffer in raytracing shaders
+	// STORAGE_IMAGE for RAYTRACING : 1 binding of 1 storage image, 1 sceneObj buffer, 1 accumulation image
+	// and the 3 images of the reduced resolution reflections in raytracing shaders
 	{
 		VkDescriptorSetLayoutBinding accStructBinding = {};
 		accStructBinding.binding = 0;
 		accStructBinding.descriptorCount = 1;
 		accStructBinding.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
-		accStructBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
+		accStructBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_FRAGMENT_BIT;
 		VkDescriptorSetLayoutBinding storageImgLayoutBinding = {};
 		storageImgLayoutBinding.binding = 1;
 		storageImgLayoutBinding.descriptorCount = 1;
@@ -78,8 +79,17 @@ void DescriptorSetsFactory::initLayouts() {
 		sceneDescBinding.binding = 2;
 		sceneDescBinding.descriptorCount = 1;
 		sceneDescBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		sceneDescBinding.stageFlags = VK_SHADER_STAGE_ANY_HIT_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
-		layouts[DSL_RT_IMAGE_AND_OBJECTS].bindings = { accStructBinding, storageImgLayoutBinding, sceneDescBinding };
+		sceneDescBinding.stageFlags = VK_SHADER_STAGE_ANY_HIT_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_FRAGMENT_BIT;
+		VkDescriptorSetLayoutBinding accumulationImgBinding = storageImgLayoutBinding;
+		accumulationImgBinding.binding = 3;
+		VkDescriptorSetLayoutBinding guideImgBinding = storageImgLayoutBinding;
+		guideImgBinding.binding = 4;
+		VkDescriptorSetLayoutBinding reflectionImgBinding = storageImgLayoutBinding;
+		reflectionImgBinding.binding = 5;
+		VkDescriptorSetLayoutBinding reflectionGuideImgBinding = storageImgLayoutBinding;
+		reflectionGuideImgBinding.binding = 6;
+		layouts[DSL_RT_IMAGE_AND_OBJECTS].bindings = { accStructBinding, storageImgLayoutBinding, sceneDescBinding, accumulationImgBinding,
+			guideImgBinding, reflectionImgBinding, reflectionGuideImgBinding };
 		layouts[DSL_RT_IMAGE_AND_OBJECTS].layout = createDStLayout(layouts[DSL_RT_IMAGE_AND_OBJECTS].bindings);
 	}
 	// FRAMEBUFFER_TEXTURE: a set with 1binding of 1 Texture : in fragment shader
@@ -200,47 +210,67 @@ void DescriptorSetsFactory::updateDescriptorSets(DescSetBundle* bundle)
 	}
 	for (auto & set_group : bundle->frame_dependent_sets) {
 		for (int i = 0; i < set_group.size(); i++) {
-			descriptorWrite.dstSet = set_group[i].set;
-			for (auto & bind : set_group[i].layout->bindings) {
-				descriptorWrite.dstBinding = bind.binding;
-				descriptorWrite.dstArrayElement = 0;
-				descriptorWrite.descriptorType = bind.descriptorType;
-				descriptorWrite.descriptorCount = bind.descriptorCount;
-				descriptorWrite.pBufferInfo = nullptr;
-				descriptorWrite.pImageInfo = nullptr;
-				switch (bind.descriptorType) 
-				{
-				case VkDescriptorType::VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER: {
-					VkDescriptorBufferInfo buff_info = {};
-					buff_info.buffer = uniformBuffer;
-					buff_info.range = sizeof(UniformBlock);
-					VkDeviceSize minAlignement =
-						PhysicalDevice::getProperties().properties.limits.minUniformBufferOffsetAlignment;
-					VkDeviceSize alignemetPadding = minAlignement - (sizeof(UniformBlock) % minAlignement);
-					buff_info.offset = i * (sizeof(UniformBlock) + alignemetPadding);
-					buffers_infos.push_back({ buff_info });
-					descriptorWrite.pBufferInfo = buffers_infos.back().data();
-				}break;
-				case VkDescriptorType::VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER: {
-					VkDescriptorImageInfo imageInfo = {};
-					imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-					imageInfo.imageView = Renderer::getOffScreenFrameAttachment(i).imageView;
-					imageInfo.sampler = Renderer::getOffScreenFrameAttachment(i).Sampler;
-					images_infos.push_back({ imageInfo });
-					descriptorWrite.pImageInfo = images_infos.back().data();
-				}
-					break;
-				default:
-					std::runtime_error("Tried to initialize a Descriptor set NOT supported by the engine!");
-				}
-				writes.push_back(descriptorWrite);
-			}
+			appendFrameSetWrites(set_group[i], i, writes, images_infos, buffers_infos);
 		}
 	}
 	vkQueueWaitIdle(Device::getGraphicQueue()); // wait for queue to be free
 	vkUpdateDescriptorSets(Device::get(), writes.size(), writes.data(), 0, nullptr);
 }
 
+void DescriptorSetsFactory::updateFrameDescriptorSets(DescSetBundle* bundle, unsigned index)
+{
+	std::vector<VkWriteDescriptorSet> writes;
+	std::vector<std::vector<VkDescriptorImageInfo>> images_infos;
+	std::vector<std::vector<VkDescriptorBufferInfo>> buffers_infos;
+	for (auto & set_group : bundle->frame_dependent_sets) {
+		if (index < set_group.size()) {
+			appendFrameSetWrites(set_group[index], index, writes, images_infos, buffers_infos);
+		}
+	}
+	vkUpdateDescriptorSets(Device::get(), writes.size(), writes.data(), 0, nullptr);
+}
+
+void DescriptorSetsFactory::appendFrameSetWrites(DescSet& set, int index, std::vector<VkWriteDescriptorSet>& writes,
+	std::vector<std::vector<VkDescriptorImageInfo>>& images_infos, std::vector<std::vector<VkDescriptorBufferInfo>>& buffers_infos)
+{
+	VkWriteDescriptorSet descriptorWrite = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+	descriptorWrite.dstSet = set.set;
+	for (auto & bind : set.layout->bindings) {
+		descriptorWrite.dstBinding = bind.binding;
+		descriptorWrite.dstArrayElement = 0;
+		descriptorWrite.descriptorType = bind.descriptorType;
+		descriptorWrite.descriptorCount = bind.descriptorCount;
+		descriptorWrite.pBufferInfo = nullptr;
+		descriptorWrite.pImageInfo = nullptr;
+		switch (bind.descriptorType) 
+		{
+		case VkDescriptorType::VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER: {
+			VkDescriptorBufferInfo buff_info = {};
+			buff_info.buffer = uniformBuffer;
+			buff_info.range = sizeof(UniformBlock);
+			VkDeviceSize minAlignement =
+				PhysicalDevice::getProperties().properties.limits.minUniformBufferOffsetAlignment;
+			VkDeviceSize alignemetPadding = minAlignement - (sizeof(UniformBlock) % minAlignement);
+			buff_info.offset = index * (sizeof(UniformBlock) + alignemetPadding);
+			buffers_infos.push_back({ buff_info });
+			descriptorWrite.pBufferInfo = buffers_infos.back().data();
+		}break;
+		case VkDescriptorType::VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER: {
+			VkDescriptorImageInfo imageInfo = {};
+			imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			imageInfo.imageView = Renderer::getOffScreenFrameAttachment(index).imageView;
+			imageInfo.sampler = Renderer::getOffScreenFrameAttachment(index).Sampler;
+			images_infos.push_back({ imageInfo });
+			descriptorWrite.pImageInfo = images_infos.back().data();
+		}
+			break;
+		default:
+			std::runtime_error("Tried to initialize a Descriptor set NOT supported by the engine!");
+		}
+		writes.push_back(descriptorWrite);
+	}
+}
+
 void DescriptorSetsFactory::updateUniformBuffer(UniformBlock uniforms, int imageIndex)
 {
 	VkDeviceSize minAlignement =
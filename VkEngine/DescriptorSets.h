@@ -76,7 +76,17 @@ struct SceneObjRtDescBlock {
 };
 struct RayTracingPushConstantBlock {
 	uint32_t max_reflection_depth;
+	uint32_t sample_index; // 0 restarts the accumulation
+	uint32_t accumulate;
+	uint32_t converged; // no rays, the accumulation image is only copied to the output
+	float roulette; // probability of ending a path at each reflection after the first
+	uint32_t pass; // RayTracingPass
+	uint32_t reflection_divisor; // pixels per side of a low resolution reflection
+	uint32_t trace_width; // full resolution size of the dispatch
+	uint32_t trace_height;
 };
+// Dispatches of a frame with the reflections at reduced resolution, RT_PASS_FULL alone traces everything
+enum RayTracingPass { RT_PASS_FULL, RT_PASS_PRIMARY, RT_PASS_REFLECTIONS, RT_PASS_COMPOSITE };
 
 struct UniformBlock {
 	glm::mat4 P_matrix;
@@ -89,6 +99,7 @@ struct UniformBlock {
 struct MainPushConstantBlock { // max 128 bytes for compatibility reasons
 	glm::mat4 model_transform;
 	uint32_t textureIndex;
+	uint32_t reflective; // read by the hybrid fragment shader only
 };
 
 struct ImGuiPushConstantBlock {
@@ -110,6 +121,8 @@ public:
 	// Depending on the bundle config initializes its VkDescriptorSets with proper Data
 	// Note: the data choice logic is embedded in the code, this should change in future...
 	static void updateDescriptorSets(DescSetBundle* bundle);
+	// Only the frame dependent sets of one frame, no wait: the caller knows that frame is done with them
+	static void updateFrameDescriptorSets(DescSetBundle* bundle, unsigned index);
 	static void updateUniformBuffer(UniformBlock uniforms, int imageIndex);
 	inline static VkBuffer getUniformBuffer() {	return uniformBuffer;};
 	static void cleanUp();
@@ -123,6 +136,8 @@ private:
 	static void* mappedUniformMemory;
 
 	static std::vector<VkDescriptorImageInfo> gatherImageInfos(DescSetUsage usage, DescSetsResourceContext data_context);
+	static void appendFrameSetWrites(DescSet& set, int index, std::vector<VkWriteDescriptorSet>& writes,
+		std::vector<std::vector<VkDescriptorImageInfo>>& images_infos, std::vector<std::vector<VkDescriptorBufferInfo>>& buffers_infos);
 	//static std::vector<VkDescriptorBufferInfo> gatherBufferInfos(DescSetUsage usage, DescSetsResourceContext data_context);
 
 };
\ No newline at end of file
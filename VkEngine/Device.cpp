@@ -8,8 +8,10 @@ VkDevice Device::device = VK_NULL_HANDLE;
 VkQueue Device::graphicQueue = VK_NULL_HANDLE;
 VkQueue Device::presentQueue = VK_NULL_HANDLE;
 VkQueue Device::transferQueue = VK_NULL_HANDLE;
+VkQueue Device::computeQueue = VK_NULL_HANDLE;
 VkCommandPool Device::graphicCommandPool = VK_NULL_HANDLE;
 VkCommandPool Device::transferCommandPool = VK_NULL_HANDLE;
+VkCommandPool Device::computeCommandPool = VK_NULL_HANDLE;
 
 bool Device::validation;
 bool Device::ready;
@@ -26,6 +28,12 @@ VkDevice Device::get()
 		createDevice();
 		createCommandPool(PhysicalDevice::getQueueFamilies().graphicsFamily, &graphicCommandPool);
 		createCommandPool(PhysicalDevice::getQueueFamilies().transferFamily, &transferCommandPool);
+		if (PhysicalDevice::hasAsyncCompute()) {
+			createCommandPool(PhysicalDevice::getQueueFamilies().computeFamily, &computeCommandPool);
+		}
+		else {
+			computeCommandPool = graphicCommandPool;
+		}
 		ready = true;
 	}
 	return Device::device;
@@ -36,6 +44,9 @@ void Device::destroy()
 	if(!ready)  throw std::runtime_error("Device Not Ready!!");
 	vkDestroyCommandPool(Device::get(), Device::getGraphicCmdPool(), nullptr);
 	vkDestroyCommandPool(Device::get(), Device::getTransferCmdPool(), nullptr);
+	if (PhysicalDevice::hasAsyncCompute()) {
+		vkDestroyCommandPool(Device::get(), Device::getComputeCmdPool(), nullptr);
+	}
 	vkDestroyDevice(Device::get(), nullptr);
 	ready = false;
 }
@@ -58,6 +69,12 @@ VkQueue Device::getTransferQueue()
 	return Device::transferQueue;
 }
 
+VkQueue Device::getComputeQueue()
+{
+	if (!ready) throw std::runtime_error("Device Not Ready!!");
+	return Device::computeQueue;
+}
+
 VkCommandPool Device::getGraphicCmdPool()
 {
 	if (!ready) throw std::runtime_error("Device Not Ready!!");
@@ -70,11 +87,25 @@ VkCommandPool Device::getTransferCmdPool()
 	return Device::transferCommandPool;
 }
 
+VkCommandPool Device::getComputeCmdPool()
+{
+	if (!ready) throw std::runtime_error("Device Not Ready!!");
+	return Device::computeCommandPool;
+}
+
+std::vector<uint32_t> Device::getComputeSharingFamilies()
+{
+	if (!PhysicalDevice::hasAsyncCompute()) return {};
+	QueueFamilyIndices indices = PhysicalDevice::getQueueFamilies();
+	return { (uint32_t)indices.graphicsFamily, (uint32_t)indices.computeFamily };
+}
+
 void Device::createDevice() {
 	// Prendo l'indice della coda selezionata durante la scelta del dispositivo fisico
 	QueueFamilyIndices indices = PhysicalDevice::getQueueFamilies();
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 	std::set<int> uniqueQueueFamilies = { indices.graphicsFamily, indices.presentFamily };
+	if (indices.computeFamily >= 0) uniqueQueueFamilies.insert(indices.computeFamily);
 	//NOTA: usare un set accorpa gli indici uguali, quindi se le due code sono una sola il set le accorpa.
 
 	float queuePriority = 1.0f;
@@ -97,11 +128,24 @@ void Device::createDevice() {
 	createInfo.pEnabledFeatures = nullptr; 
 	createInfo.pNext = &PhysicalDevice::getPhysicalDeviceFeatures();
 
-	std::vector<const char*> extensions(requiredDeviceExtensions.begin(),requiredDeviceExtensions.end());
+	std::vector<const char*> extensions;
+	for (auto ext : requiredDeviceExtensions) {
+		// nothing is presented without a surface
+		if (PhysicalDevice::isHeadless() && strcmp(ext, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0) continue;
+		extensions.push_back(ext);
+	}
 
 	if (PhysicalDevice::hasRaytracing()) {
 		for (auto ext : rayTracingDeviceExtensions) { extensions.push_back(ext); }
 	}
+	if (PhysicalDevice::hasRayQuery()) {
+		for (auto ext : rayQueryDeviceExtensions) { extensions.push_back(ext); }
+	}
+#ifdef VK_KHR_present_wait
+	if (PhysicalDevice::hasPresentWait()) {
+		for (auto ext : presentWaitDeviceExtensions) { extensions.push_back(ext); }
+	}
+#endif
 
 	createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
 	createInfo.ppEnabledExtensionNames = extensions.data();
@@ -120,6 +164,17 @@ void Device::createDevice() {
 	vkGetDeviceQueue(device, indices.graphicsFamily, 0, &graphicQueue); // indice 0 siccome ho una sola coda
 	vkGetDeviceQueue(device, indices.presentFamily, 0, &presentQueue); // indice 0 siccome ho una sola coda
 	vkGetDeviceQueue(device, indices.transferFamily, 0, &transferQueue); // indice 0 siccome ho una sola coda
+	if (indices.computeFamily >= 0) {
+		vkGetDeviceQueue(device, indices.computeFamily, 0, &computeQueue);
+	}
+	else {
+		computeQueue = graphicQueue;
+	}
+#ifdef VK_KHR_present_wait
+	if (PhysicalDevice::hasPresentWait()) {
+		LOAD_PRESENT_WAIT_COMMANDS(device);
+	}
+#endif
 
 }
 
@@ -23,8 +23,13 @@ public:
 	static VkQueue getGraphicQueue();
 	static VkQueue getPresentQueue();
 	static VkQueue getTransferQueue();
+	// the async compute queue, or the graphic one if the device has none
+	static VkQueue getComputeQueue();
 	static VkCommandPool getGraphicCmdPool();
 	static VkCommandPool getTransferCmdPool();
+	static VkCommandPool getComputeCmdPool();
+	// families of buffers written on one queue and read on the other: empty without async compute
+	static std::vector<uint32_t> getComputeSharingFamilies();
 	static void createCommandPool(int queueFamily, VkCommandPool* commandPool);
 private:
 	static void createDevice();
@@ -32,8 +37,10 @@ private:
 	static VkQueue graphicQueue;
 	static VkQueue transferQueue;
 	static VkQueue presentQueue;
+	static VkQueue computeQueue;
 	static VkCommandPool graphicCommandPool;
 	static VkCommandPool transferCommandPool;
+	static VkCommandPool computeCommandPool;
 	static bool validation;
 	static bool ready;
 };
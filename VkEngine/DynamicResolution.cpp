@@ -0,0 +1,40 @@
+#include "DynamicResolution.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace vkengine;
+
+constexpr const float SCALE_STEP = 0.05f;
+
+void DynamicResolutionController::configure(const DynamicResolutionSettings& settings)
+{
+	if (settings == this->settings) return;
+	this->settings = settings;
+	filter.configure(settings.target_ms, settings.tolerance, settings.settle_frames, settings.smoothing);
+	moveTo(1.f);
+}
+
+void DynamicResolutionController::moveTo(float new_scale)
+{
+	scale = new_scale;
+	filter.restart();
+}
+
+float DynamicResolutionController::update(float gpu_ms)
+{
+	if (!settings.enabled || gpu_ms <= 0.f) return current();
+	FrameTimeFilter::Verdict verdict = filter.add(gpu_ms);
+	bool over = verdict == FrameTimeFilter::OVER;
+	bool under = verdict == FrameTimeFilter::UNDER && scale < 1.f;
+	if (!over && !under) return current();
+	// pixels are scale^2: the scale where the frame would take target_ms
+	float wanted = scale * std::sqrt(settings.target_ms / filter.smoothedTime());
+	float min_scale = std::min(std::max(settings.min_scale, 0.1f), 1.f);
+	wanted = std::min(std::max(wanted, min_scale), 1.f);
+	// down to the step below when over, up to the step below the wanted one when under: never over the target again
+	float stepped = std::floor(wanted / SCALE_STEP) * SCALE_STEP;
+	if (over && stepped >= scale) stepped = scale - SCALE_STEP;
+	stepped = std::min(std::max(stepped, min_scale), 1.f);
+	if (stepped != scale) moveTo(stepped);
+	return current();
+}
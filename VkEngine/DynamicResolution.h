@@ -0,0 +1,50 @@
+#pragma once
+#include "FrameTimeFilter.h"
+#include <cstdint>
+
+namespace vkengine
+{
+	// How the scene image is stretched over the viewport when it is rendered smaller
+	enum UpscaleFilter { UPSCALE_LINEAR, UPSCALE_NEAREST };
+
+	struct DynamicResolutionSettings {
+		bool enabled = false;
+		// GPU time of the whole frame the controller aims at
+		float target_ms = 12.f;
+		// no change while the smoothed time is within target_ms * (1 +- tolerance)
+		float tolerance = 0.1f;
+		// the floor of the scale, on each axis
+		float min_scale = 0.5f;
+		// frames ignored after a change: they were recorded with the previous scale
+		uint32_t settle_frames = 6;
+		// weight of a new timing in the running average
+		float smoothing = 0.2f;
+		UpscaleFilter filter = UPSCALE_LINEAR;
+		inline bool operator==(const DynamicResolutionSettings& other) const {
+			return enabled == other.enabled && target_ms == other.target_ms && tolerance == other.tolerance &&
+				min_scale == other.min_scale && settle_frames == other.settle_frames && smoothing == other.smoothing;
+		};
+	};
+
+	/*
+	* Picks the fraction of the viewport that is rasterized, on each axis, from the measured GPU frame time.
+	* The time is taken as proportional to the pixels: the scale jumps to where the target should be met,
+	* in steps of 1/20 so small changes in the timings don't move it.
+	* Only measured times go in and scales come out, so it can be simulated without a device.
+	*/
+	class DynamicResolutionController
+	{
+	public:
+		// starts again from full resolution only if something changed
+		void configure(const DynamicResolutionSettings& settings);
+		// one measured frame, in ms. Returns the scale of the next frame
+		float update(float gpu_ms);
+		inline float current() const { return scale; };
+		inline float smoothedTime() const { return filter.smoothedTime(); };
+	private:
+		void moveTo(float new_scale);
+		DynamicResolutionSettings settings;
+		FrameTimeFilter filter;
+		float scale = 1.f;
+	};
+}
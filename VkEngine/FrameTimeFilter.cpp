@@ -0,0 +1,31 @@
+#include "FrameTimeFilter.h"
+
+using namespace vkengine;
+
+void FrameTimeFilter::configure(float target_ms, float tolerance, uint32_t settle_frames, float smoothing)
+{
+	this->target_ms = target_ms;
+	this->tolerance = tolerance;
+	this->settle_frames = settle_frames;
+	this->smoothing = smoothing;
+	restart();
+}
+
+void FrameTimeFilter::restart()
+{
+	settle = settle_frames;
+	has_time = false;
+}
+
+FrameTimeFilter::Verdict FrameTimeFilter::add(float gpu_ms)
+{
+	if (settle > 0) {
+		settle--;
+		return SETTLING;
+	}
+	smoothed_ms = has_time ? smoothed_ms + (gpu_ms - smoothed_ms) * smoothing : gpu_ms;
+	has_time = true;
+	if (smoothed_ms > target_ms * (1.f + tolerance)) return OVER;
+	if (smoothed_ms < target_ms * (1.f - tolerance)) return UNDER;
+	return INSIDE;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+
+namespace vkengine
+{
+	/*
+	* The part of the GPU time controllers that only looks at the timings: a running average that
+	* skips the frames recorded before the last change, and the tolerance band around the target
+	* that keeps the controllers from reacting to noise.
+	*/
+	class FrameTimeFilter
+	{
+	public:
+		enum Verdict { SETTLING, UNDER, INSIDE, OVER };
+		void configure(float target_ms, float tolerance, uint32_t settle_frames, float smoothing);
+		// the controller changed its setting: the next timings still belong to the previous one
+		void restart();
+		// one measured time, in ms. SETTLING while the frames of the previous setting go by
+		Verdict add(float gpu_ms);
+		inline float smoothedTime() const { return smoothed_ms; };
+	private:
+		float target_ms = 0.f;
+		float tolerance = 0.f;
+		uint32_t settle_frames = 0;
+		float smoothing = 1.f;
+		float smoothed_ms = 0.f;
+		bool has_time = false;
+		uint32_t settle = 0;
+	};
+}
@@ -0,0 +1,126 @@
+#include "GpuProfiler.h"
+#include "Device.h"
+#include "PhysicalDevice.h"
+
+std::deque<vkengine::GpuFrameTimings> GpuProfiler::history;
+size_t GpuProfiler::history_size = 300;
+VkQueryPool GpuProfiler::query_pool = VK_NULL_HANDLE;
+std::vector<uint64_t> GpuProfiler::frame_numbers;
+uint64_t GpuProfiler::timestamp_mask = 0;
+bool GpuProfiler::compute_timestamps = false;
+
+void GpuProfiler::init(unsigned frame_count)
+{
+	cleanUp();
+	uint32_t valid_bits = PhysicalDevice::getTimestampValidBits(PhysicalDevice::getQueueFamilies().graphicsFamily);
+	if (!PhysicalDevice::getProperties().properties.limits.timestampComputeAndGraphics || valid_bits == 0) {
+		std::cout << "No timestamps on the graphics queue: the GPU profiler is off" << std::endl;
+		return;
+	}
+	// the slices are reset from the CPU once read, see collect
+	if (!PhysicalDevice::hasHostQueryReset()) {
+		std::cout << "No host query reset: the GPU profiler is off" << std::endl;
+		return;
+	}
+	timestamp_mask = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
+	compute_timestamps = PhysicalDevice::getTimestampValidBits(PhysicalDevice::getQueueFamilies().computeFamily) > 0;
+	// begin and end of every pass, for each frame
+	VkQueryPoolCreateInfo qpci{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+	qpci.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	qpci.queryCount = 2 * vkengine::GPU_PASS_COUNT * frame_count;
+	vkCreateQueryPool(Device::get(), &qpci, nullptr, &query_pool);
+	vkResetQueryPool(Device::get(), query_pool, 0, qpci.queryCount);
+	frame_numbers.assign(frame_count, 0);
+}
+
+void GpuProfiler::cleanUp()
+{
+	if (query_pool == VK_NULL_HANDLE) return;
+	vkDestroyQueryPool(Device::get(), query_pool, nullptr);
+	query_pool = VK_NULL_HANDLE;
+	frame_numbers.clear();
+}
+
+void GpuProfiler::beginFrame(unsigned frameIndex, uint64_t frame_number)
+{
+	if (query_pool == VK_NULL_HANDLE) return;
+	collect(frameIndex);
+	frame_numbers[frameIndex] = frame_number;
+}
+
+void GpuProfiler::collectAll()
+{
+	if (query_pool == VK_NULL_HANDLE) return;
+	std::vector<unsigned> slices;
+	for (unsigned i = 0; i < frame_numbers.size(); i++) {
+		if (frame_numbers[i] != 0) slices.push_back(i);
+	}
+	std::sort(slices.begin(), slices.end(), [](unsigned a, unsigned b) { return frame_numbers[a] < frame_numbers[b]; });
+	for (auto slice : slices) collect(slice);
+}
+
+void GpuProfiler::beginPass(VkCommandBuffer cmd, unsigned frameIndex, vkengine::GpuPass pass, bool compute_queue)
+{
+	if (query_pool == VK_NULL_HANDLE || (compute_queue && !compute_timestamps)) return;
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 2 * (vkengine::GPU_PASS_COUNT * frameIndex + pass));
+}
+
+void GpuProfiler::endPass(VkCommandBuffer cmd, unsigned frameIndex, vkengine::GpuPass pass, bool compute_queue)
+{
+	if (query_pool == VK_NULL_HANDLE || (compute_queue && !compute_timestamps)) return;
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 2 * (vkengine::GPU_PASS_COUNT * frameIndex + pass) + 1);
+}
+
+void GpuProfiler::collect(unsigned frameIndex)
+{
+	if (frame_numbers[frameIndex] == 0) return;
+	// timestamp and availability of each query: the passes that didn't run in the frame were never written
+	std::array<uint64_t, 4 * vkengine::GPU_PASS_COUNT> results = {};
+	uint32_t first = 2 * vkengine::GPU_PASS_COUNT * frameIndex;
+	vkGetQueryPoolResults(Device::get(), query_pool, first, 2 * vkengine::GPU_PASS_COUNT, sizeof(results), results.data(),
+		2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+	// the frame is done, the slice is free for the next one
+	vkResetQueryPool(Device::get(), query_pool, first, 2 * vkengine::GPU_PASS_COUNT);
+
+	vkengine::GpuFrameTimings timings = { frame_numbers[frameIndex] };
+	float period = PhysicalDevice::getProperties().properties.limits.timestampPeriod;
+	for (int pass = 0; pass < vkengine::GPU_PASS_COUNT; pass++) {
+		const uint64_t* begin = &results[4 * pass];
+		const uint64_t* end = &results[4 * pass + 2];
+		timings.pass_ms[pass] = begin[1] && end[1] ? ((end[0] - begin[0]) & timestamp_mask) * period / 1000000.f : -1.f;
+	}
+	frame_numbers[frameIndex] = 0;
+	history.push_back(timings);
+	while (history.size() > history_size) history.pop_front();
+}
+
+const char* GpuProfiler::passName(vkengine::GpuPass pass)
+{
+	switch (pass) {
+	case vkengine::GPU_PASS_UPLOADS: return "uploads";
+	case vkengine::GPU_PASS_TLAS: return "tlas";
+	case vkengine::GPU_PASS_TRACE: return "trace";
+	case vkengine::GPU_PASS_RASTER: return "raster";
+	case vkengine::GPU_PASS_IMGUI: return "imgui";
+	default: return "";
+	}
+}
+
+bool GpuProfiler::exportCsv(const std::string& file)
+{
+	std::ofstream out(file, std::ios::trunc);
+	if (!out) return false;
+	// one row per frame, the passes that didn't run are left empty
+	out << "frame";
+	for (int pass = 0; pass < vkengine::GPU_PASS_COUNT; pass++) out << "," << passName((vkengine::GpuPass)pass) << "_ms";
+	out << "\n";
+	for (auto& timings : history) {
+		out << timings.frame;
+		for (int pass = 0; pass < vkengine::GPU_PASS_COUNT; pass++) {
+			out << ",";
+			if (timings.pass_ms[pass] >= 0.f) out << timings.pass_ms[pass];
+		}
+		out << "\n";
+	}
+	return (bool)out;
+}
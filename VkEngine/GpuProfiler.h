@@ -0,0 +1,37 @@
+#pragma once
+#include "VkEngine.h"
+#include "commons.h"
+#include <deque>
+
+/*
+* GPU time of the passes of each frame, from timestamps written around them.
+* Every swapchain image has its own slice of the query pool: the slice is read back when the
+* image comes around again, after the frame that used it completed, so nothing ever waits for the results.
+* Without timestamps on the graphics queue or host query reset the pool is not created and every call does nothing,
+* the dynamic resolution and the ray budget then keep their current setting.
+*/
+class GpuProfiler
+{
+public:
+	static void init(unsigned frame_count);
+	static void cleanUp();
+	static inline bool isSupported() { return query_pool != VK_NULL_HANDLE; };
+	// reads the last frame that used this slice into the history, then starts frame_number in it
+	static void beginFrame(unsigned frameIndex, uint64_t frame_number);
+	// reads every slice still holding a frame, oldest first. Only after the frames in flight completed
+	static void collectAll();
+	// outside of render passes. A pass can be recorded in the compute queue only if it has timestamps too
+	static void beginPass(VkCommandBuffer cmd, unsigned frameIndex, vkengine::GpuPass pass, bool compute_queue = false);
+	static void endPass(VkCommandBuffer cmd, unsigned frameIndex, vkengine::GpuPass pass, bool compute_queue = false);
+	static const char* passName(vkengine::GpuPass pass);
+	static bool exportCsv(const std::string& file);
+	// frames kept, oldest first
+	static std::deque<vkengine::GpuFrameTimings> history;
+	static size_t history_size;
+private:
+	static void collect(unsigned frameIndex);
+	static VkQueryPool query_pool;
+	static std::vector<uint64_t> frame_numbers; // frame last recorded in each slice, 0 for none
+	static uint64_t timestamp_mask; // timestampValidBits of the graphics queue
+	static bool compute_timestamps;
+};
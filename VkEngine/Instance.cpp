@@ -63,7 +63,10 @@ void Instance::destroyInstance()
 	if (validation) {
 		destroyDebugUtilsMessengerEXT(instance, messangerExtension, nullptr);
 	}	
-	vkDestroySurfaceKHR(Instance::get(), (VkSurfaceKHR)Instance::surfaceOwner->getSurface(instance), nullptr);
+	VkSurfaceKHR surface = (VkSurfaceKHR)Instance::surfaceOwner->getSurface(instance);
+	if (surface != VK_NULL_HANDLE) { // headless there is none
+		vkDestroySurfaceKHR(Instance::get(), surface, nullptr);
+	}
 	vkDestroyInstance(instance, nullptr);
 	ready = false;
 }
@@ -17,7 +17,8 @@ VkBuffer BaseMesh::getVkIndexBuffer() const {return this->indexBuffer;}
 
 Mesh3D::Mesh3D(std::string modelPath)
 {
-	this->loadModel(modelPath);
+	Mesh3D::loadModel(modelPath, this->vertices, this->indices);
+	Mesh3D::computeBounds(this->vertices, this->aabb, this->bounding_sphere);
 	this->createVertexBuffer();
 	this->createIndexBuffer();
 }
@@ -41,7 +42,7 @@ Mesh3D::~Mesh3D()
 	vkFreeMemory(Device::get(), vertexBufferMemory, nullptr);
 }
 
-void Mesh3D::loadModel(std::string modelPath) {
+void Mesh3D::loadModel(std::string modelPath, std::vector<Vertex3D>& vertices, std::vector<uint32_t>& indices) {
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
 	std::vector<tinyobj::material_t> materials;
@@ -101,6 +102,51 @@ void Mesh3D::loadModel(std::string modelPath) {
 	}
 }
 
+/*
+* AABB plus a tight sphere: Ritter's approximation is compared with the sphere
+* centered in the AABB and the smaller of the two is kept.
+*/
+void Mesh3D::computeBounds(const std::vector<Vertex3D>& vertices, AABB& aabb, BoundingSphere& bounding_sphere)
+{
+	if (vertices.empty()) {
+		aabb = { glm::vec3(0.f), glm::vec3(0.f) };
+		bounding_sphere = { glm::vec3(0.f), 0.f };
+		return;
+	}
+	aabb = { vertices[0].pos, vertices[0].pos };
+	for (const auto& v : vertices) {
+		aabb.min = glm::min(aabb.min, v.pos);
+		aabb.max = glm::max(aabb.max, v.pos);
+	}
+	// sphere centered in the box
+	BoundingSphere box_sphere = { aabb.center(), 0.f };
+	for (const auto& v : vertices) {
+		box_sphere.radius = std::max(box_sphere.radius, glm::distance(box_sphere.center, v.pos));
+	}
+	// Ritter: start from two far apart points, then grow to include everything
+	auto farthest_from = [&vertices](glm::vec3 p) {
+		glm::vec3 far_point = p;
+		float max_dist = -1.f;
+		for (const auto& v : vertices) {
+			float d = glm::distance(p, v.pos);
+			if (d > max_dist) { max_dist = d; far_point = v.pos; }
+		}
+		return far_point;
+	};
+	glm::vec3 a = farthest_from(vertices[0].pos);
+	glm::vec3 b = farthest_from(a);
+	BoundingSphere ritter = { (a + b) * 0.5f, glm::distance(a, b) * 0.5f };
+	for (const auto& v : vertices) {
+		float d = glm::distance(ritter.center, v.pos);
+		if (d > ritter.radius) {
+			float new_radius = (ritter.radius + d) * 0.5f;
+			ritter.center += (v.pos - ritter.center) * ((new_radius - ritter.radius) / d);
+			ritter.radius = new_radius;
+		}
+	}
+	bounding_sphere = ritter.radius < box_sphere.radius ? ritter : box_sphere;
+}
+
 void Mesh3D::createVertexBuffer()
 {
 	VkDeviceSize bufferSize = sizeof(Vertex3D) * vertices.size();
@@ -130,7 +176,8 @@ void Mesh3D::createVertexBuffer()
 			VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
 			VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR) : 0),
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		vertexBuffer, vertexBufferMemory);
+		vertexBuffer, vertexBufferMemory,
+		Device::getComputeSharingFamilies()); // BLAS builds read it on the compute queue
 	copyBufferToBuffer(Device::get(),Device::getGraphicQueue(),Device::getGraphicCmdPool(),stagingBuffer, vertexBuffer, bufferSize);
 
 	vkDestroyBuffer(Device::get(), stagingBuffer, nullptr);
@@ -162,7 +209,8 @@ void Mesh3D::createIndexBuffer()
 				VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
 				VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR) : 0),
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		indexBuffer, indexBufferMemory);
+		indexBuffer, indexBufferMemory,
+		Device::getComputeSharingFamilies());
 
 	copyBufferToBuffer(Device::get(), Device::getGraphicQueue(), Device::getGraphicCmdPool(), stagingBuffer, indexBuffer, bufferSize);
 
@@ -1,5 +1,6 @@
 #pragma once
 #include "VkEngine.h"
+#include "BoundingVolumes.h"
 #include "commons.h"
 
 enum VertexTypes { VERTEX_2D, VERTEX_3D };
@@ -112,13 +113,24 @@ public:
 	Mesh3D(std::string modelPath);
 	uint32_t getIdxCount() const override;
 	uint32_t getVertexCount() const;
+	// Mesh space bounds, computed once at import
+	inline const vkengine::AABB& getAABB() const { return aabb; };
+	inline const vkengine::BoundingSphere& getBoundingSphere() const { return bounding_sphere; };
+	// CPU side copies, used by the software occlusion culling
+	inline const std::vector<Vertex3D>& getVertices() const { return vertices; };
+	inline const std::vector<uint32_t>& getIndices() const { return indices; };
+	// OBJ parsing only, no device needed
+	static void loadModel(std::string modelPath, std::vector<Vertex3D>& vertices, std::vector<uint32_t>& indices);
+	// no device needed either
+	static void computeBounds(const std::vector<Vertex3D>& vertices, vkengine::AABB& aabb, vkengine::BoundingSphere& bounding_sphere);
 	~Mesh3D();
 private:
-	void loadModel(std::string modelPath);
 	void createVertexBuffer();
 	void createIndexBuffer();
 	std::vector<Vertex3D> vertices;
 	std::vector<uint32_t> indices;
+	vkengine::AABB aabb;
+	vkengine::BoundingSphere bounding_sphere;
 };
 
 class GuiMesh : public BaseMesh {
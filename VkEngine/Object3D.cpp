@@ -16,9 +16,8 @@ Object3D::Object3D(unsigned id, std::string name, std::string mesh_id,
 
 glm::mat4 Object3D::getMatrix()
 {
-	return glm::translate(glm::mat4(1), transform.position) * 
-		glm::toMat4(glm::quat(transform.eulerAngles * glm::pi<float>() / 180.f)) * 
-		glm::scale(glm::mat4(1.f),glm::vec3(transform.scale_factor));
+	updateWorldBounds();
+	return cached_matrix;
 }
 
 ObjTransformation & vkengine::Object3D::getObjTransform()
@@ -26,9 +25,33 @@ ObjTransformation & vkengine::Object3D::getObjTransform()
 	return this->transform;
 }
 
-float vkengine::Object3D::getBoundingRadius()
-{ // big brain code...
-	return this->transform.scale_factor;
+void vkengine::Object3D::setLocalBounds(AABB box, BoundingSphere sphere)
+{
+	this->local_aabb = box;
+	this->local_sphere = sphere;
+	this->cache_valid = false;
+	updateWorldBounds();
+}
+
+bool vkengine::Object3D::updateWorldBounds()
+{
+	// the editor writes the transformation directly, so the only way to know is to compare
+	if (cache_valid &&
+		cached_transform.position == transform.position &&
+		cached_transform.eulerAngles == transform.eulerAngles &&
+		cached_transform.scale_factor == transform.scale_factor)
+	{
+		return false;
+	}
+	cached_matrix = glm::translate(glm::mat4(1), transform.position) *
+		glm::toMat4(glm::quat(transform.eulerAngles * glm::pi<float>() / 180.f)) *
+		glm::scale(glm::mat4(1.f), glm::vec3(transform.scale_factor));
+	cached_transform = transform;
+	cache_valid = true;
+	moved = true;
+	world_aabb = local_aabb.transformed(cached_matrix);
+	world_sphere = local_sphere.transformed(cached_matrix, transform.scale_factor);
+	return true;
 }
 
 std::string Object3D::getMeshName()
@@ -41,6 +64,16 @@ std::string Object3D::getTextureName()
 	return texture_name;
 }
 
+void Object3D::setMeshName(std::string mesh_id)
+{
+	this->mesh_name = mesh_id;
+}
+
+void Object3D::setTextureName(std::string texture_id)
+{
+	this->texture_name = texture_id;
+}
+
 Object3D::~Object3D()
 {
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include "SceneElement.h"
+#include "BoundingVolumes.h"
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
@@ -21,6 +22,7 @@ namespace vkengine
 		std::string mesh_name;
 		std::string texture_name;
 		bool reflective;
+		bool occluder;
 		ObjTransformation transformation;
 	} ObjectInitInfo;
 
@@ -28,19 +30,45 @@ namespace vkengine
 	{
 	public:
 		Object3D(unsigned id, std::string name, std::string mesh_id, std::string texture_id, ObjTransformation transform);
+		// Cached: recomputed only when the transformation changes
 		glm::mat4 getMatrix();
 		ObjTransformation & getObjTransform();
-		// this is dumb and fake
-		float getBoundingRadius();
+		// Mesh space bounds, set by the scene when the object is created
+		void setLocalBounds(AABB box, BoundingSphere sphere);
+		/*
+		* Refreshes the cached matrix and the world space bounds if the transformation
+		* has been edited since the last call. Returns true if something changed.
+		*/
+		bool updateWorldBounds();
+		inline const AABB& getWorldAABB() { return world_aabb; };
+		inline const BoundingSphere& getWorldSphere() { return world_sphere; };
+		// position of the object in the ray tracing instances, kept by the scene
+		inline unsigned getInstanceSlot() { return instance_slot; };
 		std::string getMeshName();
 		std::string getTextureName();
+		void setMeshName(std::string mesh_id);
+		void setTextureName(std::string texture_id);
 		~Object3D();
 		bool visible = true;
 		bool reflective = false;
+		// rasterized in the CPU occlusion buffer to hide what is behind it
+		bool occluder = false;
 	private:
+		friend class Scene3D;
+		unsigned instance_slot = 0;
+		// the world bounds were recomputed since the scene last logged the slot
+		bool moved = false;
 		std::string mesh_name;
 		std::string texture_name;
 		ObjTransformation transform;
+		// world bounds cache
+		ObjTransformation cached_transform;
+		glm::mat4 cached_matrix;
+		bool cache_valid = false;
+		AABB local_aabb = { glm::vec3(0.f), glm::vec3(0.f) };
+		BoundingSphere local_sphere = { glm::vec3(0.f), 0.f };
+		AABB world_aabb = { glm::vec3(0.f), glm::vec3(0.f) };
+		BoundingSphere world_sphere = { glm::vec3(0.f), 0.f };
 	};
 }
 
@@ -0,0 +1,294 @@
+#include "OcclusionCulling.h"
+#include "MeshManager.h"
+#include "CpuProfiler.h"
+#include "commons.h"
+#include <tuple>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUSION_SSE2
+#endif
+
+using namespace vkengine;
+
+// vertices closer than this (clip space w) are not rasterized: skipping an occluder is always safe
+constexpr const float NEAR_W_EPSILON = 1e-4f;
+// with automatic selection, objects whose bounding sphere covers less than this (radius / distance) are ignored
+constexpr const float AUTO_OCCLUDER_MIN_SIZE = 0.1f;
+constexpr const unsigned MAX_OCCLUDERS = 64;
+
+static inline float edgeFunction(const glm::vec3& a, const glm::vec3& b, float px, float py)
+{
+	return (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+}
+
+namespace {
+	// from a to b, in a counterclockwise screen triangle
+	struct ScreenEdge {
+		float ax, ay, bx, by;
+		inline bool operator<(const ScreenEdge& other) const {
+			return std::tie(ax, ay, bx, by) < std::tie(other.ax, other.ay, other.bx, other.by);
+		};
+	};
+}
+
+OcclusionBuffer::OcclusionBuffer(int width, int height)
+{
+	// rows of 4 pixels for the SIMD loop
+	this->width = (width + 3) & ~3;
+	this->height = height;
+	this->tiles_x = (this->width + TILE_WIDTH - 1) / TILE_WIDTH;
+	this->tiles_y = (this->height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+	this->depth.resize(this->width * this->height);
+	this->tile_max_depth.resize(tiles_x * tiles_y);
+	clear();
+}
+
+void OcclusionBuffer::clear()
+{
+	std::fill(depth.begin(), depth.end(), 1.f);
+	std::fill(tile_max_depth.begin(), tile_max_depth.end(), 1.f);
+}
+
+void OcclusionBuffer::rasterize(const std::vector<glm::vec4>& clip_vertices, const std::vector<uint32_t>& indices,
+	int first_row, int last_row)
+{
+	first_row = std::max(first_row, 0);
+	last_row = std::min(last_row, height);
+	std::vector<std::array<glm::vec3, 3>> triangles;
+	triangles.reserve(indices.size() / 3);
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		std::array<glm::vec3, 3> screen;
+		bool clipped = false;
+		for (int v = 0; v < 3; v++) {
+			const glm::vec4& c = clip_vertices[indices[i + v]];
+			if (c.w <= NEAR_W_EPSILON || c.z < 0.f) { clipped = true; break; }
+			screen[v] = { (c.x / c.w * 0.5f + 0.5f) * width, (c.y / c.w * 0.5f + 0.5f) * height, c.z / c.w };
+		}
+		if (clipped) continue;
+		float area = edgeFunction(screen[0], screen[1], screen[2].x, screen[2].y);
+		if (std::abs(area) < 1e-6f) continue;
+		// both windings are rasterized, the nearest depth wins anyway
+		if (area < 0.f) std::swap(screen[1], screen[2]);
+		triangles.push_back(screen);
+	}
+	// an edge drawn in both directions has a triangle on each side. Matched by position, not by index:
+	// meshes repeat the vertices of their hard edges
+	std::vector<ScreenEdge> edges;
+	edges.reserve(triangles.size() * 3);
+	for (auto& t : triangles) {
+		for (int e = 0; e < 3; e++) {
+			const glm::vec3& a = t[(e + 1) % 3];
+			const glm::vec3& b = t[(e + 2) % 3];
+			edges.push_back({ a.x, a.y, b.x, b.y });
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	for (auto& t : triangles) {
+		bool inner[3];
+		for (int e = 0; e < 3; e++) {
+			const glm::vec3& a = t[(e + 1) % 3];
+			const glm::vec3& b = t[(e + 2) % 3];
+			inner[e] = std::binary_search(edges.begin(), edges.end(), ScreenEdge{ b.x, b.y, a.x, a.y });
+		}
+		rasterizeTriangle(t[0], t[1], t[2], inner, first_row, last_row);
+	}
+}
+
+void OcclusionBuffer::rasterizeTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, const bool inner[3],
+	int first_row, int last_row)
+{
+	float area = edgeFunction(v0, v1, v2.x, v2.y);
+
+	int min_x = std::max(0, (int)std::floor(std::min({ v0.x, v1.x, v2.x })));
+	int max_x = std::min(width - 1, (int)std::ceil(std::max({ v0.x, v1.x, v2.x })));
+	int min_y = std::max(first_row, (int)std::floor(std::min({ v0.y, v1.y, v2.y })));
+	int max_y = std::min(last_row - 1, (int)std::ceil(std::max({ v0.y, v1.y, v2.y })));
+	if (min_x > max_x || min_y > max_y) return;
+
+	float inv_area = 1.f / area;
+	// edge function steps along x and y
+	float dx0 = -(v2.y - v1.y), dx1 = -(v0.y - v2.y), dx2 = -(v1.y - v0.y);
+	// a pixel is covered if its centre is half a pixel inside every outer edge, as measured along x and y:
+	// the edge functions are shifted by that much, the depth is still interpolated at the centre
+	float bias0 = inner[0] ? 0.f : 0.5f * (std::abs(dx0) + std::abs(v2.x - v1.x));
+	float bias1 = inner[1] ? 0.f : 0.5f * (std::abs(dx1) + std::abs(v0.x - v2.x));
+	float bias2 = inner[2] ? 0.f : 0.5f * (std::abs(dx2) + std::abs(v1.x - v0.x));
+	float z_bias = (bias0 * v0.z + bias1 * v1.z + bias2 * v2.z) * inv_area;
+	min_x &= ~3;
+
+	for (int y = min_y; y <= max_y; y++) {
+		float py = y + 0.5f, px = min_x + 0.5f;
+		float w0 = edgeFunction(v1, v2, px, py) - bias0;
+		float w1 = edgeFunction(v2, v0, px, py) - bias1;
+		float w2 = edgeFunction(v0, v1, px, py) - bias2;
+		float* row = &depth[y * width];
+#ifdef OCCLUSION_SSE2
+		const __m128 lanes = _mm_set_ps(3.f, 2.f, 1.f, 0.f);
+		const __m128 zero = _mm_setzero_ps();
+		__m128 e0 = _mm_add_ps(_mm_set1_ps(w0), _mm_mul_ps(lanes, _mm_set1_ps(dx0)));
+		__m128 e1 = _mm_add_ps(_mm_set1_ps(w1), _mm_mul_ps(lanes, _mm_set1_ps(dx1)));
+		__m128 e2 = _mm_add_ps(_mm_set1_ps(w2), _mm_mul_ps(lanes, _mm_set1_ps(dx2)));
+		const __m128 step0 = _mm_set1_ps(4.f * dx0), step1 = _mm_set1_ps(4.f * dx1), step2 = _mm_set1_ps(4.f * dx2);
+		const __m128 z0 = _mm_set1_ps(v0.z * inv_area), z1 = _mm_set1_ps(v1.z * inv_area), z2 = _mm_set1_ps(v2.z * inv_area);
+		const __m128 zb = _mm_set1_ps(z_bias);
+		for (int x = min_x; x <= max_x; x += 4) {
+			__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+			if (_mm_movemask_ps(inside)) {
+				__m128 z = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e0, z0), _mm_mul_ps(e1, z1)), _mm_mul_ps(e2, z2)), zb);
+				__m128 old_depth = _mm_loadu_ps(row + x);
+				__m128 new_depth = _mm_min_ps(old_depth, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, new_depth), _mm_andnot_ps(inside, old_depth)));
+			}
+			e0 = _mm_add_ps(e0, step0); e1 = _mm_add_ps(e1, step1); e2 = _mm_add_ps(e2, step2);
+		}
+#else
+		for (int x = min_x; x <= max_x; x++) {
+			if (w0 >= 0.f && w1 >= 0.f && w2 >= 0.f) {
+				float z = (w0 * v0.z + w1 * v1.z + w2 * v2.z) * inv_area + z_bias;
+				row[x] = std::min(row[x], z);
+			}
+			w0 += dx0; w1 += dx1; w2 += dx2;
+		}
+#endif
+	}
+}
+
+void OcclusionBuffer::updateTiles(int first_row, int last_row)
+{
+	first_row = std::max(first_row, 0);
+	last_row = std::min(last_row, height);
+	for (int ty = first_row / TILE_HEIGHT; ty * TILE_HEIGHT < last_row; ty++) {
+		for (int tx = 0; tx < tiles_x; tx++) {
+			float max_depth = 0.f;
+			for (int y = ty * TILE_HEIGHT; y < std::min((ty + 1) * TILE_HEIGHT, height); y++)
+				for (int x = tx * TILE_WIDTH; x < std::min((tx + 1) * TILE_WIDTH, width); x++)
+					max_depth = std::max(max_depth, depth[y * width + x]);
+			tile_max_depth[ty * tiles_x + tx] = max_depth;
+		}
+	}
+}
+
+bool OcclusionBuffer::isOccluded(const AABB& world_box, const glm::mat4& view_projection) const
+{
+	glm::vec2 rect_min(std::numeric_limits<float>::max()), rect_max(-std::numeric_limits<float>::max());
+	float nearest_z = std::numeric_limits<float>::max();
+	for (int i = 0; i < 8; i++) {
+		glm::vec3 corner = {
+			i & 1 ? world_box.max.x : world_box.min.x,
+			i & 2 ? world_box.max.y : world_box.min.y,
+			i & 4 ? world_box.max.z : world_box.min.z };
+		glm::vec4 c = view_projection * glm::vec4(corner, 1.f);
+		// box crossing the near plane: can't say anything
+		if (c.w <= NEAR_W_EPSILON) return false;
+		glm::vec2 screen = { (c.x / c.w * 0.5f + 0.5f) * width, (c.y / c.w * 0.5f + 0.5f) * height };
+		rect_min = glm::min(rect_min, screen);
+		rect_max = glm::max(rect_max, screen);
+		nearest_z = std::min(nearest_z, c.z / c.w);
+	}
+	if (nearest_z < 0.f) return false;
+	int x0 = std::max(0, (int)std::floor(rect_min.x)), x1 = std::min(width - 1, (int)std::floor(rect_max.x));
+	int y0 = std::max(0, (int)std::floor(rect_min.y)), y1 = std::min(height - 1, (int)std::floor(rect_max.y));
+	// outside the screen is frustum culling business
+	if (x0 > x1 || y0 > y1) return false;
+
+	for (int ty = y0 / TILE_HEIGHT; ty <= y1 / TILE_HEIGHT; ty++) {
+		for (int tx = x0 / TILE_WIDTH; tx <= x1 / TILE_WIDTH; tx++) {
+			// the whole tile is nearer than the box
+			if (tile_max_depth[ty * tiles_x + tx] < nearest_z) continue;
+			for (int y = std::max(y0, ty * TILE_HEIGHT); y <= std::min(y1, (ty + 1) * TILE_HEIGHT - 1); y++)
+				for (int x = std::max(x0, tx * TILE_WIDTH); x <= std::min(x1, (tx + 1) * TILE_WIDTH - 1); x++)
+					if (depth[y * width + x] >= nearest_z) return false;
+		}
+	}
+	return true;
+}
+
+bool OcclusionCuller::enabled = false;
+bool OcclusionCuller::automatic_occluders = true;
+float OcclusionCuller::budget_ms = 1.f;
+unsigned OcclusionCuller::occluders_drawn;
+std::atomic<unsigned> OcclusionCuller::objects_culled;
+OcclusionBuffer OcclusionCuller::buffer;
+glm::mat4 OcclusionCuller::view_projection;
+bool OcclusionCuller::ready = false;
+
+void OcclusionCuller::prepareFrame(Scene3D* scene, unsigned thread_count,
+	std::function<void(unsigned, std::function<void()>)> run_job, std::function<void()> wait_jobs)
+{
+	PROFILE_FUNCTION();
+	ready = false;
+	occluders_drawn = 0;
+	objects_culled = 0;
+	if (!enabled) return;
+
+	auto deadline = std::chrono::high_resolution_clock::now() +
+		std::chrono::microseconds(static_cast<long long>(budget_ms * 1000.f));
+	Camera* cam = scene->getCamera(scene->current_camera);
+	view_projection = cam->getViewProjection();
+
+	// biggest on screen first, so when the budget runs out only the least useful ones are lost
+	struct Occluder { Object3D* obj; float size; std::vector<glm::vec4> clip_vertices; };
+	std::vector<Occluder> occluders;
+	for (auto id : scene->listObjects()) {
+		Object3D* obj = scene->getObject(id);
+		if (!obj->occluder && !automatic_occluders) continue;
+		const BoundingSphere& sphere = obj->getWorldSphere();
+		if (!cam->checkFrustum(sphere, obj->getWorldAABB())) continue;
+		float dist = glm::distance(cam->getViewSetup().position, sphere.center);
+		float size = dist > sphere.radius ? sphere.radius / dist : std::numeric_limits<float>::max();
+		if (!obj->occluder && size < AUTO_OCCLUDER_MIN_SIZE) continue;
+		occluders.push_back({ obj, size, {} });
+	}
+	std::sort(occluders.begin(), occluders.end(),
+		[](const Occluder& a, const Occluder& b) { return a.size > b.size; });
+	if (occluders.size() > MAX_OCCLUDERS) occluders.resize(MAX_OCCLUDERS);
+	buffer.clear();
+	if (occluders.empty() || thread_count == 0) return;
+
+	// 1) vertices to clip space, occluders spread round robin on the workers
+	for (unsigned t = 0; t < thread_count; t++) {
+		run_job(t, [t, thread_count, deadline, &occluders] {
+			for (size_t i = t; i < occluders.size(); i += thread_count) {
+				if (std::chrono::high_resolution_clock::now() > deadline) break;
+				Mesh3D* mesh = MeshManager::getMesh(occluders[i].obj->getMeshName());
+				glm::mat4 mvp = view_projection * occluders[i].obj->getMatrix();
+				occluders[i].clip_vertices.reserve(mesh->getVertexCount());
+				for (const auto& v : mesh->getVertices())
+					occluders[i].clip_vertices.push_back(mvp * glm::vec4(v.pos, 1.f));
+			}
+		});
+	}
+	wait_jobs();
+
+	// 2) each worker owns a band of tile rows, so no locking on the buffer
+	int tile_rows_x_thread = (buffer.countTileRows() + thread_count - 1) / thread_count;
+	for (unsigned t = 0; t < thread_count; t++) {
+		int first_row = t * tile_rows_x_thread * OcclusionBuffer::TILE_HEIGHT;
+		int last_row = (t + 1) * tile_rows_x_thread * OcclusionBuffer::TILE_HEIGHT;
+		if (first_row >= buffer.getHeight()) break;
+		run_job(t, [first_row, last_row, deadline, &occluders] {
+			for (auto& occluder : occluders) {
+				if (std::chrono::high_resolution_clock::now() > deadline) break;
+				if (occluder.clip_vertices.empty()) continue;
+				buffer.rasterize(occluder.clip_vertices,
+					MeshManager::getMesh(occluder.obj->getMeshName())->getIndices(), first_row, last_row);
+			}
+			buffer.updateTiles(first_row, last_row);
+		});
+	}
+	wait_jobs();
+
+	for (auto& occluder : occluders) {
+		if (!occluder.clip_vertices.empty()) occluders_drawn++;
+	}
+	ready = true;
+}
+
+bool OcclusionCuller::isOccluded(const AABB& world_box)
+{
+	if (!ready) return false;
+	bool occluded = buffer.isOccluded(world_box, view_projection);
+	if (occluded) objects_culled++;
+	return occluded;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "BoundingVolumes.h"
+#include "Scene3D.h"
+#include <vector>
+#include <functional>
+#include <atomic>
+
+/*
+* Low resolution CPU depth buffer in the spirit of masked software occlusion culling:
+* occluder triangles are rasterized (4 pixels at a time when SSE2 is available) and
+* every tile keeps the farthest depth written in it, so most tests are answered per tile.
+* No Vulkan in here: the buffer can be filled and queried without a device.
+*/
+class OcclusionBuffer
+{
+public:
+	static constexpr int TILE_WIDTH = 32;
+	static constexpr int TILE_HEIGHT = 8;
+
+	OcclusionBuffer(int width = 256, int height = 144);
+	// depth back to the far plane, has to be called once per frame before rasterizing
+	void clear();
+	/*
+	* Rasterizes a triangle list already transformed to clip space, only inside the rows [first_row, last_row).
+	* Only the pixels the triangles cover completely are written. An edge shared by two triangles on its
+	* two sides is inside the occluder: there the pixel centre decides, so the mesh has no cracks.
+	* Different row ranges can be filled by different threads at the same time.
+	*/
+	void rasterize(const std::vector<glm::vec4>& clip_vertices, const std::vector<uint32_t>& indices,
+		int first_row, int last_row);
+	// refreshes the per-tile farthest depth for the tile rows covering [first_row, last_row)
+	void updateTiles(int first_row, int last_row);
+	// true only if the whole box is behind the occluders already rasterized (conservative)
+	bool isOccluded(const vkengine::AABB& world_box, const glm::mat4& view_projection) const;
+	inline int getWidth() const { return width; };
+	inline int getHeight() const { return height; };
+	inline int countTileRows() const { return tiles_y; };
+	inline float getDepth(int x, int y) const { return depth[y * width + x]; };
+private:
+	// counterclockwise on screen, inner[i] for the edge opposite to vertex i
+	void rasterizeTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, const bool inner[3], int first_row, int last_row);
+	int width, height;
+	int tiles_x, tiles_y;
+	std::vector<float> depth;
+	std::vector<float> tile_max_depth;
+};
+
+/*
+* Engine side: picks the occluders of the scene, fills the buffer on the renderer workers
+* within a time budget and answers the visibility queries of the command recording.
+*/
+class OcclusionCuller
+{
+public:
+	/*
+	* Rasterizes the occluders visible from the current camera.
+	* run_job is used to dispatch the band jobs (thread index, job), wait_jobs to join them.
+	*/
+	static void prepareFrame(vkengine::Scene3D* scene, unsigned thread_count,
+		std::function<void(unsigned, std::function<void()>)> run_job, std::function<void()> wait_jobs);
+	static bool isOccluded(const vkengine::AABB& world_box);
+	static bool enabled;
+	// pick big on-screen objects as occluders even if they are not flagged
+	static bool automatic_occluders;
+	// CPU time each worker is allowed to spend rasterizing occluders
+	static float budget_ms;
+	static unsigned occluders_drawn;
+	static std::atomic<unsigned> objects_culled;
+private:
+	static OcclusionBuffer buffer;
+	static glm::mat4 view_projection;
+	static bool ready;
+};
@@ -12,9 +12,11 @@ SwapChainSupportDetails PhysicalDevice::swapChainSupportDetails;
 VkPhysicalDeviceProperties PhysicalDevice::basicProperties = {};
 VkPhysicalDeviceFeatures PhysicalDevice::basicFeatures = {};
 VkPhysicalDeviceProperties2 PhysicalDevice::deviceProperties2 = {};
+VkPhysicalDeviceIDProperties PhysicalDevice::idProperties = {};
 VkPhysicalDeviceFeatures2 PhysicalDevice::deviceFeatures2 = {};
 
 VkPhysicalDeviceHostQueryResetFeatures PhysicalDevice::hostQueryResetFeatures = {};
+VkPhysicalDeviceTimelineSemaphoreFeatures PhysicalDevice::timelineSemaphoreFeatures = {};
 VkPhysicalDeviceScalarBlockLayoutFeatures PhysicalDevice::scalarBlockLayoutFeatures = {};
 VkPhysicalDeviceDescriptorIndexingFeaturesEXT PhysicalDevice::descriptorIndexingFeatures = {};
 VkPhysicalDeviceBufferDeviceAddressFeaturesKHR PhysicalDevice::deviceAddrFeatures = {};
@@ -23,10 +25,17 @@ VkPhysicalDeviceRayTracingPipelinePropertiesKHR PhysicalDevice::rayTracingPipeli
 VkPhysicalDeviceRayTracingPipelineFeaturesKHR PhysicalDevice::rayTracingPipelineFeatures = {};
 VkPhysicalDeviceAccelerationStructurePropertiesKHR PhysicalDevice::accelerationStructureProperties = {};
 VkPhysicalDeviceAccelerationStructureFeaturesKHR PhysicalDevice::accelerationStructureFeatures = {};
+VkPhysicalDeviceRayQueryFeaturesKHR PhysicalDevice::rayQueryFeatures = {};
+#ifdef VK_KHR_present_wait
+VkPhysicalDevicePresentIdFeaturesKHR PhysicalDevice::presentIdFeatures = {};
+VkPhysicalDevicePresentWaitFeaturesKHR PhysicalDevice::presentWaitFeatures = {};
+#endif
 
 
 bool PhysicalDevice::ready;
 bool PhysicalDevice::raytracing;
+bool PhysicalDevice::ray_query;
+bool PhysicalDevice::present_wait;
 
 void PhysicalDevice::setSurface(VkSurfaceKHR surface)
 {
@@ -66,6 +75,12 @@ VkPhysicalDeviceProperties2& PhysicalDevice::getProperties()
 	return PhysicalDevice::deviceProperties2;
 }
 
+VkPhysicalDeviceIDProperties& PhysicalDevice::getIDProperties()
+{
+	if (!ready) throw std::runtime_error("PhysicalDevice Not Ready!!");
+	return PhysicalDevice::idProperties;
+}
+
 VkPhysicalDeviceFeatures2& PhysicalDevice::getPhysicalDeviceFeatures()
 {
 	if (!ready) throw std::runtime_error("PhysicalDevice Not Ready!!");
@@ -78,6 +93,22 @@ VkPhysicalDeviceRayTracingPipelinePropertiesKHR & PhysicalDevice::getPhysicalDev
 	return PhysicalDevice::rayTracingPipelineProperties;
 }
 
+VkPhysicalDeviceAccelerationStructurePropertiesKHR & PhysicalDevice::getAccelerationStructureProperties()
+{
+	if (!ready) throw std::runtime_error("PhysicalDevice Not Ready!!");
+	return PhysicalDevice::accelerationStructureProperties;
+}
+
+uint32_t PhysicalDevice::getTimestampValidBits(int family)
+{
+	if (family < 0) return 0;
+	uint32_t count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(PhysicalDevice::get(), &count, nullptr);
+	std::vector<VkQueueFamilyProperties> families(count);
+	vkGetPhysicalDeviceQueueFamilyProperties(PhysicalDevice::get(), &count, families.data());
+	return (uint32_t)family < count ? families[family].timestampValidBits : 0;
+}
+
 void PhysicalDevice::pickPhysicalDevice()
 {
 	uint32_t deviceCount = 0;
@@ -115,9 +146,15 @@ bool PhysicalDevice::isDeviceSuitable(VkPhysicalDevice device)
 	// Acceleration Structure properties:
 	accelerationStructureProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
 	rayTracingPipelineProperties.pNext = &accelerationStructureProperties;
+	// Device and driver UUIDs
+	idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+	accelerationStructureProperties.pNext = &idProperties;
 	vkGetPhysicalDeviceProperties2(device, &deviceProperties2);
 	// FEATURES //
 	hostQueryResetFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_QUERY_RESET_FEATURES;
+	// Timeline semaphores
+	timelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+	hostQueryResetFeatures.pNext = &timelineSemaphoreFeatures;
 	// Scalar Block features
 	scalarBlockLayoutFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SCALAR_BLOCK_LAYOUT_FEATURES;
 	scalarBlockLayoutFeatures.pNext = &hostQueryResetFeatures;
@@ -133,10 +170,22 @@ bool PhysicalDevice::isDeviceSuitable(VkPhysicalDevice device)
 	//Acceleration Struct features:
 	accelerationStructureFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
 	accelerationStructureFeatures.pNext = &rayTracingPipelineFeatures;
+	//Ray Query features:
+	rayQueryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR;
+	rayQueryFeatures.pNext = &accelerationStructureFeatures;
+	void* features_chain = &rayQueryFeatures;
+#ifdef VK_KHR_present_wait
+	//Present Id and Present Wait features:
+	presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+	presentIdFeatures.pNext = features_chain;
+	presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+	presentWaitFeatures.pNext = &presentIdFeatures;
+	features_chain = &presentWaitFeatures;
+#endif
 	// feature final query
 	deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
 	deviceFeatures2.features = basicFeatures;
-	deviceFeatures2.pNext = &accelerationStructureFeatures; // feature chaining
+	deviceFeatures2.pNext = features_chain; // feature chaining
 	vkGetPhysicalDeviceFeatures2(device, &deviceFeatures2);
 
 	// trovo una coda utilizzabile
@@ -144,17 +193,21 @@ bool PhysicalDevice::isDeviceSuitable(VkPhysicalDevice device)
 
 	bool extensionsSupported = checkDeviceExtensionSupport(device);
 
-	bool swapChainAdequate = false;
-	if (extensionsSupported) {
+	bool swapChainAdequate = isHeadless();
+	if (extensionsSupported && !isHeadless()) {
 		swapChainSupportDetails = querySwapChainSupport(device);
 		swapChainAdequate = !swapChainSupportDetails.formats.empty() && !swapChainSupportDetails.presentModes.empty();
 	}
+	// without a window software implementations (lavapipe, SwiftShader) are fine too, 
+	// and no geometry shader is used by the engine anyway
+	bool software = isHeadless() && basicProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU;
 
-	return basicProperties.deviceType &
-		(VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU | VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU) //dedicata o integrata 
-		&& basicFeatures.geometryShader && queueFamilyIndices.isComplete() // che supporti il geometry shader e abbia le code richieste
+	return (basicProperties.deviceType &
+		(VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU | VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU) || software) //dedicata o integrata 
+		&& (basicFeatures.geometryShader || isHeadless()) && queueFamilyIndices.isComplete() // che supporti il geometry shader e abbia le code richieste
 		&& extensionsSupported && swapChainAdequate // supporti le estensioni di superficie e supporti una swap_chain compatibile
-		&& basicFeatures.samplerAnisotropy; // supporti il multisampling
+		&& basicFeatures.samplerAnisotropy // supporti il multisampling
+		&& timelineSemaphoreFeatures.timelineSemaphore; // the frame synchronization
 }
 
 QueueFamilyIndices PhysicalDevice::findQueueFamilies(VkPhysicalDevice device)
@@ -170,11 +223,17 @@ QueueFamilyIndices PhysicalDevice::findQueueFamilies(VkPhysicalDevice device)
 	for (const auto& queueFamily : queueFamilies) {
 		// chiedo se il tipo di coda di indice i  compatilbile con la superficie
 		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+		if (!isHeadless()) {
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+		}
 
 		if (queueFamily.queueCount > 0 && (queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
 			indices.graphicsFamily = i;
 		}
+		// headless the final pass is never presented, the "present" queue is the graphics one
+		if (isHeadless()) {
+			presentSupport = indices.graphicsFamily == i;
+		}
 
 		if (queueFamily.queueCount > 0 && presentSupport) {
 			indices.presentFamily = i;
@@ -192,6 +251,14 @@ QueueFamilyIndices PhysicalDevice::findQueueFamilies(VkPhysicalDevice device)
 
 		i++;
 	}
+	// a compute only family runs beside the graphics queue instead of waiting in it
+	for (i = 0; i < (int)queueFamilies.size(); i++) {
+		if (queueFamilies[i].queueCount > 0 && (queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+			!(queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+			indices.computeFamily = i;
+			break;
+		}
+	}
 	return indices;
 }
 
@@ -204,7 +271,12 @@ bool PhysicalDevice::checkDeviceExtensionSupport(VkPhysicalDevice device)
 	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
 	std::set<std::string> requiredExtensions(requiredDeviceExtensions.begin(), requiredDeviceExtensions.end());
+	if (isHeadless()) requiredExtensions.erase(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 	std::set<std::string> raytracingExtensions(std::begin(rayTracingDeviceExtensions), std::end(rayTracingDeviceExtensions));
+	std::set<std::string> rayQueryExtensions(std::begin(rayQueryDeviceExtensions), std::end(rayQueryDeviceExtensions));
+#ifdef VK_KHR_present_wait
+	std::set<std::string> presentWaitExtensions(std::begin(presentWaitDeviceExtensions), std::end(presentWaitDeviceExtensions));
+#endif
 
 	std::cout << extensionCount << " available extensions for the GPU:" << std::endl;
 
@@ -212,9 +284,23 @@ bool PhysicalDevice::checkDeviceExtensionSupport(VkPhysicalDevice device)
 		std::cout << "\t" << extension.extensionName << std::endl;
 		requiredExtensions.erase(extension.extensionName);
 		raytracingExtensions.erase(extension.extensionName);
+		rayQueryExtensions.erase(extension.extensionName);
+#ifdef VK_KHR_present_wait
+		presentWaitExtensions.erase(extension.extensionName);
+#endif
 	}
 
 	raytracing = raytracingExtensions.empty();
+	ray_query = raytracing && rayQueryExtensions.empty() && rayQueryFeatures.rayQuery;
+	present_wait = false;
+#ifdef VK_KHR_present_wait
+	present_wait = !isHeadless() && presentWaitExtensions.empty() && presentIdFeatures.presentId && presentWaitFeatures.presentWait;
+	// the features are enabled as queried: none of them without the extensions
+	if (!present_wait) {
+		presentIdFeatures.presentId = VK_FALSE;
+		presentWaitFeatures.presentWait = VK_FALSE;
+	}
+#endif
 
 	return requiredExtensions.empty(); // se  vuoto allora ho trovato tutte le estensioni minime richieste
 }
@@ -10,6 +10,7 @@ struct QueueFamilyIndices {
 	int graphicsFamily = -1; // the queue index for graphic commands
 	int presentFamily = -1; //  the queue index for presentation commands
 	int transferFamily = -1; // the queu index for data transfer commands
+	int computeFamily = -1; // compute without graphics, for work running beside the frame (optional)
 
 	bool isComplete() {
 		return graphicsFamily >= 0 && presentFamily >= 0 && transferFamily >= 0;
@@ -27,14 +28,27 @@ class PhysicalDevice
 public:
 	static void setSurface(VkSurfaceKHR surface);
 	static VkSurfaceKHR getSurface();
+	// No surface: the frames are rendered into images of the engine and never presented
+	inline static bool isHeadless() { return surface == VK_NULL_HANDLE; };
 	static VkPhysicalDevice get();
 	static QueueFamilyIndices getQueueFamilies();
 	static SwapChainSupportDetails getSwapChainSupport();
 	static VkPhysicalDeviceProperties2& getProperties();
+	// UUIDs of the device and of the driver, what a pipeline cache saved on disk is valid for
+	static VkPhysicalDeviceIDProperties& getIDProperties();
 	static VkPhysicalDeviceFeatures2& getPhysicalDeviceFeatures();
 	static VkPhysicalDeviceRayTracingPipelinePropertiesKHR& getPhysicalDeviceRayTracingProperties();
+	static VkPhysicalDeviceAccelerationStructurePropertiesKHR& getAccelerationStructureProperties();
+	// timestampValidBits of a queue family, 0 if it can't write timestamps (or family is -1)
+	static uint32_t getTimestampValidBits(int family);
 
 	inline static bool hasRaytracing() { return raytracing; };
+	inline static bool hasRayQuery() { return ray_query; };
+	inline static bool hasAsyncCompute() { return queueFamilyIndices.computeFamily >= 0; };
+	// vkResetQueryPool from the CPU, what the GPU profiler recycles its queries with
+	inline static bool hasHostQueryReset() { return hostQueryResetFeatures.hostQueryReset; };
+	// present ids and waiting for them, to know when a frame reaches the display
+	inline static bool hasPresentWait() { return present_wait; };
 private:
 	static void pickPhysicalDevice();
 	static bool isDeviceSuitable(VkPhysicalDevice device);
@@ -53,6 +67,7 @@ private:
 	static VkPhysicalDeviceFeatures basicFeatures;
 	// Structs concatenating all features and properties of the device
 	static VkPhysicalDeviceProperties2 deviceProperties2;
+	static VkPhysicalDeviceIDProperties idProperties;
 	static VkPhysicalDeviceFeatures2 deviceFeatures2;
 	// Extra features and properties
 	// ScalarBlockLayout: to be able to specify a glsl layout as (scalar) and aligne struct member access to float 4 byte
@@ -63,11 +78,21 @@ private:
 	static VkPhysicalDeviceBufferDeviceAddressFeaturesKHR deviceAddrFeatures;
 	// Reset queries from host code
 	static VkPhysicalDeviceHostQueryResetFeatures hostQueryResetFeatures;
+	// Timeline semaphores: the frames are tracked by one counter on the GPU
+	static VkPhysicalDeviceTimelineSemaphoreFeatures timelineSemaphoreFeatures;
 	// Ray Tracing
 	static VkPhysicalDeviceRayTracingPipelinePropertiesKHR rayTracingPipelineProperties;
 	static VkPhysicalDeviceRayTracingPipelineFeaturesKHR rayTracingPipelineFeatures;
 	static VkPhysicalDeviceAccelerationStructurePropertiesKHR accelerationStructureProperties;
 	static VkPhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeatures;
+	static VkPhysicalDeviceRayQueryFeaturesKHR rayQueryFeatures;
+#ifdef VK_KHR_present_wait
+	// Present wait
+	static VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures;
+	static VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures;
+#endif
 	static bool raytracing;
+	static bool ray_query;
+	static bool present_wait;
 };
 
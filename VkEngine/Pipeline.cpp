@@ -2,13 +2,64 @@
 #include "DescriptorSets.h"
 #include "Device.h"
 #include "Mesh.h"
+#include "PhysicalDevice.h"
+#include <filesystem>
+namespace fs = std::filesystem;
 
 std::unordered_map<std::string, Pipeline> PipelineFactory::pipelines;
 std::vector<PipelineLayout> PipelineFactory::pipeline_layouts;
 std::string PipelineFactory::current_pipeline;
+VkPipelineCache PipelineFactory::pipeline_cache = VK_NULL_HANDLE;
+float PipelineFactory::pipeline_creation_ms = 0.f;
+bool PipelineFactory::use_variants = true;
+
+// What the cache data on disk was saved by, the data follows
+struct PipelineCacheFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vendor_id;
+	uint32_t device_id;
+	uint32_t driver_version;
+	uint8_t device_uuid[VK_UUID_SIZE];
+	uint8_t driver_uuid[VK_UUID_SIZE];
+	uint8_t cache_uuid[VK_UUID_SIZE]; // pipelineCacheUUID
+	uint32_t reserved; // no padding: headers are compared with memcmp
+	uint64_t data_size;
+	uint64_t checksum; // of the data, a truncated or damaged file is not given to the driver
+};
+constexpr const uint32_t PIPELINE_CACHE_MAGIC = 0x43504B56; // "VKPC"
+constexpr const uint32_t PIPELINE_CACHE_VERSION = 1;
+
+static PipelineCacheFileHeader currentDeviceHeader()
+{
+	auto& properties = PhysicalDevice::getProperties().properties;
+	auto& ids = PhysicalDevice::getIDProperties();
+	PipelineCacheFileHeader header = {};
+	header.magic = PIPELINE_CACHE_MAGIC;
+	header.version = PIPELINE_CACHE_VERSION;
+	header.vendor_id = properties.vendorID;
+	header.device_id = properties.deviceID;
+	header.driver_version = properties.driverVersion;
+	memcpy(header.device_uuid, ids.deviceUUID, VK_UUID_SIZE);
+	memcpy(header.driver_uuid, ids.driverUUID, VK_UUID_SIZE);
+	memcpy(header.cache_uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+	return header;
+}
+
+// FNV-1a
+static uint64_t cacheChecksum(const std::vector<char>& data)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (char c : data) {
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
 
 void PipelineFactory::init()
 {
+	loadPipelineCache();
 	DescriptorSetsFactory::initLayouts();
 	PipelineFactory::createPipelineLayouts();
 	DescriptorSetsFactory::initDescSetPool();
@@ -30,6 +81,8 @@ void PipelineFactory::newPipeline(const char * name,
 	pipelines[name].settings.pipeline_layout = &PipelineFactory::pipeline_layouts[type].layout;
 
 	initializeWithDefaultSettings(&pipelines[name].settings);
+	// the extent is set while recording, a resize doesn't touch the pipelines
+	setDynamicViewPortAndScissor();
 }
 
 void PipelineFactory::setVertexType(VertexTypes type)
@@ -105,56 +158,113 @@ void PipelineFactory::createRasterizationPipelines()
 	{
 		Pipeline* p = &entry.second;
 		pipeline_references.push_back(p); // saving pointer
-
-		VkGraphicsPipelineCreateInfo info = {};
-		info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		info.stageCount = p->settings.shader_stages.size();
-		info.pStages = p->settings.shader_stages.data();
-		info.pVertexInputState = &p->settings.vertexInputInfo;
-		info.pInputAssemblyState = &p->settings.inputAssembly;
-		info.pViewportState = &p->settings.viewportState;
-		info.pRasterizationState = &p->settings.rasterizer;
-		info.pMultisampleState = &p->settings.multisampler;
-		info.pDepthStencilState = &p->settings.depthStencil; // Optional
-		info.pColorBlendState = &p->settings.colorBlending;
-		if (p->settings.dynamic_states.size() > 0) 
-		{
-			info.pDynamicState = &p->settings.dynamic_states_info;
-		}else
-		{ 
-			info.pDynamicState = nullptr; 
-		}
-		info.layout = *p->settings.pipeline_layout;
-		info.renderPass = *p->render_pass;
-		info.subpass = p->subpass_index; // the index of the subpass in which the graphic pipeline will be used
-		info.basePipelineHandle = VK_NULL_HANDLE; // Optional
-		info.basePipelineIndex = -1; // Optional
-
-		create_infos.push_back(info);
+		create_infos.push_back(makeCreateInfo(p));
 	});
-	if (vkCreateGraphicsPipelines(Device::get(), VK_NULL_HANDLE, create_infos.size(), create_infos.data(),
+	auto start = std::chrono::high_resolution_clock::now();
+	if (vkCreateGraphicsPipelines(Device::get(), pipeline_cache, create_infos.size(), create_infos.data(),
 		nullptr, pipeline_objects.data()) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create graphics pipeline!");
 	}
+	pipeline_creation_ms += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 	// copia di ogni VkPipeline nella mappa
 	for (int i = 0; i < pipelines.size(); i++) {
 		pipeline_references[i]->pipeline = pipeline_objects[i];
 	}
 }
 
-void PipelineFactory::updatePipelinesViewPorts()
+VkGraphicsPipelineCreateInfo PipelineFactory::makeCreateInfo(Pipeline* p)
 {
-	for (std::pair<const std::string, Pipeline> & entry : PipelineFactory::pipelines) {
-		vkDestroyPipeline(Device::get(), entry.second.pipeline, nullptr);
-		for (auto & viewport : entry.second.settings.viewports) {
-			viewport.width = (float)SwapChainMng::get()->getExtent().width;
-			viewport.height = (float)SwapChainMng::get()->getExtent().height;
+	VkGraphicsPipelineCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	info.stageCount = p->settings.shader_stages.size();
+	info.pStages = p->settings.shader_stages.data();
+	info.pVertexInputState = &p->settings.vertexInputInfo;
+	info.pInputAssemblyState = &p->settings.inputAssembly;
+	info.pViewportState = &p->settings.viewportState;
+	info.pRasterizationState = &p->settings.rasterizer;
+	info.pMultisampleState = &p->settings.multisampler;
+	info.pDepthStencilState = &p->settings.depthStencil; // Optional
+	info.pColorBlendState = &p->settings.colorBlending;
+	if (p->settings.dynamic_states.size() > 0) 
+	{
+		info.pDynamicState = &p->settings.dynamic_states_info;
+	}else
+	{ 
+		info.pDynamicState = nullptr; 
+	}
+	info.layout = *p->settings.pipeline_layout;
+	info.renderPass = *p->render_pass;
+	info.subpass = p->subpass_index; // the index of the subpass in which the graphic pipeline will be used
+	info.basePipelineHandle = VK_NULL_HANDLE; // Optional
+	info.basePipelineIndex = -1; // Optional
+	return info;
+}
+
+VkPipeline PipelineFactory::getVariant(const char* name, int32_t light_count)
+{
+	Pipeline& p = pipelines[name];
+	if (!use_variants) return p.pipeline;
+	auto ready = p.variants.find(light_count);
+	if (ready != p.variants.end()) {
+		return ready->second != VK_NULL_HANDLE ? ready->second : p.pipeline;
+	}
+	auto pending = p.pending_variants.find(light_count);
+	if (pending == p.pending_variants.end()) {
+		// map nodes don't move: the worker can keep a pointer to the pipeline
+		Pipeline* target = &p;
+		p.pending_variants[light_count] = std::async(std::launch::async, [target, light_count]() {
+			return compileVariant(target, light_count);
+		});
+	}
+	else if (pending->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		VkPipeline variant = pending->second.get();
+		p.pending_variants.erase(pending);
+		p.variants[light_count] = variant;
+		if (variant != VK_NULL_HANDLE) return variant;
+	}
+	return p.pipeline;
+}
+
+VkPipeline PipelineFactory::compileVariant(Pipeline* p, int32_t light_count)
+{
+	VkSpecializationMapEntry entry = { 0, 0, sizeof(int32_t) };
+	VkSpecializationInfo specialization = { 1, &entry, sizeof(int32_t), &light_count };
+	std::vector<VkPipelineShaderStageCreateInfo> stages = p->settings.shader_stages;
+	for (auto& stage : stages) {
+		if (stage.stage == VK_SHADER_STAGE_FRAGMENT_BIT) stage.pSpecializationInfo = &specialization;
+	}
+	VkGraphicsPipelineCreateInfo info = makeCreateInfo(p);
+	info.pStages = stages.data();
+	// the cache is synchronized by the driver, and it's not counted in pipeline_creation_ms: nothing waits for it
+	VkPipeline variant = VK_NULL_HANDLE;
+	if (vkCreateGraphicsPipelines(Device::get(), pipeline_cache, 1, &info, nullptr, &variant) != VK_SUCCESS) {
+		std::cout << "failed to compile the variant for " << light_count << " lights, the generic pipeline is kept" << std::endl;
+		return VK_NULL_HANDLE;
+	}
+	return variant;
+}
+
+void PipelineFactory::destroyVariants()
+{
+	for (auto& entry : pipelines) {
+		for (auto& pending : entry.second.pending_variants) {
+			VkPipeline variant = pending.second.get();
+			if (variant != VK_NULL_HANDLE) vkDestroyPipeline(Device::get(), variant, nullptr);
 		}
-		for (auto & scissor : entry.second.settings.scissors) {
-			scissor.extent = SwapChainMng::get()->getExtent();
+		entry.second.pending_variants.clear();
+		for (auto& variant : entry.second.variants) {
+			if (variant.second != VK_NULL_HANDLE) vkDestroyPipeline(Device::get(), variant.second, nullptr);
 		}
+		entry.second.variants.clear();
 	}
-	// TODO: Optimize with use of pipelineCaches/derivative ecc
+}
+
+void PipelineFactory::recreatePipelines()
+{
+	for (std::pair<const std::string, Pipeline> & entry : PipelineFactory::pipelines) {
+		vkDestroyPipeline(Device::get(), entry.second.pipeline, nullptr);
+	}
+	// only the render passes changed: the shaders come from the pipeline cache
 	PipelineFactory::createRasterizationPipelines();
 }
 
@@ -165,6 +275,7 @@ void PipelineFactory::updatePipelineResources(PipelineLayoutType PLayout)
 
 void PipelineFactory::cleanUP()
 {
+	destroyVariants();
 	for (std::pair<const std::string,Pipeline> & entry : PipelineFactory::pipelines) {
 		vkDestroyPipeline(Device::get(), entry.second.pipeline, nullptr);
 	}
@@ -173,6 +284,90 @@ void PipelineFactory::cleanUP()
 		vkDestroyPipelineLayout(Device::get(), Playout.layout, nullptr);
 	}
 	pipeline_layouts.clear();
+	savePipelineCache();
+	vkDestroyPipelineCache(Device::get(), pipeline_cache, nullptr);
+	pipeline_cache = VK_NULL_HANDLE;
+}
+
+VkPipelineCache PipelineFactory::getPipelineCache()
+{
+	return pipeline_cache;
+}
+
+void PipelineFactory::loadPipelineCache()
+{
+	std::vector<char> data;
+	std::ifstream file(PIPELINE_CACHE_FILE, std::ios::binary);
+	if (file) {
+		PipelineCacheFileHeader header = {};
+		PipelineCacheFileHeader expected = currentDeviceHeader();
+		file.read(reinterpret_cast<char*>(&header), sizeof(header));
+		expected.data_size = header.data_size;
+		expected.checksum = header.checksum;
+		// what follows the header: a damaged data_size must not allocate more than the file holds
+		std::streamoff remaining = 0;
+		if (file) {
+			file.seekg(0, std::ios::end);
+			remaining = (std::streamoff)file.tellg() - (std::streamoff)sizeof(header);
+			file.seekg(sizeof(header), std::ios::beg);
+		}
+		if (!file || memcmp(&header, &expected, sizeof(header)) != 0) {
+			std::cout << "Pipeline cache saved by another device or driver, starting empty" << std::endl;
+		}
+		else if ((uint64_t)header.data_size > (uint64_t)remaining) {
+			std::cout << "Pipeline cache damaged, starting empty" << std::endl;
+		}
+		else {
+			data.resize(header.data_size);
+			file.read(data.data(), data.size());
+			if (!file || cacheChecksum(data) != header.checksum) {
+				std::cout << "Pipeline cache damaged, starting empty" << std::endl;
+				data.clear();
+			}
+		}
+	}
+
+	VkPipelineCacheCreateInfo info = { VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+	info.initialDataSize = data.size();
+	info.pInitialData = data.empty() ? nullptr : data.data();
+	if (vkCreatePipelineCache(Device::get(), &info, nullptr, &pipeline_cache) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create pipeline cache!");
+	}
+	pipeline_creation_ms = 0.f;
+}
+
+void PipelineFactory::savePipelineCache()
+{
+	if (pipeline_cache == VK_NULL_HANDLE) return;
+	size_t size = 0;
+	if (vkGetPipelineCacheData(Device::get(), pipeline_cache, &size, nullptr) != VK_SUCCESS || size == 0) return;
+	std::vector<char> data(size);
+	if (vkGetPipelineCacheData(Device::get(), pipeline_cache, &size, data.data()) != VK_SUCCESS) return;
+	data.resize(size);
+
+	PipelineCacheFileHeader header = currentDeviceHeader();
+	header.data_size = data.size();
+	header.checksum = cacheChecksum(data);
+	std::string temporary = std::string(PIPELINE_CACHE_FILE) + ".tmp";
+	{
+		std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(data.data(), data.size());
+		file.flush();
+		if (!file) {
+			std::cout << "Could not write the pipeline cache" << std::endl;
+			file.close();
+			std::error_code ignored;
+			fs::remove(temporary, ignored);
+			return;
+		}
+	}
+	std::error_code error;
+	fs::rename(temporary, PIPELINE_CACHE_FILE, error);
+	if (error) {
+		std::cout << "Could not replace the pipeline cache: " << error.message() << std::endl;
+		fs::remove(temporary, error);
+	}
 }
 
 void PipelineFactory::initializeWithDefaultSettings(VulkanPipelineSettings * setup)
@@ -379,6 +574,33 @@ void PipelineFactory::createPipelineLayouts()
 		PipelineFactory::pipeline_layouts[PIPELINE_LAYOUT_RAY_TRACING].descriptors = bundle;
 
 	}
+
+	// Hybrid rendering pipeline layout--------------------------------------------
+	{
+		std::vector<VkDescriptorSetLayout> layouts;
+		layouts.push_back(DescriptorSetsFactory::getDescSetLayout(DSL_RAY_TRACING_SCENE)->layout);
+		layouts.push_back(DescriptorSetsFactory::getDescSetLayout(DSL_UNIFORM_BUFFER)->layout); // set 1 like in the standard layout, for phong.vert
+		layouts.push_back(DescriptorSetsFactory::getDescSetLayout(DSL_RT_IMAGE_AND_OBJECTS)->layout);
+		VkPushConstantRange pushRange = {};
+		pushRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+		pushRange.size = sizeof(MainPushConstantBlock);
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+		pipelineLayoutInfo.setLayoutCount = layouts.size();
+		pipelineLayoutInfo.pSetLayouts = layouts.data();
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushRange;
+		if (vkCreatePipelineLayout(Device::get(),
+			&pipelineLayoutInfo, nullptr,
+			&PipelineFactory::pipeline_layouts[PIPELINE_LAYOUT_HYBRID].layout)
+			!= VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create pipeline layout!");
+		}
+		// empty bundle: the sets of the ray tracing layout are bound, same desc set layouts
+		DescSetBundle bundle = {};
+		bundle.data_context = DescSetsResourceContext::SCENE_DATA;
+		PipelineFactory::pipeline_layouts[PIPELINE_LAYOUT_HYBRID].descriptors = bundle;
+	}
 	
 	// ImGui rendering pipeline layout-------------------------------------------
 	{
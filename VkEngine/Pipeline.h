@@ -5,9 +5,13 @@
 #include "DescriptorSets.h"
 #include "Mesh.h"
 #include "commons.h"
+#include <future>
 
 constexpr const char* STD_3D_PIPELINE_ID = "standard";
 constexpr const char* IMGUI_PIPELINE_ID = "imgui";
+constexpr const char* HYBRID_3D_PIPELINE_ID = "hybrid";
+// compiled pipelines kept between runs, relative to the working directory like the shaders
+constexpr const char* PIPELINE_CACHE_FILE = "pipeline_cache.bin";
 
 /*
 A set of predefined pipelines Layouts used inside the engine.
@@ -16,6 +20,8 @@ enum PipelineLayoutType {
 	PIPELINE_LAYOUT_STANDARD,
 	PIPELINE_LAYOUT_RAY_TRACING,
 	PIPELINE_LAYOUT_IMGUI,
+	// rasterization reading the ray tracing descriptor sets, it has none of its own
+	PIPELINE_LAYOUT_HYBRID,
 	PipelineLayoutType_END
 };
 
@@ -51,11 +57,14 @@ typedef struct {
 } VulkanPipelineSettings;
 
 typedef struct {
-	VkPipeline pipeline;
+	VkPipeline pipeline; // the generic variant
 	PipelineLayoutType layout_type;
 	VulkanPipelineSettings settings;
 	VkRenderPass *render_pass;
 	unsigned subpass_index;
+	// fragment shader specialized on the light count (constant_id 0), VK_NULL_HANDLE if the compilation failed
+	std::map<int32_t, VkPipeline> variants;
+	std::map<int32_t, std::future<VkPipeline>> pending_variants; // compiling on a worker thread
 } Pipeline;
 
 /*
@@ -78,19 +87,39 @@ public:
 	// static void enableStencil();
 	// default should be culling set to back
 	static void setCulling(bool flag);
-	// This is used for imgui 
+	// Viewport and scissor set in the command buffer, default for every pipeline
 	static void setDynamicViewPortAndScissor();
 	// creates all the pipelines added
 	static void createRasterizationPipelines();
-	// Recreates all pipelines with the current swapchain extent,should be called after swapchain recreation.
-	static void updatePipelinesViewPorts();
+	// Recreates all pipelines against the current render passes, should be called after they are recreated.
+	static void recreatePipelines();
 	// Updates all decriptors of a pipeline layout
 	static void updatePipelineResources(PipelineLayoutType PLayout);
-	// destroyes everything reverting state previous to init()
+	// The pipeline with its loops over the lights unrolled for light_count, compiled in the background the
+	// first time it is asked for: the generic pipeline is returned until then. Main thread only
+	static VkPipeline getVariant(const char* name, int32_t light_count);
+	// Waits for the ones still compiling, they are compiled again when asked for.
+	// Has to be called before destroying the render passes the pipelines were made for
+	static void destroyVariants();
+	// false draws with the generic pipelines only
+	static bool use_variants;
+	// destroyes everything reverting state previous to init(), the pipeline cache is saved first
 	static void cleanUP();
+	// every pipeline is created through it, graphics and ray tracing
+	static VkPipelineCache getPipelineCache();
+	// time spent in pipeline creation calls since init(), the first run has to compile everything
+	static float pipeline_creation_ms;
 private:
+	// an empty cache if the file is missing, damaged or was saved by another device or driver
+	static void loadPipelineCache();
+	// written next to the old file, then renamed over it: an interrupted save never leaves half a cache
+	static void savePipelineCache();
 	static void initializeWithDefaultSettings(VulkanPipelineSettings * setup);
 	static void createPipelineLayouts();
+	static VkGraphicsPipelineCreateInfo makeCreateInfo(Pipeline* p);
+	// runs on a worker thread, only reads the settings of p
+	static VkPipeline compileVariant(Pipeline* p, int32_t light_count);
 	//static std::unordered_map<std::string, Shader> shaders;
 	static std::string current_pipeline;
+	static VkPipelineCache pipeline_cache;
 };
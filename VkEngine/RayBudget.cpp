@@ -0,0 +1,77 @@
+#include "RayBudget.h"
+#include <algorithm>
+
+using namespace vkengine;
+
+// a step up is considered failed if the controller has to step down within this many frames
+constexpr const uint32_t UPGRADE_PROBE_FRAMES = 60;
+// longest wait between two attempts to step up, ~8s at 60 fps
+constexpr const uint32_t MAX_UPGRADE_WAIT = 512;
+
+void RayBudgetController::configure(const RayBudgetSettings& settings, uint32_t max_depth)
+{
+	if (settings == this->settings && max_depth == this->max_depth) return;
+	this->settings = settings;
+	this->max_depth = max_depth;
+	filter.configure(settings.target_ms, settings.tolerance, settings.settle_frames, settings.smoothing);
+
+	uint32_t top_depth = std::max(max_depth, 1u);
+	uint32_t min_depth = std::min(std::max(settings.min_depth, 1u), top_depth);
+	float min_scale = std::min(std::max(settings.min_resolution_scale, 0.1f), 1.f);
+	ladder.clear();
+	// roulette only matters if there is more than one bounce
+	ladder.push_back({ top_depth, 1.f, 0.f });
+	if (top_depth > 1) {
+		ladder.push_back({ top_depth, 1.f, 0.25f });
+		ladder.push_back({ top_depth, 1.f, 0.5f });
+	}
+	for (uint32_t depth = top_depth - 1; depth >= min_depth && depth > 0; depth--) {
+		ladder.push_back({ depth, 1.f, ladder.back().roulette });
+	}
+	for (float scale = 0.85f; ; scale *= 0.85f) {
+		ladder.push_back({ min_depth, std::max(scale, min_scale), ladder.back().roulette });
+		if (scale <= min_scale) break;
+	}
+	upgrade_wait = 2 * settings.settle_frames;
+	moveTo(0);
+}
+
+void RayBudgetController::moveTo(size_t new_level)
+{
+	level = new_level;
+	filter.restart();
+	frames_at_level = 0;
+	frames_under = 0;
+}
+
+RayBudget RayBudgetController::update(float gpu_ms)
+{
+	if (!settings.enabled) return current();
+	FrameTimeFilter::Verdict verdict = filter.add(gpu_ms);
+	if (verdict == FrameTimeFilter::SETTLING) return current();
+	frames_at_level++;
+
+	if (verdict == FrameTimeFilter::OVER) {
+		if (probing && frames_at_level < UPGRADE_PROBE_FRAMES) {
+			upgrade_wait = std::min(upgrade_wait * 2, MAX_UPGRADE_WAIT);
+		}
+		probing = false;
+		if (level + 1 < ladder.size()) moveTo(level + 1);
+		return current();
+	}
+	if (probing && frames_at_level >= UPGRADE_PROBE_FRAMES) {
+		// the step up held: the next one can be tried as soon as there is room
+		probing = false;
+		upgrade_wait = 2 * settings.settle_frames;
+	}
+	if (verdict == FrameTimeFilter::UNDER && level > 0) {
+		if (++frames_under >= upgrade_wait) {
+			probing = true;
+			moveTo(level - 1);
+		}
+	}
+	else {
+		frames_under = 0;
+	}
+	return current();
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "FrameTimeFilter.h"
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace vkengine
+{
+	struct RayBudgetSettings {
+		bool enabled = false;
+		// GPU time of the ray tracing dispatch the controller aims at
+		float target_ms = 8.f;
+		// no change while the smoothed time is within target_ms * (1 +- tolerance)
+		float tolerance = 0.15f;
+		// reflections are never cut below this depth (nor above the depth set by the user)
+		uint32_t min_depth = 2;
+		float min_resolution_scale = 0.5f;
+		// frames ignored after a change: they were recorded with the previous settings
+		uint32_t settle_frames = 6;
+		// weight of a new timing in the running average
+		float smoothing = 0.2f;
+		inline bool operator==(const RayBudgetSettings& other) const {
+			return enabled == other.enabled && target_ms == other.target_ms && tolerance == other.tolerance &&
+				min_depth == other.min_depth && min_resolution_scale == other.min_resolution_scale &&
+				settle_frames == other.settle_frames && smoothing == other.smoothing;
+		};
+	};
+
+	// What the ray tracing dispatch is allowed to cost
+	struct RayBudget {
+		uint32_t max_depth;
+		float resolution_scale; // the dispatch covers this fraction of the storage image on each axis
+		float roulette; // probability of ending a reflection path at each bounce after the first
+		inline bool operator==(const RayBudget& other) const {
+			return max_depth == other.max_depth && resolution_scale == other.resolution_scale && roulette == other.roulette;
+		};
+		inline bool operator!=(const RayBudget& other) const { return !(*this == other); };
+	};
+
+	/*
+	* Walks a ladder of budgets, from full quality to the cheapest one, one step at a time:
+	* first more roulette, then less depth, then less resolution.
+	* Only measured times go in and budgets come out, so it can be simulated without a device.
+	*/
+	class RayBudgetController
+	{
+	public:
+		// rebuilds the ladder (and starts again from its top) only if something changed,
+		// max_depth is the depth of the top of the ladder
+		void configure(const RayBudgetSettings& settings, uint32_t max_depth);
+		// one measured dispatch, in ms. Returns the budget of the next frame
+		RayBudget update(float gpu_ms);
+		inline const RayBudget& current() const { return ladder[level]; };
+		inline float smoothedTime() const { return filter.smoothedTime(); };
+		inline size_t countLevels() const { return ladder.size(); };
+		// frames under the target before the next step up
+		inline uint32_t upgradeWait() const { return upgrade_wait; };
+	private:
+		void moveTo(size_t new_level);
+		RayBudgetSettings settings;
+		FrameTimeFilter filter;
+		uint32_t max_depth = 0;
+		std::vector<RayBudget> ladder = { { 1, 1.f, 0.f } };
+		size_t level = 0;
+		uint32_t frames_at_level = 0;
+		uint32_t frames_under = 0;
+		// a step up that had to be undone doubles the wait before the next one, so it can't oscillate
+		uint32_t upgrade_wait = 0;
+		bool probing = false;
+	};
+}
@@ -0,0 +1,441 @@
+#include "RenderGraph.h"
+#include "ApiUtils.h"
+#include <stdexcept>
+#include <algorithm>
+
+struct AccessInfo {
+	VkImageLayout layout;
+	VkPipelineStageFlags stage;
+	VkAccessFlags access;
+	VkImageUsageFlags usage;
+};
+
+static AccessInfo accessInfo(RenderGraphAccess access)
+{
+	switch (access) {
+	case RG_COLOR_ATTACHMENT:
+		return { VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT };
+	case RG_DEPTH_ATTACHMENT:
+		return { VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+			VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT };
+	case RG_SAMPLED_FRAGMENT:
+		return { VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_USAGE_SAMPLED_BIT };
+	case RG_STORAGE_RAY_TRACING:
+		return { VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+			VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_USAGE_STORAGE_BIT };
+	case RG_TRANSFER_SOURCE:
+		return { VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_USAGE_TRANSFER_SRC_BIT };
+	}
+	throw std::runtime_error("unknown render graph access!");
+}
+
+// the part of an access that has to be made available to the uses after it
+static const VkAccessFlags WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+	VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+static bool isAttachment(RenderGraphAccess access)
+{
+	return access == RG_COLOR_ATTACHMENT || access == RG_DEPTH_ATTACHMENT;
+}
+
+void RenderGraph::clear()
+{
+	passes.clear();
+	resources.clear();
+	compiled.clear();
+	transients.clear();
+	slot_count = 0;
+}
+
+uint32_t RenderGraph::createImage(const std::string& name, const GraphImageDesc& desc)
+{
+	resources.push_back({ name, desc, false, {} });
+	return (uint32_t)resources.size() - 1;
+}
+
+uint32_t RenderGraph::importImage(const std::string& name, const GraphImageDesc& desc, const GraphImportInfo& info)
+{
+	resources.push_back({ name, desc, true, info });
+	return (uint32_t)resources.size() - 1;
+}
+
+uint32_t RenderGraph::addPass(const std::string& name, RecordFunction record, bool side_effects)
+{
+	passes.push_back({ name, record, side_effects, {} });
+	return (uint32_t)passes.size() - 1;
+}
+
+void RenderGraph::read(uint32_t pass, uint32_t resource, RenderGraphAccess access)
+{
+	if (pass >= passes.size() || resource >= resources.size()) {
+		throw std::runtime_error("render graph: unknown pass or resource!");
+	}
+	passes[pass].uses.push_back({ resource, access, false });
+}
+
+void RenderGraph::write(uint32_t pass, uint32_t resource, RenderGraphAccess access)
+{
+	if (pass >= passes.size() || resource >= resources.size()) {
+		throw std::runtime_error("render graph: unknown pass or resource!");
+	}
+	passes[pass].uses.push_back({ resource, access, true });
+}
+
+void RenderGraph::compile(bool lazy_memory)
+{
+	compiled.clear();
+	transients.clear();
+	slot_count = 0;
+	for (auto& pass : passes) {
+		for (size_t i = 0; i < pass.uses.size(); i++) {
+			for (size_t j = i + 1; j < pass.uses.size(); j++) {
+				if (pass.uses[i].resource == pass.uses[j].resource &&
+					accessInfo(pass.uses[i].access).layout != accessInfo(pass.uses[j].access).layout) {
+					throw std::runtime_error("render graph: pass " + pass.name + " uses " +
+						resources[pass.uses[i].resource].name + " in two layouts!");
+				}
+			}
+		}
+	}
+	cullPasses();
+	// everything after the first pass touching an acquired image waits for it
+	uint32_t batch = 0;
+	for (uint32_t p = 0; p < passes.size(); p++) {
+		if (passes[p].culled) continue;
+		for (auto& use : passes[p].uses) {
+			if (resources[use.resource].imported && resources[use.resource].import.acquired) batch = 1;
+		}
+		compiled.push_back({ p, batch, {}, {} });
+	}
+	assignSlots(lazy_memory);
+	deriveBarriers();
+}
+
+void RenderGraph::cullPasses()
+{
+	// from the last pass back: a pass is needed if it writes something read after it, or exported
+	std::vector<bool> needed(resources.size());
+	for (size_t r = 0; r < resources.size(); r++) {
+		needed[r] = resources[r].imported && resources[r].import.exported;
+	}
+	for (size_t p = passes.size(); p-- > 0;) {
+		Pass& pass = passes[p];
+		bool used = pass.side_effects;
+		for (auto& use : pass.uses) {
+			if (use.write && needed[use.resource]) used = true;
+		}
+		pass.culled = !used;
+		if (!used) continue;
+		// what it writes is not needed before it, unless it reads it too
+		for (auto& use : pass.uses) {
+			if (use.write) needed[use.resource] = false;
+		}
+		for (auto& use : pass.uses) {
+			if (!use.write) needed[use.resource] = true;
+		}
+	}
+}
+
+void RenderGraph::assignSlots(bool lazy_memory)
+{
+	std::vector<int> transient_index(resources.size(), -1);
+	for (uint32_t i = 0; i < compiled.size(); i++) {
+		for (auto& use : passes[compiled[i].pass].uses) {
+			if (resources[use.resource].imported) continue;
+			if (transient_index[use.resource] < 0) {
+				transient_index[use.resource] = (int)transients.size();
+				transients.push_back({ use.resource, 0, i, i, 0, lazy_memory });
+			}
+			TransientImage& transient = transients[transient_index[use.resource]];
+			transient.last_use = i;
+			transient.usage |= accessInfo(use.access).usage;
+			transient.lazy = transient.lazy && isAttachment(use.access);
+		}
+	}
+	// first fit, in order of first use. Color and depth images are not mixed, their memory types can differ
+	std::vector<uint32_t> slot_end;
+	std::vector<VkImageAspectFlags> slot_aspect;
+	for (auto& transient : transients) {
+		VkImageAspectFlags aspect = resources[transient.resource].desc.aspect;
+		if (transient.lazy) {
+			transient.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+			transient.slot = slot_count++;
+			slot_end.push_back(UINT32_MAX);
+			slot_aspect.push_back(aspect);
+			continue;
+		}
+		uint32_t slot = 0;
+		while (slot < slot_count && (slot_end[slot] >= transient.first_use || slot_aspect[slot] != aspect)) slot++;
+		if (slot == slot_count) {
+			slot_count++;
+			slot_end.push_back(0);
+			slot_aspect.push_back(aspect);
+		}
+		transient.slot = slot;
+		slot_end[slot] = transient.last_use;
+	}
+}
+
+void RenderGraph::deriveBarriers()
+{
+	struct State {
+		VkImageLayout layout;
+		// the last write (or layout transition) and the reads since
+		VkPipelineStageFlags write_stage;
+		VkAccessFlags write_access;
+		VkPipelineStageFlags read_stages;
+		// stages the last write is already visible to
+		VkPipelineStageFlags synced_stages;
+		int last_pass;
+	};
+	std::vector<State> states(resources.size());
+	std::vector<VkPipelineStageFlags> used_stages(resources.size(), 0);
+	std::vector<VkAccessFlags> written_access(resources.size(), 0);
+	for (auto& compiled_pass : compiled) {
+		for (auto& use : passes[compiled_pass.pass].uses) {
+			used_stages[use.resource] |= accessInfo(use.access).stage;
+			if (use.write) written_access[use.resource] |= accessInfo(use.access).access & WRITE_ACCESS;
+		}
+	}
+	for (size_t r = 0; r < resources.size(); r++) {
+		if (resources[r].imported) {
+			states[r] = { resources[r].import.initial_layout, resources[r].import.initial_stage, 0, 0, 0, -1 };
+		}
+	}
+	// a transient starts after the last image of its slot used before it: in this frame,
+	// or in the previous one for the first image of the slot
+	for (auto& transient : transients) {
+		const TransientImage* previous = nullptr;
+		for (auto& other : transients) {
+			if (other.slot == transient.slot && other.last_use < transient.first_use &&
+				(previous == nullptr || other.last_use > previous->last_use)) previous = &other;
+		}
+		if (previous == nullptr) {
+			previous = &transient;
+			for (auto& other : transients) {
+				if (other.slot == transient.slot && other.last_use > previous->last_use) previous = &other;
+			}
+		}
+		states[transient.resource] = { VK_IMAGE_LAYOUT_UNDEFINED, used_stages[previous->resource],
+			written_access[previous->resource], 0, 0, -1 };
+	}
+
+	for (uint32_t i = 0; i < compiled.size(); i++) {
+		for (auto& use : passes[compiled[i].pass].uses) {
+			State& state = states[use.resource];
+			AccessInfo info = accessInfo(use.access);
+			if (state.last_pass == (int)i) {
+				// used twice by the same pass, in the same layout: the first barrier covers both
+				if (use.write) {
+					state.write_stage |= info.stage;
+					state.write_access |= info.access & WRITE_ACCESS;
+				}
+				continue;
+			}
+			bool transition = state.layout != info.layout;
+			bool barrier = false;
+			VkPipelineStageFlags src_stage = 0;
+			VkAccessFlags src_access = 0;
+			if (transition || use.write) {
+				// the last write and the reads since have to be done with it
+				src_stage = state.write_stage | state.read_stages;
+				src_access = state.write_access;
+				barrier = transition || src_stage != 0;
+			}
+			else if (state.write_stage != 0 && (state.synced_stages & info.stage) != info.stage) {
+				// read after write, not yet visible to these stages
+				src_stage = state.write_stage;
+				src_access = state.write_access;
+				barrier = true;
+			}
+			if (barrier) {
+				compiled[i].barriers.push_back({ use.resource, state.layout, info.layout,
+					src_stage != 0 ? src_stage : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, info.stage, src_access, info.access });
+			}
+			if (use.write) {
+				state.write_stage = info.stage;
+				state.write_access = info.access & WRITE_ACCESS;
+				state.read_stages = 0;
+				state.synced_stages = 0;
+			}
+			else if (transition) {
+				// the transition is the last write, made before these stages
+				state.write_stage = info.stage;
+				state.write_access = 0;
+				state.read_stages = info.stage;
+				state.synced_stages = info.stage;
+			}
+			else {
+				state.read_stages |= info.stage;
+				if (barrier) state.synced_stages |= info.stage;
+			}
+			state.layout = info.layout;
+			state.last_pass = (int)i;
+		}
+	}
+
+	// imported images are left in their final layouts by the last pass using them
+	for (uint32_t r = 0; r < resources.size(); r++) {
+		const State& state = states[r];
+		if (!resources[r].imported || state.last_pass < 0) continue;
+		VkImageLayout final_layout = resources[r].import.final_layout;
+		if (final_layout == VK_IMAGE_LAYOUT_UNDEFINED || final_layout == state.layout) continue;
+		compiled[state.last_pass].final_barriers.push_back({ r, state.layout, final_layout,
+			state.write_stage | state.read_stages, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, state.write_access, 0 });
+	}
+}
+
+bool RenderGraph::isCulled(uint32_t pass) const
+{
+	return passes[pass].culled;
+}
+
+VkPipelineStageFlags RenderGraph::getFirstUseStages(uint32_t resource) const
+{
+	for (auto& compiled_pass : compiled) {
+		VkPipelineStageFlags stages = 0;
+		for (auto& use : passes[compiled_pass.pass].uses) {
+			if (use.resource == resource) stages |= accessInfo(use.access).stage;
+		}
+		if (stages != 0) return stages;
+	}
+	return 0;
+}
+
+void RenderGraph::realize(VkPhysicalDevice physicalDevice, VkDevice device)
+{
+	if (!transient_images.empty()) {
+		throw std::runtime_error("render graph: the transients have to be released before realizing new ones!");
+	}
+	for (uint32_t slot = 0; slot < slot_count; slot++) {
+		VkMemoryRequirements slot_requirements = { 0, 1, ~0u };
+		std::vector<VkImage> slot_images;
+		bool lazy = false;
+		for (auto& transient : transients) {
+			if (transient.slot != slot) continue;
+			Resource& resource = resources[transient.resource];
+			VkImageCreateInfo imageInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+			imageInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageInfo.extent = { resource.desc.extent.width, resource.desc.extent.height, 1 };
+			imageInfo.mipLevels = 1;
+			imageInfo.arrayLayers = 1;
+			imageInfo.format = resource.desc.format;
+			imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			imageInfo.usage = transient.usage;
+			imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			if (vkCreateImage(device, &imageInfo, nullptr, &resource.image) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create image!");
+			}
+			transient_images.push_back(resource.image);
+			slot_images.push_back(resource.image);
+
+			VkMemoryRequirements requirements;
+			vkGetImageMemoryRequirements(device, resource.image, &requirements);
+			slot_requirements.size = std::max(slot_requirements.size, requirements.size);
+			slot_requirements.alignment = std::max(slot_requirements.alignment, requirements.alignment);
+			slot_requirements.memoryTypeBits &= requirements.memoryTypeBits;
+			lazy = transient.lazy;
+		}
+		if (slot_images.empty()) continue;
+		if (slot_requirements.memoryTypeBits == 0) {
+			throw std::runtime_error("render graph: the images of a memory slot have no memory type in common!");
+		}
+
+		// the images of a slot all start at offset 0, their lifetimes don't overlap
+		VkMemoryAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+		allocInfo.allocationSize = slot_requirements.size;
+		allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, slot_requirements.memoryTypeBits,
+			lazy ? VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VkDeviceMemory memory;
+		if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate image memory!");
+		}
+		transient_memories.push_back(memory);
+		for (auto image : slot_images) {
+			vkBindImageMemory(device, image, memory, 0);
+		}
+	}
+	for (auto& transient : transients) {
+		Resource& resource = resources[transient.resource];
+		// attachments are viewed through the depth only
+		VkImageAspectFlags aspect = resource.desc.aspect & VK_IMAGE_ASPECT_DEPTH_BIT ? VK_IMAGE_ASPECT_DEPTH_BIT : resource.desc.aspect;
+		resource.view = createImageView(device, resource.image, resource.desc.format, aspect);
+		transient_views.push_back(resource.view);
+	}
+}
+
+std::function<void()> RenderGraph::releaseTransients(VkDevice device)
+{
+	for (auto& transient : transients) {
+		resources[transient.resource].image = VK_NULL_HANDLE;
+		resources[transient.resource].view = VK_NULL_HANDLE;
+	}
+	std::vector<VkImage> images = transient_images;
+	std::vector<VkImageView> views = transient_views;
+	std::vector<VkDeviceMemory> memories = transient_memories;
+	transient_images.clear();
+	transient_views.clear();
+	transient_memories.clear();
+	return [device, images, views, memories]() {
+		for (auto view : views) vkDestroyImageView(device, view, nullptr);
+		for (auto image : images) vkDestroyImage(device, image, nullptr);
+		for (auto memory : memories) vkFreeMemory(device, memory, nullptr);
+	};
+}
+
+VkImageView RenderGraph::getImageView(uint32_t resource) const
+{
+	return resources[resource].view;
+}
+
+void RenderGraph::setImage(uint32_t resource, VkImage image)
+{
+	if (!resources[resource].imported) {
+		throw std::runtime_error("render graph: only imported images can be set!");
+	}
+	resources[resource].image = image;
+}
+
+void RenderGraph::execute(uint32_t batch, VkCommandBuffer cmd, uint32_t frame) const
+{
+	for (auto& compiled_pass : compiled) {
+		if (compiled_pass.batch != batch) continue;
+		recordBarriers(cmd, compiled_pass.barriers);
+		passes[compiled_pass.pass].record(cmd, frame);
+		recordBarriers(cmd, compiled_pass.final_barriers);
+	}
+}
+
+void RenderGraph::recordBarriers(VkCommandBuffer cmd, const std::vector<GraphBarrier>& barriers) const
+{
+	if (barriers.empty()) return;
+	std::vector<VkImageMemoryBarrier> image_barriers;
+	VkPipelineStageFlags src_stage = 0, dst_stage = 0;
+	for (auto& barrier : barriers) {
+		const Resource& resource = resources[barrier.resource];
+		if (resource.image == VK_NULL_HANDLE) {
+			throw std::runtime_error("render graph: no image for " + resource.name + "!");
+		}
+		VkImageMemoryBarrier image_barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+		image_barrier.oldLayout = barrier.old_layout;
+		image_barrier.newLayout = barrier.new_layout;
+		image_barrier.srcAccessMask = barrier.src_access;
+		image_barrier.dstAccessMask = barrier.dst_access;
+		image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		image_barrier.image = resource.image;
+		image_barrier.subresourceRange = { resource.desc.aspect, 0, 1, 0, 1 };
+		image_barriers.push_back(image_barrier);
+		src_stage |= barrier.src_stage;
+		dst_stage |= barrier.dst_stage;
+	}
+	vkCmdPipelineBarrier(cmd, src_stage, dst_stage, 0, 0, nullptr, 0, nullptr,
+		(uint32_t)image_barriers.size(), image_barriers.data());
+}
@@ -0,0 +1,140 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <string>
+#include <functional>
+
+// How a pass uses an image: each one implies the layout, stages and access of the barriers around it
+enum RenderGraphAccess {
+	RG_COLOR_ATTACHMENT,
+	RG_DEPTH_ATTACHMENT,
+	RG_SAMPLED_FRAGMENT, // read by fragment shaders
+	RG_STORAGE_RAY_TRACING, // storage image of the ray tracing shaders
+	RG_TRANSFER_SOURCE
+};
+
+struct GraphImageDesc {
+	VkFormat format;
+	VkExtent2D extent;
+	VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+};
+
+// An image the graph doesn't own (swapchain, attachments kept between frames): its state before and after a frame
+struct GraphImportInfo {
+	VkImageLayout initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	// where the work before the frame is waited, e.g. the stage of the semaphore wait of an acquired image
+	VkPipelineStageFlags initial_stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	// layout the frame leaves it in, UNDEFINED to keep the one of its last use
+	VkImageLayout final_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	// used after the frame (presented, read back...): the passes writing it are never culled
+	bool exported = true;
+	// usable only after a semaphore wait: the first pass using it starts the second batch
+	bool acquired = false;
+};
+
+struct GraphBarrier {
+	uint32_t resource;
+	VkImageLayout old_layout;
+	VkImageLayout new_layout;
+	VkPipelineStageFlags src_stage;
+	VkPipelineStageFlags dst_stage;
+	VkAccessFlags src_access;
+	VkAccessFlags dst_access;
+};
+
+struct CompiledPass {
+	uint32_t pass;
+	// 0 before the acquired images are waited for, 1 after
+	uint32_t batch;
+	std::vector<GraphBarrier> barriers;
+	// to the final layouts of the imported images last used by the pass
+	std::vector<GraphBarrier> final_barriers;
+};
+
+// Transient images in the same slot are never used by the same passes and share its memory
+struct TransientImage {
+	uint32_t resource;
+	uint32_t slot;
+	// positions in the compiled passes
+	uint32_t first_use, last_use;
+	VkImageUsageFlags usage;
+	// only attachments of render passes, never stored: lazily allocated memory, a slot of its own
+	bool lazy;
+};
+
+/*
+* The passes of a frame with the images they read and write, in the order they are recorded.
+* compile() culls the passes nobody needs the output of, derives the layout transitions and barriers
+* between the passes and puts the transient images with disjoint lifetimes in the same memory slot.
+* Up to compile() no Vulkan function is called: a graph can be declared and compiled without a device.
+* realize() and execute() are the device side: images and memory of the transients, and the recording.
+*/
+class RenderGraph
+{
+public:
+	// command buffer and frame index (the swapchain image)
+	typedef std::function<void(VkCommandBuffer, uint32_t)> RecordFunction;
+
+	// forgets the passes and resources, not the realized transients (see releaseTransients)
+	void clear();
+	uint32_t createImage(const std::string& name, const GraphImageDesc& desc);
+	uint32_t importImage(const std::string& name, const GraphImageDesc& desc, const GraphImportInfo& info);
+	// a pass with side effects (e.g. writes to buffers) is never culled
+	uint32_t addPass(const std::string& name, RecordFunction record, bool side_effects = false);
+	void read(uint32_t pass, uint32_t resource, RenderGraphAccess access);
+	// the pass is taken to overwrite what it writes: the writers before it are culled if nobody read them
+	void write(uint32_t pass, uint32_t resource, RenderGraphAccess access);
+	// lazy_memory if the device has lazily allocated memory for the transient attachments
+	void compile(bool lazy_memory = false);
+
+	inline const std::vector<CompiledPass>& getCompiledPasses() const { return compiled; };
+	inline const std::vector<TransientImage>& getTransients() const { return transients; };
+	inline uint32_t countSlots() const { return slot_count; };
+	bool isCulled(uint32_t pass) const;
+	// stages of the first use of an image in the compiled graph, 0 if no pass uses it
+	VkPipelineStageFlags getFirstUseStages(uint32_t resource) const;
+
+	// images and memory of the transients of the last compile, the previous ones have to be released first
+	void realize(VkPhysicalDevice physicalDevice, VkDevice device);
+	// the caller destroys them once no frame uses them anymore
+	std::function<void()> releaseTransients(VkDevice device);
+	VkImageView getImageView(uint32_t resource) const;
+	// an imported image for the frames recorded from now on
+	void setImage(uint32_t resource, VkImage image);
+	// the passes of a batch with their barriers, in a command buffer being recorded
+	void execute(uint32_t batch, VkCommandBuffer cmd, uint32_t frame) const;
+private:
+	struct Use {
+		uint32_t resource;
+		RenderGraphAccess access;
+		bool write;
+	};
+	struct Pass {
+		std::string name;
+		RecordFunction record;
+		bool side_effects;
+		std::vector<Use> uses;
+		bool culled = false;
+	};
+	struct Resource {
+		std::string name;
+		GraphImageDesc desc;
+		bool imported;
+		GraphImportInfo import;
+		VkImage image = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+	};
+	void cullPasses();
+	void assignSlots(bool lazy_memory);
+	void deriveBarriers();
+	void recordBarriers(VkCommandBuffer cmd, const std::vector<GraphBarrier>& barriers) const;
+	std::vector<Pass> passes;
+	std::vector<Resource> resources;
+	std::vector<CompiledPass> compiled;
+	std::vector<TransientImage> transients;
+	uint32_t slot_count = 0;
+	// realized transients
+	std::vector<VkImage> transient_images;
+	std::vector<VkImageView> transient_views;
+	std::vector<VkDeviceMemory> transient_memories;
+};
@@ -7,6 +7,9 @@
 #include "MeshManager.h"
 #include "TextureManager.h"
 #include "LightSource.h"
+#include "OcclusionCulling.h"
+#include "GpuProfiler.h"
+#include "CpuProfiler.h"
 #include "ApiUtils.h"
 #include "commons.h"
 
@@ -15,22 +18,39 @@ using namespace vkengine;
 // function to feed a thread job
 void threadRenderCode(Object3D* obj, Camera* cam, 
 	ThreadData* threadData, uint32_t frameBufferIndex, uint32_t cmdBufferIndex, 
-	VkCommandBufferInheritanceInfo inheritanceInfo, std::vector<VkDescriptorSet> descriptorSets);
+	VkCommandBufferInheritanceInfo inheritanceInfo, std::vector<VkDescriptorSet> descriptorSets, bool hybrid, VkPipeline pipeline,
+	VkExtent2D extent);
 
 bool Renderer::useRayTracing;
+bool Renderer::useHybridRendering;
 bool Renderer::multithreading;
-FrameAttachment Renderer::final_depth_buffer;
-FrameAttachment Renderer::offScreen_depth_buffer;
 std::vector<FrameAttachment> Renderer::offScreenAttachments;
+std::vector<bool> Renderer::stale_imgui_sets;
+RenderGraph Renderer::frame_graph;
+FrameGraphImages Renderer::frame_images = {};
+bool Renderer::frame_graph_ray_tracing = false;
+VkExtent2D Renderer::offscreen_extent = { 0, 0 };
+vkengine::UpscaleFilter Renderer::offscreen_filter = vkengine::UPSCALE_LINEAR;
+VkExtent2D Renderer::viewport_size = { 0, 0 };
+vkengine::DynamicResolutionSettings Renderer::dynamic_resolution = {};
+float Renderer::render_scale = 1.f;
+float Renderer::next_render_scale = 1.f;
+vkengine::DynamicResolutionController Renderer::resolution_controller;
+uint64_t Renderer::last_timed_frame = 0;
 
 
 std::vector<VkFramebuffer> Renderer::swapChainFramebuffers;
 std::vector<VkFramebuffer> Renderer::offScreenFramebuffers;
 
 std::vector<VkSemaphore> Renderer::imageAvailableSemaphores;
-std::vector<VkSemaphore> Renderer::offScreenRenderReadySemaphores;
 std::vector<VkSemaphore> Renderer::renderFinishedSemaphores;
-std::vector<VkFence> Renderer::inFlightFences;
+VkSemaphore Renderer::frame_timeline = VK_NULL_HANDLE;
+std::vector<uint64_t> Renderer::imagesInFlight;
+std::vector<RetiredResource> Renderer::retired_resources;
+uint64_t Renderer::frame_counter = 0;
+uint32_t Renderer::frame_submits = 0;
+float Renderer::frame_submit_ms = 0.f;
+SubmitStats Renderer::submit_stats = { 0, 0.f };
 
 VkCommandPool Renderer::primaryCommandPool;
 std::vector<VkCommandBuffer> Renderer::offScreenCmdBuffers;
@@ -46,12 +66,151 @@ uint32_t Renderer::numThreads;
 uint32_t Renderer::objXthread;
 uint32_t Renderer::currentFrame;
 uint32_t Renderer::last_imageIndex;
+uint32_t Renderer::frames_in_flight = 2;
+FrameLatency Renderer::frame_latency = { -1.f, -1.f };
+std::chrono::high_resolution_clock::time_point Renderer::frame_start;
+std::deque<std::pair<uint64_t, std::chrono::high_resolution_clock::time_point>> Renderer::pending_presents;
+uint64_t Renderer::last_present_id = 0;
+
+static void smoothLatency(float& latency, std::chrono::high_resolution_clock::time_point start)
+{
+	float ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	latency = latency < 0.f ? ms : latency + (ms - latency) * 0.1f;
+}
+
+// the top left part of the offscreen target drawn at a lower render scale
+static VkExtent2D scaledExtent(VkExtent2D extent, float scale)
+{
+	return { std::max(1u, (uint32_t)std::ceil(extent.width * scale)), std::max(1u, (uint32_t)std::ceil(extent.height * scale)) };
+}
+
+// the attachments and framebuffers that follow the swapchain (or viewport) extent
+static void destroyFrameTargets(const std::vector<FrameAttachment>& attachments, const std::vector<VkFramebuffer>& framebuffers)
+{
+	for (auto framebuffer : framebuffers) {
+		vkDestroyFramebuffer(Device::get(), framebuffer, nullptr);
+	}
+	for (auto image : attachments) {
+		vkDestroySampler(Device::get(), image.Sampler, nullptr);
+		vkDestroyImageView(Device::get(), image.imageView, nullptr);
+		vkDestroyImage(Device::get(), image.image, nullptr);
+		vkFreeMemory(Device::get(), image.Memory, nullptr);
+	}
+}
+
+// tiled GPUs can keep transient attachments in tile memory only
+static bool hasLazilyAllocatedMemory()
+{
+	VkPhysicalDeviceMemoryProperties properties;
+	vkGetPhysicalDeviceMemoryProperties(PhysicalDevice::get(), &properties);
+	for (uint32_t i = 0; i < properties.memoryTypeCount; i++) {
+		if (properties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) return true;
+	}
+	return false;
+}
 
 void Renderer::init()
 {
 	createOffScreenAttachments();
-	createFramebuffers();
+	rebuildFrameGraph();
 	createSyncObjects();
+	GpuProfiler::init(SwapChainMng::get()->getImageCount());
+}
+
+void Renderer::resize()
+{
+	// without a viewport the offscreen targets follow the swapchain
+	if (offScreenTargetsOutdated()) {
+		resizeOffScreen();
+	}
+	else {
+		rebuildFrameGraph();
+	}
+	// the swapchain they were presented to is retired
+	pending_presents.clear();
+}
+
+bool Renderer::offScreenTargetsOutdated()
+{
+	VkExtent2D extent = viewport_size.width > 0 && viewport_size.height > 0 ? viewport_size : SwapChainMng::get()->getExtent();
+	return extent.width != offscreen_extent.width || extent.height != offscreen_extent.height ||
+		dynamic_resolution.filter != offscreen_filter;
+}
+
+void Renderer::resizeOffScreen()
+{
+	// the frames in flight still render to the old targets, they go once those are done
+	deferDestruction([attachments = offScreenAttachments]() {
+		destroyFrameTargets(attachments, {});
+	});
+	offScreenAttachments.clear();
+	createOffScreenAttachments();
+	stale_imgui_sets.assign(offScreenAttachments.size(), true);
+	rebuildFrameGraph();
+}
+
+void Renderer::rebuildFrameGraph()
+{
+	std::vector<VkFramebuffer> old_framebuffers = swapChainFramebuffers;
+	old_framebuffers.insert(old_framebuffers.end(), offScreenFramebuffers.begin(), offScreenFramebuffers.end());
+	deferDestruction([framebuffers = old_framebuffers, transients = frame_graph.releaseTransients(Device::get())]() {
+		destroyFrameTargets({}, framebuffers);
+		transients();
+	});
+	swapChainFramebuffers.clear();
+	offScreenFramebuffers.clear();
+
+	declareFrameGraph();
+	frame_graph.compile(hasLazilyAllocatedMemory());
+	frame_graph.realize(PhysicalDevice::get(), Device::get());
+	frame_graph_ray_tracing = useRayTracing;
+	// a culled pass has no depth image to build its framebuffers with
+	if (!frame_graph.isCulled(frame_images.ui_pass)) {
+		createFramebuffers();
+	}
+	if (!useRayTracing) {
+		createOffScreenFramebuffers();
+	}
+}
+
+void Renderer::declareFrameGraph()
+{
+	frame_graph.clear();
+	VkFormat depth_format = findDepthFormat(PhysicalDevice::get());
+	VkImageAspectFlags depth_aspect = VK_IMAGE_ASPECT_DEPTH_BIT |
+		(hasStencilComponent(depth_format) ? VK_IMAGE_ASPECT_STENCIL_BIT : 0);
+	VkExtent2D swapchain_extent = SwapChainMng::get()->getExtent();
+
+	// kept between frames, ready to be sampled by the UI and read back by saveFrame
+	GraphImportInfo scene_info;
+	scene_info.initial_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	scene_info.final_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	frame_images.scene = frame_graph.importImage("scene", { VK_FORMAT_R8G8B8A8_UNORM, offscreen_extent }, scene_info);
+	// the acquire semaphore is waited at the color output
+	GraphImportInfo swapchain_info;
+	swapchain_info.initial_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	swapchain_info.final_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	swapchain_info.acquired = true;
+	// headless nothing is presented, the UI pass is culled
+	swapchain_info.exported = !PhysicalDevice::isHeadless();
+	frame_images.swapchain = frame_graph.importImage("swapchain", { SwapChainMng::get()->getFormat(), swapchain_extent },
+		swapchain_info);
+	frame_images.ui_depth = frame_graph.createImage("ui depth", { depth_format, swapchain_extent, depth_aspect });
+
+	if (useRayTracing) {
+		uint32_t trace = frame_graph.addPass("trace", RayTracer::recordCmdBuffer);
+		frame_graph.write(trace, frame_images.scene, RG_STORAGE_RAY_TRACING);
+	}
+	else {
+		frame_images.scene_depth = frame_graph.createImage("scene depth", { depth_format, offscreen_extent, depth_aspect });
+		uint32_t raster = frame_graph.addPass("raster", recordOffScreenPass);
+		frame_graph.write(raster, frame_images.scene, RG_COLOR_ATTACHMENT);
+		frame_graph.write(raster, frame_images.scene_depth, RG_DEPTH_ATTACHMENT);
+	}
+	frame_images.ui_pass = frame_graph.addPass("ui", recordFinalPass);
+	frame_graph.read(frame_images.ui_pass, frame_images.scene, RG_SAMPLED_FRAGMENT);
+	frame_graph.write(frame_images.ui_pass, frame_images.swapchain, RG_COLOR_ATTACHMENT);
+	frame_graph.write(frame_images.ui_pass, frame_images.ui_depth, RG_DEPTH_ATTACHMENT);
 }
 
 unsigned Renderer::getNextFrameBufferIndex()
@@ -67,7 +226,7 @@ FrameAttachment Renderer::getOffScreenFrameAttachment(unsigned frameIndex)
 
 void Renderer::prepareScene(Scene3D* scene)
 {
-	vkQueueWaitIdle(Device::getGraphicQueue());
+	Renderer::waitForFrames();
 	if (Renderer::scene != nullptr) {
 		for (auto threadResource : Renderer::per_thread_resources) {
 			vkDestroyCommandPool(Device::get(), threadResource.commandPool, nullptr);
@@ -86,78 +245,298 @@ void Renderer::prepareScene(Scene3D* scene)
 
 bool Renderer::prepareFrame()
 {
-	// Wait for fence to signal that all command buffers are ready
-	VkResult error = vkWaitForFences(Device::get(), 1, &inFlightFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
-	if (error == VK_TIMEOUT) std::cout << "FRAME exeeded max rendering time: FENCE timed OUT!" << std::endl;
-	vkResetFences(Device::get(), 1, &inFlightFences[currentFrame]);
+	PROFILE_FUNCTION();
+	frame_start = std::chrono::high_resolution_clock::now();
+	submit_stats.submits = frame_submits;
+	submit_stats.submit_ms += (frame_submit_ms - submit_stats.submit_ms) * 0.1f;
+	frame_submits = 0;
+	frame_submit_ms = 0.f;
+	// Wait for the frame that last used the semaphores of this slot
+	uint64_t frames = imageAvailableSemaphores.size();
+	Renderer::waitForFrame(frame_counter >= frames ? frame_counter + 1 - frames : 0);
+	Renderer::measurePresents();
 
 	// Prendo l'indice dell'immagine su cui disegnare dalla swapchain
 	uint32_t imageIndex;
 	if (!SwapChainMng::get()->acquireNextImage(imageAvailableSemaphores[currentFrame], &imageIndex)) {
 		return false;
 	}
+	// the image could still be used by a more recent frame than the one just waited
+	Renderer::waitForFrame(imagesInFlight[imageIndex]);
+	if (imageIndex < stale_imgui_sets.size() && stale_imgui_sets[imageIndex]) {
+		DescriptorSetsFactory::updateFrameDescriptorSets(&PipelineFactory::pipeline_layouts[PIPELINE_LAYOUT_IMGUI].descriptors, imageIndex);
+		stale_imgui_sets[imageIndex] = false;
+	}
+	GpuProfiler::beginFrame(imageIndex, frame_counter + 1);
+	Renderer::updateRenderScale();
+	Renderer::destroyRetiredResources();
 	Renderer::last_imageIndex = imageIndex;	
+	// Matrices and bounds are refreshed here, so workers only read them
+	Renderer::scene->updateWorldBounds();
 	// Update the uniformBuffer
 	Renderer::updateUniforms(imageIndex);
-	if (useRayTracing) {
+	if (useRayTracing || hybridFrame()) {
 		RayTracer::updateSceneData(scene, imageIndex);
 	}
 	return true;
 }
 
-void Renderer::renderScene()
+void Renderer::updateRenderScale()
 {
-	VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.waitSemaphoreCount = 0;
-	submitInfo.commandBufferCount = 1;
-	// Indico quale  il semaforo che indica la fine dell'attesa
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = &offScreenRenderReadySemaphores[currentFrame];
-	
-	submitInfo.pCommandBuffers = &offScreenCmdBuffers[Renderer::last_imageIndex];
-	if (useRayTracing) {
-		RayTracer::updateCmdBuffer(offScreenCmdBuffers, offScreenAttachments, Renderer::last_imageIndex);
+	// what the UI was told this frame shows
+	render_scale = next_render_scale;
+	resolution_controller.configure(dynamic_resolution);
+	// the ray traced frames follow the ray budget
+	if (!dynamic_resolution.enabled || useRayTracing) {
+		next_render_scale = 1.f;
+		return;
 	}
-	else /* RASTERIZATION */{
-		Renderer::updateOffScreenCommandBuffer(Renderer::last_imageIndex);
+	// the newest frame read back, a few frames old: the controller lets a change settle before trusting the timings.
+	// Without the GPU profiler nothing is measured and the scale stays where it is
+	if (GpuProfiler::history.empty() || GpuProfiler::history.back().frame <= last_timed_frame) return;
+	last_timed_frame = GpuProfiler::history.back().frame;
+	float frame_ms = 0.f;
+	for (float pass_ms : GpuProfiler::history.back().pass_ms) {
+		if (pass_ms > 0.f) frame_ms += pass_ms;
 	}
+	next_render_scale = resolution_controller.update(frame_ms);
+}
 
-	VkResult res = vkQueueSubmit(Device::getGraphicQueue(), 1, &submitInfo, VK_NULL_HANDLE);
-	if (res != VK_SUCCESS) {
-		throw std::runtime_error("failed to submit draw command buffer! with code " + res);
+bool Renderer::hybridFrame()
+{
+	return useHybridRendering && !useRayTracing && PhysicalDevice::hasRayQuery();
+}
+
+void Renderer::renderScene()
+{
+	PROFILE_FUNCTION();
+	if (useRayTracing != frame_graph_ray_tracing) {
+		// the passes and transient images of the other rendering mode
+		rebuildFrameGraph();
+	}
+	frame_graph.setImage(frame_images.scene, offScreenAttachments[Renderer::last_imageIndex].image);
+	frame_graph.setImage(frame_images.swapchain, SwapChainMng::get()->getImage(Renderer::last_imageIndex));
+	// the passes before the swapchain image is used go in the first batch, the others wait for it
+	std::array<VkCommandBuffer, 2> batch_cmds = { offScreenCmdBuffers[Renderer::last_imageIndex],
+		primaryCmdBuffers[Renderer::last_imageIndex] };
+	for (uint32_t batch = 0; batch < batch_cmds.size(); batch++) {
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		if (vkBeginCommandBuffer(batch_cmds[batch], &beginInfo) != VK_SUCCESS) {
+			throw std::runtime_error("failed to begin recording command buffer!");
+		}
+		frame_graph.execute(batch, batch_cmds[batch], Renderer::last_imageIndex);
+		if (vkEndCommandBuffer(batch_cmds[batch]) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record command buffer!");
+		}
 	}
 
-	Renderer::updateFinalPassCommandBuffer(Renderer::last_imageIndex);
+	// One submit, two batches: the first doesn't wait for the swapchain image, the second does.
+	// The barriers between the passes come from the frame graph
+	std::array<VkSubmitInfo, 2> batches = {};
+	batches[0].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	batches[0].commandBufferCount = 1;
+	batches[0].pCommandBuffers = &offScreenCmdBuffers[Renderer::last_imageIndex];
+	// the TLAS can be updated on the async compute queue: rays start once it is built
+	VkSemaphore tlas_ready = hasRayTracing() ? RayTracer::takeSceneUpdateSemaphore() : VK_NULL_HANDLE;
+	VkPipelineStageFlags tlas_stage = useRayTracing ? VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR : VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	if (tlas_ready != VK_NULL_HANDLE) {
+		batches[0].waitSemaphoreCount = 1;
+		batches[0].pWaitSemaphores = &tlas_ready;
+		batches[0].pWaitDstStageMask = &tlas_stage;
+	}
 
-	std::array<VkSemaphore, 2> waited_semaphores = { offScreenRenderReadySemaphores[currentFrame],imageAvailableSemaphores[currentFrame] };
-	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-	submitInfo.pWaitDstStageMask = waitStages;
-	submitInfo.pWaitSemaphores = waited_semaphores.data();
-	submitInfo.waitSemaphoreCount = waited_semaphores.size();
-	submitInfo.pSignalSemaphores = &renderFinishedSemaphores[currentFrame];
-	submitInfo.pCommandBuffers = &primaryCmdBuffers[Renderer::last_imageIndex];
+	uint64_t frame = frame_counter + 1;
+	std::array<VkSemaphore, 2> signaled_semaphores = { renderFinishedSemaphores[currentFrame], frame_timeline };
+	std::array<uint64_t, 2> signaled_values = { 0, frame }; // the binary semaphore ignores its value
+	VkTimelineSemaphoreSubmitInfo timelineInfo = { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+	timelineInfo.signalSemaphoreValueCount = (uint32_t)signaled_values.size();
+	timelineInfo.pSignalSemaphoreValues = signaled_values.data();
+	VkPipelineStageFlags waitStage = frame_graph.getFirstUseStages(frame_images.swapchain);
+	batches[1].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	batches[1].pNext = &timelineInfo;
+	batches[1].waitSemaphoreCount = 1;
+	batches[1].pWaitSemaphores = &imageAvailableSemaphores[currentFrame];
+	batches[1].pWaitDstStageMask = &waitStage;
+	batches[1].commandBufferCount = 1;
+	batches[1].pCommandBuffers = &primaryCmdBuffers[Renderer::last_imageIndex];
+	batches[1].signalSemaphoreCount = (uint32_t)signaled_semaphores.size();
+	batches[1].pSignalSemaphores = signaled_semaphores.data();
+	if (PhysicalDevice::isHeadless()) {
+		// no image to acquire and no present to wait for it: the timeline alone tracks the frame
+		batches[1].waitSemaphoreCount = 0;
+		batches[1].signalSemaphoreCount = 1;
+		batches[1].pSignalSemaphores = &frame_timeline;
+		timelineInfo.signalSemaphoreValueCount = 1;
+		timelineInfo.pSignalSemaphoreValues = &frame;
+	}
 
-	res = vkQueueSubmit(Device::getGraphicQueue(), 1, &submitInfo, inFlightFences[currentFrame]);
+	VkResult res = Renderer::submit(Device::getGraphicQueue(), (uint32_t)batches.size(), batches.data(), VK_NULL_HANDLE);
 	if ( res != VK_SUCCESS) {
 		throw std::runtime_error("failed to submit draw command buffer! with code " + res);
 	}
+	frame_counter = frame;
+	imagesInFlight[Renderer::last_imageIndex] = frame;
 }
 
 bool Renderer::finalizeFrame()
 {
+	PROFILE_FUNCTION();
 	// Presentazione del frame
-	if (!SwapChainMng::get()->presentImage(Renderer::last_imageIndex, &renderFinishedSemaphores[currentFrame])) {
+	uint64_t present_id = PhysicalDevice::hasPresentWait() ? ++last_present_id : 0;
+	if (!SwapChainMng::get()->presentImage(Renderer::last_imageIndex, &renderFinishedSemaphores[currentFrame], present_id)) {
 		return false;
 	}
 	//vkQueueWaitIdle(Device::getPresentQueue()); //not optimal time usage!!!!
+	smoothLatency(frame_latency.cpu_to_present_ms, frame_start);
+	if (present_id != 0) {
+		pending_presents.push_back({ present_id, frame_start });
+	}
 
-	currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+	currentFrame = (currentFrame + 1) % imageAvailableSemaphores.size();
 	return true;
 }
 
+void Renderer::measurePresents()
+{
+	// presents complete in order: the first one still waiting stops the others
+	while (!pending_presents.empty()) {
+		VkResult result = SwapChainMng::get()->waitForPresent(pending_presents.front().first, 0);
+		if (result == VK_TIMEOUT) break;
+		if (result == VK_SUCCESS) smoothLatency(frame_latency.cpu_to_display_ms, pending_presents.front().second);
+		pending_presents.pop_front();
+	}
+}
+
+void Renderer::resizeDrawLists()
+{
+	unsigned obj_num = Renderer::scene->get_object_num();
+	// workers are only added, never removed: respawning them is cheap but freeing their pools is not
+	uint32_t wanted_threads = obj_num < std::thread::hardware_concurrency() ? 1 : std::thread::hardware_concurrency();
+	if (wanted_threads > numThreads) {
+		thread_pool.wait();
+		per_thread_resources.resize(wanted_threads);
+		for (uint32_t t = numThreads; t < wanted_threads; t++) {
+			Device::createCommandPool(PhysicalDevice::getQueueFamilies().graphicsFamily,
+				&per_thread_resources[t].commandPool);
+			per_thread_resources[t].commandBuffers.resize(SwapChainMng::get()->getImageCount());
+		}
+		numThreads = wanted_threads;
+		thread_pool.setThreadCount(numThreads);
+	}
+	objXthread = (obj_num + numThreads - 1) / numThreads;
+	for (auto& thread_data : per_thread_resources) {
+		allocateSecondaryCmdBuffers(thread_data, objXthread);
+	}
+}
+
+void Renderer::waitForFrame(uint64_t frame)
+{
+	PROFILE_FUNCTION();
+	VkSemaphoreWaitInfo waitInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &frame_timeline;
+	waitInfo.pValues = &frame;
+	VkResult error = vkWaitSemaphores(Device::get(), &waitInfo, std::numeric_limits<uint64_t>::max());
+	if (error == VK_TIMEOUT) std::cout << "FRAME exeeded max rendering time: timeline wait timed OUT!" << std::endl;
+}
+
+void Renderer::waitForFrames()
+{
+	// before the first init there is nothing to wait for
+	if (frame_timeline != VK_NULL_HANDLE) {
+		Renderer::waitForFrame(frame_counter);
+	}
+}
+
+bool Renderer::saveFrame(const std::string& ppm_file)
+{
+	if (frame_counter == 0) return false;
+	Renderer::waitForFrames();
+	// between frames the offscreen attachment is ready to be sampled by the final pass
+	FrameAttachment& attachment = offScreenAttachments[last_imageIndex];
+	VkExtent2D extent = offscreen_extent;
+	VkDeviceSize size = (VkDeviceSize)extent.width * extent.height * 4;
+	VkBuffer staging;
+	VkDeviceMemory staging_memory;
+	createBuffer(PhysicalDevice::get(), Device::get(), size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, staging, staging_memory);
+
+	VkCommandBuffer command = beginSingleTimeCommandBuffer(Device::get(), Device::getGraphicCmdPool());
+	transitionImageLayout(command, attachment.image, VK_FORMAT_R8G8B8A8_UNORM,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+	VkBufferImageCopy region = {};
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent = { extent.width, extent.height, 1 };
+	vkCmdCopyImageToBuffer(command, attachment.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, staging, 1, &region);
+	transitionImageLayout(command, attachment.image, VK_FORMAT_R8G8B8A8_UNORM,
+		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	submitAndWaitCommandBuffer(Device::get(), Device::getGraphicQueue(), Device::getGraphicCmdPool(), command);
+
+	unsigned char* rgba;
+	vkMapMemory(Device::get(), staging_memory, 0, size, 0, (void**)&rgba);
+	std::ofstream out(ppm_file, std::ios::binary);
+	if (out) {
+		out << "P6\n" << extent.width << " " << extent.height << "\n255\n";
+		std::vector<unsigned char> rgb(extent.width * extent.height * 3);
+		for (uint32_t i = 0; i < extent.width * extent.height; i++) {
+			memcpy(&rgb[i * 3], &rgba[i * 4], 3);
+		}
+		out.write((const char*)rgb.data(), rgb.size());
+	}
+	vkUnmapMemory(Device::get(), staging_memory);
+	vkDestroyBuffer(Device::get(), staging, nullptr);
+	vkFreeMemory(Device::get(), staging_memory, nullptr);
+	return (bool)out;
+}
+
+VkResult Renderer::submit(VkQueue queue, uint32_t count, const VkSubmitInfo* submits, VkFence fence)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	VkResult result = vkQueueSubmit(queue, count, submits, fence);
+	frame_submit_ms += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	frame_submits++;
+	return result;
+}
+
+void Renderer::deferDestruction(std::function<void()> destroyer)
+{
+	retired_resources.push_back({ frame_counter, destroyer });
+}
+
+void Renderer::submitSetupCommands(VkCommandBuffer command)
+{
+	vkEndCommandBuffer(command);
+	VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &command;
+	if (submit(Device::getGraphicQueue(), 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+		throw std::runtime_error("failed to submit setup commands!");
+	}
+	// the timeline value of the next frame is signaled after everything submitted before it
+	retired_resources.push_back({ frame_counter + 1, [command]() {
+		vkFreeCommandBuffers(Device::get(), Device::getGraphicCmdPool(), 1, &command);
+	} });
+}
+
+void Renderer::destroyRetiredResources(bool all)
+{
+	// whatever the frames that completed were using
+	uint64_t completed = 0;
+	if (!all) vkGetSemaphoreCounterValue(Device::get(), frame_timeline, &completed);
+	auto first_alive = std::partition(retired_resources.begin(), retired_resources.end(),
+		[all, completed](const RetiredResource& res) { return !all && res.retire_frame > completed; });
+	for (auto it = first_alive; it != retired_resources.end(); it++) {
+		it->destroy();
+	}
+	retired_resources.erase(first_alive, retired_resources.end());
+}
+
 void Renderer::cleanUp()
 {
+	Renderer::destroyRetiredResources(true);
+	GpuProfiler::cleanUp();
 	Renderer::scene = nullptr;
 	for (auto threadResource : Renderer::per_thread_resources) {
 		vkDestroyCommandPool(Device::get(), threadResource.commandPool, nullptr);
@@ -168,44 +547,35 @@ void Renderer::cleanUp()
 	vkDestroyCommandPool(Device::get(), Renderer::primaryCommandPool, nullptr);
 	primaryCmdBuffers.clear();
 
-	vkDestroyImageView(Device::get(), final_depth_buffer.imageView, nullptr);
-	vkDestroyImage(Device::get(), final_depth_buffer.image, nullptr);
-	vkFreeMemory(Device::get(), final_depth_buffer.Memory, nullptr);
-
-	for (auto image : offScreenAttachments) {
-		vkDestroySampler(Device::get(), image.Sampler, nullptr);
-		vkDestroyImageView(Device::get(), image.imageView, nullptr);
-		vkDestroyImage(Device::get(), image.image, nullptr);
-		vkFreeMemory(Device::get(), image.Memory, nullptr);
-	}
-
-	for (auto framebuffer : swapChainFramebuffers) {
-		vkDestroyFramebuffer(Device::get(), framebuffer, nullptr);
-	}
-	for (auto framebuffer : offScreenFramebuffers) {
-		vkDestroyFramebuffer(Device::get(), framebuffer, nullptr);
-	}
-	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+	destroyFrameTargets(offScreenAttachments, swapChainFramebuffers);
+	destroyFrameTargets({}, offScreenFramebuffers);
+	frame_graph.releaseTransients(Device::get())();
+	swapChainFramebuffers.clear();
+	offScreenFramebuffers.clear();
+	offScreenAttachments.clear();
+	offscreen_extent = { 0, 0 };
+	for (size_t i = 0; i < imageAvailableSemaphores.size(); i++) {
 		vkDestroySemaphore(Device::get(), renderFinishedSemaphores[i], nullptr);
-		vkDestroySemaphore(Device::get(), offScreenRenderReadySemaphores[i], nullptr);
 		vkDestroySemaphore(Device::get(), imageAvailableSemaphores[i], nullptr);
-		vkDestroyFence(Device::get(), inFlightFences[i], nullptr);
 	}
+	vkDestroySemaphore(Device::get(), frame_timeline, nullptr);
+	frame_timeline = VK_NULL_HANDLE;
 	renderFinishedSemaphores.clear();
 	imageAvailableSemaphores.clear();
-	inFlightFences.clear();
+	imagesInFlight.clear();
+	// the swapchain they were presented to goes away
+	pending_presents.clear();
 }
 
 void Renderer::createFramebuffers()
 {
 	swapChainFramebuffers.resize(SwapChainMng::get()->getImageCount());
-	offScreenFramebuffers.resize(SwapChainMng::get()->getImageCount());
 	// Un framebuffer per ogni immagine della swapchain
 	for (size_t i = 0; i < SwapChainMng::get()->getImageCount(); i++) {
 
 		std::array<VkImageView, 2> attachments = {
 			SwapChainMng::get()->getImageViews()[i],
-			final_depth_buffer.imageView
+			frame_graph.getImageView(frame_images.ui_depth)
 		};
 
 		VkFramebufferCreateInfo framebufferInfo = {};
@@ -220,12 +590,26 @@ void Renderer::createFramebuffers()
 		if (vkCreateFramebuffer(Device::get(), &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create framebuffer!");
 		}
+	}
+}
 
-		attachments = {
+void Renderer::createOffScreenFramebuffers()
+{
+	offScreenFramebuffers.resize(SwapChainMng::get()->getImageCount());
+	for (size_t i = 0; i < SwapChainMng::get()->getImageCount(); i++) {
+		std::array<VkImageView, 2> attachments = {
 			offScreenAttachments[i].imageView,
-			final_depth_buffer.imageView
+			frame_graph.getImageView(frame_images.scene_depth)
 		};
+
+		VkFramebufferCreateInfo framebufferInfo = {};
+		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
 		framebufferInfo.renderPass = RenderPassCatalog::offscreenRP;
+		framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		framebufferInfo.pAttachments = attachments.data();
+		framebufferInfo.width = offscreen_extent.width;
+		framebufferInfo.height = offscreen_extent.height;
+		framebufferInfo.layers = 1;
 
 		if (vkCreateFramebuffer(Device::get(), &framebufferInfo, nullptr, &offScreenFramebuffers[i]) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create framebuffer!");
@@ -234,51 +618,42 @@ void Renderer::createFramebuffers()
 }
 
 void Renderer::createOffScreenAttachments() {
-	// Depth Attachment
-	VkFormat depthFormat = findDepthFormat(PhysicalDevice::get());
-	createImage(PhysicalDevice::get(), Device::get(),
-		SwapChainMng::get()->getExtent().width, SwapChainMng::get()->getExtent().height,
-		depthFormat, VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		final_depth_buffer.image, final_depth_buffer.Memory);
-	
-	final_depth_buffer.imageView = createImageView(Device::get(), final_depth_buffer.image, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
-	
-	VkCommandBuffer command = beginSingleTimeCommandBuffer(Device::get(), Device::getGraphicCmdPool());
-
-	transitionImageLayout(command,
-		final_depth_buffer.image, depthFormat, 
-		VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+	// sized as the viewport showing them, the swapchain if there is none
+	offscreen_extent = viewport_size.width > 0 && viewport_size.height > 0 ? viewport_size : SwapChainMng::get()->getExtent();
+	offscreen_filter = dynamic_resolution.filter;
+	VkFilter filter = offscreen_filter == vkengine::UPSCALE_NEAREST ? VK_FILTER_NEAREST : VK_FILTER_LINEAR;
 
+	VkCommandBuffer command = beginSingleTimeCommandBuffer(Device::get(), Device::getGraphicCmdPool());
 	// Offscreen Attachments
 	Renderer::offScreenAttachments.resize(SwapChainMng::get()->getImageCount());
 	for (int i = 0; i < SwapChainMng::get()->getImageCount();i++) {
 		VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
 		createImage(PhysicalDevice::get(), Device::get(),
-			SwapChainMng::get()->getExtent().width, SwapChainMng::get()->getExtent().height,
+			offscreen_extent.width, offscreen_extent.height,
 			format, VK_IMAGE_TILING_OPTIMAL,
 			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | // used as color attachment in first renderpass
 			VK_IMAGE_USAGE_SAMPLED_BIT | // sampled for second renderpass
-			VK_IMAGE_USAGE_STORAGE_BIT, // Storage is for usage in ray tracing pipeline (first pass)
+			VK_IMAGE_USAGE_STORAGE_BIT | // Storage is for usage in ray tracing pipeline (first pass)
+			VK_IMAGE_USAGE_TRANSFER_SRC_BIT, // read back by saveFrame
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 			offScreenAttachments[i].image, offScreenAttachments[i].Memory);
 		
 		offScreenAttachments[i].imageView = createImageView(Device::get(), offScreenAttachments[i].image, 
 			format, VK_IMAGE_ASPECT_COLOR_BIT);
 
-		// For the offscreen renderpass COLOR_ATTACHMENT_OPTIMAL, SHADER_READ_ONLY_OPTIMAL instead for the RayTracer
+		// between frames the frame graph expects them ready to be sampled
 		transitionImageLayout(command,
 			offScreenAttachments[i].image, format,
-			VK_IMAGE_LAYOUT_UNDEFINED, 
-			useRayTracing ?  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
 		VkSamplerCreateInfo samplerInfo = {};
 		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-		samplerInfo.magFilter = VK_FILTER_LINEAR;
-		samplerInfo.minFilter = VK_FILTER_LINEAR;
-		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerInfo.magFilter = filter; // stretches the image rendered at a lower scale
+		samplerInfo.minFilter = filter;
+		// no wrapping around the borders of the image
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
 		samplerInfo.anisotropyEnable = VK_FALSE;
 		samplerInfo.maxAnisotropy = 1;
 		samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
@@ -294,7 +669,7 @@ void Renderer::createOffScreenAttachments() {
 			throw std::runtime_error("failed to create texture sampler!");
 		}	
 	}
-	submitAndWaitCommandBuffer(Device::get(), Device::getGraphicQueue(), Device::getGraphicCmdPool(), command);
+	submitSetupCommands(command);
 }
 
 void Renderer::prepareThreadedRendering()
@@ -303,8 +678,8 @@ void Renderer::prepareThreadedRendering()
 		//Creazione della pool per i buffer di comando principali
 		Device::createCommandPool(PhysicalDevice::getQueueFamilies().graphicsFamily, &Renderer::primaryCommandPool);
 		//allocazione buffer principali 1 per ogni frame
-		primaryCmdBuffers.resize(swapChainFramebuffers.size());	
-		offScreenCmdBuffers.resize(swapChainFramebuffers.size());
+		primaryCmdBuffers.resize(SwapChainMng::get()->getImageCount());
+		offScreenCmdBuffers.resize(SwapChainMng::get()->getImageCount());
 
 		VkCommandBufferAllocateInfo allocInfo = {};
 		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -312,7 +687,7 @@ void Renderer::prepareThreadedRendering()
 		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 		allocInfo.commandBufferCount = 1;
 
-		for (int i = 0; i < swapChainFramebuffers.size(); i++) {
+		for (int i = 0; i < SwapChainMng::get()->getImageCount(); i++) {
 			if (vkAllocateCommandBuffers(Device::get(), &allocInfo, &primaryCmdBuffers[i]) 
 				!= VK_SUCCESS) 
 			{
@@ -334,31 +709,35 @@ void Renderer::prepareThreadedRendering()
 		Device::createCommandPool(PhysicalDevice::getQueueFamilies().graphicsFamily,
 			&per_thread_resources[t].commandPool);
 		// for each framebuffer...
-		per_thread_resources[t].commandBuffers.resize(swapChainFramebuffers.size());
-
-		VkCommandBufferAllocateInfo allocInfo = {};
-		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		allocInfo.commandPool = per_thread_resources[t].commandPool; // using the standard Pool
-		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
-		allocInfo.commandBufferCount = 1;
-
-		for (uint32_t f = 0; f < swapChainFramebuffers.size(); f++) {
-			per_thread_resources[t].commandBuffers[f].resize(objXthread);
+		per_thread_resources[t].commandBuffers.resize(SwapChainMng::get()->getImageCount());
+		allocateSecondaryCmdBuffers(per_thread_resources[t], objXthread);
+	}
+}
 
-			//... and for each object to draw, 1 command buffer.
-			for (int i = 0; i < objXthread; i++) {
-				if (vkAllocateCommandBuffers(Device::get(), &allocInfo, 
-					&per_thread_resources[t].commandBuffers[f][i]) != VK_SUCCESS) 
-				{
-					throw std::runtime_error("failed to allocate secondary command buffer!");
-				}
+void Renderer::allocateSecondaryCmdBuffers(ThreadData& thread_data, uint32_t count)
+{
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = thread_data.commandPool; // using the standard Pool
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+	allocInfo.commandBufferCount = 1;
+
+	for (auto& frame_buffers : thread_data.commandBuffers) {
+		//... and for each object to draw, 1 command buffer. Existing ones are kept.
+		for (size_t i = frame_buffers.size(); i < count; i++) {
+			VkCommandBuffer cmd;
+			if (vkAllocateCommandBuffers(Device::get(), &allocInfo, &cmd) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate secondary command buffer!");
 			}
+			frame_buffers.push_back(cmd);
 		}
 	}
 }
 
 void Renderer::updateUniforms(uint32_t frameBufferIndex)
 {
+	PROFILE_FUNCTION();
 	auto lights = scene->listLights();
 	UniformBlock uniforms = {};
 	uniforms.V_matrix = Renderer::scene->getCamera(Renderer::scene->current_camera)->setCamera();
@@ -373,13 +752,15 @@ void Renderer::updateUniforms(uint32_t frameBufferIndex)
 	if (useRayTracing) {
 		uniforms.V_matrix = glm::inverse(uniforms.V_matrix);
 		uniforms.P_matrix = glm::inverse(uniforms.P_matrix);
+		RayTracer::updateAccumulation(uniforms);
 	}
 
 	DescriptorSetsFactory::updateUniformBuffer(uniforms, frameBufferIndex);
 }
 
-void Renderer::updateOffScreenCommandBuffer(uint32_t frameBufferIndex)
+void Renderer::recordOffScreenPass(VkCommandBuffer cmd, uint32_t frameBufferIndex)
 {
+	PROFILE_FUNCTION();
 	// Contains the list of secondary command buffers to be submitted
 	std::vector<VkCommandBuffer> secondaryCmdBuffers;
 
@@ -389,14 +770,38 @@ void Renderer::updateOffScreenCommandBuffer(uint32_t frameBufferIndex)
 	inheritanceInfo.framebuffer = offScreenFramebuffers[frameBufferIndex];
 	// work is divided between the available threads
 
+	bool hybrid = hybridFrame();
+	// viewport and scissor are dynamic, every secondary buffer sets them. 
+	// At a lower render scale only the top left part of the target is drawn
+	VkExtent2D extent = scaledExtent(offscreen_extent, render_scale);
+	// unrolled for the lights of the scene once its variant is compiled, the workers only record it
+	VkPipeline pipeline = PipelineFactory::getVariant(hybrid ? HYBRID_3D_PIPELINE_ID : STD_3D_PIPELINE_ID,
+		static_cast<int32_t>(scene->listLights().size()));
 	std::vector<VkDescriptorSet> descrSets;
-	for (auto& set : PipelineFactory::pipeline_layouts[PIPELINE_LAYOUT_STANDARD].descriptors.static_sets) {
-		descrSets.push_back(set.set);
+	if (hybrid) {
+		// the ray tracing sets, in the order of the hybrid layout: scene, uniforms, TLAS and objects
+		auto& rt_sets = PipelineFactory::pipeline_layouts[PIPELINE_LAYOUT_RAY_TRACING].descriptors;
+		descrSets.push_back(rt_sets.static_sets[0].set);
+		descrSets.push_back(rt_sets.frame_dependent_sets[1][frameBufferIndex].set);
+		descrSets.push_back(rt_sets.frame_dependent_sets[0][frameBufferIndex].set);
 	}
-	for (auto& setlist : PipelineFactory::pipeline_layouts[PIPELINE_LAYOUT_STANDARD].descriptors.frame_dependent_sets) {
-		descrSets.push_back(setlist[frameBufferIndex].set);
+	else {
+		for (auto& set : PipelineFactory::pipeline_layouts[PIPELINE_LAYOUT_STANDARD].descriptors.static_sets) {
+			descrSets.push_back(set.set);
+		}
+		for (auto& setlist : PipelineFactory::pipeline_layouts[PIPELINE_LAYOUT_STANDARD].descriptors.frame_dependent_sets) {
+			descrSets.push_back(setlist[frameBufferIndex].set);
+		}
 	}
 
+	// occluders are rasterized on the same workers before recording starts
+	OcclusionCuller::prepareFrame(scene, numThreads,
+		[](unsigned t, std::function<void()> job) {
+			if (multithreading) thread_pool.threads[t]->addJob(job);
+			else job();
+		},
+		[] { thread_pool.wait(); });
+
 	auto obj_list = Renderer::scene->listObjects();
 	for (uint32_t t = 0, objIndex = 0; t < numThreads; t++)
 	{
@@ -405,20 +810,18 @@ void Renderer::updateOffScreenCommandBuffer(uint32_t frameBufferIndex)
 			if (multithreading) {
 				thread_pool.threads[t]->addJob([=] { threadRenderCode(scene->getObject(obj_list[objIndex]), 
 					Renderer::scene->getCamera(Renderer::scene->current_camera), &per_thread_resources[t],	
-					frameBufferIndex, i, inheritanceInfo, descrSets); });
+					frameBufferIndex, i, inheritanceInfo, descrSets, hybrid, pipeline, extent); });
 			}
 			else {
 				threadRenderCode(scene->getObject(obj_list[objIndex]), Renderer::scene->getCamera(Renderer::scene->current_camera), 
-					&per_thread_resources[t], frameBufferIndex, i, inheritanceInfo, descrSets);
+					&per_thread_resources[t], frameBufferIndex, i, inheritanceInfo, descrSets, hybrid, pipeline, extent);
 			}
 		}
 	}
 
-	// begin main command recording
-	VkCommandBufferBeginInfo beginInfo = {};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	if (vkBeginCommandBuffer(offScreenCmdBuffers[frameBufferIndex], &beginInfo) != VK_SUCCESS) {
-		throw std::runtime_error("failed to begin recording command buffer!");
+	// the fragment shaders query this frame's TLAS
+	if (hybrid) {
+		RayTracer::recordSceneUpdate(cmd, frameBufferIndex);
 	}
 
 	std::array<VkClearValue, 2> clearValues = {};
@@ -430,11 +833,12 @@ void Renderer::updateOffScreenCommandBuffer(uint32_t frameBufferIndex)
 	renderPassInfo.renderPass = RenderPassCatalog::offscreenRP;
 	renderPassInfo.framebuffer = offScreenFramebuffers[frameBufferIndex];
 	renderPassInfo.renderArea.offset = { 0, 0 };
-	renderPassInfo.renderArea.extent = SwapChainMng::get()->getExtent();
+	renderPassInfo.renderArea.extent = extent;
 	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
 	renderPassInfo.pClearValues = clearValues.data();
 	// begin render pass
-	vkCmdBeginRenderPass(offScreenCmdBuffers[frameBufferIndex], &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+	GpuProfiler::beginPass(cmd, frameBufferIndex, GPU_PASS_RASTER);
+	vkCmdBeginRenderPass(cmd, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
 	thread_pool.wait();
 	// i draw only the command buffers related to visible objects
@@ -450,22 +854,16 @@ void Renderer::updateOffScreenCommandBuffer(uint32_t frameBufferIndex)
 	}
 	// Execute render commands from all secondary command buffers
 	if (secondaryCmdBuffers.size() > 0) {
-		vkCmdExecuteCommands(offScreenCmdBuffers[frameBufferIndex], secondaryCmdBuffers.size(), secondaryCmdBuffers.data());
+		vkCmdExecuteCommands(cmd, secondaryCmdBuffers.size(), secondaryCmdBuffers.data());
 	}
 
-	vkCmdEndRenderPass(offScreenCmdBuffers[frameBufferIndex]);
-	vkEndCommandBuffer(offScreenCmdBuffers[frameBufferIndex]);
+	vkCmdEndRenderPass(cmd);
+	GpuProfiler::endPass(cmd, frameBufferIndex, GPU_PASS_RASTER);
 }
 
-void Renderer::updateFinalPassCommandBuffer(uint32_t frameBufferIndex)
+void Renderer::recordFinalPass(VkCommandBuffer cmd, uint32_t frameBufferIndex)
 {
-	// begin main command recording
-	VkCommandBufferBeginInfo beginInfo = {};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	if (vkBeginCommandBuffer(primaryCmdBuffers[frameBufferIndex], &beginInfo) != VK_SUCCESS) {
-		throw std::runtime_error("failed to begin recording command buffer!");
-	}
-
+	PROFILE_FUNCTION();
 	std::array<VkClearValue, 2> clearValues = {};
 	clearValues[0].color = { 0.2f, 0.2f, 0.2f, 1.0f };
 	clearValues[1].depthStencil = { 1.0f, 0 };
@@ -479,21 +877,22 @@ void Renderer::updateFinalPassCommandBuffer(uint32_t frameBufferIndex)
 	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
 	renderPassInfo.pClearValues = clearValues.data();
 	// begin render pass
-	vkCmdBeginRenderPass(primaryCmdBuffers[frameBufferIndex], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	GpuProfiler::beginPass(cmd, frameBufferIndex, GPU_PASS_IMGUI);
+	vkCmdBeginRenderPass(cmd, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
 	// ImGui rendering
 	if (MeshManager::getImGuiMesh(frameBufferIndex)->getIdxCount() > 0)
 	{
-		Renderer::recordImGuiDrawCmds(frameBufferIndex);
+		Renderer::recordImGuiDrawCmds(cmd, frameBufferIndex);
 	}
 
-	vkCmdEndRenderPass(primaryCmdBuffers[frameBufferIndex]);
-	vkEndCommandBuffer(primaryCmdBuffers[frameBufferIndex]);
+	vkCmdEndRenderPass(cmd);
+	GpuProfiler::endPass(cmd, frameBufferIndex, GPU_PASS_IMGUI);
 }
 
-void Renderer::recordImGuiDrawCmds(uint32_t frameBufferIndex)
+void Renderer::recordImGuiDrawCmds(VkCommandBuffer cmd, uint32_t frameBufferIndex)
 {
-	vkCmdBindPipeline(primaryCmdBuffers[frameBufferIndex],
+	vkCmdBindPipeline(cmd,
 		VK_PIPELINE_BIND_POINT_GRAPHICS,
 		PipelineFactory::pipelines[IMGUI_PIPELINE_ID].pipeline);
 
@@ -505,16 +904,16 @@ void Renderer::recordImGuiDrawCmds(uint32_t frameBufferIndex)
 	for (auto& setlist : PipelineFactory::pipeline_layouts[PIPELINE_LAYOUT_IMGUI].descriptors.frame_dependent_sets) {
 		descrSets.push_back(setlist[frameBufferIndex].set);
 	}
-	vkCmdBindDescriptorSets(primaryCmdBuffers[frameBufferIndex],
+	vkCmdBindDescriptorSets(cmd,
 		VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, descrSets.size(),
 		descrSets.data(), 0, nullptr);
 
 	GuiMesh* imgui = MeshManager::getImGuiMesh(frameBufferIndex);
 	VkBuffer vertexBuffer = imgui->getVkVertexBuffer();
 	VkDeviceSize offsets[] = { 0 };
-	vkCmdBindVertexBuffers(primaryCmdBuffers[frameBufferIndex]
+	vkCmdBindVertexBuffers(cmd
 		, 0, 1, &vertexBuffer, offsets);
-	vkCmdBindIndexBuffer(primaryCmdBuffers[frameBufferIndex],
+	vkCmdBindIndexBuffer(cmd,
 		imgui->getVkIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
 
 
@@ -531,35 +930,35 @@ void Renderer::recordImGuiDrawCmds(uint32_t frameBufferIndex)
 	viewport.height = data.display_size.y * data.frame_buffer_scale.y;
 	viewport.minDepth = 0.0f;
 	viewport.maxDepth = 1.0f;
-	vkCmdSetViewport(primaryCmdBuffers[frameBufferIndex],
+	vkCmdSetViewport(cmd,
 		0, 1, &viewport);
 
 	uint32_t idx_offset = 0;
 	uint32_t vtx_offset = 0;
 	for (auto draw_list : data.drawLists) {
-		for ( auto cmd : draw_list.drawCommands) {
+		for (auto draw_cmd : draw_list.drawCommands) {
 			// Project scissor/clipping rectangles into framebuffer space
 			glm::vec4 clip_rect;
-			clip_rect = (cmd.clipRectangle - glm::vec4(data.display_pos,data.display_pos) )
+			clip_rect = (draw_cmd.clipRectangle - glm::vec4(data.display_pos,data.display_pos) )
 				* glm::vec4(data.display_size, data.display_size);
 			// Apply scissor/clipping rectangle
 			VkRect2D scissor;
-			scissor.offset.x = std::max((int32_t)(cmd.clipRectangle.x), 0);
-			scissor.offset.y = std::max((int32_t)(cmd.clipRectangle.y), 0);
-			scissor.extent.width = (uint32_t)(cmd.clipRectangle.z - cmd.clipRectangle.x);
-			scissor.extent.height = (uint32_t)(cmd.clipRectangle.w - cmd.clipRectangle.y);
-			vkCmdSetScissor(primaryCmdBuffers[frameBufferIndex],
+			scissor.offset.x = std::max((int32_t)(draw_cmd.clipRectangle.x), 0);
+			scissor.offset.y = std::max((int32_t)(draw_cmd.clipRectangle.y), 0);
+			scissor.extent.width = (uint32_t)(draw_cmd.clipRectangle.z - draw_cmd.clipRectangle.x);
+			scissor.extent.height = (uint32_t)(draw_cmd.clipRectangle.w - draw_cmd.clipRectangle.y);
+			vkCmdSetScissor(cmd,
 				0, 1, &scissor);
 			// Push the texture Index
-			pushBlock.tex_ID = cmd.textureID;
-			vkCmdPushConstants(primaryCmdBuffers[frameBufferIndex],
+			pushBlock.tex_ID = draw_cmd.textureID;
+			vkCmdPushConstants(cmd,
 				pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
 				0, sizeof(ImGuiPushConstantBlock), &pushBlock);
 
-			vkCmdDrawIndexed(primaryCmdBuffers[frameBufferIndex],
-				cmd.elementCount, 1, idx_offset, vtx_offset, 0);
+			vkCmdDrawIndexed(cmd,
+				draw_cmd.elementCount, 1, idx_offset, vtx_offset, 0);
 			
-			idx_offset += cmd.elementCount;
+			idx_offset += draw_cmd.elementCount;
 		}
 		vtx_offset += draw_list.vertexBufferSize;
 	}
@@ -576,7 +975,7 @@ void Renderer::findObjXthreadDivision(unsigned obj_num)
 		objXthread = obj_num;
 	}
 	else {
-		Renderer::objXthread = (obj_num + (obj_num % numThreads))/ numThreads;
+		Renderer::objXthread = (obj_num + numThreads - 1) / numThreads;
 	}
 	//Imposto il numero di thread che la libreria deve utilizzare
 	thread_pool.setThreadCount(numThreads);
@@ -589,9 +988,12 @@ void Renderer::findObjXthreadDivision(unsigned obj_num)
 	This function assembles a command buffer for 1 object running on 1 thread
 */
 void threadRenderCode(Object3D* obj, Camera* cam,ThreadData* threadData, uint32_t frameBufferIndex, uint32_t cmdBufferIndex,
-	VkCommandBufferInheritanceInfo inheritanceInfo, std::vector<VkDescriptorSet> descriptorSets)
+	VkCommandBufferInheritanceInfo inheritanceInfo, std::vector<VkDescriptorSet> descriptorSets, bool hybrid, VkPipeline pipeline,
+	VkExtent2D extent)
 {
-	obj->visible = cam->checkFrustum(obj->getObjTransform().position, obj->getBoundingRadius());
+	PROFILE_FUNCTION();
+	obj->visible = cam->checkFrustum(obj->getWorldSphere(), obj->getWorldAABB()) &&
+		!OcclusionCuller::isOccluded(obj->getWorldAABB());
 
 	VkCommandBufferBeginInfo beginInfo = {};
 	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -605,8 +1007,12 @@ void threadRenderCode(Object3D* obj, Camera* cam,ThreadData* threadData, uint32_
 	}
 	//RenderPass has already been started by the main thread so here i just have to bind the needed data and draw.
 
-	VkPipeline pipiline = PipelineFactory::pipelines[STD_3D_PIPELINE_ID].pipeline;
-	vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipiline);
+	vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	// dynamic state isn't inherited from the primary buffer
+	VkViewport viewport = { 0.0f, 0.0f, (float)extent.width, (float)extent.height, 0.0f, 1.0f };
+	VkRect2D scissor = { { 0, 0 }, extent };
+	vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+	vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
 
 	VkBuffer vertexBuffers[] = { MeshManager::getMesh(obj->getMeshName())->getVkVertexBuffer() };
 	VkDeviceSize offsets[] = { 0 };
@@ -614,7 +1020,7 @@ void threadRenderCode(Object3D* obj, Camera* cam,ThreadData* threadData, uint32_
 
 	vkCmdBindIndexBuffer(cmdBuffer, MeshManager::getMesh(obj->getMeshName())->getVkIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
 
-	VkPipelineLayout pipelineLayout = PipelineFactory::pipeline_layouts[PIPELINE_LAYOUT_STANDARD].layout;
+	VkPipelineLayout pipelineLayout = PipelineFactory::pipeline_layouts[hybrid ? PIPELINE_LAYOUT_HYBRID : PIPELINE_LAYOUT_STANDARD].layout;
 
 	vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
 		pipelineLayout,
@@ -624,7 +1030,10 @@ void threadRenderCode(Object3D* obj, Camera* cam,ThreadData* threadData, uint32_
 	MainPushConstantBlock pushConsts = {};
 	pushConsts.model_transform = obj->getMatrix();
 	pushConsts.textureIndex = TextureManager::getSceneTextureIndex(obj->getTextureName());
-	vkCmdPushConstants(cmdBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(pushConsts), &pushConsts);
+	pushConsts.reflective = obj->reflective;
+	vkCmdPushConstants(cmdBuffer, pipelineLayout,
+		hybrid ? VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT : VK_SHADER_STAGE_VERTEX_BIT,
+		0, sizeof(pushConsts), &pushConsts);
 
 
 	vkCmdDrawIndexed(cmdBuffer, static_cast<uint32_t>(MeshManager::getMesh(obj->getMeshName())->getIdxCount()), 1, 0, 0, 0);
@@ -635,27 +1044,30 @@ void threadRenderCode(Object3D* obj, Camera* cam,ThreadData* threadData, uint32_
 }
 
 void Renderer::createSyncObjects() {
-	imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	offScreenRenderReadySemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+	frames_in_flight = std::min(std::max(frames_in_flight, 1u), MAX_FRAMES_IN_FLIGHT);
+	currentFrame = 0;
+	imageAvailableSemaphores.resize(frames_in_flight);
+	renderFinishedSemaphores.resize(frames_in_flight);
+	imagesInFlight.resize(SwapChainMng::get()->getImageCount(), 0);
 
 	VkSemaphoreCreateInfo semaphoreInfo = {};
 	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-
-	VkFenceCreateInfo fenceInfo = {};
-	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+	for (size_t i = 0; i < frames_in_flight; i++) {
 		if (vkCreateSemaphore(Device::get(), &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-			vkCreateSemaphore(Device::get(), &semaphoreInfo, nullptr, &offScreenRenderReadySemaphores[i]) != VK_SUCCESS ||
-			vkCreateSemaphore(Device::get(), &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
-			vkCreateFence(Device::get(), &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS) {
+			vkCreateSemaphore(Device::get(), &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS) {
 
 			throw std::runtime_error("failed to create synchronization objects for a frame!");
 		}
 	}
+
+	// recreated with the swapchain, it goes on counting from the frames already submitted (all completed by now)
+	VkSemaphoreTypeCreateInfo timelineInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+	timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	timelineInfo.initialValue = frame_counter;
+	semaphoreInfo.pNext = &timelineInfo;
+	if (vkCreateSemaphore(Device::get(), &semaphoreInfo, nullptr, &frame_timeline) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create the frame timeline semaphore!");
+	}
 }
 
@@ -1,10 +1,14 @@
 #pragma once
+#include "VkEngine.h"
 #include "RenderPass.h"
 #include "Scene3D.h"
 #include "LightSource.h"
+#include "RenderGraph.h"
 #include "Libraries/threadpool.hpp"
+#include <deque>
 
-const uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+// upper bound of Renderer::frames_in_flight
+const uint32_t MAX_FRAMES_IN_FLIGHT = 3;
 
 struct FrameAttachment {
 	VkImage image;
@@ -13,6 +17,21 @@ struct FrameAttachment {
 	VkSampler Sampler;
 };
 
+// Destroys a resource once the frames that could still use it are done
+struct RetiredResource {
+	uint64_t retire_frame; // last frame submitted when it was retired, a value of the frame timeline
+	std::function<void()> destroy;
+};
+
+// what the passes of the frame graph are declared with
+struct FrameGraphImages {
+	uint32_t scene; // offscreen attachment of the frame, imported
+	uint32_t swapchain;
+	uint32_t scene_depth; // transient, rasterized frames only
+	uint32_t ui_depth; // transient
+	uint32_t ui_pass;
+};
+
 struct ThreadData {
 	// One pool per thread
 	VkCommandPool commandPool;
@@ -31,32 +50,107 @@ public:
 	static void renderScene();
 	static bool finalizeFrame();
 	static void cleanUp();
+	/*
+	* Called after the swapchain changed extent only: new transient images and framebuffers (and offscreen
+	* attachments if they follow the swapchain), the old ones are destroyed once the frames in flight are done with them.
+	*/
+	static void resize();
+	/*
+	* The offscreen targets are sized as the viewport the scene is shown in (the swapchain extent without one)
+	* and sampled with the upscale filter: true if either changed since they were created.
+	*/
+	static bool offScreenTargetsOutdated();
+	// New offscreen attachments, then transients and framebuffers, the old ones are destroyed like in resize
+	static void resizeOffScreen();
+	static inline VkExtent2D getOffScreenExtent() { return offscreen_extent; };
+	/*
+	* Called after objects are added/removed in the active scene: grows the per-thread
+	* secondary command buffers (and workers) in place, nothing in flight is touched.
+	*/
+	static void resizeDrawLists();
+	// The destroyer runs only after every frame in flight at the time of the call has completed
+	static void deferDestruction(std::function<void()> destroyer);
+	// Setup commands, like the first layout of new images, submitted without waiting: the next frame goes
+	// after them on the same queue. The command buffer is freed once that frame has completed
+	static void submitSetupCommands(VkCommandBuffer command);
+	// Waits until every submitted frame has completed, instead of idling the whole queue
+	static void waitForFrames();
+	// The scene image of the last frame (without the UI) as a binary PPM, after the frames in flight complete
+	static bool saveFrame(const std::string& ppm_file);
+	// vkQueueSubmit, counted and timed for the submit stats
+	static VkResult submit(VkQueue queue, uint32_t count, const VkSubmitInfo* submits, VkFence fence);
 	static bool multithreading;
 	static bool useRayTracing;
+	// rasterization with ray queries, used if the device has them and ray tracing is off
+	static bool useHybridRendering;
+	// frames recorded ahead of the GPU, applied by init (the swapchain is recreated to change it)
+	static uint32_t frames_in_flight;
+	static vkengine::FrameLatency frame_latency;
+	static vkengine::SubmitStats submit_stats;
+	// frames submitted since init, the last value signaled by the frame timeline
+	static inline uint64_t getFrameCount() { return frame_counter; };
+	// size of the viewport in pixels, 0x0 to follow the swapchain
+	static VkExtent2D viewport_size;
+	static vkengine::DynamicResolutionSettings dynamic_resolution;
+	// fraction of the offscreen extent rasterized on each axis by the next frame, what the UI has to show
+	static float next_render_scale;
 private:
+	static bool hybridFrame();
 	static void createFramebuffers();
+	static void createOffScreenFramebuffers();
 	static void createOffScreenAttachments();
+	// compiles the frame graph for the current targets and rendering mode, with new transients and framebuffers
+	static void rebuildFrameGraph();
+	static void declareFrameGraph();
+	// feeds the last GPU frame time to the dynamic resolution controller
+	static void updateRenderScale();
 	static void prepareThreadedRendering();
 	static void updateUniforms(uint32_t frameBufferIndex);
-	static void updateOffScreenCommandBuffer(uint32_t frameBufferIndex);
-	static void updateFinalPassCommandBuffer(uint32_t frameBufferIndex);
+	// passes of the frame graph, its barriers are recorded around them
+	static void recordOffScreenPass(VkCommandBuffer cmd, uint32_t frameBufferIndex);
+	static void recordFinalPass(VkCommandBuffer cmd, uint32_t frameBufferIndex);
 
-	static void recordImGuiDrawCmds(uint32_t frameBufferIndex);
+	static void recordImGuiDrawCmds(VkCommandBuffer cmd, uint32_t frameBufferIndex);
 	static void findObjXthreadDivision(unsigned obj_num);
 	static void createSyncObjects();
+	static void allocateSecondaryCmdBuffers(ThreadData& thread_data, uint32_t count);
+	static void destroyRetiredResources(bool all = false);
+	static void waitForFrame(uint64_t frame);
+	// collects the presents that reached the display, without waiting for the others
+	static void measurePresents();
 
-	static FrameAttachment final_depth_buffer;
-	static FrameAttachment offScreen_depth_buffer;
+	// one per swapchain image, the depth buffers are transients of the frame graph
 	static std::vector<FrameAttachment> offScreenAttachments;
-
+	// IMGUI sets still sampling the attachments replaced by resizeOffScreen, rewritten by prepareFrame
+	// once the frames that used their image are done
+	static std::vector<bool> stale_imgui_sets;
+	static RenderGraph frame_graph;
+	static FrameGraphImages frame_images;
+	// the rendering mode the graph was compiled for
+	static bool frame_graph_ray_tracing;
+	static VkExtent2D offscreen_extent;
+	static vkengine::UpscaleFilter offscreen_filter;
+	// of the frame being recorded
+	static float render_scale;
+	static vkengine::DynamicResolutionController resolution_controller;
+	static uint64_t last_timed_frame;
 
 	static std::vector<VkFramebuffer> swapChainFramebuffers;
 	static std::vector<VkFramebuffer> offScreenFramebuffers;
 
+	// binary, the swapchain doesn't take timeline semaphores. One per frame in flight
 	static std::vector<VkSemaphore> imageAvailableSemaphores;
-	static std::vector<VkSemaphore> offScreenRenderReadySemaphores;
 	static std::vector<VkSemaphore> renderFinishedSemaphores;
-	static std::vector<VkFence> inFlightFences;
+	// timeline semaphore, frame n signals n when it completes
+	static VkSemaphore frame_timeline;
+	// last frame that rendered to each swapchain image
+	static std::vector<uint64_t> imagesInFlight;
+	static std::vector<RetiredResource> retired_resources;
+	// frames submitted so far, the last value the timeline will reach
+	static uint64_t frame_counter;
+	// submits of the frame being prepared
+	static uint32_t frame_submits;
+	static float frame_submit_ms;
 
 	static VkCommandPool primaryCommandPool;
 	static std::vector<VkCommandBuffer> offScreenCmdBuffers;
@@ -73,5 +167,10 @@ private:
 	static uint32_t objXthread;
 	static uint32_t currentFrame;
 	static uint32_t last_imageIndex;
+
+	static std::chrono::high_resolution_clock::time_point frame_start;
+	// ids of the presents still to be displayed, with the start of their frames
+	static std::deque<std::pair<uint64_t, std::chrono::high_resolution_clock::time_point>> pending_presents;
+	static uint64_t last_present_id;
 };
 
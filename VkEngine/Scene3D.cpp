@@ -1,11 +1,15 @@
 #include "Scene3D.h"
+#include "MeshManager.h"
 #include <glm/gtc/type_ptr.hpp>
 #include <string>
+#include <algorithm>
 
 using namespace glm;
 using namespace vkengine;
 
 constexpr const unsigned INITIAL_CAPACITY = 32;
+// entries of the changed slot log kept for the readers lagging behind, at least
+constexpr const size_t MIN_SLOT_LOG = 1024;
 // This is a runtime ID unique across all scenes!
 unsigned getNewUniversalID() {
 	static unsigned next_id = 0;
@@ -50,13 +54,53 @@ std::vector<unsigned> vkengine::Scene3D::listCameras()
 	return keys;
 }
 
-void Scene3D::addObject(vkengine::ObjectInitInfo obj_info)
+unsigned Scene3D::addObject(vkengine::ObjectInitInfo obj_info)
 {
 	unsigned id = getNewUniversalID();
 	objects.insert({ id,
 		Object3D(id, obj_info.name, obj_info.mesh_name, obj_info.texture_name, obj_info.transformation) } );
 	objects.at(id).reflective = obj_info.reflective;
+	objects.at(id).occluder = obj_info.occluder;
+	objects.at(id).instance_slot = (unsigned)slot_objects.size();
+	slot_objects.push_back(id);
+	logChangedSlot(objects.at(id).instance_slot);
+	Mesh3D* mesh = MeshManager::getMesh(obj_info.mesh_name);
+	objects.at(id).setLocalBounds(mesh->getAABB(), mesh->getBoundingSphere());
 	if (objects.size() > object_capacity) object_capacity *= 2;
+	return id;
+}
+
+void Scene3D::reserveObjects(unsigned count)
+{
+	objects.reserve(objects.size() + count);
+	slot_objects.reserve(slot_objects.size() + count);
+	while (objects.size() + count > object_capacity) object_capacity *= 2;
+}
+
+void Scene3D::addObjects(const ObjectBatch& batch, size_t first, size_t count, std::vector<unsigned>* ids)
+{
+	first = std::min(first, batch.objects.size());
+	count = std::min(count, batch.objects.size() - first);
+	std::vector<Mesh3D*> meshes;
+	meshes.reserve(batch.meshes.size());
+	for (const auto& mesh_name : batch.meshes) {
+		meshes.push_back(MeshManager::getMesh(mesh_name));
+	}
+	reserveObjects((unsigned)count);
+	if (ids) ids->reserve(ids->size() + count);
+	for (size_t i = first; i < first + count; i++) {
+		const ObjectBatch::Entry& entry = batch.objects[i];
+		unsigned id = getNewUniversalID();
+		Object3D& obj = objects.emplace(id, Object3D(id, entry.name,
+			batch.meshes[entry.mesh], batch.textures[entry.texture], entry.transformation)).first->second;
+		obj.reflective = entry.reflective;
+		obj.occluder = entry.occluder;
+		obj.instance_slot = (unsigned)slot_objects.size();
+		slot_objects.push_back(id);
+		logChangedSlot(obj.instance_slot);
+		obj.setLocalBounds(meshes[entry.mesh]->getAABB(), meshes[entry.mesh]->getBoundingSphere());
+		if (ids) ids->push_back(id);
+	}
 }
 
 Object3D* Scene3D::getObject(unsigned id)
@@ -64,17 +108,75 @@ Object3D* Scene3D::getObject(unsigned id)
 	return &objects.at(id);
 }
 
+void Scene3D::updateObject(unsigned id, vkengine::ObjectInitInfo obj_info)
+{
+	Object3D& obj = objects.at(id);
+	obj.name = obj_info.name;
+	obj.reflective = obj_info.reflective;
+	obj.occluder = obj_info.occluder;
+	obj.getObjTransform() = obj_info.transformation;
+	obj.setTextureName(obj_info.texture_name);
+	if (obj.getMeshName() != obj_info.mesh_name) {
+		obj.setMeshName(obj_info.mesh_name);
+		Mesh3D* mesh = MeshManager::getMesh(obj_info.mesh_name);
+		obj.setLocalBounds(mesh->getAABB(), mesh->getBoundingSphere());
+	}
+	logChangedSlot(obj.instance_slot);
+}
+
 std::vector<unsigned> vkengine::Scene3D::listObjects()
 {
-	std::vector<unsigned> keys;
-	for (auto entry : objects) {
-		keys.push_back(entry.first);
+	return slot_objects;
+}
+
+unsigned Scene3D::updateWorldBounds()
+{
+	unsigned updated = 0;
+	for (auto & entry : objects) {
+		Object3D& obj = entry.second;
+		obj.updateWorldBounds();
+		// also the objects whose change was already picked up by getMatrix
+		if (obj.moved) {
+			obj.moved = false;
+			logChangedSlot(obj.instance_slot);
+			updated++;
+		}
 	}
-	return keys;
+	return updated;
+}
+
+void Scene3D::logChangedSlot(unsigned slot)
+{
+	changed_slots.push_back(slot);
+	// past twice the objects, re-reading every slot is cheaper than the log: the oldest half is dropped
+	size_t limit = std::max(MIN_SLOT_LOG, 2 * (size_t)objects.size());
+	if (changed_slots.size() > limit) {
+		size_t dropped = changed_slots.size() / 2;
+		changed_slots.erase(changed_slots.begin(), changed_slots.begin() + dropped);
+		changed_slots_start += dropped;
+	}
+}
+
+bool Scene3D::listChangedSlots(uint64_t& cursor, std::vector<unsigned>& slots)
+{
+	uint64_t end = changed_slots_start + changed_slots.size();
+	bool complete = cursor >= changed_slots_start && cursor <= end;
+	if (complete) {
+		slots.insert(slots.end(), changed_slots.begin() + (size_t)(cursor - changed_slots_start), changed_slots.end());
+	}
+	cursor = end;
+	return complete;
 }
 
 void Scene3D::removeObject(unsigned id)
 {
+	// the last object takes the freed slot
+	unsigned slot = objects.at(id).instance_slot;
+	unsigned last = slot_objects.back();
+	slot_objects[slot] = last;
+	objects.at(last).instance_slot = slot;
+	slot_objects.pop_back();
+	if (slot < slot_objects.size()) logChangedSlot(slot);
 	objects.erase(id);
 	if (objects.size() < object_capacity/2) object_capacity /= 2;
 }
@@ -8,9 +8,28 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
+#include <cstdint>
 
 namespace vkengine
 {
+	/*
+	* Many objects sharing a few meshes and textures, referred to by index in the two tables
+	* (the layout of the scene snapshots): names are resolved once per table entry, not once per object.
+	*/
+	struct ObjectBatch {
+		struct Entry {
+			std::string name;
+			uint32_t mesh;
+			uint32_t texture;
+			bool reflective;
+			bool occluder;
+			ObjTransformation transformation;
+		};
+		std::vector<std::string> meshes;
+		std::vector<std::string> textures;
+		std::vector<Entry> objects;
+	};
 
 	class Scene3D
 	{
@@ -21,11 +40,38 @@ namespace vkengine
 		Camera* getCamera(unsigned);
 		std::vector<unsigned> listCameras();
 
-		void addObject(vkengine::ObjectInitInfo obj_info);
+		unsigned addObject(vkengine::ObjectInitInfo obj_info);
+		// makes room for count more objects at once, e.g. before a bulk load
+		void reserveObjects(unsigned count);
+		/*
+		* Bulk load, same result as addObject called for the entries [first, first + count) of the batch.
+		* Their ids are appended to ids if not null.
+		*/
+		void addObjects(const ObjectBatch& batch, size_t first = 0, size_t count = SIZE_MAX, std::vector<unsigned>* ids = nullptr);
 		Object3D* getObject(unsigned id);
+		inline bool hasObject(unsigned id) { return objects.count(id) > 0; };
+		// overwrites every property of the object with the ones in obj_info
+		void updateObject(unsigned id, vkengine::ObjectInitInfo obj_info);
+		// ids in instance slot order
 		std::vector<unsigned> listObjects();
+		/*
+		* Objects are packed in the slots [0, get_object_num()): a slot keeps its object until the object
+		* is removed, then the object of the last slot moves in. An edit touches at most two slots.
+		*/
+		inline unsigned getObjectInSlot(unsigned slot) { return slot_objects[slot]; };
+		/*
+		* Slots edited since a reader's cursor: objects added, removed, moved or updated. Every edit is logged,
+		* each reader (e.g. the TLAS of a frame) keeps its own cursor, which is moved to the end of the log.
+		* Returns false if the log no longer goes back to the cursor: the reader has to look at every slot.
+		*/
+		bool listChangedSlots(uint64_t& cursor, std::vector<unsigned>& slots);
 		void removeObject(unsigned id);
 		inline unsigned get_object_num() { return objects.size(); }
+		/*
+		* Used by the engine once per frame: refreshes cached matrices and world space bounds
+		* of the objects whose transformation changed. Returns the number of updated objects.
+		*/
+		unsigned updateWorldBounds();
 
 		void addLight(vkengine::PointLightInfo);
 		PointLight* getLight(unsigned id);
@@ -49,6 +95,12 @@ namespace vkengine
 		unsigned object_capacity;
 		std::unordered_map<unsigned, Camera> cameras;
 		std::unordered_map<unsigned, Object3D> objects;
+		// object id of each instance slot
+		std::vector<unsigned> slot_objects;
+		void logChangedSlot(unsigned slot);
+		// the log only keeps the last entries, changed_slots_start is the position of the first one
+		std::vector<unsigned> changed_slots;
+		uint64_t changed_slots_start = 0;
 		std::unordered_map<unsigned, PointLight> point_lights;
 
 	};
@@ -1,3 +1,4 @@
 C:/VulkanSDK/1.2.162.0/Bin/glslc.exe --target-env=vulkan1.2 phong.vert -o vert.spv
 C:/VulkanSDK/1.2.162.0/Bin/glslc.exe --target-env=vulkan1.2 phong.frag -o frag.spv
+C:/VulkanSDK/1.2.162.0/Bin/glslc.exe --target-env=vulkan1.2 phong_hybrid.frag -o hybrid.frag.spv
 pause
\ No newline at end of file
@@ -22,6 +22,10 @@ layout(set=1,binding=0)uniform uniBlock{
 
 layout(location=0)out vec4 outColor;
 
+// set by the pipeline variants, the loop over the lights is unrolled.
+// The generic pipeline reads the count from the uniforms
+layout(constant_id=0) const int LIGHT_COUNT = -1;
+
 void main(){
 	vec4 texel = texture(texSamplers[inTextureIndex],fragTexCoord);
 	
@@ -35,7 +39,8 @@ void main(){
 	vec3 globalSpecular = computeSpecular(uniforms.global_light, E, sunDir, N);
 	color += globalDiffuse + globalSpecular;
 
-	for(int i=0;i<uniforms.light_count;i++){
+	int light_count = LIGHT_COUNT >= 0 ? LIGHT_COUNT : uniforms.light_count;
+	for(int i=0;i<light_count;i++){
 		// Distance to the light
 		vec3 lightVector = uniforms.lights[i].position.xyz - fragPos;
 		vec3 L = normalize(lightVector);
@@ -45,5 +50,5 @@ void main(){
 		vec3 specular = computeSpecular(uniforms.lights[i], E, L, N);
 		color += (diffuse * attenuation + specular * attenuation);
 	}
-	outColor = vec4 (ambient + color / (uniforms.light_count + 1) ,texel.a);// alpha correction
+	outColor = vec4 (ambient + color / (light_count + 1) ,texel.a);// alpha correction
 }
\ No newline at end of file
@@ -0,0 +1,168 @@
+#version 460
+#extension GL_ARB_separate_shader_objects:enable
+#extension GL_EXT_nonuniform_qualifier : enable
+#extension GL_EXT_scalar_block_layout : enable
+#extension GL_EXT_ray_query : require
+
+#include "..\commons.glsl"
+
+// Rasterized phong, with ray queries for the shadows and for the reflection of reflective objects.
+// Same descriptors as the ray tracing pipeline, the uniforms are not inverted here
+
+layout(location=0)in vec3 fragColor;
+layout(location=1)in vec2 fragTexCoord;
+layout(location=2)flat in int inTextureIndex;
+layout(location=3)in vec3 fragPos;
+layout(location=4)in vec3 normal;
+layout(location=5)in vec3 eyeDir;
+
+layout(set=0, binding=0, scalar) buffer Vertices { Vertex3D vertices[]; } vertexBuffers[];
+layout(set=0, binding=1) buffer Indices { uint indices[]; } indexBuffers[];
+layout(set=0, binding=2) uniform sampler2D texSamplers[];
+layout(set=0, binding=3) uniform samplerCube skybox;
+
+layout(set=1,binding=0)uniform uniBlock{
+	mat4 P;
+	mat4 V;
+	Light global_light;
+	Light lights[10];
+	int light_count;
+}uniforms;
+
+layout(set=2, binding=0) uniform accelerationStructureEXT topLevelAS;
+layout(set=2, binding=2, scalar) buffer SceneDesc { ObjDesc obj[]; } sceneObjects;
+
+layout(push_constant)uniform PushConsts
+{
+	mat4 M;
+	int textureIndex;
+	uint reflective;
+}pushConsts;
+
+layout(location=0)out vec4 outColor;
+
+// light count of the pipeline variant, -1 in the generic one (see phong.frag)
+layout(constant_id=0) const int LIGHT_COUNT = -1;
+
+const float ray_offset = 0.001;
+const float sun_distance = 1000000.0;
+
+struct Surface {
+	vec3 position;
+	vec3 normal;
+	vec4 albedo;
+};
+
+// What the hit shaders read from a triangle of an instance
+Surface fetchSurface(uint instance, uint primitive, vec2 attribs)
+{
+	ObjDesc object = sceneObjects.obj[instance];
+	uint mesh_id = object.meshId;
+	ivec3 indices = ivec3(indexBuffers[nonuniformEXT(mesh_id)].indices[3 * primitive + 0],
+	                      indexBuffers[nonuniformEXT(mesh_id)].indices[3 * primitive + 1],
+	                      indexBuffers[nonuniformEXT(mesh_id)].indices[3 * primitive + 2]);
+	Vertex3D v0 = vertexBuffers[nonuniformEXT(mesh_id)].vertices[indices.x];
+	Vertex3D v1 = vertexBuffers[nonuniformEXT(mesh_id)].vertices[indices.y];
+	Vertex3D v2 = vertexBuffers[nonuniformEXT(mesh_id)].vertices[indices.z];
+	const vec3 barycentrics = vec3(1.0 - attribs.x - attribs.y, attribs.x, attribs.y);
+
+	Surface surface;
+	surface.normal = normalize(vec3(object.transform * vec4(v0.nrm * barycentrics.x + v1.nrm * barycentrics.y + v2.nrm * barycentrics.z, 0.0)));
+	surface.position = vec3(object.transform * vec4(v0.pos * barycentrics.x + v1.pos * barycentrics.y + v2.pos * barycentrics.z, 1.0));
+	vec2 UV = v0.texCoord * barycentrics.x + v1.texCoord * barycentrics.y + v2.texCoord * barycentrics.z;
+	// no derivatives inside the ray query loops: top mip level
+	surface.albedo = textureLod(texSamplers[nonuniformEXT(object.textureId)], UV, 0.0);
+	return surface;
+}
+
+// Like the shadow any hit shader: the alpha of everything between the point and the light adds up
+float shadowAlpha(vec3 origin, vec3 direction, float distance)
+{
+	rayQueryEXT query;
+	rayQueryInitializeEXT(query, topLevelAS, gl_RayFlagsNoneEXT, 0xFF, origin, ray_offset, direction, distance);
+	float alpha = 0.0;
+	while(rayQueryProceedEXT(query))
+	{
+		if(rayQueryGetIntersectionTypeEXT(query, false) == gl_RayQueryCandidateIntersectionTriangleEXT)
+		{
+			alpha += fetchSurface(rayQueryGetIntersectionInstanceCustomIndexEXT(query, false),
+				rayQueryGetIntersectionPrimitiveIndexEXT(query, false),
+				rayQueryGetIntersectionBarycentricsEXT(query, false)).albedo.a;
+			if(alpha >= 1.0) rayQueryTerminateEXT(query);
+		}
+	}
+	// opaque geometry is committed without being a candidate
+	if(rayQueryGetIntersectionTypeEXT(query, true) != gl_RayQueryCommittedIntersectionNoneEXT) return 1.0;
+	return clamp(alpha, 0.0, 1.0);
+}
+
+vec3 shade(vec3 albedo, vec3 position, vec3 N, vec3 viewDir, bool shadows)
+{
+	vec3 color = {0,0,0};
+	vec3 origin = position + N * ray_offset;
+
+	vec3 sunDir = normalize(uniforms.global_light.position.xyz);
+	vec3 c = computeDiffuse(albedo, uniforms.global_light, sunDir, N);
+	float shadow = shadows && facingLight(N, sunDir) ? shadowAlpha(origin, sunDir, sun_distance) : 0.0;
+	if(shadow > 0.0) c *= 1.0 - shadow;
+	else c += computeSpecular(uniforms.global_light, viewDir, sunDir, N);
+	color += c;
+
+	int light_count = LIGHT_COUNT >= 0 ? LIGHT_COUNT : uniforms.light_count;
+	for(int i=0;i<light_count;i++){
+		vec3 lightVector = uniforms.lights[i].position.xyz - position;
+		vec3 L = normalize(lightVector);
+		float lightDst = length(lightVector);
+		c = computeDiffuse(albedo, uniforms.lights[i], L, N);
+		shadow = shadows && facingLight(N, L) ? shadowAlpha(origin, L, lightDst) : 0.0;
+		if(shadow > 0.0) c *= 1.0 - shadow;
+		else c += computeSpecular(uniforms.lights[i], viewDir, L, N);
+		color += c * LIGTH_ATTENUATION(lightDst);
+	}
+	return albedo * 0.01 + color / (light_count + 1);
+}
+
+// One bounce: the surface hit is shaded without shadows, a miss shows the sky
+vec3 reflection(vec3 position, vec3 N, vec3 viewDir)
+{
+	vec3 direction = reflect(viewDir, N);
+	rayQueryEXT query;
+	rayQueryInitializeEXT(query, topLevelAS, gl_RayFlagsNoneEXT, 0xFF, position + N * ray_offset, ray_offset, direction, 10000.0);
+	while(rayQueryProceedEXT(query))
+	{
+		// fully transparent texels are ignored, like in the any hit shader
+		if(rayQueryGetIntersectionTypeEXT(query, false) == gl_RayQueryCandidateIntersectionTriangleEXT &&
+			fetchSurface(rayQueryGetIntersectionInstanceCustomIndexEXT(query, false),
+				rayQueryGetIntersectionPrimitiveIndexEXT(query, false),
+				rayQueryGetIntersectionBarycentricsEXT(query, false)).albedo.a > 0.0)
+		{
+			rayQueryConfirmIntersectionEXT(query);
+		}
+	}
+	if(rayQueryGetIntersectionTypeEXT(query, true) == gl_RayQueryCommittedIntersectionNoneEXT)
+	{
+		return textureLod(skybox, direction, 0.0).xyz;
+	}
+	Surface hit = fetchSurface(rayQueryGetIntersectionInstanceCustomIndexEXT(query, true),
+		rayQueryGetIntersectionPrimitiveIndexEXT(query, true),
+		rayQueryGetIntersectionBarycentricsEXT(query, true));
+	return shade(hit.albedo.xyz, hit.position, hit.normal, direction, false);
+}
+
+void main(){
+	vec4 texel = texture(texSamplers[inTextureIndex],fragTexCoord);
+	vec3 N = normalize(normal);
+	vec3 E = normalize(eyeDir);
+
+	vec3 color;
+	if(pushConsts.reflective > 0)
+	{
+		// mirrors get no diffuse light of their own, like in the closest hit shader
+		color = texel.xyz * 0.01 + reflection(fragPos, N, E);
+	}
+	else
+	{
+		color = shade(texel.xyz, fragPos, N, E, true);
+	}
+	outColor = vec4(color, texel.a);
+}
@@ -13,6 +13,7 @@ struct hitPayload
 struct shadowPayload
 {
   float shadow_alpha;
+  uint occluded; // cleared by the shadow miss shader: only opaque instances are ever committed
 };
 
 
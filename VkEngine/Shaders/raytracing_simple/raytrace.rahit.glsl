@@ -65,7 +65,9 @@ void main()
   vec4 albedo = texture(texSamplers[nonuniformEXT(object.textureId)],UV);
 
 #ifdef PAYLOAD_1
+  // every surface with alpha on the way adds up, none of them stops the ray
   shadow.shadow_alpha += albedo.a;
+  ignoreIntersectionEXT;
 #endif
 
   if (albedo.a > 0.0f){
@@ -0,0 +1,152 @@
+#include "SnapshotFormat.h"
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+
+uint32_t SceneData::addString(const std::string& str)
+{
+	uint32_t offset = (uint32_t)strings.size();
+	strings.insert(strings.end(), str.begin(), str.end());
+	strings.push_back('\0');
+	return offset;
+}
+
+template<typename T>
+static void readBlock(const char*& cursor, std::vector<T>& block, uint32_t count)
+{
+	block.resize(count);
+	if (count > 0) memcpy(block.data(), cursor, count * sizeof(T));
+	cursor += count * sizeof(T);
+}
+
+template<typename T>
+static void writeBlock(std::ofstream& out, const std::vector<T>& block)
+{
+	if (!block.empty()) out.write(reinterpret_cast<const char*>(block.data()), block.size() * sizeof(T));
+}
+
+bool readSnapshot(const std::string& file, SceneData& data)
+{
+	std::ifstream in(file.c_str(), std::ios::binary | std::ios::ate);
+	if (!in) return false;
+	size_t size = (size_t)in.tellg();
+	if (size < sizeof(SnapshotHeader)) return false;
+	// one read for the whole file, everything after is plain copies
+	std::vector<char> bytes(size);
+	in.seekg(0);
+	if (!in.read(bytes.data(), size)) return false;
+
+	memcpy(&data.header, bytes.data(), sizeof(SnapshotHeader));
+	const SnapshotHeader& h = data.header;
+	if (h.magic != SNAPSHOT_MAGIC || h.version != SNAPSHOT_VERSION) return false;
+	uint64_t expected_size = sizeof(SnapshotHeader) + (uint64_t)h.string_bytes
+		+ ((uint64_t)h.mesh_count + h.texture_count) * sizeof(uint32_t)
+		+ (uint64_t)h.camera_count * sizeof(CameraRecord)
+		+ (uint64_t)h.light_count * sizeof(LightRecord)
+		+ (uint64_t)h.object_count * sizeof(ObjectRecord);
+	if (expected_size != size || h.string_bytes == 0) return false;
+
+	const char* cursor = bytes.data() + sizeof(SnapshotHeader);
+	readBlock(cursor, data.strings, h.string_bytes);
+	readBlock(cursor, data.meshes, h.mesh_count);
+	readBlock(cursor, data.textures, h.texture_count);
+	readBlock(cursor, data.cameras, h.camera_count);
+	readBlock(cursor, data.lights, h.light_count);
+	readBlock(cursor, data.objects, h.object_count);
+
+	// A truncated or hand-edited file must not send us reading outside the blob
+	if (data.strings.back() != '\0') return false;
+	auto valid_string = [&h](uint32_t offset) { return offset < h.string_bytes; };
+	bool valid = valid_string(h.id) && valid_string(h.title);
+	for (auto offset : data.meshes) valid = valid && valid_string(offset);
+	for (auto offset : data.textures) valid = valid && valid_string(offset);
+	for (auto& cam : data.cameras) valid = valid && valid_string(cam.name);
+	for (auto& light : data.lights) valid = valid && valid_string(light.name);
+	for (auto& obj : data.objects) {
+		valid = valid && valid_string(obj.name) && obj.mesh < h.mesh_count && obj.texture < h.texture_count;
+	}
+	return valid;
+}
+
+void writeSnapshot(const std::string& file, const SceneData& data)
+{
+	std::vector<char> strings = data.strings;
+	strings.resize((strings.size() + 3) & ~size_t(3), '\0'); // keeps the records 4 byte aligned
+
+	SnapshotHeader header = data.header;
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	header.string_bytes = (uint32_t)strings.size();
+	header.mesh_count = (uint32_t)data.meshes.size();
+	header.texture_count = (uint32_t)data.textures.size();
+	header.camera_count = (uint32_t)data.cameras.size();
+	header.light_count = (uint32_t)data.lights.size();
+	header.object_count = (uint32_t)data.objects.size();
+
+	std::ofstream out(file.c_str(), std::ios::binary | std::ios::trunc);
+	if (!out) throw std::runtime_error("failed to open scene snapshot " + file + " for writing!");
+	out.write(reinterpret_cast<const char*>(&header), sizeof(SnapshotHeader));
+	writeBlock(out, strings);
+	writeBlock(out, data.meshes);
+	writeBlock(out, data.textures);
+	writeBlock(out, data.cameras);
+	writeBlock(out, data.lights);
+	writeBlock(out, data.objects);
+	out.flush();
+	if (!out) throw std::runtime_error("failed to write scene snapshot " + file + "!");
+}
+
+SnapshotObjectWriter::SnapshotObjectWriter(SceneData& data) : data(data)
+{
+	for (uint32_t i = 0; i < (uint32_t)data.meshes.size(); i++) mesh_indices.insert({ data.getString(data.meshes[i]), i });
+	for (uint32_t i = 0; i < (uint32_t)data.textures.size(); i++) texture_indices.insert({ data.getString(data.textures[i]), i });
+}
+
+uint32_t SnapshotObjectWriter::intern(std::vector<uint32_t>& table, std::unordered_map<std::string, uint32_t>& indices, const std::string& name)
+{
+	auto it = indices.find(name);
+	if (it != indices.end()) return it->second;
+	uint32_t index = (uint32_t)table.size();
+	table.push_back(data.addString(name));
+	indices.insert({ name, index });
+	return index;
+}
+
+void SnapshotObjectWriter::add(const std::string& name, const std::string& mesh, const std::string& texture,
+	bool reflective, bool occluder, const vkengine::ObjTransformation& transform)
+{
+	ObjectRecord record = {};
+	record.name = data.addString(name);
+	record.mesh = intern(data.meshes, mesh_indices, mesh);
+	record.texture = intern(data.textures, texture_indices, texture);
+	record.flags = (reflective ? OBJECT_REFLECTIVE : 0) | (occluder ? OBJECT_OCCLUDER : 0);
+	for (int c = 0; c < 3; c++) {
+		record.position[c] = transform.position[c];
+		record.euler_angles[c] = transform.eulerAngles[c];
+	}
+	record.scale = transform.scale_factor;
+	data.objects.push_back(record);
+}
+
+vkengine::ObjectBatch toObjectBatch(const SceneData& data)
+{
+	// the name tables map one to one, the records keep their indices
+	vkengine::ObjectBatch batch;
+	for (auto offset : data.meshes) batch.meshes.push_back(data.getString(offset));
+	for (auto offset : data.textures) batch.textures.push_back(data.getString(offset));
+	batch.objects.resize(data.objects.size());
+	for (size_t i = 0; i < data.objects.size(); i++) {
+		const ObjectRecord& obj = data.objects[i];
+		vkengine::ObjectBatch::Entry& entry = batch.objects[i];
+		entry.name = data.getString(obj.name);
+		entry.mesh = obj.mesh;
+		entry.texture = obj.texture;
+		entry.reflective = (obj.flags & OBJECT_REFLECTIVE) != 0;
+		entry.occluder = (obj.flags & OBJECT_OCCLUDER) != 0;
+		entry.transformation = {};
+		entry.transformation.position = glm::vec3(obj.position[0], obj.position[1], obj.position[2]);
+		entry.transformation.eulerAngles = glm::vec3(obj.euler_angles[0], obj.euler_angles[1], obj.euler_angles[2]);
+		entry.transformation.scale_factor = obj.scale;
+	}
+	return batch;
+}
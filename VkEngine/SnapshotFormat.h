@@ -0,0 +1,103 @@
+#pragma once
+#include "Scene3D.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+/*
+* Binary scene snapshot (.vkscene), the format of the editor scenes and of the streamed world cells.
+* File layout (little endian, every block is 4 byte aligned):
+*   SnapshotHeader | string blob | mesh name offsets | texture name offsets | cameras | lights | objects
+* Records hold no pointers, only offsets inside the string blob: the file is read with one call
+* and every record array is copied as it is.
+*/
+constexpr uint32_t SNAPSHOT_MAGIC = 0x4E534B56; // "VKSN"
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+constexpr const char* SNAPSHOT_EXT = ".vkscene";
+
+struct SnapshotHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t string_bytes;
+	uint32_t mesh_count;
+	uint32_t texture_count;
+	uint32_t camera_count;
+	uint32_t light_count;
+	uint32_t object_count;
+	// offsets in the string blob
+	uint32_t id;
+	uint32_t title;
+	uint32_t def_camera;
+	float global_position[3];
+	float global_color[3];
+	float global_power;
+};
+
+struct CameraRecord {
+	uint32_t name;
+	float position[3];
+	float target[3];
+	float up_vector[3];
+	float fovY, aspect, near, far;
+};
+
+struct LightRecord {
+	uint32_t name;
+	float position[3];
+	float color[3];
+	float power;
+};
+
+enum ObjectRecordFlags : uint32_t {
+	OBJECT_REFLECTIVE = 1,
+	OBJECT_OCCLUDER = 2
+};
+
+struct ObjectRecord {
+	uint32_t name;
+	uint32_t mesh; // index in the mesh name table
+	uint32_t texture; // index in the texture name table
+	uint32_t flags;
+	float position[3];
+	float euler_angles[3];
+	float scale;
+};
+
+// A scene outside of the engine: what snapshots are read into and written from
+struct SceneData {
+	SnapshotHeader header = {};
+	std::vector<char> strings;
+	std::vector<uint32_t> meshes;
+	std::vector<uint32_t> textures;
+	std::vector<CameraRecord> cameras;
+	std::vector<LightRecord> lights;
+	std::vector<ObjectRecord> objects;
+
+	inline const char* getString(uint32_t offset) const { return strings.data() + offset; };
+	uint32_t addString(const std::string& str);
+};
+
+// false if the file is missing, corrupted or of another version
+bool readSnapshot(const std::string& file, SceneData& data);
+void writeSnapshot(const std::string& file, const SceneData& data);
+
+// Appends object records, the objects using the same mesh/texture share one table entry
+class SnapshotObjectWriter
+{
+public:
+	// the tables already in data are reused
+	SnapshotObjectWriter(SceneData& data);
+	void add(const std::string& name, const std::string& mesh, const std::string& texture,
+		bool reflective, bool occluder, const vkengine::ObjTransformation& transform);
+	inline void add(const vkengine::ObjectInitInfo& info) {
+		add(info.name, info.mesh_name, info.texture_name, info.reflective, info.occluder, info.transformation);
+	};
+private:
+	uint32_t intern(std::vector<uint32_t>& table, std::unordered_map<std::string, uint32_t>& indices, const std::string& name);
+	SceneData& data;
+	std::unordered_map<std::string, uint32_t> mesh_indices, texture_indices;
+};
+
+// The object records with their name tables, ready for Scene3D::addObjects
+vkengine::ObjectBatch toObjectBatch(const SceneData& data);
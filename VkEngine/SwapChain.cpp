@@ -2,22 +2,44 @@
 #include "PhysicalDevice.h"
 #include "Device.h"
 #include "ApiUtils.h"
+#include "Renderer.h"
 #include "VkEngine.h"
 #include "commons.h"
 
 std::vector<SwapChainMng::SwapChain*> SwapChainMng::swapchains;
 unsigned SwapChainMng::current_swapchain;
+vkengine::PresentMode SwapChainMng::requested_present_mode = vkengine::PRESENT_MAILBOX;
 
-SwapChainMng::SwapChain::SwapChain(vkengine::SurfaceOwner * surface_owner)
+static VkPresentModeKHR toVkPresentMode(vkengine::PresentMode mode)
+{
+	switch (mode) {
+	case vkengine::PRESENT_MAILBOX: return VK_PRESENT_MODE_MAILBOX_KHR;
+	case vkengine::PRESENT_IMMEDIATE: return VK_PRESENT_MODE_IMMEDIATE_KHR;
+	default: return VK_PRESENT_MODE_FIFO_KHR;
+	}
+}
+
+SwapChainMng::SwapChain::SwapChain(vkengine::SurfaceOwner * surface_owner, VkSwapchainKHR old_swapchain)
 {
 	this->surface_owner = surface_owner;
-	this->createSwapChain();
+	if (PhysicalDevice::isHeadless()) {
+		this->createHeadlessImages();
+	}
+	else {
+		this->createSwapChain(old_swapchain);
+	}
 	this->createImageViews();
 	this->image_count = this->getImageViews().size();
 }
 
 bool SwapChainMng::SwapChain::acquireNextImage(VkSemaphore semaphore, uint32_t* imageIndex)
 {
+	if (PhysicalDevice::isHeadless()) {
+		// the semaphore is not signaled: the renderer doesn't wait for it without a surface
+		*imageIndex = next_headless_image;
+		next_headless_image = (next_headless_image + 1) % image_count;
+		return true;
+	}
 	VkResult result = vkAcquireNextImageKHR(Device::get(), this->swapChain, std::numeric_limits<uint64_t>::max(), semaphore, VK_NULL_HANDLE, imageIndex);
 	if (result == VK_ERROR_OUT_OF_DATE_KHR) {
 		return false;
@@ -28,8 +50,9 @@ bool SwapChainMng::SwapChain::acquireNextImage(VkSemaphore semaphore, uint32_t*
 	return true;
 }
 
-bool SwapChainMng::SwapChain::presentImage(uint32_t imageIndex, VkSemaphore* semaphores)
+bool SwapChainMng::SwapChain::presentImage(uint32_t imageIndex, VkSemaphore* semaphores, uint64_t present_id)
 {
+	if (PhysicalDevice::isHeadless()) return true;
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 	presentInfo.waitSemaphoreCount = 1;
@@ -40,6 +63,15 @@ bool SwapChainMng::SwapChain::presentImage(uint32_t imageIndex, VkSemaphore* sem
 	presentInfo.pSwapchains = swapChains;
 	presentInfo.pImageIndices = &imageIndex;
 	presentInfo.pResults = nullptr; // Optional
+#ifdef VK_KHR_present_wait
+	VkPresentIdKHR presentId = {};
+	if (present_id != 0) {
+		presentId.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+		presentId.swapchainCount = 1;
+		presentId.pPresentIds = &present_id;
+		presentInfo.pNext = &presentId;
+	}
+#endif
 
 	VkResult result = vkQueuePresentKHR(Device::getPresentQueue(), &presentInfo);
 	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
@@ -51,23 +83,46 @@ bool SwapChainMng::SwapChain::presentImage(uint32_t imageIndex, VkSemaphore* sem
 	return true;
 }
 
+VkResult SwapChainMng::SwapChain::waitForPresent(uint64_t present_id, uint64_t timeout)
+{
+#ifdef VK_KHR_present_wait
+	VkResult result = vkWaitForPresentKHR(Device::get(), this->swapChain, present_id, timeout);
+	if (result != VK_SUCCESS && result != VK_TIMEOUT && result != VK_ERROR_OUT_OF_DATE_KHR && result != VK_SUBOPTIMAL_KHR) {
+		throw std::runtime_error("failed to wait for a present!");
+	}
+	return result;
+#else
+	return VK_ERROR_EXTENSION_NOT_PRESENT;
+#endif
+}
+
 
 SwapChainMng::SwapChain::~SwapChain()
 {
 	for (auto imageView : swapImageViews) {
 		vkDestroyImageView(Device::get(), imageView, nullptr);
 	}
-	vkDestroySwapchainKHR(Device::get(), swapChain, nullptr);
+	if (PhysicalDevice::isHeadless()) {
+		for (size_t i = 0; i < swapImages.size(); i++) {
+			vkDestroyImage(Device::get(), swapImages[i], nullptr);
+			vkFreeMemory(Device::get(), headlessMemories[i], nullptr);
+		}
+		headlessMemories.clear();
+	}
+	else {
+		vkDestroySwapchainKHR(Device::get(), swapChain, nullptr);
+	}
 	swapImages.clear();
 	swapImageViews.clear();
 }
 
-void  SwapChainMng::SwapChain::createSwapChain()
+void  SwapChainMng::SwapChain::createSwapChain(VkSwapchainKHR old_swapchain)
 {
 	SwapChainSupportDetails swapChainSupport = PhysicalDevice::getSwapChainSupport();
 
 	VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
 	VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
+	this->present_mode = presentMode == VK_PRESENT_MODE_FIFO_KHR ? vkengine::PRESENT_FIFO : requested_present_mode;
 	VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
 
 	// Rimane da scegliere quante immagini pu contenere la swapchain
@@ -103,7 +158,7 @@ void  SwapChainMng::SwapChain::createSwapChain()
 	createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR; // disabilito il blending con l'anmbiente windows
 	createInfo.presentMode = presentMode;
 	createInfo.clipped = VK_TRUE; // se la mia finestra  in parte coperta, disabilita i pixels coperti
-	createInfo.oldSwapchain = VK_NULL_HANDLE;
+	createInfo.oldSwapchain = old_swapchain;
 
 	if (vkCreateSwapchainKHR(Device::get(), &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create swap chain!");
@@ -116,6 +171,26 @@ void  SwapChainMng::SwapChain::createSwapChain()
 	this->swapChainExtent = extent;
 }
 
+void SwapChainMng::SwapChain::createHeadlessImages()
+{
+	int width = 0, height = 0;
+	this->surface_owner->getFrameBufferSize(&width, &height);
+	this->swapChain = VK_NULL_HANDLE;
+	this->swapChainImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+	this->swapChainExtent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
+	// nothing waits for a display
+	this->present_mode = vkengine::PRESENT_IMMEDIATE;
+
+	this->swapImages.resize(MAX_FRAMES_IN_FLIGHT);
+	this->headlessMemories.resize(MAX_FRAMES_IN_FLIGHT);
+	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		createImage(PhysicalDevice::get(), Device::get(), swapChainExtent.width, swapChainExtent.height,
+			swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, // the final pass can be read back
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, this->swapImages[i], this->headlessMemories[i]);
+	}
+}
+
 VkSurfaceFormatKHR  SwapChainMng::SwapChain::chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
 	//scelta di default se la superficie non ha preferenze
 	if (availableFormats.size() == 1 && availableFormats[0].format == VK_FORMAT_UNDEFINED) {
@@ -133,15 +208,12 @@ VkSurfaceFormatKHR  SwapChainMng::SwapChain::chooseSwapSurfaceFormat(const std::
 
 VkPresentModeKHR  SwapChainMng::SwapChain::chooseSwapPresentMode(const std::vector<VkPresentModeKHR> availablePresentModes) {
 	VkPresentModeKHR defaultMode = VK_PRESENT_MODE_FIFO_KHR;
-	// Se disponibile seleziono la modalit a triplo buffering che  la migliore
+	// mailbox (the default) is triple buffering without tearing, immediate has the least latency but tears
+	VkPresentModeKHR requestedMode = toVkPresentMode(requested_present_mode);
 	for (const auto& availablePresentMode : availablePresentModes) {
-		if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
+		if (availablePresentMode == requestedMode) {
 			return availablePresentMode;
 		}
-		// I prefer not to use immediate for now
-		//else if (availablePresentMode == VK_PRESENT_MODE_IMMEDIATE_KHR) {
-		//	defaultMode = availablePresentMode;
-		//}
 	}
 	return defaultMode;
 }
@@ -183,6 +255,14 @@ void SwapChainMng::init(vkengine::SurfaceOwner * surface_owner)
 	current_swapchain = 0;
 }
 
+void SwapChainMng::recreate(vkengine::SurfaceOwner* surface_owner)
+{
+	SwapChain* old = swapchains[current_swapchain];
+	swapchains[current_swapchain] = new SwapChain(surface_owner, old->get());
+	// presents of the old images may still be queued
+	Renderer::deferDestruction([old]() { delete old; });
+}
+
 SwapChainMng::SwapChain * SwapChainMng::get()
 {
 	return SwapChainMng::swapchains[current_swapchain];
@@ -6,17 +6,25 @@
 class SwapChainMng {
 	class SwapChain {
 	public:
-		SwapChain(vkengine::SurfaceOwner* surface_owner);
+		// the images of old_swapchain not yet acquired are handed over to the new one
+		SwapChain(vkengine::SurfaceOwner* surface_owner, VkSwapchainKHR old_swapchain = VK_NULL_HANDLE);
 		bool acquireNextImage(VkSemaphore semaphore, uint32_t* imageIndex);
-		bool presentImage(uint32_t imageIndex, VkSemaphore* semaphores);
+		// a present_id other than 0 can be waited with waitForPresent (ids grow frame after frame)
+		bool presentImage(uint32_t imageIndex, VkSemaphore* semaphores, uint64_t present_id = 0);
+		// VK_SUCCESS once the image of the present is on screen, VK_TIMEOUT before
+		VkResult waitForPresent(uint64_t present_id, uint64_t timeout);
 		inline VkSwapchainKHR get() { return this->swapChain; };
 		inline unsigned getImageCount() { return this->image_count; };
 		inline std::vector<VkImageView> getImageViews() {return this->swapImageViews;}
+		inline VkImage getImage(unsigned index) { return this->swapImages[index]; };
 		inline VkFormat getFormat() {return this->swapChainImageFormat;	};
 		inline VkExtent2D getExtent() { return  this->swapChainExtent; };
+		inline vkengine::PresentMode getPresentMode() { return this->present_mode; };
 		~SwapChain();
 	private:
-		void createSwapChain();
+		void createSwapChain(VkSwapchainKHR old_swapchain);
+		// without a surface the "swapchain" is a ring of images owned by the engine
+		void createHeadlessImages();
 		void createImageViews();
 		VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
 		VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR> availablePresentModes);
@@ -27,12 +35,19 @@ class SwapChainMng {
 		VkExtent2D swapChainExtent;
 		std::vector<VkImage> swapImages;
 		std::vector<VkImageView> swapImageViews;
+		std::vector<VkDeviceMemory> headlessMemories;
+		unsigned next_headless_image = 0;
 		unsigned image_count;
+		vkengine::PresentMode present_mode;
 	};
 public:
 	static void init(vkengine::SurfaceOwner* surface_owner);
 	static SwapChainMng::SwapChain* get();
+	// A new swapchain from the current one, which is retired until the frames in flight are done with it
+	static void recreate(vkengine::SurfaceOwner* surface_owner);
 	static void cleanUP();
+	// applies to the swapchains created from now on
+	static vkengine::PresentMode requested_present_mode;
 private:
 	static std::vector<SwapChain*> swapchains;
 	static unsigned current_swapchain;
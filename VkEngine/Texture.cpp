@@ -10,6 +10,8 @@
 #include <filesystem>
 namespace fs = std::filesystem;
 
+bool BaseTexture::keep_cpu_copy = true;
+
 Texture::Texture()
 {
 	unsigned char pixels[] = { 247, 231., 206., 255. }; // default
@@ -28,6 +30,8 @@ Texture::Texture(std::string texturePath)
 
 Texture::Texture(unsigned char* pixels, int *width, int *height)
 {
+	this->opaque = hasOnlyOpaqueTexels(pixels, (size_t)*width * *height);
+	this->keepCpuLayer(pixels, *width, *height);
 	this->createTextureImage(pixels,*width,*height);
 	this->createTextureImageView();
 	this->createTextureSampler();
@@ -138,6 +142,7 @@ CubeMapTexture::CubeMapTexture(std::string texturePath)
 	{
 		faces[i].pixels = this->readImageFile(texturePath + "/" + parts[i] + ext, &faces[i].width, &faces[i].height);
 		buffer_size += faces[i].width * faces[i].height * 4 * sizeof(char);
+		this->keepCpuLayer(faces[i].pixels, faces[i].width, faces[i].height);
 	}
 	Buffer stage = {};
 	createBuffer(PhysicalDevice::get(), Device::get(), buffer_size,
@@ -214,6 +219,22 @@ CubeMapTexture::CubeMapTexture(std::string texturePath)
 	}
 }
 
+void BaseTexture::keepCpuLayer(const unsigned char* pixels, int width, int height)
+{
+	if (!keep_cpu_copy) return;
+	cpu_width = width;
+	cpu_height = height;
+	cpu_layers.emplace_back(pixels, pixels + width * height * 4);
+}
+
+bool BaseTexture::hasOnlyOpaqueTexels(const unsigned char* pixels, size_t pixel_count)
+{
+	for (size_t i = 0; i < pixel_count; i++) {
+		if (pixels[4 * i + 3] != 255) return false;
+	}
+	return true;
+}
+
 VkImageView BaseTexture::getTextureImgView()
 {
 	return this->textureImageView;
@@ -4,12 +4,27 @@ class BaseTexture {
 public:
 	VkImageView getTextureImgView();
 	VkSampler getTextureSampler();
+	// CPU side copy (RGBA8, one layer per cube face), used by the CPU reference ray tracer
+	inline const std::vector<unsigned char>& getPixels(unsigned layer = 0) const { return cpu_layers[layer]; };
+	inline unsigned countCpuLayers() const { return (unsigned)cpu_layers.size(); };
+	inline int getWidth() const { return cpu_width; };
+	inline int getHeight() const { return cpu_height; };
+	// textures loaded while this is false have no CPU copy
+	static bool keep_cpu_copy;
+	// every texel has alpha 255: nothing can be cut out, or let light through, where it is mapped
+	inline bool isOpaque() const { return opaque; };
+	// RGBA8 pixels, no device involved
+	static bool hasOnlyOpaqueTexels(const unsigned char* pixels, size_t pixel_count);
 	~BaseTexture();
 protected:
 	VkImage textureImage;
 	VkDeviceMemory textureImageMemory;
 	VkImageView textureImageView;
 	VkSampler textureSampler;
+	std::vector<std::vector<unsigned char>> cpu_layers;
+	int cpu_width = 0, cpu_height = 0;
+	bool opaque = false;
+	void keepCpuLayer(const unsigned char* pixels, int width, int height);
 	unsigned char* readImageFile(std::string texturePath, int* width,
 		int* height);
 	void createTextureSampler();
@@ -11,6 +11,7 @@ public:
 	static void loadFontAtlasTexture(unsigned char * pixels, int* width, int* height);
 	static Texture* getImGuiTexture(int id);
 	static CubeMapTexture* getCubeMapTexture();
+	static inline unsigned countCubeMaps() { return (unsigned)cubeMapTextures.size(); };
 	static void addTexture(std::string id, std::string texture_path);
 	static void addCubeMap(std::string id, std::string texture_path);
 	static void addImGuiTexture(unsigned char * pixels, int* width, int* height);
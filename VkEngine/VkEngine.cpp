@@ -12,6 +12,10 @@
 #include "Renderer.h"
 #include "Pipeline.h"
 #include "raytracing.h"
+#include "OcclusionCulling.h"
+#include "CpuRayTracer.h"
+#include "GpuProfiler.h"
+#include "CpuProfiler.h"
 #include "commons.h"
 
 namespace vkengine
@@ -20,9 +24,21 @@ namespace vkengine
 	SurfaceOwner* surfaceOwner;
 	std::string active_scene;
 	std::unordered_map<std::string, Scene3D>* scenes;
+	std::unordered_map<std::string, std::unique_ptr<WorldPartition>> partitions;
+	// frames in flight or present mode changed: the swapchain is recreated before the next frame
+	bool swapchain_settings_changed = false;
+	// frames in flight changed, the sync objects and command buffers are rebuilt with the swapchain
+	bool renderer_rebuild_needed = false;
+	// size last asked by setViewportSize and for how many frames in a row
+	VkExtent2D requested_viewport = { 0, 0 };
+	uint32_t requested_viewport_frames = 0;
+	// a viewport size has to hold this long before the offscreen targets follow it
+	constexpr const uint32_t VIEWPORT_SETTLE_FRAMES = 8;
 
 	void buildBasicPipelines();
 	void recreateSwapChain();
+	void resizeOffScreenTargets();
+	void updateCameraAspects();
 
 	void setSurfaceOwner(SurfaceOwner * surface_owner)
 	{
@@ -33,6 +49,9 @@ namespace vkengine
 	{
 #ifdef DEBUG
 		Instance::enableValidation();
+#endif
+#ifdef VKENGINE_CPU_PROFILER
+		CpuProfiler::setThreadName("main");
 #endif
 		Instance::setAppName("Demo");
 		Instance::setEngineName("VkEngine");
@@ -50,6 +69,7 @@ namespace vkengine
 		RenderPassCatalog::init();
 		PipelineFactory::init();
 		buildBasicPipelines();
+		std::cout << "Pipelines created in " << PipelineFactory::pipeline_creation_ms << " ms" << std::endl;
 		MeshManager::init();
 		TextureManager::init();
 		Renderer::init();
@@ -64,6 +84,7 @@ namespace vkengine
 	void shutdown()
 	{
 		vkDeviceWaitIdle(Device::get());
+		partitions.clear();
 		scenes->clear();
 		delete scenes;
 		RayTracer::cleanUP();
@@ -128,8 +149,64 @@ namespace vkengine
 		return &scenes->at(scene_id);
 	}
 
+	static bool isActiveScene(Scene3D* scene)
+	{
+		return scenes->count(active_scene) > 0 && &scenes->at(active_scene) == scene;
+	}
+
+	unsigned addObject(Scene3D* scene, ObjectInitInfo obj_info)
+	{
+		unsigned id = scene->addObject(obj_info);
+		if (isActiveScene(scene)) {
+			Renderer::resizeDrawLists();
+		}
+		return id;
+	}
+
+	void removeObject(Scene3D* scene, unsigned obj_id)
+	{
+		scene->removeObject(obj_id);
+		if (isActiveScene(scene)) {
+			Renderer::resizeDrawLists();
+		}
+	}
+
+	void updateObject(Scene3D* scene, unsigned obj_id, ObjectInitInfo obj_info)
+	{
+		// bounds, matrices and RT instances are all refreshed by the next frame
+		scene->updateObject(obj_id, obj_info);
+	}
+
+	void enableWorldPartition(Scene3D* scene, WorldPartitionSettings settings)
+	{
+		disableWorldPartition(scene);
+		partitions[scene->getId()] = std::make_unique<WorldPartition>(scene, settings);
+		// cells come back from the next frame on
+		if (isActiveScene(scene)) {
+			Renderer::resizeDrawLists();
+		}
+	}
+
+	void disableWorldPartition(Scene3D* scene)
+	{
+		auto partition = partitions.find(scene->getId());
+		if (partition == partitions.end()) return;
+		partition->second->makeAllResident();
+		partitions.erase(partition);
+		if (isActiveScene(scene)) {
+			Renderer::resizeDrawLists();
+		}
+	}
+
+	WorldPartition* getWorldPartition(Scene3D* scene)
+	{
+		auto partition = partitions.find(scene->getId());
+		return partition == partitions.end() ? nullptr : partition->second.get();
+	}
+
 	void removeScene(std::string scene_id)
 	{
+		partitions.erase(scene_id);
 		scenes->erase(scene_id);
 		if (scenes->size() == 0) {
 			createScene("scene","Scene");
@@ -163,6 +240,7 @@ namespace vkengine
 		if (hasRayTracing()) {
 			RayTracer::updateRTPipelineResources(&scenes->at(active_scene));
 		}
+		updateCameraAspects();
 	}
 
 	bool* multithreadedRendering()
@@ -170,6 +248,122 @@ namespace vkengine
 		return &Renderer::multithreading;
 	}
 
+	bool* occlusionCulling()
+	{
+		return &OcclusionCuller::enabled;
+	}
+
+	float getPipelineCreationTime()
+	{
+		return PipelineFactory::pipeline_creation_ms;
+	}
+
+	bool* pipelineVariants()
+	{
+		return &PipelineFactory::use_variants;
+	}
+
+	void setFramesInFlight(uint32_t frames)
+	{
+		frames = std::min(std::max(frames, 1u), MAX_FRAMES_IN_FLIGHT);
+		if (frames == Renderer::frames_in_flight) return;
+		Renderer::frames_in_flight = frames;
+		swapchain_settings_changed = true;
+		renderer_rebuild_needed = true;
+	}
+
+	uint32_t getFramesInFlight()
+	{
+		return Renderer::frames_in_flight;
+	}
+
+	void setPresentMode(PresentMode mode)
+	{
+		if (mode == SwapChainMng::requested_present_mode) return;
+		SwapChainMng::requested_present_mode = mode;
+		swapchain_settings_changed = true;
+	}
+
+	PresentMode getPresentMode()
+	{
+		return SwapChainMng::get()->getPresentMode();
+	}
+
+	void setViewportSize(uint32_t width, uint32_t height)
+	{
+		// a panel being dragged changes size every frame: the targets are resized once it stops,
+		// until then the UI stretches the current image
+		if (width != requested_viewport.width || height != requested_viewport.height) {
+			requested_viewport = { width, height };
+			requested_viewport_frames = 0;
+		}
+		requested_viewport_frames++;
+		bool first_size = Renderer::viewport_size.width == 0 || Renderer::viewport_size.height == 0;
+		if (first_size || requested_viewport_frames >= VIEWPORT_SETTLE_FRAMES) {
+			// applied before the next frame, see Renderer::offScreenTargetsOutdated
+			Renderer::viewport_size = requested_viewport;
+		}
+	}
+
+	DynamicResolutionSettings* dynamicResolution()
+	{
+		return &Renderer::dynamic_resolution;
+	}
+
+	FrameLatency getFrameLatency()
+	{
+		return Renderer::frame_latency;
+	}
+
+	SubmitStats getSubmitStats()
+	{
+		return Renderer::submit_stats;
+	}
+
+	bool hasGpuProfiler()
+	{
+		return GpuProfiler::isSupported();
+	}
+
+	const char* gpuPassName(GpuPass pass)
+	{
+		return GpuProfiler::passName(pass);
+	}
+
+	std::vector<GpuFrameTimings> getGpuTimings()
+	{
+		return std::vector<GpuFrameTimings>(GpuProfiler::history.begin(), GpuProfiler::history.end());
+	}
+
+	bool exportGpuTimings(const std::string& csv_file)
+	{
+		return GpuProfiler::exportCsv(csv_file);
+	}
+
+	bool hasCpuProfiler()
+	{
+#ifdef VKENGINE_CPU_PROFILER
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	void setCpuProfiling(bool enabled)
+	{
+		CpuProfiler::setRecording(enabled);
+	}
+
+	bool isCpuProfiling()
+	{
+		return CpuProfiler::isRecording();
+	}
+
+	bool exportCpuTrace(const std::string& json_file)
+	{
+		return CpuProfiler::exportChromeTrace(json_file);
+	}
+
 	bool hasRayTracing()
 	{
 		return PhysicalDevice::hasRaytracing();
@@ -185,8 +379,153 @@ namespace vkengine
 		return &RayTracer::max_reflections_depth;
 	}
 
+	RayTracingStats getRayTracingStats()
+	{
+		return RayTracer::update_stats;
+	}
+
+	bool* compactBlas()
+	{
+		return &RayTracer::compact_blas;
+	}
+
+	std::vector<BlasMemoryInfo> listBlasMemory()
+	{
+		return RayTracer::getBlasMemoryReport();
+	}
+
+	float* blasBuildBudget()
+	{
+		return &RayTracer::blas_build_budget_ms;
+	}
+
+	bool* rtAccumulation()
+	{
+		return &RayTracer::accumulate;
+	}
+
+	uint32_t* rtAccumulationMaxSamples()
+	{
+		return &RayTracer::accumulation_max_samples;
+	}
+
+	uint32_t rtAccumulatedSamples()
+	{
+		return RayTracer::accumulated_samples;
+	}
+
+	RayBudgetSettings* rtBudgetSettings()
+	{
+		return &RayTracer::budget_settings;
+	}
+
+	RayBudget getRayBudget()
+	{
+		return RayTracer::next_budget;
+	}
+
+	ReflectionResolution* rtReflectionResolution()
+	{
+		return &RayTracer::reflection_resolution;
+	}
+
+	float getReflectionTraceTime(ReflectionResolution resolution)
+	{
+		return RayTracer::getReflectionTraceTime(resolution);
+	}
+
+	bool hasHybridRendering()
+	{
+		return PhysicalDevice::hasRayQuery();
+	}
+
+	bool* hybridRendering()
+	{
+		return &Renderer::useHybridRendering;
+	}
+
+	float getRenderScale()
+	{
+		return Renderer::useRayTracing ? RayTracer::next_budget.resolution_scale : Renderer::next_render_scale;
+	}
+
+	// What the ray tracing descriptor sets and uniforms hold, from the CPU copies of meshes and textures
+	static CpuScene captureCpuScene(Scene3D* scene, unsigned width, unsigned height)
+	{
+		CpuScene cpu_scene;
+		for (auto mesh : MeshManager::getMeshLibrary()) {
+			cpu_scene.addMesh(mesh->getVertices(), mesh->getIndices());
+		}
+		for (unsigned i = 0; i < TextureManager::countSceneTextures(); i++) {
+			Texture* texture = TextureManager::getSceneTexture(i);
+			CpuImage image;
+			if (texture->countCpuLayers() > 0) image = { texture->getWidth(), texture->getHeight(), texture->getPixels() };
+			cpu_scene.addTexture(image);
+		}
+		if (TextureManager::countCubeMaps() > 0 && TextureManager::getCubeMapTexture()->countCpuLayers() == 6) {
+			CubeMapTexture* sky = TextureManager::getCubeMapTexture();
+			for (unsigned face = 0; face < 6; face++) {
+				cpu_scene.sky_faces.push_back({ sky->getWidth(), sky->getHeight(), sky->getPixels(face) });
+			}
+		}
+		for (auto id : scene->listObjects()) {
+			Object3D* obj = scene->getObject(id);
+			cpu_scene.addInstance(MeshManager::getMeshID(obj->getMeshName()),
+				TextureManager::getSceneTextureIndex(obj->getTextureName()), obj->getMatrix(), obj->reflective);
+		}
+		cpu_scene.commit();
+		// the uniform block has room for 10 point lights
+		for (auto id : scene->listLights()) {
+			if (cpu_scene.lights.size() == 10) break;
+			cpu_scene.lights.push_back(scene->getLight(id)->getData());
+		}
+		cpu_scene.global_light = scene->globalLight;
+		// same camera, with the aspect ratio of the image
+		Camera* camera = scene->getCamera(scene->current_camera);
+		ViewSetup view = camera->getViewSetup();
+		PerspectiveSetup perspective = camera->getPerspectiveSetup();
+		cpu_scene.setCamera(glm::lookAt(view.position, view.target, view.upVector),
+			glm::perspective(glm::radians(perspective.fovY), (float)width / height, perspective.near, perspective.far));
+		return cpu_scene;
+	}
+
+	CpuRayTracingStats renderCpuReference(const std::string& ppm_file, unsigned width, unsigned height, unsigned thread_count)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		CpuScene cpu_scene = captureCpuScene(&scenes->at(active_scene), width, height);
+		float build_ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		CpuImage image;
+		image.width = width;
+		image.height = height;
+		CpuRayTracingStats stats = CpuRayTracer::render(cpu_scene, image, RayTracer::max_reflections_depth, thread_count);
+		stats.build_ms = build_ms;
+		image.writePPM(ppm_file);
+		std::cout << "CPU ray tracing: " << ppm_file << " " << width << "x" << height << ", BVHs built in " << build_ms
+			<< " ms, " << stats.rays << " rays in " << stats.trace_ms << " ms (" << stats.mrays_per_second << " Mrays/s)" << std::endl;
+		return stats;
+	}
+
 	void renderFrame()
 	{
+		PROFILE_FUNCTION();
+		// streaming happens between frames, like the editing of objects
+		auto partition = partitions.find(active_scene);
+		if (partition != partitions.end()) {
+			Scene3D* scene = &scenes->at(active_scene);
+			glm::vec3 eye = scene->getCamera(scene->current_camera)->getViewSetup().position;
+			if (partition->second->update(eye)) {
+				Renderer::resizeDrawLists();
+			}
+		}
+		if (swapchain_settings_changed) {
+			swapchain_settings_changed = false;
+			recreateSwapChain();
+			// the averages start again with the new settings
+			Renderer::frame_latency = { -1.f, -1.f };
+		}
+		if (Renderer::offScreenTargetsOutdated()) {
+			resizeOffScreenTargets();
+		}
 		if (!Renderer::prepareFrame()) {
 			recreateSwapChain();
 			return;
@@ -199,26 +538,56 @@ namespace vkengine
 		}
 	}
 
+	uint64_t getFrameCount()
+	{
+		return Renderer::getFrameCount();
+	}
+
+	void waitForFrames()
+	{
+		Renderer::waitForFrames();
+		GpuProfiler::collectAll();
+	}
+
+	bool saveRenderedFrame(const std::string& ppm_file)
+	{
+		return Renderer::saveFrame(ppm_file);
+	}
+
 	void recreateSwapChain() {
-		// TODO: comporre la nuova swapchain riagganciando la vecchia
+		PROFILE_FUNCTION();
 		int width = 0, height = 0;
 		surfaceOwner->getFrameBufferSize(&width, &height);
 		while (width == 0 || height == 0) {
 			surfaceOwner->waitEvents();// window is minimized so application stops
 			surfaceOwner->getFrameBufferSize(&width, &height);
 		}
+		VkFormat old_format = SwapChainMng::get()->getFormat();
+		unsigned old_image_count = SwapChainMng::get()->getImageCount();
+		// built from the old one, which is retired with the frames still presenting it
+		SwapChainMng::recreate(surfaceOwner);
+
+		if (!renderer_rebuild_needed && old_format == SwapChainMng::get()->getFormat() &&
+			old_image_count == SwapChainMng::get()->getImageCount()) {
+			// same render passes and pipelines (viewports are dynamic), only the extent changed
+			// new offscreen targets mark the IMGUI sets stale, each one is rewritten after the wait on its frame
+			Renderer::resize();
+			if (hasRayTracing()) {
+				RayTracer::resize();
+			}
+			updateCameraAspects();
+			return;
+		}
+		renderer_rebuild_needed = false;
+
 		vkDeviceWaitIdle(Device::get());
+		// they could be compiling against the old render passes
+		PipelineFactory::destroyVariants();
 		Renderer::cleanUp();
 		RenderPassCatalog::cleanUP();
-		SwapChainMng::cleanUP();
 
-		for (auto & s : *scenes) {
-			scenes->at(s.first).getCamera(scenes->at(s.first).current_camera)->updateAspectRatio(width, height);
-		}
-
-		SwapChainMng::init(surfaceOwner);
 		RenderPassCatalog::init();
-		PipelineFactory::updatePipelinesViewPorts();
+		PipelineFactory::recreatePipelines();
 		Renderer::init();
 		Renderer::prepareScene(&scenes->at(active_scene));
 
@@ -229,6 +598,28 @@ namespace vkengine
 		if (hasRayTracing()) {
 			RayTracer::updateRTPipelineResources(&scenes->at(active_scene));
 		}
+		updateCameraAspects();
+	}
+
+	// new viewport size or upscale filter, the swapchain stays
+	void resizeOffScreenTargets()
+	{
+		PROFILE_FUNCTION();
+		// nothing waits: the sets of each image are rewritten once the frames using it are done
+		Renderer::resizeOffScreen();
+		if (hasRayTracing()) {
+			RayTracer::resize();
+		}
+		updateCameraAspects();
+	}
+
+	// the cameras project on the offscreen image, whatever its size is
+	void updateCameraAspects()
+	{
+		VkExtent2D extent = Renderer::getOffScreenExtent();
+		for (auto & s : *scenes) {
+			scenes->at(s.first).getCamera(scenes->at(s.first).current_camera)->updateAspectRatio(extent.width, extent.height);
+		}
 	}
 
 	void buildBasicPipelines() 
@@ -238,6 +629,13 @@ namespace vkengine
 			0, PipelineLayoutType::PIPELINE_LAYOUT_STANDARD);
 		PipelineFactory::setShaders("VkEngine/Shaders/phong_multi_light/vert.spv", "VkEngine/Shaders/phong_multi_light/frag.spv");
 
+		// Same rasterization, shadows and reflections from ray queries
+		if (hasHybridRendering()) {
+			PipelineFactory::newPipeline(HYBRID_3D_PIPELINE_ID, &RenderPassCatalog::offscreenRP,
+				0, PipelineLayoutType::PIPELINE_LAYOUT_HYBRID);
+			PipelineFactory::setShaders("VkEngine/Shaders/phong_multi_light/vert.spv", "VkEngine/Shaders/phong_multi_light/hybrid.frag.spv");
+		}
+
 		// Imgui rendering to final presentation on swapchain
 		PipelineFactory::newPipeline(IMGUI_PIPELINE_ID, &RenderPassCatalog::presentationRP,
 			0, PipelineLayoutType::PIPELINE_LAYOUT_IMGUI);
@@ -245,7 +643,6 @@ namespace vkengine
 		PipelineFactory::setShaders("VkEngine/Shaders/imgui/vert.spv", "VkEngine/Shaders/imgui/frag.spv");
 		PipelineFactory::setCulling(false);
 		PipelineFactory::setDepthTest(false);
-		PipelineFactory::setDynamicViewPortAndScissor();
 		// Building
 		PipelineFactory::createRasterizationPipelines();
 
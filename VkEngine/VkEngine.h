@@ -5,6 +5,9 @@
 #include <string>
 #include <vector>
 #include "Scene3D.h"
+#include "WorldPartition.h"
+#include "RayBudget.h"
+#include "DynamicResolution.h"
 
 
 #define OFFSCREEN_FRAMEBUFFER_TEXTURE_ID -1 // special case in gui fragment shader
@@ -43,6 +46,68 @@ namespace vkengine
 		std::vector<UiDrawList> drawLists;
 	};
 
+	// Per frame work of the ray tracing scene update
+	struct RayTracingStats {
+		uint64_t bytes_uploaded; // instances copied to the GPU and scene descriptions written
+		uint32_t instances_changed;
+		uint32_t descriptions_changed; // mesh, texture or reflectiveness read by the hit shaders
+		uint32_t tlas_builds;
+		uint32_t tlas_refits;
+		uint32_t tlas_skipped; // nothing changed, no update recorded
+		uint32_t blas_built; // BLAS batch collected this frame
+		uint32_t blas_pending; // meshes still waiting for their BLAS
+		uint32_t opaque_instances; // textures without alpha: traced without any hit shaders
+		float trace_ms; // GPU time of the dispatch of the frame that last used this image, negative if unknown
+	};
+
+	// Reflection rays of the ray tracing pipeline, below full resolution one is traced for each block
+	// of divisor x divisor pixels and upsampled following the normals and depths of the mirrors
+	enum ReflectionResolution { REFLECTIONS_FULL = 1, REFLECTIONS_HALF = 2, REFLECTIONS_QUARTER = 4 };
+
+	// How the swapchain waits for the display. FIFO is always there, the others fall back to it
+	enum PresentMode { PRESENT_FIFO, PRESENT_MAILBOX, PRESENT_IMMEDIATE };
+
+	// Smoothed time from the start of renderFrame, right before which the input is read
+	struct FrameLatency {
+		float cpu_to_present_ms; // until the frame is handed to the presentation engine
+		float cpu_to_display_ms; // until it is on screen, negative without VK_KHR_present_wait
+	};
+
+	// Queue submissions of the last frame: the frame itself and the ray tracing scene updates
+	struct SubmitStats {
+		uint32_t submits; // vkQueueSubmit calls
+		float submit_ms; // CPU time spent in them, smoothed
+	};
+
+	// Passes timed by the GPU profiler
+	enum GpuPass { GPU_PASS_UPLOADS, GPU_PASS_TLAS, GPU_PASS_TRACE, GPU_PASS_RASTER, GPU_PASS_IMGUI, GPU_PASS_COUNT };
+
+	// GPU time of each pass of one frame, negative for the passes that didn't run
+	struct GpuFrameTimings {
+		uint64_t frame;
+		float pass_ms[GPU_PASS_COUNT];
+	};
+
+	// CPU reference ray tracer run (see CpuRayTracer.h)
+	struct CpuRayTracingStats {
+		uint64_t rays; // primary, continuation, reflection and shadow rays
+		float build_ms; // BVHs of the meshes and of the instances
+		float trace_ms;
+		float mrays_per_second;
+	};
+
+	// Memory of the bottom level acceleration structure of one mesh
+	struct BlasMemoryInfo {
+		std::string mesh;
+		uint64_t original_size;
+		uint64_t current_size; // equal to original_size until compacted
+		bool compacted;
+	};
+
+	/*
+	* The window of the engine. A getSurface returning nullptr runs it headless: the frames are rendered
+	* into images of the engine sized as getFrameBufferSize and never presented, no surface extensions are needed.
+	*/
 	class SurfaceOwner {
 	protected:
 		void* surface = nullptr;
@@ -70,6 +135,19 @@ namespace vkengine
 	Scene3D* getActiveScene();
 	Scene3D* getScene(std::string scene_id);
 	void removeScene(std::string scene_id);
+	/*
+	* Object editing without reloading the scene: the renderer grows its draw lists
+	* and acceleration structures in place if the scene is the one being rendered.
+	*/
+	unsigned addObject(Scene3D* scene, ObjectInitInfo obj_info);
+	void removeObject(Scene3D* scene, unsigned obj_id);
+	void updateObject(Scene3D* scene, unsigned obj_id, ObjectInitInfo obj_info);
+	// Streams the objects of the scene in and out around its camera, see WorldPartition
+	void enableWorldPartition(Scene3D* scene, WorldPartitionSettings settings);
+	// Every streamed object is added back to the scene
+	void disableWorldPartition(Scene3D* scene);
+	// nullptr if the scene is not partitioned
+	WorldPartition* getWorldPartition(Scene3D* scene);
 
 	void loadFontAtlas(unsigned char* pixels, int * width, int * height);
 	void updateImGuiData(UiDrawData draw_data);
@@ -79,13 +157,78 @@ namespace vkengine
 	void loadScene(std::string scene_id);
 	// Intended as parallel CMD buffer recording CPU-side
 	bool* multithreadedRendering();
+	// CPU occlusion culling of the rasterized objects
+	bool* occlusionCulling();
+	// milliseconds spent creating pipelines since init, most of it is skipped once the pipeline cache is on disk
+	float getPipelineCreationTime();
+	// rasterization pipelines specialized on the light count, compiled in the background
+	bool* pipelineVariants();
+	// Frames the CPU can record ahead of the GPU (1-3): fewer is less latency, more is more throughput.
+	// Both settings recreate the swapchain before the next frame
+	void setFramesInFlight(uint32_t frames);
+	uint32_t getFramesInFlight();
+	void setPresentMode(PresentMode mode);
+	// the mode in use, FIFO if the requested one is not supported
+	PresentMode getPresentMode();
+	FrameLatency getFrameLatency();
+	SubmitStats getSubmitStats();
+	// false if the device has no timestamps on the graphics queue
+	bool hasGpuProfiler();
+	const char* gpuPassName(GpuPass pass);
+	// the last frames measured, oldest first. They are a few frames behind the one being recorded
+	std::vector<GpuFrameTimings> getGpuTimings();
+	bool exportGpuTimings(const std::string& csv_file);
+	// CPU scope markers (see CpuProfiler.h), false if they were compiled out
+	bool hasCpuProfiler();
+	void setCpuProfiling(bool enabled);
+	bool isCpuProfiling();
+	// Chrome trace event JSON of the scopes recorded so far, for chrome://tracing or Perfetto
+	bool exportCpuTrace(const std::string& json_file);
 
 	//RAY_TRACING
 	bool hasRayTracing();
 	bool* rayTracing();
 	uint32_t* rayMaxDepth();
+	RayTracingStats getRayTracingStats();
+	// compaction runs in the background after the BLASs are built, the flag applies to the next build
+	bool* compactBlas();
+	std::vector<BlasMemoryInfo> listBlasMemory();
+	// estimated GPU milliseconds of the BLAS batch started each frame for new meshes,
+	// from their triangles and a cost per triangle measured on the previous batches
+	float* blasBuildBudget();
+	// averages jittered samples of a still view, restarting when camera, lights or objects change
+	bool* rtAccumulation();
+	// samples per pixel after which the rays stop and the converged image is kept
+	uint32_t* rtAccumulationMaxSamples();
+	uint32_t rtAccumulatedSamples();
+	// lowers depth, then resolution, when the dispatch takes longer than the target time (see RayBudget.h)
+	RayBudgetSettings* rtBudgetSettings();
+	// what the next frame traces with
+	RayBudget getRayBudget();
+	ReflectionResolution* rtReflectionResolution();
+	// smoothed GPU time of the dispatches traced with this reflection resolution, negative if never measured
+	float getReflectionTraceTime(ReflectionResolution resolution);
+	// fraction of the offscreen image the next frame renders to, on each axis
+	float getRenderScale();
+	// pixel size of the panel showing the scene, the offscreen image is sized to it.
+	// 0x0 follows the swapchain extent
+	void setViewportSize(uint32_t width, uint32_t height);
+	// scales the rasterized frames to a GPU time target, ray traced frames follow their ray budget
+	DynamicResolutionSettings* dynamicResolution();
+	// rasterized frame with ray-queried shadows, and one bounce reflections on reflective objects
+	bool hasHybridRendering();
+	bool* hybridRendering();
+	// Traces the active scene on the CPU like the ray tracing pipeline and writes it as a PPM image,
+	// thread_count 0 uses every hardware thread
+	CpuRayTracingStats renderCpuReference(const std::string& ppm_file, unsigned width, unsigned height, unsigned thread_count = 0);
 
 	void renderFrame();
+	// frames submitted since init
+	uint64_t getFrameCount();
+	// returns once the GPU completed every frame submitted, their timings included
+	void waitForFrames();
+	// The scene image of the last frame (without the UI) as a binary PPM, waits for the frames in flight
+	bool saveRenderedFrame(const std::string& ppm_file);
 	void shutdown();
 
 }
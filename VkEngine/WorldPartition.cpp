@@ -0,0 +1,335 @@
+#include "WorldPartition.h"
+#include "SnapshotFormat.h"
+#include "commons.h"
+#include <filesystem>
+#include <climits>
+namespace fs = std::filesystem;
+
+using namespace vkengine;
+
+// share of an object in the per instance GPU buffers: TLAS instance and nodes, ray tracing description of each frame in flight
+constexpr const size_t GPU_BYTES_PER_OBJECT = 512;
+
+// estimate of what an object takes once in the scene, the unit of the memory budget
+static size_t objectBytes(const std::string& name, const std::string& mesh, const std::string& texture)
+{
+	// node of the scene map and the string buffers on top of the object itself
+	return sizeof(Object3D) + 4 * sizeof(void*) + name.size() + mesh.size() + texture.size() + 3 + GPU_BYTES_PER_OBJECT;
+}
+
+static size_t objectBytes(const ObjectBatch& batch, size_t i)
+{
+	const ObjectBatch::Entry& entry = batch.objects[i];
+	return objectBytes(entry.name, batch.meshes[entry.mesh], batch.textures[entry.texture]);
+}
+
+static ObjectInitInfo describeObject(Object3D* obj)
+{
+	ObjectInitInfo info = {};
+	info.name = obj->name;
+	info.mesh_name = obj->getMeshName();
+	info.texture_name = obj->getTextureName();
+	info.reflective = obj->reflective;
+	info.occluder = obj->occluder;
+	info.transformation = obj->getObjTransform();
+	return info;
+}
+
+static ObjectInitInfo describeEntry(const ObjectBatch& batch, size_t i)
+{
+	const ObjectBatch::Entry& entry = batch.objects[i];
+	return { entry.name, batch.meshes[entry.mesh], batch.textures[entry.texture], entry.reflective, entry.occluder, entry.transformation };
+}
+
+static SceneData readCell(const std::string& file)
+{
+	SceneData data;
+	if (!readSnapshot(file, data)) {
+		throw std::runtime_error("failed to read world cell " + file + "!");
+	}
+	return data;
+}
+
+WorldPartition::WorldPartition(Scene3D* scene, WorldPartitionSettings settings)
+{
+	this->scene = scene;
+	this->settings = settings;
+	this->cell_dir = settings.cell_dir.empty() ?
+		(fs::temp_directory_path() / "vkengine_cells" / scene->getId()).string() : settings.cell_dir;
+	fs::create_directories(cell_dir);
+	std::unordered_map<CellCoord, std::vector<ObjectInitInfo>, CellCoordHash> by_cell;
+	for (auto id : scene->listObjects()) {
+		ObjectInitInfo info = describeObject(scene->getObject(id));
+		by_cell[cellOf(info.transformation.position)].push_back(info);
+		scene->removeObject(id);
+	}
+	for (auto& entry : by_cell) {
+		storeObjects(entry.first, std::move(entry.second));
+	}
+}
+
+CellCoord WorldPartition::cellOf(glm::vec3 position)
+{
+	return { (int)std::floor(position.x / settings.cell_size), (int)std::floor(position.z / settings.cell_size) };
+}
+
+float WorldPartition::distance(CellCoord coord, glm::vec3 position)
+{
+	glm::vec2 center = (glm::vec2(coord.x, coord.z) + 0.5f) * settings.cell_size;
+	return glm::length(center - glm::vec2(position.x, position.z));
+}
+
+std::string WorldPartition::cellFile(CellCoord coord)
+{
+	return (fs::path(cell_dir) / (std::to_string(coord.x) + "_" + std::to_string(coord.z) + SNAPSHOT_EXT)).string();
+}
+
+void WorldPartition::storeObjects(CellCoord coord, std::vector<ObjectInitInfo> objects)
+{
+	Cell& cell = cells[coord];
+	// a cell already on disk is read back and written again with the new objects
+	bool append = cell.stored_count > 0;
+	cell.stored_count += (unsigned)objects.size();
+	for (auto& info : objects) {
+		cell.stored_bytes += objectBytes(info.name, info.mesh_name, info.texture_name);
+	}
+	std::shared_future<void> previous = cell.writing;
+	std::string file = cellFile(coord), scene_id = scene->getId();
+	cell.writing = std::async(std::launch::async, [previous, append, file, scene_id, objects = std::move(objects)]() {
+		if (previous.valid()) previous.get();
+		SceneData data;
+		if (append) {
+			data = readCell(file);
+		}
+		else {
+			data.header.id = data.addString(scene_id);
+			data.header.title = data.addString("cell");
+		}
+		SnapshotObjectWriter writer(data);
+		for (auto& info : objects) {
+			writer.add(info);
+		}
+		writeSnapshot(file, data);
+	}).share();
+}
+
+void WorldPartition::startLoading(CellCoord coord, Cell& cell)
+{
+	cell.state = CellState::LOADING;
+	pending_bytes += cell.stored_bytes;
+	cell.stored_count = 0;
+	cell.stored_bytes = 0;
+	std::shared_future<void> written = cell.writing;
+	cell.writing = {};
+	std::string file = cellFile(coord);
+	cell.loading = std::async(std::launch::async, [written, file]() {
+		if (written.valid()) written.get();
+		SceneData data = readCell(file);
+		// the objects belong to the scene now
+		std::error_code ignored;
+		fs::remove(file, ignored);
+		return toObjectBatch(data);
+	});
+}
+
+void WorldPartition::finishLoading(Cell& cell)
+{
+	cell.to_add = cell.loading.get();
+	cell.next_to_add = 0;
+	cell.state = CellState::RESIDENT;
+}
+
+unsigned WorldPartition::addFetchedObjects(Cell& cell, unsigned max_count)
+{
+	size_t first = cell.next_to_add;
+	unsigned count = (unsigned)std::min<size_t>(max_count, cell.to_add.objects.size() - first);
+	if (count == 0) return 0;
+	std::vector<unsigned> ids;
+	scene->addObjects(cell.to_add, first, count, &ids);
+	for (unsigned i = 0; i < count; i++) {
+		size_t bytes = objectBytes(cell.to_add, first + i);
+		cell.residents.push_back({ ids[i], bytes });
+		pending_bytes -= std::min(pending_bytes, bytes);
+		resident_bytes += bytes;
+	}
+	cell.next_to_add += count;
+	if (cell.next_to_add == cell.to_add.objects.size()) {
+		cell.to_add = {};
+		cell.next_to_add = 0;
+	}
+	resident_objects += count;
+	return count;
+}
+
+void WorldPartition::unloadCell(CellCoord coord, Cell& cell)
+{
+	std::unordered_map<CellCoord, std::vector<ObjectInitInfo>, CellCoordHash> to_store;
+	// never added: straight back to the cell file
+	for (size_t i = cell.next_to_add; i < cell.to_add.objects.size(); i++) {
+		pending_bytes -= std::min(pending_bytes, objectBytes(cell.to_add, i));
+		to_store[coord].push_back(describeEntry(cell.to_add, i));
+	}
+	cell.to_add = {};
+	cell.next_to_add = 0;
+	std::vector<Cell::Resident> residents;
+	residents.swap(cell.residents);
+	cell.state = CellState::UNLOADED;
+	for (auto& resident : residents) {
+		// it could have been deleted from the editor
+		if (!scene->hasObject(resident.id)) {
+			resident_objects--;
+			resident_bytes -= std::min(resident_bytes, resident.bytes);
+			continue;
+		}
+		// objects moved while resident are stored in the cell they are in now
+		ObjectInitInfo info = describeObject(scene->getObject(resident.id));
+		CellCoord now_in = cellOf(info.transformation.position);
+		auto target = cells.find(now_in);
+		if (!(now_in == coord) && target != cells.end() && target->second.state != CellState::UNLOADED) {
+			// that cell is in the scene already, the object just changes owner
+			target->second.residents.push_back(resident);
+			continue;
+		}
+		to_store[now_in].push_back(info);
+		scene->removeObject(resident.id);
+		resident_objects--;
+		resident_bytes -= std::min(resident_bytes, resident.bytes);
+	}
+	for (auto& entry : to_store) {
+		storeObjects(entry.first, std::move(entry.second));
+	}
+}
+
+bool WorldPartition::update(glm::vec3 camera_position)
+{
+	bool changed = false;
+	// Stream out what is beyond the unload radius (unloading can add cells, so not while iterating)
+	std::vector<CellCoord> far_cells;
+	for (auto& entry : cells) {
+		if (entry.second.state == CellState::RESIDENT && distance(entry.first, camera_position) > settings.unload_radius) {
+			far_cells.push_back(entry.first);
+		}
+	}
+	for (auto& coord : far_cells) {
+		unloadCell(coord, cells.at(coord));
+		changed = true;
+	}
+
+	// Collect finished reads and add them to the scene within the per frame budget
+	unsigned frame_budget = settings.max_objects_per_frame;
+	for (auto& entry : cells) {
+		Cell& cell = entry.second;
+		if (cell.state == CellState::LOADING &&
+			cell.loading.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+			finishLoading(cell);
+		}
+		if (cell.state == CellState::RESIDENT && cell.next_to_add < cell.to_add.objects.size() && frame_budget > 0) {
+			frame_budget -= addFetchedObjects(cell, frame_budget);
+			changed = true;
+		}
+	}
+
+	// Stream in the cells inside the load radius, nearest first
+	std::vector<std::pair<float, CellCoord>> candidates;
+	CellCoord center = cellOf(camera_position);
+	int reach = (int)std::ceil(settings.load_radius / settings.cell_size);
+	for (int x = center.x - reach; x <= center.x + reach; x++) {
+		for (int z = center.z - reach; z <= center.z + reach; z++) {
+			auto it = cells.find({ x, z });
+			if (it == cells.end() || it->second.state != CellState::UNLOADED || it->second.stored_count == 0) continue;
+			float d = distance({ x, z }, camera_position);
+			if (d <= settings.load_radius) candidates.push_back({ d, { x, z } });
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(),
+		[](const std::pair<float, CellCoord>& a, const std::pair<float, CellCoord>& b) { return a.first < b.first; });
+	for (auto& candidate : candidates) {
+		Cell& cell = cells.at(candidate.second);
+		// over budget: evict resident cells farther than this one, the farthest first
+		while (resident_bytes + pending_bytes + cell.stored_bytes > settings.memory_budget) {
+			CellCoord farthest = candidate.second;
+			float farthest_distance = candidate.first;
+			for (auto& entry : cells) {
+				float d = distance(entry.first, camera_position);
+				if (entry.second.state == CellState::RESIDENT && d > farthest_distance) {
+					farthest = entry.first;
+					farthest_distance = d;
+				}
+			}
+			if (farthest == candidate.second) break;
+			unloadCell(farthest, cells.at(farthest));
+			changed = true;
+		}
+		if (resident_bytes + pending_bytes + cell.stored_bytes > settings.memory_budget) break;
+		startLoading(candidate.second, cell);
+	}
+	return changed;
+}
+
+void WorldPartition::makeAllResident()
+{
+	// every read is started before waiting for the first one
+	for (auto& entry : cells) {
+		if (entry.second.state == CellState::UNLOADED && entry.second.stored_count > 0) {
+			startLoading(entry.first, entry.second);
+		}
+	}
+	for (auto& entry : cells) {
+		Cell& cell = entry.second;
+		if (cell.state == CellState::LOADING) finishLoading(cell);
+		cell.state = CellState::RESIDENT;
+		addFetchedObjects(cell, UINT_MAX);
+	}
+}
+
+std::vector<ObjectInitInfo> WorldPartition::listStreamedObjects()
+{
+	std::vector<ObjectInitInfo> objects;
+	for (auto& entry : cells) {
+		Cell& cell = entry.second;
+		// a read in progress owns the objects of its cell
+		if (cell.state == CellState::LOADING) finishLoading(cell);
+		for (size_t i = cell.next_to_add; i < cell.to_add.objects.size(); i++) {
+			objects.push_back(describeEntry(cell.to_add, i));
+		}
+		if (cell.state == CellState::UNLOADED && cell.stored_count > 0) {
+			if (cell.writing.valid()) cell.writing.get();
+			ObjectBatch stored = toObjectBatch(readCell(cellFile(entry.first)));
+			for (size_t i = 0; i < stored.objects.size(); i++) {
+				objects.push_back(describeEntry(stored, i));
+			}
+		}
+	}
+	return objects;
+}
+
+unsigned WorldPartition::countResidentCells()
+{
+	unsigned count = 0;
+	for (auto& entry : cells) {
+		if (entry.second.state == CellState::RESIDENT) count++;
+	}
+	return count;
+}
+
+unsigned WorldPartition::countLoadingCells()
+{
+	unsigned count = 0;
+	for (auto& entry : cells) {
+		if (entry.second.state == CellState::LOADING) count++;
+	}
+	return count;
+}
+
+WorldPartition::~WorldPartition()
+{
+	// the workers write and delete the cell files: they have to be done first
+	std::error_code ignored;
+	for (auto& entry : cells) {
+		if (entry.second.loading.valid()) entry.second.loading.wait();
+		if (entry.second.writing.valid()) entry.second.writing.wait();
+		fs::remove(cellFile(entry.first), ignored);
+	}
+	// a folder of our own, removed only if nothing else is in it
+	if (settings.cell_dir.empty()) fs::remove(cell_dir, ignored);
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include "Scene3D.h"
+#include <vector>
+#include <unordered_map>
+#include <future>
+
+namespace vkengine
+{
+	struct WorldPartitionSettings {
+		float cell_size = 100.f;
+		// cells closer than load_radius to the camera are streamed in...
+		float load_radius = 300.f;
+		// ...and streamed out only once farther than unload_radius (hysteresis)
+		float unload_radius = 400.f;
+		// bytes the resident objects may take, CPU and GPU: far cells are evicted to stay below it
+		size_t memory_budget = 64ull << 20;
+		// objects added to the scene each frame, big cells are spread over several frames
+		unsigned max_objects_per_frame = 2000;
+		// folder of the cell files, a folder in the temporary directory if empty
+		std::string cell_dir;
+	};
+
+	// Cell of the XZ grid
+	struct CellCoord {
+		int x, z;
+		inline bool operator==(const CellCoord& other) const { return x == other.x && z == other.z; };
+	};
+
+	struct CellCoordHash {
+		inline size_t operator()(const CellCoord& c) const
+		{
+			return std::hash<uint64_t>()(((uint64_t)(uint32_t)c.x << 32) | (uint32_t)c.z);
+		}
+	};
+
+	/*
+	* Splits the objects of a scene on a XZ grid and keeps in memory only the cells around the camera.
+	* The other cells are snapshot files on disk (SnapshotFormat.h): a worker thread writes them and reads
+	* them back, the main thread adds the objects to the scene, a few every frame.
+	* Only objects are streamed, meshes and textures stay loaded: their IDs are positions in fixed size
+	* descriptor arrays, so the budget counts the objects alone.
+	*/
+	class WorldPartition
+	{
+	public:
+		// Every object of the scene is written to its cell file
+		WorldPartition(Scene3D* scene, WorldPartitionSettings settings);
+		// Main thread, once per frame. Returns true if objects were added or removed from the scene.
+		bool update(glm::vec3 camera_position);
+		// Adds back to the scene every streamed object
+		void makeAllResident();
+		// Objects currently not in the scene, e.g. to save them. Reads the cell files
+		std::vector<ObjectInitInfo> listStreamedObjects();
+		inline unsigned countResidentObjects() { return resident_objects; };
+		// estimate of what the resident objects take, the number the budget is checked against
+		inline size_t countResidentBytes() { return resident_bytes; };
+		unsigned countResidentCells();
+		unsigned countLoadingCells();
+		// removes the cell files
+		~WorldPartition();
+		WorldPartitionSettings settings;
+	private:
+		enum class CellState { UNLOADED, LOADING, RESIDENT };
+		struct Cell {
+			CellState state = CellState::UNLOADED;
+			// objects in the cell file and their estimated size once resident
+			unsigned stored_count = 0;
+			size_t stored_bytes = 0;
+			// last write of the cell file, a read waits for it
+			std::shared_future<void> writing;
+			std::future<ObjectBatch> loading;
+			// read but not yet added to the scene, from next_to_add on
+			ObjectBatch to_add;
+			size_t next_to_add = 0;
+			struct Resident { unsigned id; size_t bytes; };
+			std::vector<Resident> residents;
+		};
+		CellCoord cellOf(glm::vec3 position);
+		float distance(CellCoord coord, glm::vec3 position);
+		std::string cellFile(CellCoord coord);
+		// appends the objects to the cell file on a worker
+		void storeObjects(CellCoord coord, std::vector<ObjectInitInfo> objects);
+		void startLoading(CellCoord coord, Cell& cell);
+		// waits for the read of a LOADING cell
+		void finishLoading(Cell& cell);
+		void unloadCell(CellCoord coord, Cell& cell);
+		// returns how many objects were added
+		unsigned addFetchedObjects(Cell& cell, unsigned max_count);
+		Scene3D* scene;
+		std::string cell_dir;
+		// main thread only, the workers get copies of what they need
+		std::unordered_map<CellCoord, Cell, CellCoordHash> cells;
+		unsigned resident_objects = 0;
+		size_t resident_bytes = 0;
+		// read from disk but not yet in the scene
+		size_t pending_bytes = 0;
+	};
+}
@@ -9,16 +9,57 @@
 #include "PhysicalDevice.h"
 #include "ApiUtils.h"
 #include "vk_extensions.h"
+#include "GpuProfiler.h"
+#include "CpuProfiler.h"
 #include "commons.h"
+#include <cassert>
 
 using namespace vkengine;
 
 uint32_t RayTracer::max_reflections_depth;
 std::vector<BottomLevelAS> RayTracer::BLASs;
 std::vector<TopLevelAS> RayTracer::TLASs;
+float RayTracer::refit_drift_threshold = 1.f;
+bool RayTracer::compact_blas = true;
+VkDeviceSize RayTracer::blas_scratch_budget = 64 * 1024 * 1024;
+float RayTracer::blas_build_budget_ms = 2.f;
+// 50M triangles/s until the first batch is timed: slow for a GPU, so the first batches stay within the budget
+float RayTracer::blas_ms_per_triangle = 2e-5f;
+VkQueryPool RayTracer::blas_timestamp_pool = VK_NULL_HANDLE;
+uint64_t RayTracer::blas_timestamp_mask = 0;
+std::vector<uint32_t> RayTracer::blas_build_queue;
+BlasBuildBatch RayTracer::blas_batch;
+std::vector<BlasCompaction> RayTracer::compactions;
+Buffer RayTracer::blas_scratch;
+VkDeviceSize RayTracer::blas_scratch_size = 0;
+vkengine::RayTracingStats RayTracer::update_stats = {};
+bool RayTracer::accumulate = false;
+uint32_t RayTracer::accumulation_max_samples = 256;
+uint32_t RayTracer::accumulated_samples = 0;
+FrameAttachment RayTracer::accumulation_image = {};
+FrameAttachment RayTracer::guide_image = {};
+FrameAttachment RayTracer::reflection_image = {};
+FrameAttachment RayTracer::reflection_guide_image = {};
+vkengine::ReflectionResolution RayTracer::reflection_resolution = vkengine::REFLECTIONS_FULL;
+vkengine::ReflectionResolution RayTracer::accumulation_reflections = vkengine::REFLECTIONS_FULL;
+UniformBlock RayTracer::accumulation_view = {};
+vkengine::RayBudget RayTracer::accumulation_budget = {};
+vkengine::RayBudgetSettings RayTracer::budget_settings = {};
+vkengine::RayBudgetController RayTracer::budget_controller;
+vkengine::RayBudget RayTracer::traced_budget = { 1, 1.f, 0.f };
+vkengine::RayBudget RayTracer::next_budget = { 1, 1.f, 0.f };
+std::vector<uint64_t> RayTracer::traced_frames;
+std::vector<bool> RayTracer::stale_storage_sets;
+std::vector<vkengine::ReflectionResolution> RayTracer::traced_reflections;
+float RayTracer::reflection_trace_ms[3] = { -1.f, -1.f, -1.f };
+std::vector<VkCommandBuffer> RayTracer::tlas_update_cmds;
+std::vector<VkSemaphore> RayTracer::tlas_update_semaphores;
+VkSemaphore RayTracer::pending_tlas_update = VK_NULL_HANDLE;
+
+// dirty instances closer than this are copied with a single region
+constexpr const uint32_t DIRTY_REGION_MERGE_GAP = 4;
 VkPipeline RayTracer::rayTracingPipeline;
 Buffer RayTracer::shaderBindingTable;
-Buffer RayTracer::sceneBuffer;
 
 VkDeviceAddress getBufferDeviceAddress(VkBuffer buffer)
 {
@@ -27,6 +68,13 @@ VkDeviceAddress getBufferDeviceAddress(VkBuffer buffer)
 	return vkGetBufferDeviceAddressKHR(Device::get(), &bufferDeviceAI);
 }
 
+VkDeviceAddress getAccelerationStructureAddress(VkAccelerationStructureKHR accelerationStructure)
+{
+	VkAccelerationStructureDeviceAddressInfoKHR addressInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR };
+	addressInfo.accelerationStructure = accelerationStructure;
+	return vkGetAccelerationStructureDeviceAddressKHR(Device::get(), &addressInfo);
+}
+
 Buffer createScratchBuffer(VkDeviceSize size) {
 	VkBuffer scratchBuffer;
 	VkDeviceMemory scratchMem;
@@ -82,7 +130,8 @@ AccelerationStructure createAcceleration(VkAccelerationStructureCreateInfoKHR &
 	// Create the buffer for the acceleration structure
 	createBuffer(PhysicalDevice::get(),Device::get(), asCreateinfo.size,
 		VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, 
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, AS.buffer.vkBuffer, AS.buffer.vkMemory);
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, AS.buffer.vkBuffer, AS.buffer.vkMemory,
+		Device::getComputeSharingFamilies()); // built on the compute queue, traced on the graphic one
 	asCreateinfo.buffer = AS.buffer.vkBuffer;
 
 	// Create the acceleration structure
@@ -94,43 +143,72 @@ AccelerationStructure createAcceleration(VkAccelerationStructureCreateInfoKHR &
 	return AS;
 }
 
-void RayTracer::buildBottomLevelAS()
+void RayTracer::queueBottomLevelAS()
 {
-	// Mesh to geometry traslation and setup of the BLAS vector
-	
-	for (auto& mesh : MeshManager::getMeshLibrary())
+	// BLASs are indexed by mesh ID, only new meshes and replaced ones are (re)built
+	auto meshes = MeshManager::getMeshLibrary();
+	if (BLASs.size() < meshes.size()) BLASs.resize(meshes.size());
+	for (uint32_t i = 0; i < meshes.size(); i++)
 	{
-		BLASs.push_back({});
+		BottomLevelAS& blas = BLASs[i];
+		if (blas.mesh == meshes[i]) continue;
+		if (blas.as.accelerationStructure != VK_NULL_HANDLE) {
+			// frames in flight can still trace the old one
+			AccelerationStructure old_as = blas.as;
+			Renderer::deferDestruction([old_as]() {
+				vkDestroyAccelerationStructureKHR(Device::get(), old_as.accelerationStructure, nullptr);
+				vkDestroyBuffer(Device::get(), old_as.buffer.vkBuffer, nullptr);
+				vkFreeMemory(Device::get(), old_as.buffer.vkMemory, nullptr);
+			});
+		}
+		bool queued = blas.mesh != nullptr && !blas.ready && blas.as.accelerationStructure == VK_NULL_HANDLE;
+		blas = {};
+		blas.mesh = meshes[i];
 		// for simplicity we define one blas for each mesh			
 		// each mesh is a geometry, so 1 geometry per blas
-		auto ASG = mesh3DToASGeometryKHR(mesh);
-		BLASs.back().geometries.push_back(ASG.geometry);
-		BLASs.back().offsets.push_back(ASG.offset);
+		auto ASG = mesh3DToASGeometryKHR(meshes[i]);
+		blas.geometries.push_back(ASG.geometry);
+		blas.offsets.push_back(ASG.offset);
 
 		//We wrap up all infos on how to build the geometries
-		BLASs.back().buildGeomInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
-		BLASs.back().buildGeomInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
-		BLASs.back().buildGeomInfo.geometryCount = BLASs.back().geometries.size();
-		BLASs.back().buildGeomInfo.pGeometries = BLASs.back().geometries.data();
-		BLASs.back().buildGeomInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
-		BLASs.back().buildGeomInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-		BLASs.back().buildGeomInfo.srcAccelerationStructure = VK_NULL_HANDLE;
-
+		blas.buildGeomInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
+		blas.buildGeomInfo.geometryCount = blas.geometries.size();
+		blas.buildGeomInfo.pGeometries = blas.geometries.data();
+		blas.buildGeomInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+		blas.buildGeomInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+		blas.buildGeomInfo.srcAccelerationStructure = VK_NULL_HANDLE;
+		if (!queued) blas_build_queue.push_back(i);
 	}
+}
 
-	std::vector<VkDeviceSize> originalSizes;
-	// For each blas we create its AccelerationStructure and query its memory requirements
-	VkDeviceSize maxScratch{ 0 }; // we want to find the worst case scratch size we could need
-
-	for (auto& blas : BLASs) {
+void RayTracer::startBottomLevelBatch()
+{
+	VkDeviceSize alignment = std::max<VkDeviceSize>(1,
+		PhysicalDevice::getAccelerationStructureProperties().minAccelerationStructureScratchOffsetAlignment);
+	// every BLAS of the batch has its own slice of the shared scratch buffer
+	std::vector<VkDeviceSize> scratchOffsets;
+	VkDeviceSize scratchEnd{ 0 };
+	uint64_t batch_triangles = 0;
+	for (auto index : blas_build_queue)
+	{
+		BottomLevelAS& blas = BLASs[index];
+		blas.buildGeomInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+		if (compact_blas) blas.buildGeomInfo.flags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
 		std::vector<uint32_t> primitivesCounts; 
+		uint64_t triangles = 0;
 		for (auto offset : blas.offsets) {
 			primitivesCounts.push_back(offset.primitiveCount);  // Number of primitives/triangles
+			triangles += offset.primitiveCount;
 		}
+		// the batch is full once over the scratch budget or its estimated GPU time, a BLAS over either is built alone
+		if (!scratchOffsets.empty() && (batch_triangles + triangles) * blas_ms_per_triangle > blas_build_budget_ms) break;
 		//Calc AS build-Sizes like final-size, scratch-size ecc...
 		VkAccelerationStructureBuildSizesInfoKHR buildSizes = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
 		vkGetAccelerationStructureBuildSizesKHR(Device::get(), VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
 			&blas.buildGeomInfo, primitivesCounts.data(), &buildSizes);
+		VkDeviceSize offset = (scratchEnd + alignment - 1) / alignment * alignment;
+		// the batch is full, a BLAS bigger than the whole budget is built alone
+		if (!scratchOffsets.empty() && offset + buildSizes.buildScratchSize > blas_scratch_budget) break;
 
 		/////// BLAS CREATION (vulkan object)
 		VkAccelerationStructureCreateInfoKHR asCreateInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
@@ -138,194 +216,327 @@ void RayTracer::buildBottomLevelAS()
 		asCreateInfo.createFlags = 0;
 		asCreateInfo.size = buildSizes.accelerationStructureSize;
 		asCreateInfo.offset = 0;
-		// Create an acceleration structure identifier and allocate memory to
-		// store the resulting structure data
 		blas.as = createAcceleration(asCreateInfo);
 		blas.buildGeomInfo.dstAccelerationStructure = blas.as.accelerationStructure;
-		// SCRATCH MEMORY ESTIMATION
-		// Estimate the amount of scratch memory required to build the BLAS, and
-		// update the size of the scratch buffer that will be allocated to
-		// sequentially build all BLASes
-		maxScratch = std::max(maxScratch, buildSizes.buildScratchSize);
-		////Memory size of the future build result
-		VkDeviceSize objectSize = buildSizes.accelerationStructureSize;
-		originalSizes.push_back(objectSize);
-	}
-
-	// SCRATCH BUFFER CREATION
-	Buffer scratchBuffer = createScratchBuffer(maxScratch);
-
-	//EXTRA
-	// Query for the size of compacted BLASs
-	VkQueryPoolCreateInfo qpci{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
-	qpci.queryCount = (uint32_t)BLASs.size();
-	qpci.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
-	VkQueryPool queryPool;
-	vkCreateQueryPool(Device::get(), &qpci, nullptr, &queryPool); 
-	vkResetQueryPool(Device::get(), queryPool, 0, qpci.queryCount);
-	int queryCtr = 0;
-
-	// Record CMDs to build the final BLAS, 
-	// We use 1 cmdBuffer x blas to let the driver to allow system interuption 
-	// and avoid a TDR (Timeout Detection and Recovery) if the job was to heavy
-	std::vector<VkCommandBuffer> cmdBuffers;
-	cmdBuffers.reserve(BLASs.size());
-	for (auto & blas : BLASs) {
-
-		auto cmdBuffer = beginSingleTimeCommandBuffer(Device::get(), Device::getGraphicCmdPool());
-		cmdBuffers.push_back(cmdBuffer);
-
-		blas.buildGeomInfo.scratchData.deviceAddress = scratchBuffer.deviceAddr;
-		// Vulkan wants an array of pointers to offsets... :(
-		std::vector<VkAccelerationStructureBuildRangeInfoKHR*> pBuildRanges(blas.offsets.size());
-		for (size_t i = 0; i < blas.offsets.size(); i++) {	pBuildRanges[i] = &blas.offsets[i];	}
-
-		// BUILD
-		vkCmdBuildAccelerationStructuresKHR(cmdBuffer, 1,&blas.buildGeomInfo, pBuildRanges.data());
-
-		// Since the scratch buffer is reused across builds, we need a barrier to ensure one build
-		// is finished before starting the next one | NOTE: BLAS building on GPU cannot be done in parallel (stated by NVIDIA)
+		blas.original_size = buildSizes.accelerationStructureSize;
+		scratchOffsets.push_back(offset);
+		scratchEnd = offset + buildSizes.buildScratchSize;
+		batch_triangles += triangles;
+	}
+	if (scratchOffsets.empty()) return;
+	blas_batch.triangles = batch_triangles;
+	blas_batch.blas_indices.assign(blas_build_queue.begin(), blas_build_queue.begin() + scratchOffsets.size());
+	blas_build_queue.erase(blas_build_queue.begin(), blas_build_queue.begin() + scratchOffsets.size());
+
+	// SCRATCH BUFFER, kept between batches and grown only for a BLAS bigger than the budget
+	// (no batch is running: the old one can go right away)
+	if (scratchEnd > blas_scratch_size) {
+		if (blas_scratch_size > 0) {
+			vkDestroyBuffer(Device::get(), blas_scratch.vkBuffer, nullptr);
+			vkFreeMemory(Device::get(), blas_scratch.vkMemory, nullptr);
+		}
+		blas_scratch_size = std::max(scratchEnd, blas_scratch_budget);
+		blas_scratch = createScratchBuffer(blas_scratch_size);
+	}
+
+	// Query for the size of compacted BLASs, read back later without stalling
+	if (compact_blas) {
+		VkQueryPoolCreateInfo qpci{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+		qpci.queryCount = (uint32_t)blas_batch.blas_indices.size();
+		qpci.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
+		vkCreateQueryPool(Device::get(), &qpci, nullptr, &blas_batch.query_pool);
+	}
+
+	// One build call for the whole batch: the BLASs don't share scratch memory so they can be built together
+	std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos;
+	std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> pBuildRanges;
+	std::vector<VkAccelerationStructureKHR> built;
+	for (size_t i = 0; i < blas_batch.blas_indices.size(); i++) {
+		BottomLevelAS& blas = BLASs[blas_batch.blas_indices[i]];
+		blas.buildGeomInfo.scratchData.deviceAddress = blas_scratch.deviceAddr + scratchOffsets[i];
+		buildInfos.push_back(blas.buildGeomInfo);
+		pBuildRanges.push_back(blas.offsets.data());
+		built.push_back(blas.as.accelerationStructure);
+	}
+	blas_batch.cmd_buffer = beginSingleTimeCommandBuffer(Device::get(), Device::getComputeCmdPool());
+	// queries are reset in the command buffer, no host query reset needed
+	if (blas_batch.query_pool != VK_NULL_HANDLE) {
+		vkCmdResetQueryPool(blas_batch.cmd_buffer, blas_batch.query_pool, 0, (uint32_t)blas_batch.blas_indices.size());
+	}
+	if (blas_timestamp_pool != VK_NULL_HANDLE) {
+		vkCmdResetQueryPool(blas_batch.cmd_buffer, blas_timestamp_pool, 0, 2);
+		vkCmdWriteTimestamp(blas_batch.cmd_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, blas_timestamp_pool, 0);
+	}
+	// BUILD
+	vkCmdBuildAccelerationStructuresKHR(blas_batch.cmd_buffer, (uint32_t)buildInfos.size(), buildInfos.data(), pBuildRanges.data());
+	if (blas_timestamp_pool != VK_NULL_HANDLE) {
+		vkCmdWriteTimestamp(blas_batch.cmd_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, blas_timestamp_pool, 1);
+	}
+	if (blas_batch.query_pool != VK_NULL_HANDLE) {
+		// sizes are known once the builds are done
 		VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
 		barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
 		barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
-		vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+		vkCmdPipelineBarrier(blas_batch.cmd_buffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
 			VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
-
-		//vkCmdResetQueryPool(cmdBuffer, queryPool, queryCtr, qpci.queryCount);
-		vkCmdWriteAccelerationStructuresPropertiesKHR(cmdBuffer, 1, &blas.as.accelerationStructure,
-			VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, queryPool, queryCtr++);
+		vkCmdWriteAccelerationStructuresPropertiesKHR(blas_batch.cmd_buffer, (uint32_t)built.size(), built.data(),
+			VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, blas_batch.query_pool, 0);
+	}
+	vkEndCommandBuffer(blas_batch.cmd_buffer);
+	VkFenceCreateInfo fenceInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+	vkCreateFence(Device::get(), &fenceInfo, nullptr, &blas_batch.fence);
+	VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &blas_batch.cmd_buffer;
+	if (Renderer::submit(Device::getComputeQueue(), 1, &submitInfo, blas_batch.fence) != VK_SUCCESS) {
+		throw std::runtime_error("raytracing: failed to submit BLAS build!");
 	}
-	submitAndWaitCommandBuffers(Device::get(), Device::getGraphicQueue(), Device::getGraphicCmdPool(), cmdBuffers);
-	cmdBuffers.clear();
+}
 
-	//BLAS COMPACTION - phase
-	std::vector<AccelerationStructure> okBoomers(BLASs.size());
-	{
-		auto cmdBuff = beginSingleTimeCommandBuffer(Device::get(), Device::getGraphicCmdPool());		
-		cmdBuffers.push_back(cmdBuff);
-		// Get the size result back
-		std::vector<VkDeviceSize> compactSizes(BLASs.size());
-		vkGetQueryPoolResults(Device::get(), queryPool, 0, (uint32_t)compactSizes.size(), compactSizes.size() * sizeof(VkDeviceSize),
-			compactSizes.data(), sizeof(VkDeviceSize), VK_QUERY_RESULT_WAIT_BIT);
-
-		// Compacting
-		uint32_t totOriginalSize{ 0 }, totCompactSize{ 0 };
-		for (int i = 0; i < BLASs.size(); i++)
-		{
-			std::cout << "Compacting BLAS from " << originalSizes[i] << " to " << compactSizes[i] << " bytes" << std::endl;
-			totOriginalSize += (uint32_t)originalSizes[i];
-			totCompactSize += (uint32_t)compactSizes[i];
-
-			// Creating a compact version of the AS
-			VkAccelerationStructureCreateInfoKHR asCreateInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
-			asCreateInfo.size = compactSizes[i];
-			asCreateInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-			AccelerationStructure newBlas = createAcceleration(asCreateInfo);
-
-			// Copy the original BLAS to a compact version
-			VkCopyAccelerationStructureInfoKHR copyInfo{ VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR };
-			copyInfo.src = BLASs[i].as.accelerationStructure;
-			copyInfo.dst = newBlas.accelerationStructure;
-			copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
-			vkCmdCopyAccelerationStructureKHR(cmdBuff, &copyInfo);
-			okBoomers[i] = BLASs[i].as;
-			BLASs[i].as = newBlas;
+void RayTracer::finishBottomLevelBatch()
+{
+	// The BLASs are usable, compaction swaps them later (see compactBottomLevelAS)
+	for (auto index : blas_batch.blas_indices) {
+		BLASs[index].as.handle = getAccelerationStructureAddress(BLASs[index].as.accelerationStructure);
+		BLASs[index].ready = true;
+	}
+	if (blas_batch.query_pool != VK_NULL_HANDLE) {
+		BlasCompaction compaction;
+		compaction.query_pool = blas_batch.query_pool;
+		compaction.blas_indices = blas_batch.blas_indices;
+		for (auto index : blas_batch.blas_indices) {
+			compaction.sources.push_back(BLASs[index].as.accelerationStructure);
 		}
-		std::cout << "BLASs total size went from " << totOriginalSize << " to " << totCompactSize << " bytes, saving "
-			<< (float)(totOriginalSize - totCompactSize) / totOriginalSize * 100 << "% of memory." << std::endl;
+		compactions.push_back(compaction);
 	}
-
-	submitAndWaitCommandBuffers(Device::get(),Device::getGraphicQueue(),Device::getGraphicCmdPool(), cmdBuffers);
-
-	//Destroy the query for the blas size
-	vkDestroyQueryPool(Device::get(),queryPool, nullptr);
-	// Destroying previous BLAS versions
-	for (auto oldAS : okBoomers) {
-		vkDestroyAccelerationStructureKHR(Device::get(), oldAS.accelerationStructure, nullptr);
-		vkDestroyBuffer(Device::get(), oldAS.buffer.vkBuffer, nullptr);
-		vkFreeMemory(Device::get(), oldAS.buffer.vkMemory, nullptr);
+	// the batch is done: its GPU time calibrates the estimate of the next ones
+	uint64_t stamps[2];
+	if (blas_timestamp_pool != VK_NULL_HANDLE && blas_batch.triangles > 0 &&
+		vkGetQueryPoolResults(Device::get(), blas_timestamp_pool, 0, 2, sizeof(stamps), stamps,
+			sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+		float batch_ms = ((stamps[1] - stamps[0]) & blas_timestamp_mask) *
+			PhysicalDevice::getProperties().properties.limits.timestampPeriod / 1000000.f;
+		blas_ms_per_triangle += (batch_ms / blas_batch.triangles - blas_ms_per_triangle) * 0.25f;
 	}
-	// We can destroy our scratch buffer
-	vkDestroyBuffer(Device::get(), scratchBuffer.vkBuffer, nullptr);
-	vkFreeMemory(Device::get(), scratchBuffer.vkMemory, nullptr);
+	update_stats.blas_built += (uint32_t)blas_batch.blas_indices.size();
+	refreshAllInstances();
+	vkFreeCommandBuffers(Device::get(), Device::getComputeCmdPool(), 1, &blas_batch.cmd_buffer);
+	vkDestroyFence(Device::get(), blas_batch.fence, nullptr);
+	blas_batch = {};
 }
 
-void RayTracer::buildTopLevelAS(Scene3D * scene, TopLevelAS* tlas)
+void RayTracer::updateBottomLevelAS()
 {
-	tlas->instances.reserve((scene->get_object_num()));
-	int i = 0;
-	for (auto & obj_id : scene->listObjects()) {
-		Object3D* obj = scene->getObject(obj_id);
-		unsigned mesh_id = MeshManager::getMeshID(obj->getMeshName());
+	if (blas_batch.fence != VK_NULL_HANDLE && vkGetFenceStatus(Device::get(), blas_batch.fence) == VK_SUCCESS) {
+		finishBottomLevelBatch();
+	}
+	// one batch at a time: they all use the same scratch buffer
+	if (blas_batch.fence == VK_NULL_HANDLE) {
+		queueBottomLevelAS();
+		startBottomLevelBatch();
+	}
+	compactBottomLevelAS();
+	update_stats.blas_pending = (uint32_t)(blas_build_queue.size() + blas_batch.blas_indices.size());
+}
 
-		VkAccelerationStructureDeviceAddressInfoKHR addressInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR };
-		addressInfo.accelerationStructure = BLASs[mesh_id].as.accelerationStructure;
-		VkDeviceAddress blasAddress = vkGetAccelerationStructureDeviceAddressKHR(Device::get(), &addressInfo);
+void RayTracer::buildBottomLevelAS()
+{
+	// Everything right away, before the first frame of a scene
+	if (blas_batch.fence != VK_NULL_HANDLE) {
+		vkWaitForFences(Device::get(), 1, &blas_batch.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+		finishBottomLevelBatch();
+	}
+	queueBottomLevelAS();
+	while (!blas_build_queue.empty()) {
+		startBottomLevelBatch();
+		vkWaitForFences(Device::get(), 1, &blas_batch.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+		finishBottomLevelBatch();
+	}
+}
 
-		TLAS_Instance instance = {};
-		instance.customID = i++; // return by gl_InstaceID
-		instance.blasAddr = blasAddress;
-		instance.hitGroupId = 0;  // We will use the same hit group for all objects
-		instance.matrix = obj->getMatrix();  // Position of the instance
-		instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-		tlas->instances.push_back(instance);
+void RayTracer::compactBottomLevelAS()
+{
+	for (auto& compaction : compactions) {
+		// 1) sizes known: record the copies to right-sized BLASs
+		if (compaction.fence == VK_NULL_HANDLE) {
+			std::vector<VkDeviceSize> compactSizes(compaction.blas_indices.size());
+			VkResult res = vkGetQueryPoolResults(Device::get(), compaction.query_pool, 0, (uint32_t)compactSizes.size(),
+				compactSizes.size() * sizeof(VkDeviceSize), compactSizes.data(), sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT);
+			if (res == VK_NOT_READY) continue;
+			vkDestroyQueryPool(Device::get(), compaction.query_pool, nullptr);
+			compaction.query_pool = VK_NULL_HANDLE;
+			if (res != VK_SUCCESS) continue; // the BLASs just stay as they are
+
+			compaction.cmd_buffer = beginSingleTimeCommandBuffer(Device::get(), Device::getComputeCmdPool());
+			for (size_t i = 0; i < compaction.blas_indices.size(); i++)
+			{
+				BottomLevelAS& blas = BLASs[compaction.blas_indices[i]];
+				// the mesh could have been replaced in the meantime
+				if (blas.as.accelerationStructure != compaction.sources[i]) continue;
+				if (compactSizes[i] == 0 || compactSizes[i] >= blas.original_size) continue;
+				// Creating a compact version of the AS
+				VkAccelerationStructureCreateInfoKHR asCreateInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
+				asCreateInfo.size = compactSizes[i];
+				asCreateInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+				AccelerationStructure newBlas = createAcceleration(asCreateInfo);
+
+				// Copy the original BLAS to a compact version
+				VkCopyAccelerationStructureInfoKHR copyInfo{ VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR };
+				copyInfo.src = blas.as.accelerationStructure;
+				copyInfo.dst = newBlas.accelerationStructure;
+				copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+				vkCmdCopyAccelerationStructureKHR(compaction.cmd_buffer, &copyInfo);
+				compaction.copies.push_back({ compaction.blas_indices[i], copyInfo.src, newBlas });
+				blas.compact_size = compactSizes[i];
+			}
+			vkEndCommandBuffer(compaction.cmd_buffer);
+			if (compaction.copies.empty()) {
+				vkFreeCommandBuffers(Device::get(), Device::getComputeCmdPool(), 1, &compaction.cmd_buffer);
+				continue;
+			}
+			VkFenceCreateInfo fenceInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+			vkCreateFence(Device::get(), &fenceInfo, nullptr, &compaction.fence);
+			VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &compaction.cmd_buffer;
+			if (Renderer::submit(Device::getComputeQueue(), 1, &submitInfo, compaction.fence) != VK_SUCCESS) {
+				throw std::runtime_error("raytracing: failed to submit BLAS compaction!");
+			}
+		}
+		// 2) copies done: swap in the compact BLASs, the TLASs pick the new addresses up on their next update
+		else if (vkGetFenceStatus(Device::get(), compaction.fence) == VK_SUCCESS) {
+			VkDeviceSize totOriginalSize{ 0 }, totCompactSize{ 0 };
+			for (auto& copy : compaction.copies) {
+				BottomLevelAS& blas = BLASs[copy.blas_index];
+				// frames in flight can still trace the original one (or the copy, if the mesh was replaced)
+				AccelerationStructure old_as = blas.as;
+				if (blas.as.accelerationStructure != copy.source) old_as = copy.compact_as;
+				Renderer::deferDestruction([old_as]() {
+					vkDestroyAccelerationStructureKHR(Device::get(), old_as.accelerationStructure, nullptr);
+					vkDestroyBuffer(Device::get(), old_as.buffer.vkBuffer, nullptr);
+					vkFreeMemory(Device::get(), old_as.buffer.vkMemory, nullptr);
+				});
+				if (blas.as.accelerationStructure != copy.source) continue;
+				blas.as = copy.compact_as;
+				blas.as.handle = getAccelerationStructureAddress(blas.as.accelerationStructure);
+				blas.compacted = true;
+				totOriginalSize += blas.original_size;
+				totCompactSize += blas.compact_size;
+			}
+			if (totOriginalSize > 0) {
+				refreshAllInstances();
+				std::cout << "BLASs total size went from " << totOriginalSize << " to " << totCompactSize << " bytes, saving "
+					<< (float)(totOriginalSize - totCompactSize) / totOriginalSize * 100 << "% of memory." << std::endl;
+			}
+			compaction.copies.clear();
+			vkFreeCommandBuffers(Device::get(), Device::getComputeCmdPool(), 1, &compaction.cmd_buffer);
+			vkDestroyFence(Device::get(), compaction.fence, nullptr);
+			compaction.fence = VK_NULL_HANDLE;
+		}
 	}
+	// done (or failed) compactions have neither a query nor a fence left
+	compactions.erase(std::remove_if(compactions.begin(), compactions.end(), [](const BlasCompaction& c) {
+		return c.query_pool == VK_NULL_HANDLE && c.fence == VK_NULL_HANDLE; }), compactions.end());
+}
 
-	// For each instance, build the corresponding instance descriptor
-	std::vector<VkAccelerationStructureInstanceKHR> geometryInstances;
-	geometryInstances.reserve(tlas->instances.size());
-	for (const auto& inst : tlas->instances)
-	{
-		geometryInstances.push_back(inst.to_VkAcInstanceKHR());
+void RayTracer::cancelBottomLevelWork()
+{
+	if (blas_batch.fence != VK_NULL_HANDLE) {
+		vkWaitForFences(Device::get(), 1, &blas_batch.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+		if (blas_batch.query_pool != VK_NULL_HANDLE) vkDestroyQueryPool(Device::get(), blas_batch.query_pool, nullptr);
+		vkFreeCommandBuffers(Device::get(), Device::getComputeCmdPool(), 1, &blas_batch.cmd_buffer);
+		vkDestroyFence(Device::get(), blas_batch.fence, nullptr);
+		blas_batch = {};
 	}
-	// SIZE
-	if (geometryInstances.size() > 0)
-	{
-		tlas->bufferSize = geometryInstances.size() * sizeof(VkAccelerationStructureInstanceKHR);
+	blas_build_queue.clear();
+	for (auto& compaction : compactions) {
+		if (compaction.fence != VK_NULL_HANDLE) {
+			vkWaitForFences(Device::get(), 1, &compaction.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+			// the compact copies were never swapped in
+			for (auto& copy : compaction.copies) {
+				vkDestroyAccelerationStructureKHR(Device::get(), copy.compact_as.accelerationStructure, nullptr);
+				vkDestroyBuffer(Device::get(), copy.compact_as.buffer.vkBuffer, nullptr);
+				vkFreeMemory(Device::get(), copy.compact_as.buffer.vkMemory, nullptr);
+			}
+			vkFreeCommandBuffers(Device::get(), Device::getComputeCmdPool(), 1, &compaction.cmd_buffer);
+			vkDestroyFence(Device::get(), compaction.fence, nullptr);
+		}
+		if (compaction.query_pool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(Device::get(), compaction.query_pool, nullptr);
+		}
 	}
-	else {
-		tlas->bufferSize = 256; // If there are no objects to render we still need a buffer
+	compactions.clear();
+}
+
+std::vector<vkengine::BlasMemoryInfo> RayTracer::getBlasMemoryReport()
+{
+	// BLASs are indexed by mesh ID
+	std::vector<vkengine::BlasMemoryInfo> report(BLASs.size());
+	for (auto& mesh : MeshManager::listLoadedMeshes()) {
+		unsigned id = MeshManager::getMeshID(mesh);
+		if (id >= BLASs.size()) continue;
+		report[id] = { mesh, BLASs[id].original_size,
+			BLASs[id].compacted ? BLASs[id].compact_size : BLASs[id].original_size,
+			BLASs[id].compacted };
 	}
-	// STAGE buffer loading
-	createBuffer(PhysicalDevice::get(), Device::get(), tlas->bufferSize,
+	return report;
+}
+
+void RayTracer::buildTopLevelAS(Scene3D * scene, TopLevelAS* tlas)
+{
+	// room for the whole scene capacity, so adding objects does not need a reallocation
+	allocateTopLevelAS(tlas, std::max(scene->getCurrentObjectCapacity(), scene->get_object_num()));
+	fillInstances(scene, tlas);
+
+	VkCommandBuffer cmdBuffer = beginSingleTimeCommandBuffer(Device::get(), Device::getComputeCmdPool());
+	recordCmdUpdateTopLevelAS(cmdBuffer, tlas, 0);
+	std::vector<VkCommandBuffer> buffers = { cmdBuffer };
+	submitAndWaitCommandBuffers(Device::get(), Device::getComputeQueue(), Device::getComputeCmdPool(), buffers);
+}
+
+void RayTracer::allocateTopLevelAS(TopLevelAS* tlas, uint32_t capacity)
+{
+	tlas->capacity = std::max(capacity, 1u); // If there are no objects to render we still need a buffer
+	tlas->built_instances = 0;
+	tlas->needs_full_build = true;
+	// new buffers hold nothing: every instance will be written
+	tlas->refresh_all = true;
+	tlas->instances.clear();
+	tlas->descriptions.clear();
+	tlas->centers.clear();
+	tlas->build_centers.clear();
+	tlas->drift.clear();
+	tlas->total_drift = 0.f;
+	tlas->opaque_instances = 0;
+	tlas->dirty_regions.clear();
+	VkDeviceSize instances_size = tlas->capacity * sizeof(VkAccelerationStructureInstanceKHR);
+	// STAGE buffer, stays mapped: the instances are rewritten every frame
+	createBuffer(PhysicalDevice::get(), Device::get(), instances_size,
 		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 		tlas->stagebuffer.vkBuffer, tlas->stagebuffer.vkMemory);
-	vkMapMemory(Device::get(), tlas->stagebuffer.vkMemory, 0, tlas->bufferSize, 0, &tlas->stagebuffer.mappedMemory);
-	if (geometryInstances.size() > 0)
-	{		
-		// We must load the AS instances in GPU memory
-		memcpy(tlas->stagebuffer.mappedMemory, geometryInstances.data(), tlas->bufferSize);
-	}
-	//Final TLAS instance buffer loading
-	createBuffer(PhysicalDevice::get(), Device::get(), tlas->bufferSize,
+	vkMapMemory(Device::get(), tlas->stagebuffer.vkMemory, 0, instances_size, 0, &tlas->stagebuffer.mappedMemory);
+	//Final TLAS instance buffer
+	createBuffer(PhysicalDevice::get(), Device::get(), instances_size,
 		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 		tlas->instanceBuffer.vkBuffer, tlas->instanceBuffer.vkMemory);
-	//--------------------------------------------------------------------------------------------------------------
-	// Copy data in GPU memory
-	VkCommandBuffer cmdBuffer = beginSingleTimeCommandBuffer(Device::get(), Device::getGraphicCmdPool());
-	VkBufferCopy copyRegion = {};
-	copyRegion.size = tlas->bufferSize;
-	vkCmdCopyBuffer(cmdBuffer, tlas->stagebuffer.vkBuffer, tlas->instanceBuffer.vkBuffer, 1, &copyRegion);
-	//We put a barrier to make all as_structure build operations to wait for previous commands to end their write operations
-	VkMemoryBarrier barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
-	barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
-	barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
-	// The barrier defines the type of the operations. But GPU work is in pipeline fascion so we must set the stages affected by the barrier
-	vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 
-		0, 1, &barrier, 0, nullptr, 0, nullptr);
-	//--------------------------------------------------------------------------------------------------------------
-	//FINALLY we have the data in device local memory safely written ready for the TLAS build
+	tlas->instanceBuffer.deviceAddr = getBufferDeviceAddress(tlas->instanceBuffer.vkBuffer);
+	// Scene description of this frame
+	VkDeviceSize scene_size = tlas->capacity * sizeof(SceneObjRtDescBlock);
+	createBuffer(PhysicalDevice::get(), Device::get(), scene_size,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+		tlas->sceneBuffer.vkBuffer, tlas->sceneBuffer.vkMemory);
+	vkMapMemory(Device::get(), tlas->sceneBuffer.vkMemory, 0, scene_size, 0, &tlas->sceneBuffer.mappedMemory);
 
 	VkAccelerationStructureGeometryDataKHR  gData = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR };
 	gData.instances.arrayOfPointers = VK_FALSE;
-	gData.instances.data.deviceAddress = getBufferDeviceAddress(tlas->instanceBuffer.vkBuffer);
+	gData.instances.data.deviceAddress = tlas->instanceBuffer.deviceAddr;
 	VkAccelerationStructureGeometryKHR topASGeometry = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
 	topASGeometry.geometryType = VkGeometryTypeKHR::VK_GEOMETRY_TYPE_INSTANCES_KHR;
 	topASGeometry.geometry = gData;
 
-	// Find sizes
+	// Find sizes for the worst case: every instance slot in use
 	VkAccelerationStructureBuildGeometryInfoKHR buildInfo{
 	  VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
 	buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
@@ -335,7 +546,7 @@ void RayTracer::buildTopLevelAS(Scene3D * scene, TopLevelAS* tlas)
 	buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
 	buildInfo.srcAccelerationStructure = VK_NULL_HANDLE;
 
-	uint32_t count = (uint32_t)tlas->instances.size();
+	uint32_t count = tlas->capacity;
 	VkAccelerationStructureBuildSizesInfoKHR sizeInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
 	vkGetAccelerationStructureBuildSizesKHR(
 		Device::get(), VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo, &count, &sizeInfo);
@@ -346,35 +557,151 @@ void RayTracer::buildTopLevelAS(Scene3D * scene, TopLevelAS* tlas)
 
 	tlas->as = createAcceleration(asCreateInfo);
 
-	//SCRATCH BUFFER CREATION
-	tlas->scratchBuffer = createScratchBuffer(sizeInfo.buildScratchSize);
-
-	VkAccelerationStructureBuildGeometryInfoKHR topASInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
-	topASInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-	topASInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
-	topASInfo.srcAccelerationStructure = VK_NULL_HANDLE;
-	topASInfo.dstAccelerationStructure = tlas->as.accelerationStructure;
-	topASInfo.geometryCount = 1;
-	topASInfo.pGeometries = &topASGeometry;
-	topASInfo.scratchData.deviceAddress = tlas->scratchBuffer.deviceAddr;
-	VkAccelerationStructureBuildRangeInfoKHR offsets = {static_cast<uint32_t>(tlas->instances.size()),0,0,0};
-	const VkAccelerationStructureBuildRangeInfoKHR* pOffsets = &offsets;
-
-	vkCmdBuildAccelerationStructuresKHR(cmdBuffer, 1, &topASInfo, &pOffsets);
+	//SCRATCH BUFFER CREATION, big enough for both build and update
+	tlas->scratchBuffer = createScratchBuffer(std::max(sizeInfo.buildScratchSize, sizeInfo.updateScratchSize));
+}
 
-	std::vector<VkCommandBuffer> buffers = { cmdBuffer };
-	submitAndWaitCommandBuffers(Device::get(), Device::getGraphicQueue(), Device::getGraphicCmdPool(), buffers);
-	//--------------------------------------------------------------------------------------------------------------
+void RayTracer::refreshAllInstances()
+{
+	for (auto& tlas : TLASs) {
+		tlas.refresh_all = true;
+	}
+}
 
-	tlas->instanceBuffer.deviceAddr = getBufferDeviceAddress(tlas->instanceBuffer.vkBuffer);
+void RayTracer::fillInstances(Scene3D* scene, TopLevelAS* tlas)
+{
+	uint32_t count = scene->get_object_num();
+	// Objects added or removed: refitting is not enough
+	if (count != tlas->built_instances) tlas->needs_full_build = true;
+	size_t old_count = tlas->instances.size();
+	for (size_t i = count; i < old_count; i++) {
+		if (tlas->instances[i].flags & VK_GEOMETRY_INSTANCE_FORCE_OPAQUE_BIT_KHR) tlas->opaque_instances--;
+	}
+	tlas->instances.resize(count);
+	tlas->descriptions.resize(count);
+	tlas->drift.resize(count, 0.f);
+	tlas->centers.resize(count);
+	tlas->dirty_regions.clear();
+
+	// what the slot holds in this frame's buffers
+	auto describe = [scene](uint32_t slot, VkAccelerationStructureInstanceKHR& vk_instance, SceneObjRtDescBlock& description) {
+		Object3D* obj = scene->getObject(scene->getObjectInSlot(slot));
+		unsigned mesh_id = MeshManager::getMeshID(obj->getMeshName());
+		unsigned texture_id = TextureManager::getSceneTextureIndex(obj->getTextureName());
+		TLAS_Instance instance = {};
+		instance.customID = slot; // return by gl_InstaceID, the slot of the object
+		// 0 makes the instance inactive until the BLAS of its mesh is built
+		instance.blasAddr = mesh_id < BLASs.size() && BLASs[mesh_id].ready ? BLASs[mesh_id].as.handle : 0;
+		instance.hitGroupId = 0;  // We will use the same hit group for all objects
+		instance.matrix = obj->getMatrix();  // Position of the instance
+		instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+		// the texture decides per object if the any hit shaders have something to do, the BLAS is shared
+		if (TextureManager::getSceneTexture(texture_id)->isOpaque()) {
+			instance.flags |= VK_GEOMETRY_INSTANCE_FORCE_OPAQUE_BIT_KHR;
+		}
+		vk_instance = instance.to_VkAcInstanceKHR();
+		description = { mesh_id, texture_id, obj->getMatrix(), obj->reflective };
+	};
+
+	// only the slots edited since the last update of this TLAS, all of them if it has to start over
+	std::vector<unsigned> slots;
+	bool logged = scene->listChangedSlots(tlas->slot_cursor, slots);
+	if (!logged || tlas->refresh_all || tlas->scene != scene) {
+		slots.resize(count);
+		for (uint32_t i = 0; i < count; i++) slots[i] = i;
+		tlas->scene = scene;
+		tlas->refresh_all = false;
+	}
+	else {
+		// in order, so that the copies of neighbouring slots merge
+		std::sort(slots.begin(), slots.end());
+		slots.erase(std::unique(slots.begin(), slots.end()), slots.end());
+	}
 
+	for (uint32_t i : slots) {
+		// freed by a removal
+		if (i >= count) break;
+		Object3D* obj = scene->getObject(scene->getObjectInSlot(i));
+		tlas->centers[i] = obj->getWorldSphere().center;
+		VkAccelerationStructureInstanceKHR vk_instance;
+		SceneObjRtDescBlock description;
+		describe(i, vk_instance, description);
+
+		// Scene description is host visible: changed entries are written in place
+		if (i >= old_count || memcmp(&description, &tlas->descriptions[i], sizeof(SceneObjRtDescBlock)) != 0) {
+			tlas->descriptions[i] = description;
+			memcpy((SceneObjRtDescBlock*)tlas->sceneBuffer.mappedMemory + i, &description, sizeof(SceneObjRtDescBlock));
+			update_stats.bytes_uploaded += sizeof(SceneObjRtDescBlock);
+			update_stats.descriptions_changed++;
+		}
+		if (i < old_count && memcmp(&vk_instance, &tlas->instances[i], sizeof(VkAccelerationStructureInstanceKHR)) == 0) {
+			continue;
+		}
+		if (i < old_count) {
+			// pointing to another mesh: the BVH has to be rebuilt
+			if (vk_instance.accelerationStructureReference != tlas->instances[i].accelerationStructureReference) {
+				tlas->needs_full_build = true;
+			}
+			if (tlas->instances[i].flags & VK_GEOMETRY_INSTANCE_FORCE_OPAQUE_BIT_KHR) tlas->opaque_instances--;
+		}
+		if (vk_instance.flags & VK_GEOMETRY_INSTANCE_FORCE_OPAQUE_BIT_KHR) tlas->opaque_instances++;
+		tlas->instances[i] = vk_instance;
+		memcpy((VkAccelerationStructureInstanceKHR*)tlas->stagebuffer.mappedMemory + i, &vk_instance,
+			sizeof(VkAccelerationStructureInstanceKHR));
+		update_stats.instances_changed++;
+		// refit quality: how far the instance went from where the last build placed it, in radii
+		if (i < tlas->build_centers.size()) {
+			float radius = std::max(obj->getWorldSphere().radius, 1e-3f);
+			float drift = glm::length(tlas->centers[i] - tlas->build_centers[i]) / radius;
+			tlas->total_drift += drift - tlas->drift[i];
+			tlas->drift[i] = drift;
+		}
+		// the copy regions of consecutive (or nearly) instances are merged
+		VkDeviceSize offset = i * sizeof(VkAccelerationStructureInstanceKHR);
+		if (!tlas->dirty_regions.empty() &&
+			offset - (tlas->dirty_regions.back().srcOffset + tlas->dirty_regions.back().size) <=
+			DIRTY_REGION_MERGE_GAP * sizeof(VkAccelerationStructureInstanceKHR)) {
+			tlas->dirty_regions.back().size = offset + sizeof(VkAccelerationStructureInstanceKHR) - tlas->dirty_regions.back().srcOffset;
+		}
+		else {
+			tlas->dirty_regions.push_back({ offset, offset, sizeof(VkAccelerationStructureInstanceKHR) });
+		}
+	}
+	update_stats.opaque_instances = tlas->opaque_instances;
+#ifdef _DEBUG
+	// the log has to cover every edit: the slots it did not list still match the scene
+	for (uint32_t i = 0; i < count; i++) {
+		VkAccelerationStructureInstanceKHR vk_instance;
+		SceneObjRtDescBlock description;
+		describe(i, vk_instance, description);
+		assert(memcmp(&vk_instance, &tlas->instances[i], sizeof(VkAccelerationStructureInstanceKHR)) == 0);
+		assert(memcmp(&description, &tlas->descriptions[i], sizeof(SceneObjRtDescBlock)) == 0);
+	}
+#endif
+	if (count > 0 && tlas->total_drift / count > refit_drift_threshold) {
+		tlas->needs_full_build = true;
+	}
 }
 
-void RayTracer::recordCmdUpdateTopLevelAS(VkCommandBuffer& cmd_buf, TopLevelAS * tlas)
+bool RayTracer::recordCmdUpdateTopLevelAS(VkCommandBuffer& cmd_buf, TopLevelAS * tlas, VkPipelineStageFlags reading_stages,
+	int frameIndex)
 {
-	// COPY to GPU
-	VkBufferCopy region = { 0, 0, tlas->bufferSize };
-	vkCmdCopyBuffer(cmd_buf, tlas->stagebuffer.vkBuffer, tlas->instanceBuffer.vkBuffer, 1, &region);
+	// Nothing moved: the TLAS of this frame is still good
+	if (tlas->dirty_regions.empty() && !tlas->needs_full_build) {
+		update_stats.tlas_skipped++;
+		return false;
+	}
+	// with async compute the updates of the frames are recorded for the compute queue
+	bool compute_queue = PhysicalDevice::hasAsyncCompute();
+	// COPY to GPU only the instances that changed
+	if (!tlas->dirty_regions.empty()) {
+		if (frameIndex >= 0) GpuProfiler::beginPass(cmd_buf, frameIndex, vkengine::GPU_PASS_UPLOADS, compute_queue);
+		vkCmdCopyBuffer(cmd_buf, tlas->stagebuffer.vkBuffer, tlas->instanceBuffer.vkBuffer,
+			(uint32_t)tlas->dirty_regions.size(), tlas->dirty_regions.data());
+		if (frameIndex >= 0) GpuProfiler::endPass(cmd_buf, frameIndex, vkengine::GPU_PASS_UPLOADS, compute_queue);
+		for (auto& region : tlas->dirty_regions) update_stats.bytes_uploaded += region.size;
+		tlas->dirty_regions.clear();
+	}
 	VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
 	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 	barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
@@ -391,7 +718,16 @@ void RayTracer::recordCmdUpdateTopLevelAS(VkCommandBuffer& cmd_buf, TopLevelAS *
 	VkAccelerationStructureBuildGeometryInfoKHR topASInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
 	topASInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
 	topASInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
-	topASInfo.srcAccelerationStructure = tlas->as.accelerationStructure; //the existing TLAS being passed and updated in place
+	if (tlas->needs_full_build) {
+		// the instance set changed or refits went too far: rebuild from scratch inside the same memory
+		topASInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+		topASInfo.srcAccelerationStructure = VK_NULL_HANDLE;
+	}
+	else {
+		// only matrices changed: the existing TLAS is refitted in place
+		topASInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+		topASInfo.srcAccelerationStructure = tlas->as.accelerationStructure;
+	}
 	topASInfo.dstAccelerationStructure = tlas->as.accelerationStructure;
 	topASInfo.geometryCount = 1;
 	topASInfo.pGeometries = &topASGeometry;
@@ -402,42 +738,241 @@ void RayTracer::recordCmdUpdateTopLevelAS(VkCommandBuffer& cmd_buf, TopLevelAS *
 	const VkAccelerationStructureBuildRangeInfoKHR* pBuildOffsetInfo = &buildOffsetInfo;
 
 	// Build the TLAS
+	if (frameIndex >= 0) GpuProfiler::beginPass(cmd_buf, frameIndex, vkengine::GPU_PASS_TLAS, compute_queue);
 	vkCmdBuildAccelerationStructuresKHR(cmd_buf, 1, &topASInfo, &pBuildOffsetInfo);
+	if (frameIndex >= 0) GpuProfiler::endPass(cmd_buf, frameIndex, vkengine::GPU_PASS_TLAS, compute_queue);
+	if (tlas->needs_full_build) {
+		// the new BVH fits the current positions again
+		tlas->build_centers = tlas->centers;
+		std::fill(tlas->drift.begin(), tlas->drift.end(), 0.f);
+		tlas->total_drift = 0.f;
+		update_stats.tlas_builds++;
+	}
+	else {
+		update_stats.tlas_refits++;
+	}
+	tlas->built_instances = nbInstances;
+	tlas->needs_full_build = false;
 
 	// Command structure readings from the shader to wait for writing in build phase
-	VkMemoryBarrier postUpdate{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
-	postUpdate.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
-	postUpdate.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-	vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
-		0, 1, &postUpdate, 0, nullptr, 0, nullptr);
-
+	if (reading_stages != 0) {
+		VkMemoryBarrier postUpdate{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+		postUpdate.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+		postUpdate.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, reading_stages,
+			0, 1, &postUpdate, 0, nullptr, 0, nullptr);
+	}
+	return true;
 }
 
-void RayTracer::createSceneBuffer(vkengine::Scene3D* scene)
+void RayTracer::recordSceneUpdate(VkCommandBuffer cmdBuffer, unsigned frameIndex)
 {
-	//VkDeviceSize allocation_size = sizeof(SceneObjRtDescBlock) * scene->get_object_num();
-	VkDeviceSize allocation_size = sizeof(SceneObjRtDescBlock) * scene->getCurrentObjectCapacity();
-	VkDeviceSize minAlignement = PhysicalDevice::getProperties().properties.limits.minStorageBufferOffsetAlignment;
-	VkDeviceSize padding = minAlignement - (allocation_size % minAlignement);
-	allocation_size = (allocation_size + padding) * SwapChainMng::get()->getImageCount();
+	// no dispatch in this frame
+	if (frameIndex < traced_frames.size()) traced_frames[frameIndex] = 0;
+	if (!PhysicalDevice::hasAsyncCompute()) {
+		RayTracer::recordCmdUpdateTopLevelAS(cmdBuffer, &TLASs[frameIndex], VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, frameIndex);
+	}
+}
 
-	createBuffer(PhysicalDevice::get(), Device::get(), allocation_size,
-		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-		sceneBuffer.vkBuffer, sceneBuffer.vkMemory);
+void RayTracer::createSceneUpdateResources()
+{
+	destroySceneUpdateResources();
+	if (!PhysicalDevice::hasAsyncCompute()) return;
+	tlas_update_cmds.resize(SwapChainMng::get()->getImageCount());
+	VkCommandBufferAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+	allocInfo.commandPool = Device::getComputeCmdPool();
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = (uint32_t)tlas_update_cmds.size();
+	if (vkAllocateCommandBuffers(Device::get(), &allocInfo, tlas_update_cmds.data()) != VK_SUCCESS) {
+		throw std::runtime_error("raytracing: failed to allocate TLAS update command buffers!");
+	}
+	tlas_update_semaphores.resize(tlas_update_cmds.size());
+	VkSemaphoreCreateInfo semaphoreInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+	for (auto& semaphore : tlas_update_semaphores) {
+		if (vkCreateSemaphore(Device::get(), &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS) {
+			throw std::runtime_error("raytracing: failed to create TLAS update semaphore!");
+		}
+	}
+}
 
-	vkMapMemory(Device::get(), sceneBuffer.vkMemory, 0, allocation_size, 0, &sceneBuffer.mappedMemory);
+void RayTracer::destroySceneUpdateResources()
+{
+	if (!tlas_update_cmds.empty()) {
+		vkFreeCommandBuffers(Device::get(), Device::getComputeCmdPool(), (uint32_t)tlas_update_cmds.size(), tlas_update_cmds.data());
+	}
+	for (auto semaphore : tlas_update_semaphores) {
+		vkDestroySemaphore(Device::get(), semaphore, nullptr);
+	}
+	tlas_update_cmds.clear();
+	tlas_update_semaphores.clear();
+	pending_tlas_update = VK_NULL_HANDLE;
 }
 
-void RayTracer::updateCmdBuffer(std::vector<VkCommandBuffer> &cmdBuffers, std::vector<FrameAttachment> &storageImages, unsigned frameIndex)
+void RayTracer::submitTopLevelUpdate(unsigned imageIndex)
 {
-	// begin main command recording
-	VkCommandBufferBeginInfo beginInfo = {};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	if (vkBeginCommandBuffer(cmdBuffers[frameIndex], &beginInfo) != VK_SUCCESS) {
+	// the frame that last used this image has completed, and it waited for the previous update
+	VkCommandBuffer cmdBuffer = tlas_update_cmds[imageIndex];
+	VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (vkBeginCommandBuffer(cmdBuffer, &beginInfo) != VK_SUCCESS) {
 		throw std::runtime_error("failed to begin recording command buffer!");
 	}
+	// the semaphore makes the new TLAS visible to the frame, no barrier after the build
+	bool recorded = recordCmdUpdateTopLevelAS(cmdBuffer, &TLASs[imageIndex], 0, imageIndex);
+	vkEndCommandBuffer(cmdBuffer);
+	if (!recorded) return;
+
+	VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &cmdBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &tlas_update_semaphores[imageIndex];
+	if (Renderer::submit(Device::getComputeQueue(), 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+		throw std::runtime_error("raytracing: failed to submit TLAS update!");
+	}
+	pending_tlas_update = tlas_update_semaphores[imageIndex];
+}
+
+VkSemaphore RayTracer::takeSceneUpdateSemaphore()
+{
+	VkSemaphore semaphore = pending_tlas_update;
+	pending_tlas_update = VK_NULL_HANDLE;
+	return semaphore;
+}
+
+void RayTracer::updateFrameSceneResources(unsigned imageIndex)
+{
+	auto bundle = PipelineFactory::pipeline_layouts[PIPELINE_LAYOUT_RAY_TRACING].descriptors;
+	VkDescriptorSet set = bundle.frame_dependent_sets[0][imageIndex].set;
+
+	VkWriteDescriptorSetAccelerationStructureKHR accStructureWrite{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR };
+	accStructureWrite.accelerationStructureCount = 1;
+	accStructureWrite.pAccelerationStructures = &TLASs[imageIndex].as.accelerationStructure;
+	VkDescriptorBufferInfo sceneBuffInfo = { TLASs[imageIndex].sceneBuffer.vkBuffer, 0, VK_WHOLE_SIZE };
+
+	std::array<VkWriteDescriptorSet, 2> writes{};
+	writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[0].pNext = &accStructureWrite;
+	writes[0].dstSet = set;
+	writes[0].dstBinding = 0;
+	writes[0].descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+	writes[0].descriptorCount = 1;
+	writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[1].dstSet = set;
+	writes[1].dstBinding = 2;
+	writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	writes[1].descriptorCount = 1;
+	writes[1].pBufferInfo = &sceneBuffInfo;
+	// the frame that last used this set has been waited by the renderer, no need to idle the queue
+	vkUpdateDescriptorSets(Device::get(), writes.size(), writes.data(), 0, nullptr);
+}
+
+void RayTracer::createStorageImage(FrameAttachment& target, VkFormat format, VkExtent2D extent, VkCommandBuffer command)
+{
+	createImage(PhysicalDevice::get(), Device::get(), extent.width, extent.height,
+		format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		target.image, target.Memory);
+	target.imageView = createImageView(Device::get(), target.image, format, VK_IMAGE_ASPECT_COLOR_BIT);
+	transitionImageLayout(command, target.image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+}
+
+void RayTracer::destroyStorageImage(FrameAttachment& target)
+{
+	if (target.image == VK_NULL_HANDLE) return;
+	vkDestroyImageView(Device::get(), target.imageView, nullptr);
+	vkDestroyImage(Device::get(), target.image, nullptr);
+	vkFreeMemory(Device::get(), target.Memory, nullptr);
+	target = {};
+}
+
+void RayTracer::createTraceImages()
+{
+	destroyTraceImages();
+	// as the offscreen attachments the rays are traced into
+	auto extent = Renderer::getOffScreenExtent();
+	VkExtent2D half_extent = { (extent.width + 1) / 2, (extent.height + 1) / 2 };
+	VkCommandBuffer command = beginSingleTimeCommandBuffer(Device::get(), Device::getGraphicCmdPool());
+	// 8 bits would round away the weight of late samples
+	createStorageImage(accumulation_image, VK_FORMAT_R32G32B32A32_SFLOAT, extent, command);
+	// the guides are only compared with each other, half floats are enough
+	createStorageImage(guide_image, VK_FORMAT_R16G16B16A16_SFLOAT, extent, command);
+	createStorageImage(reflection_image, VK_FORMAT_R16G16B16A16_SFLOAT, half_extent, command);
+	createStorageImage(reflection_guide_image, VK_FORMAT_R16G16B16A16_SFLOAT, half_extent, command);
+	Renderer::submitSetupCommands(command);
+	accumulated_samples = 0;
+}
+
+void RayTracer::destroyTraceImages()
+{
+	destroyStorageImage(accumulation_image);
+	destroyStorageImage(guide_image);
+	destroyStorageImage(reflection_image);
+	destroyStorageImage(reflection_guide_image);
+}
+
+void RayTracer::updateAccumulation(const UniformBlock& uniforms)
+{
+	bool same = uniforms.V_matrix == accumulation_view.V_matrix && uniforms.P_matrix == accumulation_view.P_matrix &&
+		uniforms.light_count == accumulation_view.light_count &&
+		memcmp(&uniforms.global_light, &accumulation_view.global_light, sizeof(vkengine::LightData)) == 0 &&
+		memcmp(uniforms.pointLights, accumulation_view.pointLights, uniforms.light_count * sizeof(vkengine::LightData)) == 0;
+	if (!same) {
+		accumulation_view = uniforms;
+		accumulated_samples = 0;
+	}
+}
+
+float& RayTracer::reflectionTraceTime(vkengine::ReflectionResolution resolution)
+{
+	switch (resolution) {
+	case vkengine::REFLECTIONS_HALF: return reflection_trace_ms[1];
+	case vkengine::REFLECTIONS_QUARTER: return reflection_trace_ms[2];
+	default: return reflection_trace_ms[0];
+	}
+}
+
+float RayTracer::getReflectionTraceTime(vkengine::ReflectionResolution resolution)
+{
+	return reflectionTraceTime(resolution);
+}
+
+void RayTracer::updateRayBudget(unsigned imageIndex)
+{
+	// the GPU profiler has just read back the last frame of this image. Its dispatch ran with a budget from
+	// a few frames ago: the controller waits settle_frames after each change before trusting the timings again.
+	// Without the profiler nothing is measured and the budget stays where it is
+	update_stats.trace_ms = -1.f;
+	uint64_t traced_frame = imageIndex < traced_frames.size() ? traced_frames[imageIndex] : 0;
+	if (traced_frame != 0 && !GpuProfiler::history.empty() && GpuProfiler::history.back().frame == traced_frame) {
+		update_stats.trace_ms = GpuProfiler::history.back().pass_ms[vkengine::GPU_PASS_TRACE];
+	}
+	bool traced_rays = update_stats.trace_ms >= 0.f && !(accumulate && accumulated_samples >= accumulation_max_samples);
+	if (traced_rays) {
+		float& reflection_ms = reflectionTraceTime(traced_reflections[imageIndex]);
+		reflection_ms = reflection_ms < 0.f ? update_stats.trace_ms : reflection_ms + (update_stats.trace_ms - reflection_ms) * 0.1f;
+	}
+	traced_budget = next_budget;
+	budget_controller.configure(budget_settings, max_reflections_depth);
+	if (!budget_settings.enabled) {
+		next_budget = { max_reflections_depth, 1.f, 0.f };
+	}
+	// a converged accumulation traces nothing, its time says nothing about the budget
+	else if (traced_rays) {
+		next_budget = budget_controller.update(update_stats.trace_ms);
+	}
+	else {
+		next_budget = budget_controller.current();
+	}
+}
 
-	RayTracer::recordCmdUpdateTopLevelAS(cmdBuffers[frameIndex], &TLASs[frameIndex]);
+void RayTracer::recordCmdBuffer(VkCommandBuffer cmd, unsigned frameIndex)
+{
+	PROFILE_FUNCTION();
+	// with async compute the update was submitted in updateSceneData, the frame waits on its semaphore
+	if (!PhysicalDevice::hasAsyncCompute()) {
+		RayTracer::recordCmdUpdateTopLevelAS(cmd, &TLASs[frameIndex],
+			VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, frameIndex);
+	}
 
 	auto Playout = PipelineFactory::pipeline_layouts[PIPELINE_LAYOUT_RAY_TRACING];
 	std::vector<VkDescriptorSet> descrSets;
@@ -447,14 +982,19 @@ void RayTracer::updateCmdBuffer(std::vector<VkCommandBuffer> &cmdBuffers, std::v
 	for (auto& setlist : Playout.descriptors.frame_dependent_sets) {
 		descrSets.push_back(setlist[frameIndex].set);
 	}
-	vkCmdBindPipeline(cmdBuffers[frameIndex], VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rayTracingPipeline);
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rayTracingPipeline);
 
-	vkCmdBindDescriptorSets(cmdBuffers[frameIndex], VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, Playout.layout,
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, Playout.layout,
 		 0, descrSets.size(), descrSets.data(), 0, nullptr);
 
-	RayTracingPushConstantBlock block = { RayTracer::max_reflections_depth };
-	vkCmdPushConstants(cmdBuffers[frameIndex], Playout.layout, VK_SHADER_STAGE_RAYGEN_BIT_KHR,
-		0,sizeof(RayTracingPushConstantBlock), &block);
+	if (!accumulate || accumulation_budget != traced_budget || accumulation_reflections != reflection_resolution) {
+		accumulated_samples = 0;
+		accumulation_budget = traced_budget;
+		accumulation_reflections = reflection_resolution;
+	}
+	bool converged = accumulate && accumulated_samples >= accumulation_max_samples;
+	// a converged image is only copied, there is nothing to split
+	bool reduced_reflections = reflection_resolution != vkengine::REFLECTIONS_FULL && !converged;
 
 	// Size of a program identifier
 	uint32_t groupHandleSize = PhysicalDevice::getPhysicalDeviceRayTracingProperties().shaderGroupHandleSize;
@@ -469,26 +1009,53 @@ void RayTracer::updateCmdBuffer(std::vector<VkCommandBuffer> &cmdBuffers, std::v
 	const VkStridedDeviceAddressRegionKHR hitShaderBindingTable = { shaderBindingTable.deviceAddr + hitGroupOffset, groupSize, groupSize  * 2u};
 	const VkStridedDeviceAddressRegionKHR callableShaderBindingTable = {}; // not used
 
-	// it's basically a compute task, the invocation resembles a CUDA call
-	auto extent = SwapChainMng::get()->getExtent();
-
-	transitionImageLayout(cmdBuffers[frameIndex],
-		storageImages[frameIndex].image, VK_FORMAT_R8G8B8A8_UNORM,
-		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
-
-	vkCmdTraceRaysKHR(cmdBuffers[frameIndex], &raygenShaderBindingTable, &missShaderBindingTable, &hitShaderBindingTable,
-		&callableShaderBindingTable, extent.width, extent.height, 1); 
-
-	// Usually a Renderpass takes care of changing the image layout, 
-	// here we don't have one so we must take care of this
-	transitionImageLayout(cmdBuffers[frameIndex],
-		storageImages[frameIndex].image, VK_FORMAT_R8G8B8A8_UNORM,
-		VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
+	// it's basically a compute task, the invocation resembles a CUDA call.
+	// At a lower resolution scale only the top left part of the storage image is written
+	auto extent = Renderer::getOffScreenExtent();
+	extent.width = std::max(1u, (uint32_t)std::ceil(extent.width * traced_budget.resolution_scale));
+	extent.height = std::max(1u, (uint32_t)std::ceil(extent.height * traced_budget.resolution_scale));
+
+	// what a dispatch writes is read by the next one
+	auto shaderBarrier = [&]() {
+		VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+			VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	};
+	if (accumulate || reduced_reflections) {
+		// the accumulation and reflection images are shared: the previous frame has to be done with them
+		shaderBarrier();
+	}
 
-	if (vkEndCommandBuffer(cmdBuffers[frameIndex]) != VK_SUCCESS) {
-		throw std::runtime_error("failed to submit end RT cmd command buffer!");
+	RayTracingPushConstantBlock block = { traced_budget.max_depth, accumulated_samples, accumulate, converged,
+		traced_budget.roulette, RT_PASS_FULL, (uint32_t)reflection_resolution, extent.width, extent.height };
+	if (accumulate && !converged) accumulated_samples++;
+	auto traceRays = [&](RayTracingPass pass, uint32_t width, uint32_t height) {
+		block.pass = pass;
+		vkCmdPushConstants(cmd, Playout.layout, VK_SHADER_STAGE_RAYGEN_BIT_KHR,
+			0, sizeof(RayTracingPushConstantBlock), &block);
+		vkCmdTraceRaysKHR(cmd, &raygenShaderBindingTable, &missShaderBindingTable, &hitShaderBindingTable,
+			&callableShaderBindingTable, width, height, 1);
+	};
+
+	GpuProfiler::beginPass(cmd, frameIndex, vkengine::GPU_PASS_TRACE);
+	if (reduced_reflections) {
+		// primary surfaces, one reflection per block of pixels, then upsampling and composition at full resolution
+		traceRays(RT_PASS_PRIMARY, extent.width, extent.height);
+		shaderBarrier();
+		traceRays(RT_PASS_REFLECTIONS, (extent.width + reflection_resolution - 1) / reflection_resolution,
+			(extent.height + reflection_resolution - 1) / reflection_resolution);
+		shaderBarrier();
+		traceRays(RT_PASS_COMPOSITE, extent.width, extent.height);
 	}
+	else {
+		traceRays(RT_PASS_FULL, extent.width, extent.height);
+	}
+	GpuProfiler::endPass(cmd, frameIndex, vkengine::GPU_PASS_TRACE);
+	// the frame being recorded, as numbered by the GPU profiler
+	traced_frames[frameIndex] = Renderer::getFrameCount() + 1;
+	traced_reflections[frameIndex] = reflection_resolution;
 }
 
 void RayTracer::createRayTracingPipeline()
@@ -553,9 +1120,13 @@ void RayTracer::createRayTracingPipeline()
 	rayPipelineInfo.pGroups = shaderGroups.data();
 	rayPipelineInfo.maxPipelineRayRecursionDepth = 2; // 1 forces a Miss call if a trace call happens after the first hit
 
-	if (vkCreateRayTracingPipelinesKHR(Device::get(), nullptr, nullptr, 1, &rayPipelineInfo, nullptr, &RayTracer::rayTracingPipeline) != VK_SUCCESS) {
+	auto start = std::chrono::high_resolution_clock::now();
+	if (vkCreateRayTracingPipelinesKHR(Device::get(), nullptr, PipelineFactory::getPipelineCache(), 1, &rayPipelineInfo, nullptr,
+		&RayTracer::rayTracingPipeline) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create Ray-Tracing Pipeline!");
 	}
+	PipelineFactory::pipeline_creation_ms +=
+		std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 }
 
 void RayTracer::createShaderBindingTable()
@@ -661,8 +1232,13 @@ void RayTracer::updateRTPipelineResources(vkengine::Scene3D* scene)
 		writes.push_back(texturesDescWrite);
 	}
 
+	// what was accumulated is meaningless after a resize or a new scene
+	Renderer::waitForFrames();
+	createTraceImages();
+	traced_frames.assign(SwapChainMng::get()->getImageCount(), 0);
+	traced_reflections.assign(SwapChainMng::get()->getImageCount(), vkengine::REFLECTIONS_FULL);
+
 	std::vector<VkWriteDescriptorSetAccelerationStructureKHR> accStructureWrites(bundle.frame_dependent_sets[0].size());
-	std::vector<VkDescriptorImageInfo> imageDescriptors(bundle.frame_dependent_sets[0].size());
 	std::vector<VkDescriptorBufferInfo> sceneBuffInfo(bundle.frame_dependent_sets[0].size());
 	for (int i = 0; i < bundle.frame_dependent_sets[0].size(); i++)
 	{
@@ -678,26 +1254,13 @@ void RayTracer::updateRTPipelineResources(vkengine::Scene3D* scene)
 		accStructWrite.pNext = &accStructureWrites[i];
 		writes.push_back(accStructWrite);
 
-		VkWriteDescriptorSet storageImgDescSet = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-		storageImgDescSet.dstSet = bundle.frame_dependent_sets[0][i].set;
-		storageImgDescSet.dstBinding = 1;
-		storageImgDescSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-		storageImgDescSet.descriptorCount = 1;
-		imageDescriptors[i].imageView = Renderer::getOffScreenFrameAttachment(i).imageView;
-		imageDescriptors[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-		storageImgDescSet.pImageInfo = &imageDescriptors[i];
-		writes.push_back(storageImgDescSet);
-
-		// Fill SceneBufferDescriptor at each offset
-		VkDeviceSize allocation_size = sizeof(SceneObjRtDescBlock) * scene->getCurrentObjectCapacity();
-		VkDeviceSize minAlignement = PhysicalDevice::getProperties().properties.limits.minStorageBufferOffsetAlignment;
-		VkDeviceSize padding = minAlignement - (allocation_size % minAlignement);
+		// Each frame has its own scene buffer
 		VkWriteDescriptorSet sceneDescWrite = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
 		sceneDescWrite.dstSet = bundle.frame_dependent_sets[0][i].set;
 		sceneDescWrite.dstBinding = 2;
 		sceneDescWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 		sceneDescWrite.descriptorCount = 1;
-		sceneBuffInfo[i] = { sceneBuffer.vkBuffer, i*(allocation_size + padding), allocation_size };
+		sceneBuffInfo[i] = { TLASs[i].sceneBuffer.vkBuffer, 0, VK_WHOLE_SIZE };
 		sceneDescWrite.pBufferInfo = &sceneBuffInfo[i];
 		writes.push_back(sceneDescWrite);
 	}
@@ -718,7 +1281,64 @@ void RayTracer::updateRTPipelineResources(vkengine::Scene3D* scene)
 		uniformBufferDescSet.pBufferInfo = &bufferDescriptors[i];
 		writes.push_back(uniformBufferDescSet);
 	}
-	vkQueueWaitIdle(Device::getGraphicQueue());
+	Renderer::waitForFrames();
+	vkUpdateDescriptorSets(Device::get(), writes.size(), writes.data(), 0, nullptr);
+	for (unsigned i = 0; i < bundle.frame_dependent_sets[0].size(); i++) {
+		updateStorageImageDescriptors(i);
+	}
+	stale_storage_sets.assign(bundle.frame_dependent_sets[0].size(), false);
+}
+
+void RayTracer::resize()
+{
+	// the frames still in flight trace into the old images, they go once those are done
+	std::array<FrameAttachment, 4> old_images = { accumulation_image, guide_image, reflection_image, reflection_guide_image };
+	Renderer::deferDestruction([old_images]() mutable {
+		for (auto& image : old_images) destroyStorageImage(image);
+	});
+	accumulation_image = {};
+	guide_image = {};
+	reflection_image = {};
+	reflection_guide_image = {};
+	createTraceImages();
+	stale_storage_sets.assign(PipelineFactory::pipeline_layouts[PIPELINE_LAYOUT_RAY_TRACING].descriptors.frame_dependent_sets[0].size(), true);
+}
+
+void RayTracer::updateStorageImageDescriptors(unsigned imageIndex)
+{
+	VkDescriptorSet set = PipelineFactory::pipeline_layouts[PIPELINE_LAYOUT_RAY_TRACING].descriptors.frame_dependent_sets[0][imageIndex].set;
+	VkDescriptorImageInfo accumulationDescriptor = { VK_NULL_HANDLE, accumulation_image.imageView, VK_IMAGE_LAYOUT_GENERAL };
+	VkDescriptorImageInfo guideDescriptor = { VK_NULL_HANDLE, guide_image.imageView, VK_IMAGE_LAYOUT_GENERAL };
+	VkDescriptorImageInfo reflectionDescriptor = { VK_NULL_HANDLE, reflection_image.imageView, VK_IMAGE_LAYOUT_GENERAL };
+	VkDescriptorImageInfo reflectionGuideDescriptor = { VK_NULL_HANDLE, reflection_guide_image.imageView, VK_IMAGE_LAYOUT_GENERAL };
+	VkDescriptorImageInfo imageDescriptor = { VK_NULL_HANDLE, Renderer::getOffScreenFrameAttachment(imageIndex).imageView, VK_IMAGE_LAYOUT_GENERAL };
+	std::vector<VkWriteDescriptorSet> writes;
+	VkWriteDescriptorSet storageImgDescSet = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+	storageImgDescSet.dstSet = set;
+	storageImgDescSet.dstBinding = 1;
+	storageImgDescSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	storageImgDescSet.descriptorCount = 1;
+	storageImgDescSet.pImageInfo = &imageDescriptor;
+	writes.push_back(storageImgDescSet);
+
+	// every frame accumulates in the same image
+	VkWriteDescriptorSet accumulationDescWrite = storageImgDescSet;
+	accumulationDescWrite.dstBinding = 3;
+	accumulationDescWrite.pImageInfo = &accumulationDescriptor;
+	writes.push_back(accumulationDescWrite);
+	// and so do the reduced resolution reflections
+	VkWriteDescriptorSet guideDescWrite = storageImgDescSet;
+	guideDescWrite.dstBinding = 4;
+	guideDescWrite.pImageInfo = &guideDescriptor;
+	writes.push_back(guideDescWrite);
+	VkWriteDescriptorSet reflectionDescWrite = storageImgDescSet;
+	reflectionDescWrite.dstBinding = 5;
+	reflectionDescWrite.pImageInfo = &reflectionDescriptor;
+	writes.push_back(reflectionDescWrite);
+	VkWriteDescriptorSet reflectionGuideDescWrite = storageImgDescSet;
+	reflectionGuideDescWrite.dstBinding = 6;
+	reflectionGuideDescWrite.pImageInfo = &reflectionGuideDescriptor;
+	writes.push_back(reflectionGuideDescWrite);
 	vkUpdateDescriptorSets(Device::get(), writes.size(), writes.data(), 0, nullptr);
 }
 
@@ -726,93 +1346,116 @@ void RayTracer::initialize()
 {
 	LOAD_RAYTRACING_API_COMMANDS(Device::get());
 	RayTracer::max_reflections_depth = 5;
+	RayTracer::next_budget = { RayTracer::max_reflections_depth, 1.f, 0.f };
+	// the BLAS batches are timed on the queue they run on
+	QueueFamilyIndices families = PhysicalDevice::getQueueFamilies();
+	uint32_t valid_bits = PhysicalDevice::getTimestampValidBits(
+		PhysicalDevice::hasAsyncCompute() ? families.computeFamily : families.graphicsFamily);
+	if (valid_bits > 0) {
+		blas_timestamp_mask = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
+		VkQueryPoolCreateInfo qpci{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+		qpci.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		qpci.queryCount = 2;
+		vkCreateQueryPool(Device::get(), &qpci, nullptr, &blas_timestamp_pool);
+	}
+	else {
+		std::cout << "No timestamps on the BLAS build queue: batches are sized with a fixed cost per triangle" << std::endl;
+	}
 }
 
 void RayTracer::prepare(Scene3D * scene) {
+	// the compute queue could still be updating the old TLASs
+	vkQueueWaitIdle(Device::getComputeQueue());
 	destroyTopLevelAcceleration();
-	if (blasNeedsRebuild()) {
-		destroyBottomAcceleration();
-		buildBottomLevelAS();
-	}
+	buildBottomLevelAS();
 	TLASs.resize(SwapChainMng::get()->getImageCount());
 	for (int i = 0; i < TLASs.size(); i++) {
 		buildTopLevelAS(scene, &TLASs[i]);
 	}
-	createSceneBuffer(scene);
+	createSceneUpdateResources();
 }
 
 void RayTracer::updateSceneData(vkengine::Scene3D* scene, unsigned imageIndex)
 {
-	auto obj_ids = scene->listObjects();
-	// Updating the storage buffer with objects setting taken from the scene
-	std::vector<SceneObjRtDescBlock> sceneDescription;
-	sceneDescription.reserve(scene->getCurrentObjectCapacity());
-	for (auto objId : obj_ids) {
-		auto obj = scene->getObject(objId);
-		sceneDescription.push_back({
-			MeshManager::getMeshID(obj->getMeshName()),
-			TextureManager::getSceneTextureIndex(obj->getTextureName()),
-			obj->getMatrix(),
-			obj->reflective});
-	}
-	VkDeviceSize allocation_size = sizeof(SceneObjRtDescBlock) * scene->getCurrentObjectCapacity();
-	VkDeviceSize minAlignement =
-		PhysicalDevice::getProperties().properties.limits.minStorageBufferOffsetAlignment;
-	VkDeviceSize padding = minAlignement - (allocation_size % minAlignement);
-	memcpy((char*)sceneBuffer.mappedMemory + (allocation_size + padding)*imageIndex, sceneDescription.data(), allocation_size);
+	PROFILE_FUNCTION();
+	update_stats = {};
+	// the frames that used this image are done: its set can follow a resize
+	if (imageIndex < stale_storage_sets.size() && stale_storage_sets[imageIndex]) {
+		updateStorageImageDescriptors(imageIndex);
+		stale_storage_sets[imageIndex] = false;
+	}
+	updateRayBudget(imageIndex);
+	updateBottomLevelAS();
+	TopLevelAS& tlas = TLASs[imageIndex];
+	if (scene->get_object_num() > tlas.capacity) {
+		// Objects were added beyond the room of this frame: the old buffers go away
+		// once no frame can use them anymore, the new ones follow the scene capacity.
+		TopLevelAS old_tlas = tlas;
+		Renderer::deferDestruction([old_tlas]() mutable { destroyTopLevelAS(old_tlas); });
+		allocateTopLevelAS(&tlas, std::max(scene->getCurrentObjectCapacity(), scene->get_object_num()));
+		updateFrameSceneResources(imageIndex);
+	}
+	// Instances and scene description follow the scene, only what differs from this frame's buffers is written
+	fillInstances(scene, &tlas);
+	// objects moved or were edited (a texture or the reflectiveness only changes the description),
+	// or meshes became visible: the samples taken so far are stale.
+	// The other frames' TLASs catch up on the same change, restarting a couple more times is harmless
+	if (update_stats.instances_changed > 0 || update_stats.descriptions_changed > 0 || update_stats.blas_built > 0) {
+		accumulated_samples = 0;
+	}
+	// built beside the final pass of the previous frame, instead of ahead of this frame's work
+	if (PhysicalDevice::hasAsyncCompute()) {
+		submitTopLevelUpdate(imageIndex);
+	}
+}
 
-	// Update matrix data for each instance and retrieve Vulkan struct
-	std::vector<VkAccelerationStructureInstanceKHR> geometryInstances;
-	geometryInstances.reserve(TLASs[imageIndex].instances.size());
-	for (int i = 0; i < obj_ids.size(); i++) {
-		TLASs[imageIndex].instances[i].matrix = scene->getObject(obj_ids[i])->getMatrix();
-		geometryInstances.push_back(TLASs[imageIndex].instances[i].to_VkAcInstanceKHR());
+void RayTracer::destroyTopLevelAS(TopLevelAS& tlas)
+{
+	if (tlas.stagebuffer.mappedMemory != nullptr) {
+		vkUnmapMemory(Device::get(), tlas.stagebuffer.vkMemory);
 	}
-	//Memcpy data to the stage buffer, ready for transfer
-	memcpy(TLASs[imageIndex].stagebuffer.mappedMemory, geometryInstances.data(), 
-		geometryInstances.size()*sizeof(VkAccelerationStructureInstanceKHR));
+	vkDestroyBuffer(Device::get(), tlas.stagebuffer.vkBuffer, nullptr);
+	vkFreeMemory(Device::get(), tlas.stagebuffer.vkMemory, nullptr);
+	vkDestroyBuffer(Device::get(), tlas.scratchBuffer.vkBuffer, nullptr);
+	vkFreeMemory(Device::get(), tlas.scratchBuffer.vkMemory, nullptr);
+	vkDestroyAccelerationStructureKHR(Device::get(), tlas.as.accelerationStructure, nullptr);
+	vkDestroyBuffer(Device::get(), tlas.as.buffer.vkBuffer, nullptr);
+	vkFreeMemory(Device::get(), tlas.as.buffer.vkMemory, nullptr);
+	vkDestroyBuffer(Device::get(), tlas.instanceBuffer.vkBuffer, nullptr);
+	vkFreeMemory(Device::get(), tlas.instanceBuffer.vkMemory, nullptr);
+	// destroy the scene descriptor buffer
+	if (tlas.sceneBuffer.mappedMemory != nullptr) {
+		vkUnmapMemory(Device::get(), tlas.sceneBuffer.vkMemory);
+	}
+	vkDestroyBuffer(Device::get(), tlas.sceneBuffer.vkBuffer, nullptr);
+	vkFreeMemory(Device::get(), tlas.sceneBuffer.vkMemory, nullptr);
+	tlas.instances.clear();
 }
 
 void RayTracer::destroyTopLevelAcceleration()
 {
 	for (auto& tlas : TLASs) {
-		if (tlas.stagebuffer.mappedMemory != nullptr) {
-			vkUnmapMemory(Device::get(), tlas.stagebuffer.vkMemory);
-		}
-		vkDestroyBuffer(Device::get(), tlas.stagebuffer.vkBuffer, nullptr);
-		vkFreeMemory(Device::get(), tlas.stagebuffer.vkMemory, nullptr);
-		vkDestroyBuffer(Device::get(), tlas.scratchBuffer.vkBuffer, nullptr);
-		vkFreeMemory(Device::get(), tlas.scratchBuffer.vkMemory, nullptr);
-		vkDestroyAccelerationStructureKHR(Device::get(), tlas.as.accelerationStructure, nullptr);
-		vkDestroyBuffer(Device::get(), tlas.as.buffer.vkBuffer, nullptr);
-		vkFreeMemory(Device::get(), tlas.as.buffer.vkMemory, nullptr);
-		vkDestroyBuffer(Device::get(), tlas.instanceBuffer.vkBuffer, nullptr);
-		vkFreeMemory(Device::get(), tlas.instanceBuffer.vkMemory, nullptr);
-		tlas.instances.clear();
-	}	
-	// destroy the scene descriptor uniform buffer
-	if (sceneBuffer.mappedMemory != nullptr) {
-		vkUnmapMemory(Device::get(), sceneBuffer.vkMemory);
-	}
-	vkDestroyBuffer(Device::get(), sceneBuffer.vkBuffer, nullptr);
-	vkFreeMemory(Device::get(), sceneBuffer.vkMemory, nullptr);
+		destroyTopLevelAS(tlas);
+	}
+	TLASs.clear();
 }
 
 void RayTracer::destroyBottomAcceleration()
 {
+	cancelBottomLevelWork();
 	// Destroy BLAS resources
 	for (auto& blas : BLASs) {
+		if (blas.as.accelerationStructure == VK_NULL_HANDLE) continue;
 		vkDestroyAccelerationStructureKHR(Device::get(), blas.as.accelerationStructure, nullptr); 
 		vkDestroyBuffer(Device::get(), blas.as.buffer.vkBuffer, nullptr);
 		vkFreeMemory(Device::get(), blas.as.buffer.vkMemory, nullptr);
 	}
 	BLASs.clear();
-
-}
-
-bool RayTracer::blasNeedsRebuild()
-{
-	return BLASs.size() != MeshManager::countLoadedMeshes();
+	if (blas_scratch_size > 0) {
+		vkDestroyBuffer(Device::get(), blas_scratch.vkBuffer, nullptr);
+		vkFreeMemory(Device::get(), blas_scratch.vkMemory, nullptr);
+		blas_scratch_size = 0;
+	}
 }
 
 void RayTracer::cleanUP()
@@ -824,4 +1467,12 @@ void RayTracer::cleanUP()
 	vkDestroyPipeline(Device::get(), rayTracingPipeline, nullptr);
 	destroyTopLevelAcceleration(); 
 	destroyBottomAcceleration();
+	destroySceneUpdateResources();
+	destroyTraceImages();
+	traced_frames.clear();
+	traced_reflections.clear();
+	if (blas_timestamp_pool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(Device::get(), blas_timestamp_pool, nullptr);
+		blas_timestamp_pool = VK_NULL_HANDLE;
+	}
 }
@@ -5,6 +5,7 @@
 #include "Pipeline.h"
 #include "DescriptorSets.h"
 #include "Device.h"
+#include "RayBudget.h"
 
 
 // Describes a Mesh inside a Bottom Level AS
@@ -23,11 +24,42 @@ struct AccelerationStructure {
 // One BLAS can hold multiple geometries
 struct BottomLevelAS {
 	AccelerationStructure as;
+	const Mesh3D* mesh = nullptr; // what it was built from, a replaced mesh gets a new BLAS
+	bool ready = false; // built on the GPU: TLAS instances can point to it
 	// the geometry for build the AS, in this case, from triangles.
 	std::vector<VkAccelerationStructureGeometryKHR> geometries; 
 	// the offset, which correspond to the actual wanted geometry when building.
 	std::vector<VkAccelerationStructureBuildRangeInfoKHR> offsets;
 	VkAccelerationStructureBuildGeometryInfoKHR buildGeomInfo;
+	// memory report, compact_size is 0 until the compacted size query is read back
+	VkDeviceSize original_size = 0;
+	VkDeviceSize compact_size = 0;
+	bool compacted = false;
+};
+
+// BLASs built by a single vkCmdBuildAccelerationStructuresKHR, each in its own slice of the shared scratch buffer
+struct BlasBuildBatch {
+	std::vector<uint32_t> blas_indices;
+	uint64_t triangles = 0; // what its GPU time is estimated from
+	VkQueryPool query_pool = VK_NULL_HANDLE; // compacted sizes
+	VkCommandBuffer cmd_buffer = VK_NULL_HANDLE;
+	VkFence fence = VK_NULL_HANDLE;
+};
+
+// A compaction running on the GPU, polled every frame so the build never waits for it
+struct BlasCompaction {
+	struct Copy {
+		uint32_t blas_index;
+		VkAccelerationStructureKHR source;
+		AccelerationStructure compact_as;
+	};
+	// query i is about blas_indices[i], as it was built (sources[i])
+	std::vector<uint32_t> blas_indices;
+	std::vector<VkAccelerationStructureKHR> sources;
+	VkQueryPool query_pool = VK_NULL_HANDLE; // compacted sizes, written by the build
+	VkCommandBuffer cmd_buffer = VK_NULL_HANDLE;
+	VkFence fence = VK_NULL_HANDLE; // signaled when the copies are done
+	std::vector<Copy> copies;
 };
 
 // A TLAS Instance points to a geometry inside one BLAS
@@ -64,11 +96,29 @@ struct TLAS_Instance {
 
 struct TopLevelAS {
 	AccelerationStructure as; // one each frame
-	std::vector<TLAS_Instance> instances;
+	// copies of what this frame's buffers hold, to write only what changed
+	std::vector<VkAccelerationStructureInstanceKHR> instances;
+	std::vector<SceneObjRtDescBlock> descriptions;
+	std::vector<VkBufferCopy> dirty_regions;
+	// refit quality: distance of each instance from where the last build placed it, in bounding radii
+	std::vector<glm::vec3> centers;
+	std::vector<glm::vec3> build_centers;
+	std::vector<float> drift;
+	float total_drift = 0.f;
+	uint32_t opaque_instances = 0;
+	// the scene the copies follow and the position in its log of changed slots
+	vkengine::Scene3D* scene = nullptr;
+	uint64_t slot_cursor = 0;
+	// every slot has to be written again: new buffers, or BLASs the instances point to were replaced
+	bool refresh_all = true;
 	Buffer instanceBuffer;
 	Buffer scratchBuffer;
 	Buffer stagebuffer;
-	VkDeviceSize bufferSize;
+	Buffer sceneBuffer; // per object data read by the hit shaders, indexed by customID
+	uint32_t capacity = 0; // instances the buffers and the AS have room for
+	// an update is only legal on the same instances of the last build
+	uint32_t built_instances = 0;
+	bool needs_full_build = true;
 };
 
 /*
@@ -76,6 +126,11 @@ struct TopLevelAS {
 */
 uint64_t getBufferDeviceAddress(VkBuffer buffer);
 
+/*
+	Gets the device address of an acceleration structure, what TLAS instances point to
+*/
+uint64_t getAccelerationStructureAddress(VkAccelerationStructureKHR accelerationStructure);
+
 /*
 	Fills an AccelerationStructureGeometry structure from A Mesh3D object
 */
@@ -93,26 +148,124 @@ public:
 	static void createRayTracingPipeline();
 	static void createShaderBindingTable();
 	static void updateRTPipelineResources(vkengine::Scene3D* scene);
+	// new trace images for the resized offscreen targets, nothing waits: the old images are destroyed
+	// once the frames in flight are done with them, each frame's bindings follow in updateSceneData
+	static void resize();
 	static void prepare(vkengine::Scene3D * scene);
 	static void updateSceneData(vkengine::Scene3D* scene, unsigned imageIndex);
-	static void updateCmdBuffer(std::vector<VkCommandBuffer> &cmdBuffers, std::vector<FrameAttachment> &storageImages, unsigned frameIndex);
+	// trace pass of the frame graph, which moves the storage image in and out of the GENERAL layout
+	static void recordCmdBuffer(VkCommandBuffer cmd, unsigned frameIndex);
+	// TLAS update for the ray queries of the hybrid rasterization, recorded before its render pass
+	static void recordSceneUpdate(VkCommandBuffer cmdBuffer, unsigned frameIndex);
+	// semaphore of the TLAS update submitted on the async compute queue by updateSceneData,
+	// the next graphic submission has to wait on it. VK_NULL_HANDLE if nothing was submitted
+	static VkSemaphore takeSceneUpdateSemaphore();
 	static void cleanUP();
+	static std::vector<vkengine::BlasMemoryInfo> getBlasMemoryReport();
+	static float getReflectionTraceTime(vkengine::ReflectionResolution resolution);
+	// restarts the accumulation if the camera or the lights moved, uniforms as sent to the shaders
+	static void updateAccumulation(const UniformBlock& uniforms);
 private:
+	// blocking: builds every new or replaced mesh
 	static void buildBottomLevelAS();
+	// once per frame: collects the finished batch and starts the next one
+	static void updateBottomLevelAS();
+	static void queueBottomLevelAS();
+	static void startBottomLevelBatch();
+	static void finishBottomLevelBatch();
+	// one step of the pending compactions: copies the BLASs once their sizes are known, swaps them once copied
+	static void compactBottomLevelAS();
+	static void cancelBottomLevelWork();
 	static void buildTopLevelAS(vkengine::Scene3D * scene, TopLevelAS* tlas);
-	static void recordCmdUpdateTopLevelAS(VkCommandBuffer& cmd_buf, TopLevelAS* tlas);
-	static void createSceneBuffer(vkengine::Scene3D* scene);
+	static void allocateTopLevelAS(TopLevelAS* tlas, uint32_t capacity);
+	// writes the slots changed since the last call for this TLAS
+	static void fillInstances(vkengine::Scene3D* scene, TopLevelAS* tlas);
+	// the BLAS addresses changed: the TLASs write every instance on their next update
+	static void refreshAllInstances();
+	// false if nothing changed and nothing was recorded. reading_stages 0 leaves the
+	// visibility of the new TLAS to the caller (a wait on the submission or a semaphore).
+	// The copy and the build are timed by the GPU profiler in the slice of frameIndex, if not negative
+	static bool recordCmdUpdateTopLevelAS(VkCommandBuffer& cmd_buf, TopLevelAS* tlas,
+		VkPipelineStageFlags reading_stages = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, int frameIndex = -1);
+	// rewrites the TLAS and scene buffer bindings of one frame, after its TLAS was reallocated
+	static void updateFrameSceneResources(unsigned imageIndex);
+	static void destroyTopLevelAS(TopLevelAS& tlas);
 	static void destroyTopLevelAcceleration(); 
 	static void destroyBottomAcceleration();
-	static bool blasNeedsRebuild();
+	// float images of the averaged samples and of the reduced resolution reflections, sized after the swapchain
+	static void createTraceImages();
+	static void destroyTraceImages();
+	static void createStorageImage(FrameAttachment& target, VkFormat format, VkExtent2D extent, VkCommandBuffer command);
+	static void destroyStorageImage(FrameAttachment& target);
+	// bindings of the offscreen attachment and of the trace images in the set of one frame, not in use
+	static void updateStorageImageDescriptors(unsigned imageIndex);
+	// sets still bound to the images replaced by resize
+	static std::vector<bool> stale_storage_sets;
+	static float& reflectionTraceTime(vkengine::ReflectionResolution resolution);
+	// feeds the trace time of the last frame of this image, from the GPU profiler, to the controller.
+	// The budget it picks is traced by the next frame
+	static void updateRayBudget(unsigned imageIndex);
+	// one command buffer and semaphore per image for the TLAS updates on the async compute queue
+	static void createSceneUpdateResources();
+	static void destroySceneUpdateResources();
+	static void submitTopLevelUpdate(unsigned imageIndex);
 public:
 	static uint32_t max_reflections_depth;
+	// average drift (in bounding radii) after which a refit is replaced by a full build
+	static float refit_drift_threshold;
+	// compact the BLASs after they are built (only affects the next build)
+	static bool compact_blas;
+	// BLASs are built in batches bounded by the scratch memory, each frame starts at most one batch.
+	// A batch stops taking BLASs once its estimated GPU time reaches blas_build_budget_ms
+	static VkDeviceSize blas_scratch_budget;
+	static float blas_build_budget_ms;
+	// what the last frame uploaded and built
+	static vkengine::RayTracingStats update_stats;
+	// progressive accumulation: while nothing changes every frame adds a jittered sample per pixel,
+	// after accumulation_max_samples the rays stop and the converged image is only copied
+	static bool accumulate;
+	static uint32_t accumulation_max_samples;
+	static uint32_t accumulated_samples;
+	// the adaptive controller only lowers the quality from max_reflections_depth at full resolution
+	static vkengine::RayBudgetSettings budget_settings;
+	// what the next frame traces with: the viewport has to use its resolution scale
+	static vkengine::RayBudget next_budget;
+	// independent from the budget: the adaptive controller doesn't change it
+	static vkengine::ReflectionResolution reflection_resolution;
 private:
 	// Accelleration structures
 	// one for each frame in flight
 	static std::vector<TopLevelAS> TLASs;
 	// one for each mesh
 	static std::vector<BottomLevelAS> BLASs;
+	static std::vector<uint32_t> blas_build_queue;
+	static BlasBuildBatch blas_batch;
+	static std::vector<BlasCompaction> compactions;
+	static Buffer blas_scratch;
+	static VkDeviceSize blas_scratch_size;
+	// GPU time of a BLAS build per triangle, averaged over the timed batches
+	static float blas_ms_per_triangle;
+	// begin and end of the running batch, none if its queue has no timestamps
+	static VkQueryPool blas_timestamp_pool;
+	static uint64_t blas_timestamp_mask;
+	static FrameAttachment accumulation_image; // shared by all frames, always in GENERAL layout
+	// reduced resolution reflections, shared like the accumulation image. The low resolution
+	// ones are sized for REFLECTIONS_HALF, the largest of the reduced resolutions
+	static FrameAttachment guide_image;
+	static FrameAttachment reflection_image;
+	static FrameAttachment reflection_guide_image;
+	static vkengine::ReflectionResolution accumulation_reflections;
+	static UniformBlock accumulation_view;
+	static vkengine::RayBudget accumulation_budget;
+	static vkengine::RayBudgetController budget_controller;
+	static vkengine::RayBudget traced_budget; // this frame's
+	// last frame that traced rays into each image (0 for none) and with which reflections
+	static std::vector<uint64_t> traced_frames;
+	static std::vector<vkengine::ReflectionResolution> traced_reflections;
+	static float reflection_trace_ms[3]; // full, half and quarter resolution
+	static std::vector<VkCommandBuffer> tlas_update_cmds;
+	static std::vector<VkSemaphore> tlas_update_semaphores;
+	static VkSemaphore pending_tlas_update;
 
 	/*
 	//Descriptor sets allocation managed by PipelineFactory:
@@ -123,5 +276,4 @@ private:
 
 	static VkPipeline rayTracingPipeline;
 	static Buffer shaderBindingTable;
-	static Buffer sceneBuffer;
 };
\ No newline at end of file
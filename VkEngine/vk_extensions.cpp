@@ -135,3 +135,16 @@ VKAPI_ATTR VkDeviceAddress VKAPI_CALL vkGetAccelerationStructureDeviceAddressKHR
 	return pfn_vkGetAccelerationStructureDeviceAddressKHR(device, pInfo);
 }
 
+#ifdef VK_KHR_present_wait
+static PFN_vkWaitForPresentKHR pfn_vkWaitForPresentKHR = 0;
+
+void LOAD_PRESENT_WAIT_COMMANDS(VkDevice device) {
+	pfn_vkWaitForPresentKHR = reinterpret_cast<PFN_vkWaitForPresentKHR>(vkGetDeviceProcAddr(device, "vkWaitForPresentKHR"));
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkWaitForPresentKHR(VkDevice device, VkSwapchainKHR swapchain, uint64_t presentId, uint64_t timeout)
+{
+	assert(pfn_vkWaitForPresentKHR);
+	return pfn_vkWaitForPresentKHR(device, swapchain, presentId, timeout);
+}
+#endif
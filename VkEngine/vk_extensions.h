@@ -16,5 +16,20 @@ static const char* rayTracingDeviceExtensions[] = {
 	VK_KHR_SHADER_FLOAT_CONTROLS_EXTENSION_NAME
 };
 
+// VK_KHR_ray_query: rays from the fragment shader of the hybrid rendering, on top of the ray tracing ones
+static const char* rayQueryDeviceExtensions[] = {
+	VK_KHR_RAY_QUERY_EXTENSION_NAME
+};
+
 // Loads the function pointers required for ray tracing
-void LOAD_RAYTRACING_API_COMMANDS(VkDevice device);
\ No newline at end of file
+void LOAD_RAYTRACING_API_COMMANDS(VkDevice device);
+
+// VK_KHR_present_wait: when a presented image reaches the display, for the latency measurements (optional)
+#ifdef VK_KHR_present_wait
+static const char* presentWaitDeviceExtensions[] = {
+	VK_KHR_PRESENT_ID_EXTENSION_NAME,
+	VK_KHR_PRESENT_WAIT_EXTENSION_NAME
+};
+
+void LOAD_PRESENT_WAIT_COMMANDS(VkDevice device);
+#endif
\ No newline at end of file